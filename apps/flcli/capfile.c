@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef WIN32
+	#include <Windows.h>
+#else
+	#define _POSIX_C_SOURCE 200809L
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "capfile.h"
+#include "clock.h"
+
+#define PAD8(x) (((x) + 7) & ~(uint64)7)
+
+static ReturnCode writeRecord(
+	struct CapWriter *self, const struct CapRecord *rec, const void *p1, size_t n1,
+	const void *p2, size_t n2, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	static const uint8 zeros[8] = {0,};
+	const size_t pad = (size_t)(PAD8(n1 + n2) - (n1 + n2));
+	CHECK_STATUS(
+		fwrite(rec, sizeof(*rec), 1, self->file) != 1 ||
+		fwrite(p1, 1, n1, self->file) != n1 ||
+		(n2 && fwrite(p2, 1, n2, self->file) != n2) ||
+		(pad && fwrite(zeros, 1, pad, self->file) != pad),
+		FLP_CANNOT_SAVE, cleanup, "writeRecord(): cannot write capture file");
+	self->offset += sizeof(*rec) + n1 + n2 + pad;
+cleanup:
+	return retVal;
+}
+
+static ReturnCode writeHeader(struct CapWriter *self, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	CHECK_STATUS(
+		fseek(self->file, 0, SEEK_SET) ||
+		fwrite(&self->hdr, sizeof(self->hdr), 1, self->file) != 1 ||
+		fseek(self->file, 0, SEEK_END),
+		FLP_CANNOT_SAVE, cleanup, "writeHeader(): cannot update capture header");
+cleanup:
+	return retVal;
+}
+
+static ReturnCode writeIndex(struct CapWriter *self, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct CapIndexHeader idx;
+	struct CapRecord rec = {0,};
+	const uint64 here = self->offset;
+	idx.prevIndex = self->hdr.lastIndex;
+	idx.count = self->numPending;
+	idx.reserved = 0;
+	rec.type = CAP_INDEX;
+	rec.length = (uint32)(sizeof(idx) + self->numPending * sizeof(struct CapIndexEntry));
+	rec.micros = self->pending[self->numPending - 1].micros;
+	retVal = writeRecord(
+		self, &rec, &idx, sizeof(idx),
+		self->pending, self->numPending * sizeof(struct CapIndexEntry), error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	self->hdr.lastIndex = here;
+	self->hdr.numChunks += self->numPending;
+	self->numPending = 0;
+	retVal = writeHeader(self, error);
+cleanup:
+	return retVal;
+}
+
+ReturnCode capCreate(
+	struct CapWriter *self, const char *fileName, uint32 indexInterval, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	memset(self, 0, sizeof(*self));
+	if ( !indexInterval ) {
+		indexInterval = CAP_DEFAULT_INTERVAL;
+	}
+	self->pending = (struct CapIndexEntry *)calloc(indexInterval, sizeof(struct CapIndexEntry));
+	CHECK_STATUS(!self->pending, FLP_NO_MEMORY, cleanup, "capCreate(): out of memory");
+	self->file = fopen(fileName, "w+b");
+	CHECK_STATUS(!self->file, FLP_CANNOT_SAVE, cleanup, "capCreate(): cannot create %s", fileName);
+	memcpy(self->hdr.magic, CAP_MAGIC, sizeof(self->hdr.magic));
+	self->hdr.version = CAP_VERSION;
+	self->hdr.indexInterval = indexInterval;
+	self->hdr.startMicros = clkMicros();
+	self->hdr.startEpoch = clkEpochMicros();
+	CHECK_STATUS(
+		fwrite(&self->hdr, sizeof(self->hdr), 1, self->file) != 1, FLP_CANNOT_SAVE, cleanup,
+		"capCreate(): cannot write %s", fileName);
+	self->offset = sizeof(self->hdr);
+	return FLP_SUCCESS;
+cleanup:
+	if ( self->file ) {
+		fclose(self->file);
+		self->file = NULL;
+	}
+	free(self->pending);
+	self->pending = NULL;
+	return retVal;
+}
+
+ReturnCode capAppend(
+	struct CapWriter *self, uint8 channel, uint64 micros, const uint8 *data, uint32 length,
+	const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct CapRecord rec = {0,};
+	struct CapIndexEntry *const entry = self->pending + self->numPending;
+	rec.type = CAP_CHUNK;
+	rec.length = length;
+	rec.micros = micros > self->hdr.startMicros ? micros - self->hdr.startMicros : 0;
+	rec.channel = channel;
+	entry->micros = rec.micros;
+	entry->fileOffset = self->offset;
+	entry->streamOffset = self->streamOffset;
+	retVal = writeRecord(self, &rec, data, length, NULL, 0, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	self->streamOffset += length;
+	if ( ++self->numPending == self->hdr.indexInterval ) {
+		retVal = writeIndex(self, error);
+	}
+cleanup:
+	return retVal;
+}
+
+ReturnCode capClose(struct CapWriter *self, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	if ( self->file ) {
+		if ( self->numPending ) {
+			retVal = writeIndex(self, error);
+		}
+		if ( fclose(self->file) && !retVal ) {
+			errRender(error, "capClose(): cannot close capture file");
+			retVal = FLP_CANNOT_SAVE;
+		}
+		self->file = NULL;
+	}
+	free(self->pending);
+	self->pending = NULL;
+	return retVal;
+}
+
+#ifdef WIN32
+
+ReturnCode capMap(struct CapReader *self, const char *fileName, const char **error) {
+	(void)fileName;
+	memset(self, 0, sizeof(*self));
+	errRender(error, "capMap(): memory-mapped captures are not supported on this platform");
+	return FLP_CANNOT_LOAD;
+}
+
+void capUnmap(struct CapReader *self) {
+	(void)self;
+}
+
+#else
+
+ReturnCode capMap(struct CapReader *self, const char *fileName, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct stat st;
+	const struct CapRecord *rec;
+	const struct CapIndexHeader *idx;
+	uint64 offset, n;
+	int fd;
+	void *map;
+	memset(self, 0, sizeof(*self));
+	fd = open(fileName, O_RDONLY);
+	CHECK_STATUS(fd < 0, FLP_CANNOT_LOAD, cleanup, "capMap(): cannot open %s", fileName);
+	if ( fstat(fd, &st) || (size_t)st.st_size < sizeof(struct CapFileHeader) ) {
+		close(fd);
+		FAIL(FLP_CANNOT_LOAD, badFile);
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	CHECK_STATUS(map == MAP_FAILED, FLP_CANNOT_LOAD, cleanup, "capMap(): cannot map %s", fileName);
+	self->map = (const uint8 *)map;
+	self->mapSize = (size_t)st.st_size;
+	self->hdr = (const struct CapFileHeader *)map;
+	CHECK_STATUS(
+		memcmp(self->hdr->magic, CAP_MAGIC, sizeof(self->hdr->magic)) ||
+		self->hdr->version != CAP_VERSION, FLP_CANNOT_LOAD, badFile);
+
+	// Walk the index chain newest-first, once to count and once to fill in oldest-first
+	for ( n = 0, offset = self->hdr->lastIndex; offset; offset = idx->prevIndex ) {
+		CHECK_STATUS(
+			offset + sizeof(*rec) + sizeof(*idx) > self->mapSize, FLP_CANNOT_LOAD, badFile);
+		rec = (const struct CapRecord *)(self->map + offset);
+		idx = (const struct CapIndexHeader *)(rec + 1);
+		CHECK_STATUS(
+			rec->type != CAP_INDEX || idx->prevIndex >= offset ||
+			offset + sizeof(*rec) + rec->length > self->mapSize ||
+			sizeof(*idx) + (uint64)idx->count * sizeof(struct CapIndexEntry) > rec->length,
+			FLP_CANNOT_LOAD, badFile);
+		n += idx->count;
+	}
+	if ( n ) {
+		self->index = (struct CapIndexEntry *)malloc((size_t)n * sizeof(struct CapIndexEntry));
+		CHECK_STATUS(!self->index, FLP_NO_MEMORY, cleanup, "capMap(): out of memory");
+	}
+	self->numIndex = n;
+	for ( offset = self->hdr->lastIndex; offset; offset = idx->prevIndex ) {
+		rec = (const struct CapRecord *)(self->map + offset);
+		idx = (const struct CapIndexHeader *)(rec + 1);
+		n -= idx->count;
+		memcpy(self->index + n, idx + 1, idx->count * sizeof(struct CapIndexEntry));
+	}
+	return FLP_SUCCESS;
+badFile:
+	errRender(error, "capMap(): %s is not a valid version %d capture", fileName, CAP_VERSION);
+cleanup:
+	capUnmap(self);
+	return retVal;
+}
+
+void capUnmap(struct CapReader *self) {
+	if ( self->map ) {
+		munmap((void *)self->map, self->mapSize);
+		self->map = NULL;
+	}
+	free(self->index);
+	self->index = NULL;
+}
+
+#endif
+
+const struct CapRecord *capNext(
+	const struct CapReader *self, uint64 *offset, const uint8 **data)
+{
+	while ( *offset + sizeof(struct CapRecord) <= self->mapSize ) {
+		const struct CapRecord *const rec = (const struct CapRecord *)(self->map + *offset);
+		if ( *offset + sizeof(*rec) + rec->length > self->mapSize ) {
+			break;  // truncated by a crash mid-write
+		}
+		*offset += sizeof(*rec) + PAD8(rec->length);
+		if ( rec->type == CAP_CHUNK ) {
+			*data = (const uint8 *)(rec + 1);
+			return rec;
+		}
+	}
+	return NULL;
+}
+
+// Binary search for the last index entry whose key is <= target, and return the position
+// scanning should start from.
+static uint64 seekStart(
+	const struct CapReader *self, uint64 target, bool byTime, uint64 *streamOffset)
+{
+	uint64 lo = 0, hi = self->numIndex;
+	while ( lo < hi ) {
+		const uint64 mid = lo + (hi - lo) / 2;
+		const uint64 key = byTime ? self->index[mid].micros : self->index[mid].streamOffset;
+		if ( key <= target ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if ( lo == 0 ) {
+		*streamOffset = 0;
+		return sizeof(struct CapFileHeader);
+	}
+	*streamOffset = self->index[lo - 1].streamOffset;
+	return self->index[lo - 1].fileOffset;
+}
+
+uint64 capSeekTime(const struct CapReader *self, uint64 micros, uint64 *chunkStart) {
+	uint64 stream, offset = seekStart(self, micros, true, &stream);
+	uint64 here = offset;
+	const uint8 *data;
+	const struct CapRecord *rec;
+	while ( (rec = capNext(self, &offset, &data)) ) {
+		if ( rec->micros >= micros ) {
+			*chunkStart = stream;
+			return here;
+		}
+		stream += rec->length;
+		here = offset;
+	}
+	return self->mapSize;
+}
+
+uint64 capSeekOffset(const struct CapReader *self, uint64 streamOffset, uint64 *chunkStart) {
+	uint64 stream, offset = seekStart(self, streamOffset, false, &stream);
+	uint64 here = offset;
+	const uint8 *data;
+	const struct CapRecord *rec;
+	while ( (rec = capNext(self, &offset, &data)) ) {
+		if ( streamOffset < stream + rec->length ) {
+			*chunkStart = stream;
+			return here;
+		}
+		stream += rec->length;
+		here = offset;
+	}
+	return self->mapSize;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CAPFILE_H
+#define CAPFILE_H
+
+#include <makestuff.h>
+#include <stdio.h>
+#include "flcli.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Indexed capture container. After the header, the file is a sequence of 8-byte-aligned
+	// records, each a CapRecord followed by its payload. Every chunk read from the FPGA becomes a
+	// CAP_CHUNK record. After every indexInterval chunks a CAP_INDEX record is appended, listing
+	// where those chunks are, and linking back to the previous index; the header always points at
+	// the newest index, so a reader can find any chunk by time or stream offset without scanning.
+	// All fields are in host byte order.
+	#define CAP_MAGIC "FLCAP\0\0\0"
+	#define CAP_VERSION 1
+	#define CAP_DEFAULT_INTERVAL 64
+
+	typedef enum {
+		CAP_CHUNK = 1,
+		CAP_INDEX = 2
+	} CapRecordType;
+
+	struct CapFileHeader {
+		char magic[8];
+		uint32 version;
+		uint32 indexInterval;
+		uint64 startMicros;  // monotonic clock when the capture began
+		uint64 startEpoch;   // wall clock at the same instant, in microseconds since 1970
+		uint64 lastIndex;    // file offset of the newest CAP_INDEX record, or 0
+		uint64 numChunks;    // chunks covered by the index chain
+		uint8 reserved[16];
+	};
+
+	struct CapRecord {
+		uint32 type;
+		uint32 length;       // payload bytes, excluding alignment padding
+		uint64 micros;       // chunk completion time, relative to startMicros
+		uint32 channel;
+		uint32 reserved;
+	};
+
+	struct CapIndexEntry {
+		uint64 micros;
+		uint64 fileOffset;   // of the chunk's CapRecord
+		uint64 streamOffset; // payload bytes (all channels) preceding this chunk
+	};
+
+	// A CAP_INDEX payload is this header followed by count CapIndexEntry structs
+	struct CapIndexHeader {
+		uint64 prevIndex;
+		uint32 count;
+		uint32 reserved;
+	};
+
+	struct CapWriter {
+		FILE *file;
+		struct CapFileHeader hdr;
+		uint64 offset;       // current end of file
+		uint64 streamOffset;
+		struct CapIndexEntry *pending;
+		uint32 numPending;
+	};
+
+	ReturnCode capCreate(
+		struct CapWriter *self, const char *fileName, uint32 indexInterval, const char **error
+	);
+
+	// Append one chunk, completed at monotonic time micros (from clkMicros()).
+	ReturnCode capAppend(
+		struct CapWriter *self, uint8 channel, uint64 micros, const uint8 *data, uint32 length,
+		const char **error
+	);
+
+	// Write any outstanding index entries and close the file.
+	ReturnCode capClose(struct CapWriter *self, const char **error);
+
+	struct CapReader {
+		const uint8 *map;
+		size_t mapSize;
+		const struct CapFileHeader *hdr;
+		struct CapIndexEntry *index;  // all index entries, oldest first
+		uint64 numIndex;
+	};
+
+	ReturnCode capMap(struct CapReader *self, const char *fileName, const char **error);
+	void capUnmap(struct CapReader *self);
+
+	// Return the file offset of the first chunk completed at or after micros (relative to the
+	// start of the capture), or of the chunk holding payload byte streamOffset. Returns mapSize if
+	// there is no such chunk. *chunkStart gets the stream offset of the chunk's first byte.
+	uint64 capSeekTime(const struct CapReader *self, uint64 micros, uint64 *chunkStart);
+	uint64 capSeekOffset(const struct CapReader *self, uint64 streamOffset, uint64 *chunkStart);
+
+	// Step through chunk records from *offset, skipping index records. Returns the record and
+	// sets *data to its payload, or returns NULL at the end of the file.
+	const struct CapRecord *capNext(
+		const struct CapReader *self, uint64 *offset, const uint8 **data
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
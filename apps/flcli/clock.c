@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef WIN32
+	#include <Windows.h>
+#else
+	#define _POSIX_C_SOURCE 200809L
+	#include <errno.h>
+	#include <time.h>
+#endif
+#include "clock.h"
+
+uint64 clkMicros(void) {
+	#ifdef WIN32
+		LARGE_INTEGER now, freq;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return (uint64)(now.QuadPart / freq.QuadPart) * 1000000 +
+			(uint64)(now.QuadPart % freq.QuadPart) * 1000000 / (uint64)freq.QuadPart;
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64)ts.tv_sec * 1000000 + (uint64)ts.tv_nsec / 1000;
+	#endif
+}
+
+uint64 clkEpochMicros(void) {
+	#ifdef WIN32
+		FILETIME ft;
+		ULARGE_INTEGER t;
+		GetSystemTimeAsFileTime(&ft);
+		t.LowPart = ft.dwLowDateTime;
+		t.HighPart = ft.dwHighDateTime;
+		return t.QuadPart / 10 - 11644473600000000ULL;
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return (uint64)ts.tv_sec * 1000000 + (uint64)ts.tv_nsec / 1000;
+	#endif
+}
+
+void clkSleep(uint64 micros) {
+	#ifdef WIN32
+		Sleep((DWORD)((micros + 999) / 1000));
+	#else
+		struct timespec ts;
+		ts.tv_sec = (time_t)(micros / 1000000);
+		ts.tv_nsec = (long)(micros % 1000000) * 1000;
+		while ( nanosleep(&ts, &ts) != 0 && errno == EINTR );
+	#endif
+}
+
+static uint64 realNow(struct Clock *self) {
+	(void)self;
+	return clkMicros();
+}
+
+static void realSleep(struct Clock *self, uint64 micros) {
+	(void)self;
+	clkSleep(micros);
+}
+
+static const struct ClockOps realOps = {realNow, realSleep};
+static struct Clock realClock = {&realOps};
+
+struct Clock *clkReal(void) {
+	return &realClock;
+}
+
+static uint64 virtualNow(struct Clock *self) {
+	return ((struct VirtualClock *)self)->now;
+}
+
+static void virtualSleep(struct Clock *self, uint64 micros) {
+	((struct VirtualClock *)self)->now += micros;
+}
+
+static const struct ClockOps virtualOps = {virtualNow, virtualSleep};
+
+void clkVirtualInit(struct VirtualClock *self, uint64 start) {
+	self->clock.ops = &virtualOps;
+	self->now = start;
+}
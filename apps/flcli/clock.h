@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <makestuff.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Microseconds since some arbitrary point; never goes backwards, unaffected by wall-clock
+	// adjustments. Only differences between two readings are meaningful.
+	uint64 clkMicros(void);
+
+	// Wall-clock time in microseconds since 1970, for stamping files.
+	uint64 clkEpochMicros(void);
+
+	// Block the calling thread for at least the given number of microseconds.
+	void clkSleep(uint64 micros);
+
+	// A source of time that can be swapped out. The real clock is clkMicros()/clkSleep(); a
+	// virtual clock only moves when something sleeps on it, jumping straight to the end of the
+	// sleep, so a single-threaded simulation runs as fast as it can compute and always takes
+	// the same course.
+	struct Clock;
+
+	struct ClockOps {
+		uint64 (*now)(struct Clock *self);
+		void (*sleep)(struct Clock *self, uint64 micros);
+	};
+
+	struct Clock {
+		const struct ClockOps *ops;
+	};
+
+	struct VirtualClock {
+		struct Clock clock;  // must be first
+		uint64 now;
+	};
+
+	struct Clock *clkReal(void);
+	void clkVirtualInit(struct VirtualClock *self, uint64 start);
+
+	static inline uint64 clkNow(struct Clock *self) {
+		return self->ops->now(self);
+	}
+
+	static inline void clkWait(struct Clock *self, uint64 micros) {
+		self->ops->sleep(self, micros);
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <libfpgalink.h>
+#include <liberror.h>
+#include "dumploop.h"
+#include "capfile.h"
+#include "shmring.h"
+#include "clock.h"
+
+struct DumpBuf {
+	uint64 micros;
+	uint32 length;
+	uint8 data[DUMP_CHUNK];
+};
+
+struct DumpChannel {
+	struct DumpSpec spec;
+	FILE *file;
+	struct CapWriter capWriter;
+	struct CapWriter *cap;
+
+	// Chunks handed from the reader to this channel's writer
+	struct DumpBuf *bufs;
+	uint32 head;
+	uint32 count;
+	bool done;
+	#ifndef WIN32
+		pthread_mutex_t lock;
+		pthread_cond_t notEmpty;
+		pthread_cond_t notFull;
+		pthread_t writer;
+		bool hasWriter;
+	#endif
+
+	// Set by the writer if it fails; it then discards everything so the reader never blocks
+	ReturnCode writeStatus;
+	const char *writeError;
+
+	// Statistics, owned by the reader
+	uint64 bytes;
+	uint64 lastBytes;
+	uint32 stalls;
+};
+
+bool dumpParseSpec(const char *arg, struct DumpSpec *spec) {
+	const char *fileName;
+	const unsigned long chan = strtoul(arg, (char**)&fileName, 10);
+	if ( *fileName != ':' || !fileName[1] || chan > 127 ) {
+		return false;
+	}
+	spec->chan = (uint8)chan;
+	spec->fileName = fileName + 1;
+	return true;
+}
+
+static ReturnCode writeChunk(
+	struct DumpChannel *ch, uint64 micros, const uint8 *data, uint32 length, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	if ( ch->cap ) {
+		retVal = capAppend(ch->cap, ch->spec.chan, micros, data, length, error);
+	} else {
+		CHECK_STATUS(
+			fwrite(data, 1, length, ch->file) != length, FLP_CANNOT_SAVE, cleanup,
+			"writeChunk(): cannot write to %s", ch->spec.fileName);
+	}
+cleanup:
+	return retVal;
+}
+
+#ifndef WIN32
+static void *writerThread(void *arg) {
+	struct DumpChannel *const ch = (struct DumpChannel *)arg;
+	pthread_mutex_lock(&ch->lock);
+	for ( ;; ) {
+		struct DumpBuf *buf;
+		while ( !ch->count && !ch->done ) {
+			pthread_cond_wait(&ch->notEmpty, &ch->lock);
+		}
+		if ( !ch->count ) {
+			break;
+		}
+		buf = ch->bufs + ch->head;
+		if ( !ch->writeStatus ) {
+			const char *error = NULL;
+			ReturnCode status;
+			pthread_mutex_unlock(&ch->lock);
+			status = writeChunk(ch, buf->micros, buf->data, buf->length, &error);
+			pthread_mutex_lock(&ch->lock);
+			ch->writeStatus = status;
+			ch->writeError = error;
+		}
+		ch->head = (ch->head + 1) % DUMP_QUEUE;
+		ch->count--;
+		pthread_cond_signal(&ch->notFull);
+	}
+	pthread_mutex_unlock(&ch->lock);
+	return NULL;
+}
+#endif
+
+// Hand a chunk to the channel's writer, blocking while its queue is full. If the writer has
+// failed, its error is returned instead.
+static ReturnCode enqueue(
+	struct DumpChannel *ch, uint64 micros, const uint8 *data, uint32 length, const char **error)
+{
+	#ifdef WIN32
+		return writeChunk(ch, micros, data, length, error);
+	#else
+		struct DumpBuf *buf;
+		pthread_mutex_lock(&ch->lock);
+		if ( ch->writeStatus ) {
+			const ReturnCode retVal = ch->writeStatus;
+			*error = ch->writeError;
+			ch->writeError = NULL;
+			pthread_mutex_unlock(&ch->lock);
+			return retVal;
+		}
+		if ( ch->count == DUMP_QUEUE ) {
+			ch->stalls++;
+			do {
+				pthread_cond_wait(&ch->notFull, &ch->lock);
+			} while ( ch->count == DUMP_QUEUE );
+		}
+		pthread_mutex_unlock(&ch->lock);
+
+		// Only the reader fills slots, so the tail slot can be filled without the lock
+		buf = ch->bufs + (ch->head + ch->count) % DUMP_QUEUE;
+		memcpy(buf->data, data, length);
+		buf->micros = micros;
+		buf->length = length;
+
+		pthread_mutex_lock(&ch->lock);
+		ch->count++;
+		pthread_cond_signal(&ch->notEmpty);
+		pthread_mutex_unlock(&ch->lock);
+		return FLP_SUCCESS;
+	#endif
+}
+
+static ReturnCode openChannel(struct DumpChannel *ch, uint32 indexInterval, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	if ( indexInterval ) {
+		retVal = capCreate(&ch->capWriter, ch->spec.fileName, indexInterval, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		ch->cap = &ch->capWriter;
+	} else {
+		ch->file = fopen(ch->spec.fileName, "wb");
+		CHECK_STATUS(
+			!ch->file, FLP_CANNOT_SAVE, cleanup, "openChannel(): cannot create %s", ch->spec.fileName);
+	}
+	#ifndef WIN32
+		ch->bufs = (struct DumpBuf *)malloc(DUMP_QUEUE * sizeof(struct DumpBuf));
+		CHECK_STATUS(!ch->bufs, FLP_NO_MEMORY, cleanup, "openChannel(): out of memory");
+		pthread_mutex_init(&ch->lock, NULL);
+		pthread_cond_init(&ch->notEmpty, NULL);
+		pthread_cond_init(&ch->notFull, NULL);
+		CHECK_STATUS(
+			pthread_create(&ch->writer, NULL, writerThread, ch), FLP_NO_MEMORY, cleanup,
+			"openChannel(): cannot start writer thread for %s", ch->spec.fileName);
+		ch->hasWriter = true;
+	#endif
+cleanup:
+	return retVal;
+}
+
+// Drain and stop the writer, then close the output. Returns the first error seen.
+static ReturnCode closeChannel(struct DumpChannel *ch, ReturnCode retVal, const char **error) {
+	ReturnCode status;
+	#ifndef WIN32
+		if ( ch->hasWriter ) {
+			pthread_mutex_lock(&ch->lock);
+			ch->done = true;
+			pthread_cond_signal(&ch->notEmpty);
+			pthread_mutex_unlock(&ch->lock);
+			pthread_join(ch->writer, NULL);
+			pthread_cond_destroy(&ch->notFull);
+			pthread_cond_destroy(&ch->notEmpty);
+			pthread_mutex_destroy(&ch->lock);
+			ch->hasWriter = false;
+		}
+	#endif
+	free(ch->bufs);
+	ch->bufs = NULL;
+	if ( ch->writeStatus && !retVal ) {
+		retVal = ch->writeStatus;
+		*error = ch->writeError;
+		ch->writeError = NULL;
+	}
+	if ( ch->writeError ) {
+		errFree(ch->writeError);
+		ch->writeError = NULL;
+	}
+	if ( ch->cap ) {
+		status = capClose(ch->cap, retVal ? NULL : error);
+		if ( !retVal ) {
+			retVal = status;
+		}
+		ch->cap = NULL;
+	}
+	if ( ch->file ) {
+		if ( fclose(ch->file) && !retVal ) {
+			errRender(error, "closeChannel(): cannot write to %s", ch->spec.fileName);
+			retVal = FLP_CANNOT_SAVE;
+		}
+		ch->file = NULL;
+	}
+	return retVal;
+}
+
+static void printRates(struct DumpChannel *channels, uint32 numSpecs, double secs, bool final) {
+	uint32 i;
+	printf(final ? "\n" : "\r");
+	for ( i = 0; i < numSpecs; i++ ) {
+		struct DumpChannel *const ch = channels + i;
+		const double rate = (double)(final ? ch->bytes : ch->bytes - ch->lastBytes) / (1024*1024*secs);
+		if ( final ) {
+			printf(
+				"Channel %d: %llu bytes to %s at %.2f MiB/s average, writer stalled %u times\n",
+				ch->spec.chan, (unsigned long long)ch->bytes, ch->spec.fileName, rate, ch->stalls);
+		} else {
+			printf("ch%d %7.2f MiB/s  ", ch->spec.chan, rate);
+		}
+		ch->lastBytes = ch->bytes;
+	}
+	fflush(stdout);
+}
+
+ReturnCode dumpLoop(
+	struct FLContext *handle, const struct DumpSpec *specs, uint32 numSpecs,
+	uint32 indexInterval, struct ShmRing *shm, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS, status;
+	FLStatus fStatus;
+	struct DumpChannel channels[DUMP_MAX_CHANNELS];
+	uint32 inFlight[DUMP_MAX_CHANNELS * DUMP_DEPTH];  // channel index of each outstanding read
+	uint32 i, d, numOpen = 0, flightHead = 0, numFlight = 0;
+	const uint8 *recvData;
+	uint32 actualLength;
+	uint64 start, lastReport;
+
+	memset(channels, 0, sizeof(channels));
+	CHECK_STATUS(
+		numSpecs == 0 || numSpecs > DUMP_MAX_CHANNELS, FLP_ARGS, cleanup,
+		"dumpLoop(): between 1 and %d channels can be dumped at once", DUMP_MAX_CHANNELS);
+	for ( i = 0; i < numSpecs; i++ ) {
+		channels[i].spec = specs[i];
+		retVal = openChannel(channels + i, indexInterval, error);
+		numOpen = i + 1;
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
+	sigRegisterHandler();
+
+	// Prime the pipeline: DUMP_DEPTH reads per channel, interleaved
+	for ( d = 0; d < DUMP_DEPTH; d++ ) {
+		for ( i = 0; i < numSpecs; i++ ) {
+			fStatus = flReadChannelAsyncSubmit(handle, specs[i].chan, DUMP_CHUNK, NULL, error);
+			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "dumpLoop()");
+			inFlight[(flightHead + numFlight++) % (DUMP_MAX_CHANNELS * DUMP_DEPTH)] = i;
+		}
+	}
+	start = lastReport = clkMicros();
+	while ( numFlight ) {
+		// Reads complete in submission order, so the oldest entry says whose data this is
+		struct DumpChannel *const ch = channels + inFlight[flightHead];
+		flightHead = (flightHead + 1) % (DUMP_MAX_CHANNELS * DUMP_DEPTH);
+		numFlight--;
+		fStatus = flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, error);
+		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "dumpLoop()");
+		if ( shm ) {
+			retVal = shmRingPublish(shm, ch->spec.chan, recvData, actualLength, error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+		}
+		retVal = enqueue(ch, clkMicros(), recvData, actualLength, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		ch->bytes += actualLength;
+
+		// Keep this channel's share of the pipeline topped up until SIGINT, then drain
+		if ( !sigIsRaised() ) {
+			fStatus = flReadChannelAsyncSubmit(handle, ch->spec.chan, DUMP_CHUNK, NULL, error);
+			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "dumpLoop()");
+			inFlight[(flightHead + numFlight++) % (DUMP_MAX_CHANNELS * DUMP_DEPTH)] =
+				(uint32)(ch - channels);
+		}
+		if ( clkMicros() - lastReport >= 1000000 ) {
+			const uint64 now = clkMicros();
+			printRates(channels, numSpecs, (double)(now - lastReport) / 1000000.0, false);
+			lastReport = now;
+		}
+	}
+	printf("\nCaught SIGINT, quitting...");
+	printRates(channels, numSpecs, (double)(clkMicros() - start) / 1000000.0, true);
+cleanup:
+	// On error, reap whatever is still outstanding before closing up
+	while ( numFlight-- ) {
+		if ( flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, NULL) ) {
+			break;
+		}
+	}
+	for ( i = 0; i < numOpen; i++ ) {
+		status = closeChannel(channels + i, retVal, error);
+		if ( !retVal ) {
+			retVal = status;
+		}
+	}
+	return retVal;
+}
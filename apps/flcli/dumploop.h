@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DUMPLOOP_H
+#define DUMPLOOP_H
+
+#include <makestuff.h>
+#include "flcli.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	struct FLContext;
+	struct ShmRing;
+
+	#define DUMP_MAX_CHANNELS 16
+	#define DUMP_CHUNK 22528    // bytes per async read
+	#define DUMP_DEPTH 2        // reads in flight per channel
+	#define DUMP_QUEUE 64       // chunks buffered per channel between the reader and its writer
+
+	struct DumpSpec {
+		uint8 chan;
+		const char *fileName;
+	};
+
+	// Parse a "ch:file" argument.
+	bool dumpParseSpec(const char *arg, struct DumpSpec *spec);
+
+	// Copy every listed channel to its file until SIGINT. Reads for all channels are interleaved
+	// round-robin in one async pipeline; each channel has its own writer thread and queue, so a
+	// slow disk on one file does not stall the others until its queue fills. A non-zero
+	// indexInterval writes indexed captures (see capfile.h) instead of raw files. If shm is not
+	// NULL, every chunk is also published there.
+	ReturnCode dumpLoop(
+		struct FLContext *handle, const struct DumpSpec *specs, uint32 numSpecs,
+		uint32 indexInterval, struct ShmRing *shm, const char **error
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLCLI_H
+#define FLCLI_H
+
+#include <makestuff.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	typedef enum {
+		FLP_SUCCESS,
+		FLP_LIBERR,
+		FLP_BAD_HEX,
+		FLP_CHAN_RANGE,
+		FLP_CONDUIT_RANGE,
+		FLP_ILL_CHAR,
+		FLP_UNTERM_STRING,
+		FLP_NO_MEMORY,
+		FLP_EMPTY_STRING,
+		FLP_ODD_DIGITS,
+		FLP_CANNOT_LOAD,
+		FLP_CANNOT_SAVE,
+		FLP_ARGS,
+		FLP_PROTOCOL
+	} ReturnCode;
+
+	// SIGINT handling, in sig.c
+	bool sigIsRaised(void);
+	void sigRegisterHandler(void);
+
+	// SIGUSR1 as an external capture trigger; sigTakeTrigger() clears it on read
+	bool sigTakeTrigger(void);
+	void sigRegisterTrigger(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
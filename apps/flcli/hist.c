@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "hist.h"
+
+static uint32 bucketIndex(uint32 value) {
+	uint32 octave, shift;
+	if ( value < HIST_SUB ) {
+		return value;
+	}
+	octave = 31 - (uint32)__builtin_clz(value);  // position of the top bit, >= HIST_SUB_BITS
+	shift = octave - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + ((value >> shift) & (HIST_SUB - 1));
+}
+
+uint32 histBucketLow(uint32 bucket) {
+	uint32 shift;
+	if ( bucket < HIST_SUB ) {
+		return bucket;
+	}
+	shift = bucket / HIST_SUB - 1;
+	return (HIST_SUB + bucket % HIST_SUB) << shift;
+}
+
+void histInit(struct Hist *self) {
+	memset(self, 0, sizeof(*self));
+	self->min = 0xFFFFFFFF;
+}
+
+void histAdd(struct Hist *self, uint32 value) {
+	self->bucket[bucketIndex(value)]++;
+	self->count++;
+	self->sum += value;
+	if ( value < self->min ) {
+		self->min = value;
+	}
+	if ( value > self->max ) {
+		self->max = value;
+	}
+}
+
+void histMerge(struct Hist *self, const struct Hist *other) {
+	uint32 i;
+	for ( i = 0; i < HIST_BUCKETS; i++ ) {
+		self->bucket[i] += other->bucket[i];
+	}
+	self->count += other->count;
+	self->sum += other->sum;
+	if ( other->min < self->min ) {
+		self->min = other->min;
+	}
+	if ( other->max > self->max ) {
+		self->max = other->max;
+	}
+}
+
+uint32 histPercentile(const struct Hist *self, double pct) {
+	uint64 target, seen = 0;
+	uint32 i;
+	if ( !self->count ) {
+		return 0;
+	}
+	target = (uint64)(pct * (double)self->count / 100.0 + 0.5);
+	if ( target == 0 ) {
+		target = 1;
+	}
+	for ( i = 0; i < HIST_BUCKETS; i++ ) {
+		seen += self->bucket[i];
+		if ( seen >= target ) {
+			const uint32 low = histBucketLow(i);
+			return low < self->min ? self->min : low > self->max ? self->max : low;
+		}
+	}
+	return self->max;
+}
+
+void histSummary(const struct Hist *self, FILE *out, const char *label) {
+	if ( !self->count ) {
+		fprintf(out, "%s: no samples\n", label);
+		return;
+	}
+	fprintf(
+		out, "%s: n=%llu min=%u avg=%llu p50=%u p90=%u p99=%u p99.9=%u max=%u (us)\n",
+		label, (unsigned long long)self->count, self->min,
+		(unsigned long long)(self->sum / self->count),
+		histPercentile(self, 50.0), histPercentile(self, 90.0), histPercentile(self, 99.0),
+		histPercentile(self, 99.9), self->max);
+}
+
+void histPrint(const struct Hist *self, FILE *out, const char *label) {
+	uint32 i, widest = 0;
+	histSummary(self, out, label);
+	for ( i = 0; i < HIST_BUCKETS; i++ ) {
+		if ( self->bucket[i] > widest ) {
+			widest = self->bucket[i];
+		}
+	}
+	for ( i = 0; i < HIST_BUCKETS; i++ ) {
+		if ( self->bucket[i] ) {
+			const uint32 bar = (uint32)((uint64)self->bucket[i] * 50 / widest);
+			uint32 j;
+			fprintf(out, "  >= %10u us %10u ", histBucketLow(i), self->bucket[i]);
+			for ( j = 0; j < bar; j++ ) {
+				fputc('#', out);
+			}
+			fputc('\n', out);
+		}
+	}
+}
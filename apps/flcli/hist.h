@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HIST_H
+#define HIST_H
+
+#include <makestuff.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Log-linear latency histogram: each power-of-two octave is split into HIST_SUB linear
+	// sub-buckets, so any recorded value is within 1/HIST_SUB of its bucket's lower bound.
+	#define HIST_SUB_BITS 3
+	#define HIST_SUB (1 << HIST_SUB_BITS)
+	#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+	struct Hist {
+		uint64 count;
+		uint64 sum;
+		uint32 min;
+		uint32 max;
+		uint32 bucket[HIST_BUCKETS];
+	};
+
+	void histInit(struct Hist *self);
+	void histAdd(struct Hist *self, uint32 value);
+	void histMerge(struct Hist *self, const struct Hist *other);
+	uint32 histPercentile(const struct Hist *self, double pct);
+	uint32 histBucketLow(uint32 bucket);
+
+	// Print a one-line summary (n, min, avg, p50, p90, p99, p99.9, max), values in microseconds.
+	void histSummary(const struct Hist *self, FILE *out, const char *label);
+
+	// Print the summary followed by one line per non-empty bucket.
+	void histPrint(const struct Hist *self, FILE *out, const char *label);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
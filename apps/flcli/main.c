@@ -29,24 +29,27 @@
 #include <argtable2.h>
 #include <readline/readline.h>
 #include <readline/history.h>
+#include "flcli.h"
+#include "hist.h"
+#include "ping.h"
+#include "trigcap.h"
+#include "shmring.h"
+#include "dumploop.h"
+#include "railctl.h"
+#include "railstats.h"
+#include "railevlog.h"
+#include "railsnap.h"
+#include "railview.h"
+#include "railquery.h"
 #ifdef WIN32
 #include <Windows.h>
 #else
 #include <sys/time.h>
 #endif
-#ifdef __GNUC__
-uint32 popcount(uint32 x) {
-  return __builtin_popcount(x);
-}
-#else
-#error Unimplemented popcount
-#endif
-
-bool sigIsRaised(void);
-void sigRegisterHandler(void);
 
 static const char *ptr;
 static bool enableBenchmarking = false;
+static struct ShmRing *shmOut = NULL;
 
 static bool isHexDigit(char ch) {
 	return
@@ -103,25 +106,10 @@ static const char *const errMessages[] = {
 	"Odd number of digits",
 	"Cannot load file",
 	"Cannot save file",
-	"Bad arguments"
+	"Bad arguments",
+	"Protocol error"
 };
 
-typedef enum {
-	FLP_SUCCESS,
-	FLP_LIBERR,
-	FLP_BAD_HEX,
-	FLP_CHAN_RANGE,
-	FLP_CONDUIT_RANGE,
-	FLP_ILL_CHAR,
-	FLP_UNTERM_STRING,
-	FLP_NO_MEMORY,
-	FLP_EMPTY_STRING,
-	FLP_ODD_DIGITS,
-	FLP_CANNOT_LOAD,
-	FLP_CANNOT_SAVE,
-	FLP_ARGS
-} ReturnCode;
-
 static ReturnCode doRead(
 	struct FLContext *handle, uint8 chan, uint32 length, FILE *destFile, uint16 *checksum,
 	const char **error)
@@ -156,6 +144,10 @@ static ReturnCode doRead(
 		// Write chunk N-1 to file
 		bytesWritten = (uint32)fwrite(recvData, 1, actualLength, destFile);
 		CHECK_STATUS(bytesWritten != actualLength, FLP_CANNOT_SAVE, cleanup, "doRead()");
+		if ( shmOut ) {
+			retVal = shmRingPublish(shmOut, chan, recvData, actualLength, error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+		}
 
 		// Checksum chunk N-1
 		chunkSize = actualLength;
@@ -172,6 +164,10 @@ static ReturnCode doRead(
 	// Write last chunk to file
 	bytesWritten = (uint32)fwrite(recvData, 1, actualLength, destFile);
 	CHECK_STATUS(bytesWritten != actualLength, FLP_CANNOT_SAVE, cleanup, "doRead()");
+	if ( shmOut ) {
+		retVal = shmRingPublish(shmOut, chan, recvData, actualLength, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
 
 	// Checksum last chunk
 	chunkSize = actualLength;
@@ -583,240 +579,50 @@ static const char *nibbles[] = {
 	"1111"   // 'F'
 };
 
-int pow1(int a,int b){
-    int c = 1;
-    for(int i =0;i<b;i++){
-        c = c*a;
-    }
-    return c;
-}
-
-// void rail_data(int x, int y, int i, uint8 file_data[][64], uint8 *dataPtr) {
-// 	*dataPtr = file_data[x][y * 8 + i];
-// }
-
-void text_read(uint8_t file_data[][64]) {
-	FILE* file1 = fopen("/home/gani/eval/20140524/makestuff/hdlmake/apps/makestuff/swled/cksum/vhdl/track_data.csv", "r");
-	if(file1 == NULL){
-		printf("no such file\n");
-	}
-	int i_1, j_1, x_1, y_1, dir_1, ok_1, next_1;
-	for(i_1 = 0; i_1 < 8; i_1++){
-		for(j_1 = 0; j_1 < 64; j_1++){
-			file_data[i_1][j_1] = (j_1 % 8) * 8;
+// Split a "file[:number]" option into the file name and, if given, the number.
+static bool parseFileSpec(const char *spec, char *path, size_t pathSize, unsigned long *number) {
+	const char *const colon = strrchr(spec, ':');
+	size_t len = strlen(spec);
+	if ( colon ) {
+		char *end;
+		*number = strtoul(colon + 1, &end, 10);
+		len = (size_t)(colon - spec);
+		if ( *end || end == colon + 1 ) {
+			return false;
 		}
 	}
-
-	while(fscanf(file1, "%d,%d,%d,%d,%d", &x_1, &y_1, &dir_1, &ok_1, &next_1) != EOF){
-		y_1 = dir_1 + (8 * y_1);
-		file_data[x_1][y_1] = pow1(2, 7) + (pow1(2,6) * ok_1) + (8 * dir_1) + next_1;
-	}
-	fclose(file1);
-}
-
-void update_file(uint8_t file_data[][64]) {
-	FILE* file1 = fopen("/home/gani/eval/20140524/makestuff/hdlmake/apps/makestuff/swled/cksum/vhdl/track_data.csv", "w");
-	if(file1 == NULL){
-		printf("no such file to write\n");
-	}
-	int i, j, ok, next;
-
-	for(i = 0; i < 8; i++){
-		for(j = 0; j < 64; j++){
-			if(file_data[i][j] != (j % 8) * 8){
-				ok = file_data[i][j] / pow1(2, 6);
-				ok = ok % 2;
-				next = file_data[i][j] % 8;
-				fprintf(file1, "%d,%d,%d,%d,%d\n", i, j / 8, j % 8, ok, next);
-			}
-		}
-	}
-	fclose(file1);
-}
-
-uint32 count1(uint32 a){
-    return popcount(a);
-}
- 
-uint32 neg(uint32 a){
-    uint32 b = pow1(2,32) -1;
-    b -= a;
-    return b;
-}
-
-// uint32 displaybitrev(uint32 a){
-//     uint8 b;
-//     uint32 c=0U;
-//     for(int i=0;i<32;i++){
-//         b = a % 2U;
-//         a = a / 2U;
-//         c+= b*pow1(2,31-i);
-//     }
-//     return c;
-// }
-
-// void displaybit(uint32 a){
-//     uint8 b;
-//     uint32 c = displaybitrev(a);
-//     for(int i=0;i<32;i++){
-//         b = c % 2U;
-//         c = c / 2U;
-//         printf("%u",b);
-//     }
-//     printf("\n");
-// }
-
-uint32 concat(uint8 a){
-    uint32 b = 0x00000000;
-    b |=a;
-     for (int i=0;i<8;i++) {
-        b = b << 4;
-        b |= a;
-    } 
-    return b;
-}
-
-uint32 bitXor(uint32 x, uint32 y) {
-    uint32 a = x & y;
-    uint32 b = neg(x) & neg(y);
-    uint32 c = neg(a) & neg(b);
-    return c;
-} 
-
-uint8 findki(uint32 a,int n){
-    uint8 b = 0x00;
-    for(int i=0;i<n+1;i++){
-        b = a % 2U;
-        a = a/2U;
-    }
-    return b;
-}
-
-uint8 findti(uint32 key,int n){
-    
-    uint8 t=findki(key,n%4U),k;
-    for(int i=n+4; i<32;i=i+4){
-        k = findki(key,i);
-        t = bitXor(t,k);
-    }
-    return t;
-}
-
-uint8 findt(uint32 key){
-    uint32 t=0,k;
-    for(int i=0; i<4;i++){
-        k = findti(key,i);
-        t += k*pow1(2,i); 
-    }
-    return t;
-}
-
-uint32 encrypt(uint32 inp, uint32 key){
-    uint8 t = findt(key);
-    uint8 n = count1(key);
-    uint32 cipher = inp;
-    for(uint8 i = 0; i<n;i++){
-        uint32 inter = concat(t);
-        cipher = bitXor(cipher,inter);
-        t = (t+1) % 16U;       
-    }
-    return cipher;
-}
-
-uint32 decrypt(uint32 inp,uint32 key){
-    uint8 t = findt(key);
-    uint8 n = count1(key);
-    uint32 cipher = inp;
-    t = (t+15)% 16U;
-    for(uint8 i = 0; i<32-n;i++){
-        uint32 inter = concat(t);
-        cipher = bitXor(cipher,inter);
-        t = (t+15) % 16U;
-    }
-    return cipher;
-}
-
-static int receive_from_fpga(struct FLContext *handle, uint8 chan, uint32 *decrypted_data, const char **error) {
-	uint32 key = 0x9999999F, length = 4, actualLength, received_data = 0x00000000, chunkSize;
-	uint8 chan0 = 2U * chan;
-	const uint8 *received_databit;
-	ReturnCode retVal = FLP_SUCCESS;
-	FLStatus fStatus;
-	#define READ_MAX_1 1
-
-	chunkSize = length >= READ_MAX_1 ? READ_MAX_1 : length;
-	fStatus = flReadChannelAsyncSubmit(handle, chan0, chunkSize, NULL, error);
-	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "receive_from_fpga()");
-	length = length - chunkSize;
-
-	while(length){
-		chunkSize = length >= READ_MAX_1 ? READ_MAX_1 : length;
-		fStatus = flReadChannelAsyncSubmit(handle, chan0, chunkSize, NULL, error);
-		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "receive_from_fpga()");
-		length = length - chunkSize;
-		
-		fStatus = flReadChannelAsyncAwait(handle, &received_databit, &actualLength, &actualLength, error);
-		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "receive_from_fpga()");
-		//printf("length of data received is %u\n", actualLength);
-		//printf("received_databit is %u\n", *received_databit);
-
-		received_data = received_data << actualLength * 8;
-		received_data |= *received_databit;
-	}
-
-	fStatus = flReadChannelAsyncAwait(handle, &received_databit, &actualLength, &actualLength, error);
-	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "receive_from_fpga()");
-	//printf("length of data received is %u\n", actualLength);
-	//printf("received_databit is %u\n", *received_databit);
-
-	received_data = received_data << actualLength * 8;
-	received_data |= *received_databit;
-	
-	//printf("data received %u\n", received_data);
-	*decrypted_data = decrypt(received_data, key);
-	//printf("decrypted received data is %u\n", *decrypted_data);
-
-cleanup:
-	if(*error){
-		fprintf(stderr, "%s\n", *error);
-		flFreeError(*error);
+	if ( !len || len >= pathSize ) {
+		return false;
 	}
-	return retVal;
+	memcpy(path, spec, len);
+	path[len] = '\0';
+	return true;
 }
 
-static int send_to_fpga(struct FLContext *handle, uint8 chan, uint32 send_data, const char **error) {
-	uint32 encrypted_data = 0x00000000, key = 0x9999999F, length = 0x00000001;
-	uint8 *data = NULL, *dataPtr, chan1 = (2U * chan) + 1;
-	int i;
-	data = malloc(8);
+// Open a further board for --rail and check it is ready to talk on the given conduit.
+static ReturnCode openBoard(
+	const char *vp, uint8 conduit, struct FLContext **handle, const char **error)
+{
 	ReturnCode retVal = FLP_SUCCESS;
 	FLStatus fStatus;
-
-	//printf("data to be sent is %u\n", send_data);
-	encrypted_data = encrypt(send_data, key);
-	dataPtr = data;
-	for(i = 0; i < 4; i++){
-		*dataPtr = encrypted_data % 256U;
-		encrypted_data = encrypted_data / 256U;
-		dataPtr++;
-	}
-	for(i = 0; i < 4; i++){
-		dataPtr--;
-		fStatus = flWriteChannel(handle, chan1, length, dataPtr, error);
-		//printf("send_databit is %u\n", *dataPtr);
-		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup);
-	}
-	free(data);
-	data = NULL;
+	uint8 isRunning;
+	printf("Attempting to open connection to FPGALink device %s...\n", vp);
+	fStatus = flOpen(vp, handle, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "openBoard()");
+	CHECK_STATUS(
+		!flIsCommCapable(*handle, conduit), FLP_ARGS, cleanup,
+		"openBoard(): device at %s does not support CommFPGA", vp);
+	fStatus = flSelectConduit(*handle, conduit, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "openBoard()");
+	fStatus = flIsFPGARunning(*handle, &isRunning, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "openBoard()");
+	CHECK_STATUS(
+		!isRunning, FLP_ARGS, cleanup,
+		"openBoard(): the FPGALink device at %s is not ready to talk - did you forget --program?", vp);
 cleanup:
-	if(*error){
-		fprintf(stderr, "%s\n", *error);
-		flFreeError(*error);
-	}
 	return retVal;
 }
 
-
 int main(int argc, char *argv[]) {
 	ReturnCode retVal = FLP_SUCCESS, pStatus;
 	struct arg_str *ivpOpt = arg_str0("i", "ivp", "<VID:PID>", "            vendor ID and product ID (e.g 04B4:8613)");
@@ -830,18 +636,32 @@ int main(int argc, char *argv[]) {
 	struct arg_lit *shellOpt  = arg_lit0("s", "shell", "                    start up an interactive CommFPGA session");
 	struct arg_lit *benOpt  = arg_lit0("b", "benchmark", "                enable benchmarking & checksumming");
 	struct arg_lit *rstOpt  = arg_lit0("r", "reset", "                    reset the bulk endpoints");
-	struct arg_str *dumpOpt = arg_str0("l", "dumploop", "<ch:file.bin>", "   write data from channel ch to file");
+	struct arg_str *dumpOpt = arg_strn("l", "dumploop", "<ch:file.bin>", 0, DUMP_MAX_CHANNELS, "   write data from channel ch to file (repeatable)");
+	struct arg_uint *indexOpt = arg_uint0(NULL, "index", "<chunks>", "          make --dumploop an indexed capture");
+	struct arg_str *shmOpt = arg_str0(NULL, "shm", "<name[:MB]>", "            also publish reads to a shared-memory ring");
+	struct arg_str *trigOpt = arg_str0(NULL, "trigger", "<ch:preMB:postMB:file>", "  save windows around triggers from ch");
+	struct arg_str *patOpt = arg_str0(NULL, "pattern", "<hexBytes>", "            trigger on this byte pattern (else SIGUSR1)");
+	struct arg_str *pingOpt = arg_str0(NULL, "ping", "<wch:rch[:n[:d]]>", "       time n echoes (default 1000), d in flight");
 	struct arg_lit *helpOpt  = arg_lit0("h", "help", "                     print this help and exit");
 	struct arg_str *eepromOpt  = arg_str0(NULL, "eeprom", "<std|fw.hex|fw.iic>", "   write firmware to FX2's EEPROM (!!)");
 	struct arg_str *backupOpt  = arg_str0(NULL, "backup", "<kbitSize:fw.iic>", "     backup FX2's EEPROM (e.g 128:fw.iic)\n");
 	struct arg_str *railOpt = arg_str0("y", "rail", "<railString>", "communication with the CommFPGA for rail info");
+	struct arg_str *trackOpt = arg_str0(NULL, "track", "<file>", "               track table for --rail: CSV, or database if .tdb");
+	struct arg_str *railCfgOpt = arg_str0(NULL, "railcfg", "<name=ms[,name=ms]*>", "override --rail timings (e.g. rest=5000)");
+	struct arg_str *railStatsOpt = arg_str0(NULL, "railstats", "<file[:secs]>", "     time --rail states; summarise every secs (default 60)");
+	struct arg_str *railEvOpt = arg_str0(NULL, "railevlog", "<file[:records]>", "  binary log of --rail events, a ring of 1M records by default");
+	struct arg_lit *railQuietOpt = arg_lit0(NULL, "railquiet", "                no --rail progress messages on stdout");
+	struct arg_str *railSnapOpt = arg_str0(NULL, "railsnap", "<file[:secs]>", "      snapshot --rail channels every secs (default 1)");
+	struct arg_lit *warmOpt = arg_lit0(NULL, "warm", "                     resume --rail from its --railsnap snapshot");
+	struct arg_str *railQueryOpt = arg_str0(NULL, "railquery", "<socket>", "         answer --rail state queries on a local socket");
+	struct arg_str *boardOpt = arg_strn(NULL, "board", "<VID:PID[:DID]>", 0, RAIL_MAX_BOARDS - 1, "  another board for --rail; its signals follow -v's (repeatable)");
 	{
 		
 	};
 	struct arg_end *endOpt   = arg_end(20);
 	void *argTable[] = {
 		ivpOpt, vpOpt, fwOpt, portOpt, queryOpt, progOpt, conOpt, actOpt,
-		shellOpt, benOpt, rstOpt, dumpOpt, helpOpt, eepromOpt, backupOpt, railOpt, endOpt
+		shellOpt, benOpt, rstOpt, dumpOpt, indexOpt, shmOpt, trigOpt, patOpt, pingOpt, helpOpt, eepromOpt, backupOpt, railOpt, trackOpt, railCfgOpt, railStatsOpt, railEvOpt, railQuietOpt, railSnapOpt, warmOpt, railQueryOpt, boardOpt, endOpt
 	};
 	const char *progName = "flcli";
 	int numErrors;
@@ -854,6 +674,7 @@ int main(int argc, char *argv[]) {
 	uint32 numDevices, scanChain[16], i;
 	const char *line = NULL;
 	uint8 conduit = 0x01;
+	struct ShmRing shmRing = {0,};
 
 
 	if ( arg_nullcheck(argTable) != 0 ) {
@@ -1019,6 +840,38 @@ int main(int argc, char *argv[]) {
 	if ( benOpt->count ) {
 		enableBenchmarking = true;
 	}
+
+	if ( shmOpt->count ) {
+		char *name = malloc(strlen(shmOpt->sval[0]) + 1);
+		char *colon;
+		unsigned long sizeMB = 16;
+		CHECK_STATUS(!name, FLP_NO_MEMORY, cleanup);
+		strcpy(name, shmOpt->sval[0]);
+		colon = strchr(name, ':');
+		if ( colon ) {
+			char *end;
+			*colon = '\0';
+			sizeMB = strtoul(colon + 1, &end, 10);
+			if ( end == colon + 1 || *end ) {
+				sizeMB = 0;
+			}
+		}
+
+		// The ring only takes records of up to half its size, and each read may be a whole chunk
+		if (
+			!sizeMB || sizeMB > SHM_MAX_MB ||
+			((size_t)sizeMB << 20) / 2 < sizeof(struct ShmRecord) + DUMP_CHUNK )
+		{
+			fprintf(stderr, "%s: invalid argument to option --shm=<name[:MB]> (MB is 1 to %d)\n", progName, SHM_MAX_MB);
+			free(name);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		pStatus = shmRingCreate(&shmRing, name, (size_t)sizeMB << 20, &error);
+		free(name);
+		CHECK_STATUS(pStatus, pStatus, cleanup);
+		printf("Publishing captured data to shared-memory ring %s\n", shmRing.name);
+		shmOut = &shmRing;
+	}
 	
 	if ( actOpt->count ) {
 		printf("Executing CommFPGA actions on FPGALink device %s...\n", vp);
@@ -1041,38 +894,128 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if ( dumpOpt->count ) {
-		const char *fileName;
-		unsigned long chan = strtoul(dumpOpt->sval[0], (char**)&fileName, 10);
-		FILE *file = NULL;
-		const uint8 *recvData;
-		uint32 actualLength;
-		if ( *fileName != ':' ) {
-			fprintf(stderr, "%s: invalid argument to option -l|--dumploop=<ch:file.bin>\n", progName);
+	if ( pingOpt->count ) {
+		const char *p = pingOpt->sval[0];
+		char *end;
+		unsigned long wChan, rChan, count = 1000, depth = 1;
+		struct Hist hist;
+		// Each field must have digits; p is left at the start of the last one parsed
+		wChan = strtoul(p, &end, 0);
+		if ( end != p && *end == ':' ) {
+			p = end + 1;
+			rChan = strtoul(p, &end, 0);
+			if ( end != p && *end == ':' ) {
+				p = end + 1;
+				count = strtoul(p, &end, 0);
+				if ( end != p && *end == ':' ) {
+					p = end + 1;
+					depth = strtoul(p, &end, 0);
+				}
+			}
+		} else {
+			end = NULL;
+		}
+		if (
+			!end || end == p || *end != '\0' || wChan > 127 || rChan > 127 || !count ||
+			depth > PING_MAX_DEPTH )
+		{
+			fprintf(stderr, "%s: invalid argument to option --ping=<wch:rch[:n[:d]]>\n", progName);
 			FAIL(FLP_ARGS, cleanup);
 		}
-		fileName++;
-		printf("Copying from channel %lu to %s", chan, fileName);
-		file = fopen(fileName, "wb");
-		CHECK_STATUS(!file, FLP_CANNOT_SAVE, cleanup);
-		sigRegisterHandler();
-		fStatus = flSelectConduit(handle, conduit, &error);
-		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup);
-		fStatus = flReadChannelAsyncSubmit(handle, (uint8)chan, 22528, NULL, &error);
-		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup);
-		do {
-			fStatus = flReadChannelAsyncSubmit(handle, (uint8)chan, 22528, NULL, &error);
+		if ( isCommCapable ) {
+			uint8 isRunning;
+			fStatus = flSelectConduit(handle, conduit, &error);
 			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup);
-			fStatus = flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, &error);
+			fStatus = flIsFPGARunning(handle, &isRunning, &error);
 			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup);
-			fwrite(recvData, 1, actualLength, file);
-			printf(".");
-		} while ( !sigIsRaised() );
-		printf("\nCaught SIGINT, quitting...\n");
-		fStatus = flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, &error);
+			if ( isRunning ) {
+				printf(
+					"Pinging channel %lu -> %lu (%s, depth %lu)...\n",
+					wChan, rChan, depth > 1 ? "pipelined" : "sync", depth);
+				sigRegisterHandler();
+				histInit(&hist);
+				pStatus = pingRun(
+					handle, (uint8)wChan, (uint8)rChan, (uint32)count, (uint32)depth, &hist, &error);
+				histPrint(&hist, stdout, "Round-trip latency");
+				CHECK_STATUS(pStatus, pStatus, cleanup);
+			} else {
+				fprintf(stderr, "The FPGALink device at %s is not ready to talk - did you forget --program?\n", vp);
+				FAIL(FLP_ARGS, cleanup);
+			}
+		} else {
+			fprintf(stderr, "Ping requested but device at %s does not support CommFPGA\n", vp);
+			FAIL(FLP_ARGS, cleanup);
+		}
+	}
+
+	if ( dumpOpt->count ) {
+		struct DumpSpec specs[DUMP_MAX_CHANNELS];
+		for ( i = 0; i < (uint32)dumpOpt->count; i++ ) {
+			if ( !dumpParseSpec(dumpOpt->sval[i], specs + i) ) {
+				fprintf(stderr, "%s: invalid argument to option -l|--dumploop=<ch:file.bin>\n", progName);
+				FAIL(FLP_ARGS, cleanup);
+			}
+			printf("Copying from channel %d to %s\n", specs[i].chan, specs[i].fileName);
+		}
+		fStatus = flSelectConduit(handle, conduit, &error);
 		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup);
-		fwrite(recvData, 1, actualLength, file);
-		fclose(file);
+		pStatus = dumpLoop(
+			handle, specs, (uint32)dumpOpt->count, indexOpt->count ? indexOpt->ival[0] : 0, shmOut,
+			&error);
+		CHECK_STATUS(pStatus, pStatus, cleanup);
+	}
+
+	if ( trigOpt->count ) {
+		const char *fileName;
+		char *end;
+		unsigned long chan, preMB = 0, postMB = 0;
+		uint8 pattern[TRIG_MAX_PATTERN];
+		size_t patLen = 0;
+		struct TrigCapture capture = {0,};
+		chan = strtoul(trigOpt->sval[0], &end, 10);
+		if ( *end == ':' ) {
+			preMB = strtoul(end + 1, &end, 10);
+			if ( *end == ':' ) {
+				postMB = strtoul(end + 1, &end, 10);
+			}
+		}
+		fileName = end + 1;
+		if ( *end != ':' || !*fileName || chan > 127 ) {
+			fprintf(stderr, "%s: invalid argument to option --trigger=<ch:preMB:postMB:file>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		if ( patOpt->count ) {
+			const char *p = patOpt->sval[0];
+			uint8 upperNibble, lowerNibble;
+			while ( *p ) {
+				if (
+					patLen == TRIG_MAX_PATTERN ||
+					getHexNibble(p[0], &upperNibble) || getHexNibble(p[1], &lowerNibble) )
+				{
+					fprintf(stderr, "%s: invalid argument to option --pattern=<hexBytes>\n", progName);
+					FAIL(FLP_ARGS, cleanup);
+				}
+				pattern[patLen++] = (uint8)((upperNibble << 4) | lowerNibble);
+				p += 2;
+			}
+		}
+		pStatus = trigInit(
+			&capture, (size_t)preMB << 20, (uint64)postMB << 20, pattern, patLen, fileName, &error);
+		CHECK_STATUS(pStatus, pStatus, cleanup);
+		printf(
+			"Watching channel %lu, keeping %lu MiB before and %lu MiB after each trigger (%s)\n",
+			chan, preMB, postMB, patLen ? "pattern or SIGUSR1" : "SIGUSR1 only");
+		fStatus = flSelectConduit(handle, conduit, &error);
+		if ( fStatus ) {
+			trigDestroy(&capture);
+			FAIL(FLP_LIBERR, cleanup);
+		}
+		pStatus = trigCaptureLoop(handle, (uint8)chan, &capture, &error);
+		if ( !pStatus ) {
+			printf("\nCaught SIGINT after %u trigger(s), quitting...\n", capture.numEvents);
+		}
+		trigDestroy(&capture);
+		CHECK_STATUS(pStatus, pStatus, cleanup);
 	}
 
 	if(railOpt->count){
@@ -1089,126 +1032,144 @@ int main(int argc, char *argv[]) {
 				ptr = line;
 				switch(*ptr){
 					case 'f':{
-						//printf("entered f\n");
-						uint32 decrypted_data = 0x00000000, resend_data = 0x00000000, resend_coorddata = 0x00000000;
-						uint32 ACK1 = 0xCCCCCCCC, ACK2 = 0x33333333, key = 0x9999999F;
-						ptr++;
-						int i, x, y, process_counter = 0, step = 0, norm = 0;
-						uint8_t file_data[8][64];
-
-						printf("entering the loop\n");
-						for(uint8 chan = 0; chan < 64; chan++){
-							printf("checking on channel %d\n", 2 * chan);
-							
-							fStatus = receive_from_fpga(handle, chan, &decrypted_data, &error);
-
-							decrypted_data = decrypted_data % 256U;    // since the co-ords are only in the last 8 bits
-							//printf("the last 8 bits in decrypted data are %u\n", decrypted_data);
-							x = decrypted_data / 16U;
-							y = decrypted_data % 16U;
-							printf("x is %d, y is %d\n", x, y);
-
-							resend_coorddata = (x * 16) + y;
-							fStatus = send_to_fpga(handle, chan, resend_coorddata, &error);
-							printf("co-ord data re-sent\n");
-
-							fStatus = receive_from_fpga(handle, chan, &decrypted_data, &error);
-
-							do{
-								if(decrypted_data == ACK1){
-									text_read(file_data);
-									printf("connection established on channel number %d\n", 2 * chan);
-									//printf("ACK1 received %u\n", decrypted_data);
-
-									fStatus = send_to_fpga(handle, chan, ACK2, &error);
-									//printf("ACK2 sent\n");
-
-									for(i = 0; i < 4; i++){
-										resend_data = resend_data << 8;
-										resend_data |= file_data[x][(y * 8) + i];
-										//printf("rail info first byte sent %u\n", file_data[x][(y * 8) + i]);
+						struct RailTimings timing;
+						struct TrackTable *track;
+						struct RailCtl *ctl;
+						struct RailStats stats;
+						struct FLContext *boards[RAIL_MAX_BOARDS] = {NULL,};
+						struct RailFlPort boardPorts[RAIL_MAX_BOARDS];
+						struct RailPort *ports[RAIL_MAX_BOARDS];
+						struct RailMultiPort multi = {{NULL,},};
+						struct RailPort *port = &boardPorts[0].port;
+						const uint32 numBoards = 1 + (uint32)boardOpt->count;
+						uint32 b;
+						char statsPath[256];
+						unsigned long statsSecs = 60;
+						struct EvLog events = {NULL,};
+						char evPath[256];
+						unsigned long evRecords = EVLOG_DEFAULT_RECORDS;
+						struct RailSnap snap = {NULL,};
+						char snapPath[256];
+						unsigned long snapSecs = RAILSNAP_DEFAULT_SECS;
+						struct RailView view = {0,};
+						struct RailQuery query = {NULL,};
+						railTimingsInit(&timing);
+						if ( railCfgOpt->count && !railParseTimings(railCfgOpt->sval[0], &timing) ) {
+							fprintf(stderr, "%s: invalid argument to option --railcfg (names: ackPoll, ackWait, s3Settle, s3Poll, s3Wait, noAck, rest, restMax)\n", progName);
+							FAIL(FLP_ARGS, cleanup);
+						}
+						if ( railStatsOpt->count && !parseFileSpec(railStatsOpt->sval[0], statsPath, sizeof(statsPath), &statsSecs) ) {
+							fprintf(stderr, "%s: invalid argument to option --railstats=<file[:secs]>\n", progName);
+							FAIL(FLP_ARGS, cleanup);
+						}
+						if ( railEvOpt->count && (!parseFileSpec(railEvOpt->sval[0], evPath, sizeof(evPath), &evRecords) || !evRecords) ) {
+							fprintf(stderr, "%s: invalid argument to option --railevlog=<file[:records]>\n", progName);
+							FAIL(FLP_ARGS, cleanup);
+						}
+						if ( railSnapOpt->count && !parseFileSpec(railSnapOpt->sval[0], snapPath, sizeof(snapPath), &snapSecs) ) {
+							fprintf(stderr, "%s: invalid argument to option --railsnap=<file[:secs]>\n", progName);
+							FAIL(FLP_ARGS, cleanup);
+						}
+						if ( warmOpt->count && !railSnapOpt->count ) {
+							fprintf(stderr, "%s: --warm needs --railsnap\n", progName);
+							FAIL(FLP_ARGS, cleanup);
+						}
+
+						// Signals are numbered across the boards in the order given
+						pStatus = FLP_SUCCESS;
+						boards[0] = handle;
+						for ( b = 1; b < numBoards && !pStatus; b++ ) {
+							pStatus = openBoard(boardOpt->sval[b - 1], conduit, boards + b, &error);
+						}
+						if ( !pStatus ) {
+							for ( b = 0; b < numBoards; b++ ) {
+								railFlPortInit(boardPorts + b, boards[b]);
+								ports[b] = &boardPorts[b].port;
+							}
+							if ( numBoards > 1 ) {
+								pStatus = railMultiPortInit(&multi, ports, numBoards, &error);
+								port = &multi.port;
+							}
+						}
+						track = pStatus ? NULL : (struct TrackTable *)malloc(sizeof(struct TrackTable));
+						if ( track ) {
+							const char *const trackPath = trackOpt->count ? trackOpt->sval[0] : TRACK_FILE;
+							bool trackFound;
+							uint32 replayed;
+							pStatus = trackOpen(track, trackPath, &trackFound, &replayed, &error);
+							if ( !pStatus && !trackFound ) {
+								printf("no track file at %s; starting with an empty table\n", trackPath);
+							}
+							if ( !pStatus && replayed ) {
+								printf("replayed %u track updates from %s\n", replayed, track->journalPath);
+							}
+							if ( !pStatus ) {
+								ctl = (struct RailCtl *)malloc(sizeof(struct RailCtl));
+								if ( ctl ) {
+									pStatus = railCtlInit(ctl, port, port->numSignals, track, &timing, &error);
+									if ( !pStatus && railQuietOpt->count ) {
+										ctl->log = NULL;
 									}
-									fStatus = send_to_fpga(handle, chan, resend_data, &error);
-									printf("written the first 4 bytes of rail info\n");
-
-									for(int j = 0; j < 256; j++){
-										fStatus = receive_from_fpga(handle, chan, &decrypted_data, &error);
-										if(decrypted_data == ACK1){
-											//printf("ACK1 received %u\n", decrypted_data);
-
-											for(i = 4; i < 8; i++){
-												resend_data = resend_data << 8;
-												resend_data |= file_data[x][(y * 8) + i];
-												//printf("rail info next byte sent %u\n", file_data[x][(y * 8) + i]);
-											}
-											fStatus = send_to_fpga(handle, chan, resend_data, &error);
-											printf("written the last 4 bytes of rail info\n");
-
-											for(int j = 0; j < 256; j++){
-												fStatus = receive_from_fpga(handle, chan, &decrypted_data, &error);
-												if(decrypted_data == ACK1){
-													//printf("ACK1 received %u\n", decrypted_data);
-
-													fStatus = send_to_fpga(handle, chan, ACK2, &error);
-													//printf("ACK2 sent\n");
-													printf("S2 state successfully completed\n");
-													sleep(24);
-
-													for(int t = 0; t < 20; t++){
-														fStatus = receive_from_fpga(handle, chan, &decrypted_data, &error);
-														if(decrypted_data == resend_coorddata){
-															fStatus = send_to_fpga(handle, chan, resend_coorddata, &error);
-															printf("co-ord data re-sent\n");
-
-															fStatus = receive_from_fpga(handle, chan, &decrypted_data, &error);
-															norm = 1;
-															break;
-														}
-														decrypted_data = encrypt(decrypted_data, key);
-														printf("received data at S3 is %u at time %d\n", decrypted_data, t);
-														if(decrypted_data != 0x00000000){
-															decrypted_data = decrypt(decrypted_data, key);
-															resend_data = decrypted_data >> 3;
-															i = resend_data % 8;
-															file_data[x][(8 * y) + i] = decrypted_data;
-															update_file(file_data);
-															break;
-														}else{
-															sleep(1);
-															printf("-\n");
-														}
-													}
-													//sleep(20);
-													if(norm == 0) chan--;
-													break;
-												}
-												sleep(1);
-											}
-											break;
+									if ( !pStatus && railEvOpt->count ) {
+										pStatus = evLogCreate(&events, evPath, (uint32)evRecords, clkNow(port->clock), &error);
+										ctl->events = events.hdr ? &events : NULL;
+									}
+									if ( !pStatus && railStatsOpt->count ) {
+										pStatus = railStatsInit(&stats, ctl->numChannels, statsPath, stdout, (uint64)statsSecs * 1000000, &error);
+										if ( !pStatus ) {
+											ctl->stats = &stats;
+										}
+									}
+									if ( !pStatus && warmOpt->count ) {
+										bool found;
+										uint32 revalidated;
+										pStatus = railSnapLoad(ctl, snapPath, &found, &revalidated, &error);
+										if ( !pStatus && found ) {
+											printf("Resuming from %s; %u of %u channels start over\n", snapPath, revalidated, ctl->numChannels);
+										} else if ( !pStatus ) {
+											printf("No snapshot at %s; starting cold\n", snapPath);
 										}
-										sleep(1);
 									}
-									if(norm == 0) step = 2;
-									else norm = 0;
-								}else if(step == 0){
-									printf("Didn't receive ACK on channel %d, decrypted_data = %u\n", 2 * chan, decrypted_data);
-									sleep(5);
-									step++;
-								}else if(step == 1){
-									step++;
-									if(chan == 63) chan = -1;
+									if ( !pStatus && railSnapOpt->count ) {
+										pStatus = railSnapInit(&snap, snapPath, (uint64)snapSecs * 1000000, &error);
+										ctl->snap = snap.path ? &snap : NULL;
+									}
+									if ( !pStatus && railQueryOpt->count ) {
+										pStatus = rvInit(&view, ctl, &error);
+										if ( !pStatus ) {
+											ctl->view = &view;
+											pStatus = rqStart(&query, &view, railQueryOpt->sval[0], &error);
+										}
+									}
+									if ( !pStatus ) {
+										pStatus = railCtlRun(ctl, &error);
+									}
+									rqStop(&query);
+									if ( ctl->view ) {
+										rvDestroy(&view);
+									}
+									if ( ctl->stats ) {
+										railStatsDestroy(&stats);
+									}
+									railSnapDestroy(&snap);
+									evLogClose(&events);
+									railCtlDestroy(ctl);
+									free(ctl);
+								} else {
+									pStatus = FLP_NO_MEMORY;
 								}
-							}while(step != 2);
-
-							process_counter++;
-							printf("no of processes completed %d\n", process_counter);
-							printf("waiting for next process to start\n");
-							for(i = 0; i < 10; i++){
-								sleep(2);
-								printf(".\n");
 							}
-							printf("waited for 20 seconds\n\n\n");
+							pStatus = trackClose(track, pStatus, &error);
+							free(track);
+						} else if ( !pStatus ) {
+							pStatus = FLP_NO_MEMORY;
+						}
+						railMultiPortDestroy(&multi);
+						for ( b = 1; b < numBoards; b++ ) {
+							flClose(boards[b]);
 						}
+						CHECK_STATUS(pStatus, pStatus, cleanup);
+						break;
 					}
 					// default:{
 					// 	FAIL(FLP_ILL_CHAR, cleanup);
@@ -1257,6 +1218,9 @@ int main(int argc, char *argv[]) {
 
 cleanup:
 	free((void*)line);
+	if ( shmOut ) {
+		shmRingDestroy(shmOut);
+	}
 	flClose(handle);
 	if ( error ) {
 		fprintf(stderr, "%s\n", error);
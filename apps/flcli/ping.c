@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <makestuff.h>
+#include <libfpgalink.h>
+#include <liberror.h>
+#include "ping.h"
+#include "clock.h"
+
+static void pingEncode(uint8 *msg, uint32 seq, uint32 stamp) {
+	msg[0] = (uint8)(seq >> 24);
+	msg[1] = (uint8)(seq >> 16);
+	msg[2] = (uint8)(seq >> 8);
+	msg[3] = (uint8)seq;
+	msg[4] = (uint8)(stamp >> 24);
+	msg[5] = (uint8)(stamp >> 16);
+	msg[6] = (uint8)(stamp >> 8);
+	msg[7] = (uint8)stamp;
+}
+
+static ReturnCode pingSync(
+	struct FLContext *handle, uint8 wChan, uint8 rChan, uint32 count, struct Hist *hist,
+	const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FLStatus fStatus;
+	uint8 sent[PING_MSG_LEN], echo[PING_MSG_LEN];
+	uint32 seq, stamp;
+	for ( seq = 0; (!count || seq < count) && !sigIsRaised(); seq++ ) {
+		stamp = (uint32)clkMicros();
+		pingEncode(sent, seq, stamp);
+		fStatus = flWriteChannel(handle, wChan, PING_MSG_LEN, sent, error);
+		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "pingSync()");
+		fStatus = flReadChannel(handle, rChan, PING_MSG_LEN, echo, error);
+		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "pingSync()");
+		stamp = (uint32)clkMicros() - stamp;
+		CHECK_STATUS(
+			memcmp(sent, echo, PING_MSG_LEN), FLP_PROTOCOL, cleanup,
+			"pingSync(): echo of ping %u on channel %d does not match", seq, rChan);
+		histAdd(hist, stamp);
+	}
+cleanup:
+	return retVal;
+}
+
+static ReturnCode pingPipelined(
+	struct FLContext *handle, uint8 wChan, uint8 rChan, uint32 count, uint32 depth,
+	struct Hist *hist, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FLStatus fStatus;
+	uint8 sent[PING_MAX_DEPTH][PING_MSG_LEN];
+	const uint8 *echo;
+	uint32 actualLength, stamp;
+	uint32 nextSend = 0, nextRecv = 0;
+	for ( ;; ) {
+		// Top up the pipeline, unless we're stopping
+		while (
+			nextSend - nextRecv < depth && (!count || nextSend < count) && !sigIsRaised() )
+		{
+			uint8 *const msg = sent[nextSend % depth];
+			pingEncode(msg, nextSend, (uint32)clkMicros());
+			fStatus = flWriteChannelAsync(handle, wChan, PING_MSG_LEN, msg, error);
+			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "pingPipelined()");
+			fStatus = flFlushAsyncWrites(handle, error);
+			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "pingPipelined()");
+			fStatus = flReadChannelAsyncSubmit(handle, rChan, PING_MSG_LEN, NULL, error);
+			CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "pingPipelined()");
+			nextSend++;
+		}
+		if ( nextRecv == nextSend ) {
+			break;
+		}
+
+		// Reap the oldest echo; reads complete in submission order
+		fStatus = flReadChannelAsyncAwait(handle, &echo, &actualLength, &actualLength, error);
+		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "pingPipelined()");
+		stamp = (uint32)clkMicros();
+		nextRecv++;
+		CHECK_STATUS(
+			actualLength != PING_MSG_LEN || memcmp(sent[(nextRecv - 1) % depth], echo, PING_MSG_LEN),
+			FLP_PROTOCOL, cleanup,
+			"pingPipelined(): echo of ping %u on channel %d does not match", nextRecv - 1, rChan);
+		stamp -= ((uint32)echo[4] << 24) | ((uint32)echo[5] << 16) | ((uint32)echo[6] << 8) | echo[7];
+		histAdd(hist, stamp);
+	}
+	return FLP_SUCCESS;
+cleanup:
+	// Drain anything still in flight so the device is left in a sane state
+	while ( nextRecv < nextSend ) {
+		if ( flReadChannelAsyncAwait(handle, &echo, &actualLength, &actualLength, NULL) ) {
+			break;
+		}
+		nextRecv++;
+	}
+	return retVal;
+}
+
+ReturnCode pingRun(
+	struct FLContext *handle, uint8 wChan, uint8 rChan, uint32 count, uint32 depth,
+	struct Hist *hist, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	CHECK_STATUS(
+		depth > PING_MAX_DEPTH, FLP_ARGS, cleanup,
+		"pingRun(): pipeline depth %u exceeds the maximum of %d", depth, PING_MAX_DEPTH);
+	if ( depth <= 1 ) {
+		retVal = pingSync(handle, wChan, rChan, count, hist, error);
+	} else {
+		retVal = pingPipelined(handle, wChan, rChan, count, depth, hist, error);
+	}
+cleanup:
+	return retVal;
+}
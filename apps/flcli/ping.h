@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PING_H
+#define PING_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "hist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	struct FLContext;
+
+	// Each ping is an 8-byte message: a big-endian sequence number followed by the low 32 bits of
+	// the send time in microseconds. The FPGA is expected to echo it verbatim from rChan.
+	#define PING_MSG_LEN 8
+	#define PING_MAX_DEPTH 64
+
+	// Send count pings on wChan and await their echoes on rChan, recording round-trip latencies
+	// in hist. With depth <= 1 each ping is written and read back synchronously; otherwise up to
+	// depth pings are kept in flight using the async API. A count of zero means run until SIGINT.
+	ReturnCode pingRun(
+		struct FLContext *handle, uint8 wChan, uint8 rChan, uint32 count, uint32 depth,
+		struct Hist *hist, const char **error
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
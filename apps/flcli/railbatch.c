@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <makestuff.h>
+#include "railcrypt.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define RAIL_X86_KERNELS
+	#include <immintrin.h>
+#endif
+
+typedef void (*BatchFunc)(uint32 mask, const uint32 *in, uint32 *out, size_t n);
+typedef void (*LanesFunc)(const uint32 *masks, const uint32 *in, uint32 *out, size_t n);
+
+struct Kernel {
+	const char *name;
+	BatchFunc batch;
+	LanesFunc lanes;
+	bool (*supported)(void);
+};
+
+static void batchScalar(uint32 mask, const uint32 *in, uint32 *out, size_t n) {
+	size_t i;
+	for ( i = 0; i < n; i++ ) {
+		out[i] = in[i] ^ mask;
+	}
+}
+
+static void lanesScalar(const uint32 *masks, const uint32 *in, uint32 *out, size_t n) {
+	size_t i;
+	for ( i = 0; i < n; i++ ) {
+		out[i] = in[i] ^ masks[i];
+	}
+}
+
+static bool alwaysSupported(void) {
+	return true;
+}
+
+#ifdef RAIL_X86_KERNELS
+
+// Each kernel does whole vectors and leaves the tail to the scalar loop.
+
+__attribute__((target("sse2")))
+static void batchSse2(uint32 mask, const uint32 *in, uint32 *out, size_t n) {
+	const __m128i m = _mm_set1_epi32((int)mask);
+	size_t i;
+	for ( i = 0; i + 4 <= n; i += 4 ) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(v, m));
+	}
+	batchScalar(mask, in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void lanesSse2(const uint32 *masks, const uint32 *in, uint32 *out, size_t n) {
+	size_t i;
+	for ( i = 0; i + 4 <= n; i += 4 ) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		const __m128i m = _mm_loadu_si128((const __m128i *)(masks + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(v, m));
+	}
+	lanesScalar(masks + i, in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void batchAvx2(uint32 mask, const uint32 *in, uint32 *out, size_t n) {
+	const __m256i m = _mm256_set1_epi32((int)mask);
+	size_t i;
+	for ( i = 0; i + 8 <= n; i += 8 ) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(v, m));
+	}
+	batchScalar(mask, in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void lanesAvx2(const uint32 *masks, const uint32 *in, uint32 *out, size_t n) {
+	size_t i;
+	for ( i = 0; i + 8 <= n; i += 8 ) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		const __m256i m = _mm256_loadu_si256((const __m256i *)(masks + i));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(v, m));
+	}
+	lanesScalar(masks + i, in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void batchAvx512(uint32 mask, const uint32 *in, uint32 *out, size_t n) {
+	const __m512i m = _mm512_set1_epi32((int)mask);
+	size_t i;
+	for ( i = 0; i + 16 <= n; i += 16 ) {
+		const __m512i v = _mm512_loadu_si512((const void *)(in + i));
+		_mm512_storeu_si512((void *)(out + i), _mm512_xor_si512(v, m));
+	}
+	batchScalar(mask, in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void lanesAvx512(const uint32 *masks, const uint32 *in, uint32 *out, size_t n) {
+	size_t i;
+	for ( i = 0; i + 16 <= n; i += 16 ) {
+		const __m512i v = _mm512_loadu_si512((const void *)(in + i));
+		const __m512i m = _mm512_loadu_si512((const void *)(masks + i));
+		_mm512_storeu_si512((void *)(out + i), _mm512_xor_si512(v, m));
+	}
+	lanesScalar(masks + i, in + i, out + i, n - i);
+}
+
+static bool hasSse2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool hasAvx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool hasAvx512(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+// Widest first
+static const struct Kernel kernels[] = {
+	#ifdef RAIL_X86_KERNELS
+		{"avx512", batchAvx512, lanesAvx512, hasAvx512},
+		{"avx2", batchAvx2, lanesAvx2, hasAvx2},
+		{"sse2", batchSse2, lanesSse2, hasSse2},
+	#endif
+	{"scalar", batchScalar, lanesScalar, alwaysSupported}
+};
+
+static const struct Kernel *current = NULL;
+
+static const struct Kernel *kernel(void) {
+	if ( !current ) {
+		size_t i;
+		for ( i = 0; !kernels[i].supported(); i++ );
+		current = kernels + i;
+	}
+	return current;
+}
+
+void railCryptBatch(const struct RailKey *key, const uint32 *in, uint32 *out, size_t n) {
+	kernel()->batch(key->encMask, in, out, n);
+}
+
+void railCryptBatchLanes(const uint32 *masks, const uint32 *in, uint32 *out, size_t n) {
+	kernel()->lanes(masks, in, out, n);
+}
+
+const char *railCryptKernel(void) {
+	return kernel()->name;
+}
+
+bool railCryptUseKernel(const char *name) {
+	size_t i;
+	for ( i = 0; i < sizeof(kernels) / sizeof(*kernels); i++ ) {
+		if ( !strcmp(kernels[i].name, name) ) {
+			if ( !kernels[i].supported() ) {
+				return false;
+			}
+			current = kernels + i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <makestuff.h>
+#include "railcrypt.h"
+
+#ifdef __GNUC__
+static uint32 count1(uint32 a) {
+	return (uint32)__builtin_popcount(a);
+}
+#else
+#error Unimplemented popcount
+#endif
+
+static uint32 neg(uint32 a) {
+	return 0xFFFFFFFFU - a;
+}
+
+// Replicate the low nibble of a into all eight nibbles of a word.
+static uint32 concat(uint8 a) {
+	uint32 b = a;
+	int i;
+	for ( i = 0; i < 8; i++ ) {
+		b = b << 4;
+		b |= a;
+	}
+	return b;
+}
+
+static uint32 bitXor(uint32 x, uint32 y) {
+	const uint32 a = x & y;
+	const uint32 b = neg(x) & neg(y);
+	return neg(a) & neg(b);
+}
+
+static uint8 findki(uint32 a, int n) {
+	uint8 b = 0x00;
+	int i;
+	for ( i = 0; i < n + 1; i++ ) {
+		b = a % 2U;
+		a = a / 2U;
+	}
+	return b;
+}
+
+static uint8 findti(uint32 key, int n) {
+	uint8 t = findki(key, n % 4), k;
+	int i;
+	for ( i = n + 4; i < 32; i = i + 4 ) {
+		k = findki(key, i);
+		t = (uint8)bitXor(t, k);
+	}
+	return t;
+}
+
+static uint8 findt(uint32 key) {
+	uint32 t = 0;
+	int i;
+	for ( i = 0; i < 4; i++ ) {
+		t += (uint32)findti(key, i) << i;
+	}
+	return (uint8)t;
+}
+
+uint32 railEncryptRef(uint32 inp, uint32 key) {
+	uint8 t = findt(key);
+	const uint32 n = count1(key);
+	uint32 cipher = inp, i;
+	for ( i = 0; i < n; i++ ) {
+		cipher = bitXor(cipher, concat(t));
+		t = (t + 1) % 16U;
+	}
+	return cipher;
+}
+
+uint32 railDecryptRef(uint32 inp, uint32 key) {
+	uint8 t = findt(key);
+	const uint32 n = count1(key);
+	uint32 cipher = inp, i;
+	t = (t + 15) % 16U;
+	for ( i = 0; i < 32 - n; i++ ) {
+		cipher = bitXor(cipher, concat(t));
+		t = (t + 15) % 16U;
+	}
+	return cipher;
+}
+
+// Bit i of the starting nibble t is the parity of key bits i, i + 4, ..., i + 28, which is the
+// XOR of the key's eight nibbles. Encryption XORs concat(t), concat(t + 1), ... for
+// n = popcount(key) steps; decryption steps back from t - 1 for 32 - n. Over all 32 steps of
+// two whole turns the nibbles cancel, so both come to the same mask.
+void railKeyInit(struct RailKey *self, uint32 key) {
+	uint32 t = key, i, n, enc = 0, dec = 0;
+	t ^= t >> 16;
+	t ^= t >> 8;
+	t ^= t >> 4;
+	t &= 0x0F;
+	n = count1(key);
+	for ( i = 0; i < n; i++ ) {
+		enc ^= 0x11111111U * ((t + i) % 16U);
+	}
+	for ( i = 0; i < 32 - n; i++ ) {
+		dec ^= 0x11111111U * ((t + 31 - i) % 16U);
+	}
+	self->key = key;
+	self->encMask = enc;
+	self->decMask = dec;
+}
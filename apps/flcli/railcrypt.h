@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILCRYPT_H
+#define RAILCRYPT_H
+
+#include <stddef.h>
+#include <makestuff.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Key shared with the rail signal firmware.
+	#define RAIL_KEY 0x9999999FU
+
+	// The cipher XORs each word with a sequence of nibble-replicated values derived from the
+	// key, so for a given key it amounts to a single XOR with a fixed mask. A key schedule
+	// works the masks out once; after that each word costs one XOR.
+	struct RailKey {
+		uint32 key;
+		uint32 encMask;
+		uint32 decMask;
+	};
+
+	void railKeyInit(struct RailKey *self, uint32 key);
+
+	static inline uint32 railKeyEncrypt(const struct RailKey *self, uint32 inp) {
+		return inp ^ self->encMask;
+	}
+
+	static inline uint32 railKeyDecrypt(const struct RailKey *self, uint32 inp) {
+		return inp ^ self->decMask;
+	}
+
+	// Apply a key to n words, in[i] -> out[i]; in and out may be the same array. Since the masks
+	// of every key are equal, the same call encrypts and decrypts. Uses the widest of the AVX-512,
+	// AVX2 and SSE2 kernels the CPU supports, or plain C.
+	void railCryptBatch(const struct RailKey *key, const uint32 *in, uint32 *out, size_t n);
+
+	// As railCryptBatch(), but with a separate mask for each word, e.g. when channels have
+	// different keys.
+	void railCryptBatchLanes(const uint32 *masks, const uint32 *in, uint32 *out, size_t n);
+
+	// The kernel the batch calls use ("avx512", "avx2", "sse2" or "scalar"), and a way to force
+	// a particular one for benchmarking. railCryptUseKernel() returns false if the CPU lacks it.
+	const char *railCryptKernel(void);
+	bool railCryptUseKernel(const char *name);
+
+	// The original word-at-a-time implementation, kept as the reference the key schedule is
+	// tested against.
+	uint32 railEncryptRef(uint32 inp, uint32 key);
+	uint32 railDecryptRef(uint32 inp, uint32 key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
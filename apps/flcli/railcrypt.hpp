@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILCRYPT_HPP
+#define RAILCRYPT_HPP
+
+#include "railcrypt.h"
+
+// Compile-time key schedule for C++11 callers. A key that is known when compiling gives masks
+// that are constants, so the cipher compiles to one XOR with an immediate. Keys only known at
+// run time still go through railKeyInit(). The functions are recursive so that they are valid
+// C++11 constexpr; they mirror railKeyInit() step for step.
+namespace rail {
+
+	namespace detail {
+		constexpr uint32 rep(uint32 nibble) {
+			return 0x11111111U * (nibble & 0x0F);
+		}
+
+		// XOR of the eight nibbles of the key: the cipher's starting nibble
+		constexpr uint32 fold(uint32 key, uint32 shift) {
+			return shift >= 4 ? fold(key ^ (key >> shift), shift / 2) : key & 0x0F;
+		}
+
+		constexpr uint32 popcount(uint32 key) {
+			return key ? (key & 1U) + popcount(key >> 1) : 0;
+		}
+
+		// XOR of rep(t), rep(t + 1), ... over n steps
+		constexpr uint32 stepUp(uint32 t, uint32 n) {
+			return n ? rep(t) ^ stepUp(t + 1, n - 1) : 0;
+		}
+
+		// XOR of rep(t - 1), rep(t - 2), ... over n steps
+		constexpr uint32 stepDown(uint32 t, uint32 n) {
+			return n ? rep(t + 15) ^ stepDown(t + 15, n - 1) : 0;
+		}
+	}
+
+	constexpr uint32 encMask(uint32 key) {
+		return detail::stepUp(detail::fold(key, 16), detail::popcount(key));
+	}
+
+	constexpr uint32 decMask(uint32 key) {
+		return detail::stepDown(detail::fold(key, 16), 32 - detail::popcount(key));
+	}
+
+	// The same schedule as railKeyInit(), usable wherever the C API takes a RailKey
+	constexpr RailKey keyOf(uint32 key) {
+		return RailKey{key, encMask(key), decMask(key)};
+	}
+
+	// A key fixed at compile time
+	template<uint32 Key>
+	struct StaticKey {
+		static constexpr uint32 key = Key;
+		static constexpr uint32 encMask = rail::encMask(Key);
+		static constexpr uint32 decMask = rail::decMask(Key);
+
+		static constexpr uint32 encrypt(uint32 inp) {
+			return inp ^ encMask;
+		}
+
+		static constexpr uint32 decrypt(uint32 inp) {
+			return inp ^ decMask;
+		}
+	};
+
+	// C++11 still wants a definition for a static member that is bound to a reference
+	template<uint32 Key> constexpr uint32 StaticKey<Key>::key;
+	template<uint32 Key> constexpr uint32 StaticKey<Key>::encMask;
+	template<uint32 Key> constexpr uint32 StaticKey<Key>::decMask;
+
+	typedef StaticKey<RAIL_KEY> DeployedKey;
+}
+
+#endif
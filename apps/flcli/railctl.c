@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railctl.h"
+#include "railio.h"
+#include "railcrypt.h"
+#include "railstats.h"
+#include "railevlog.h"
+#include "railsnap.h"
+#include "railview.h"
+#include "clock.h"
+
+#define RAIL_MAX_SLEEP_US 100000  // keep SIGINT responsive while idle
+
+void railTimingsInit(struct RailTimings *timing) {
+	timing->ackPoll = 1000000;
+	timing->ackWait = 256000000;
+	timing->s3Settle = 24000000;
+	timing->s3Poll = 1000000;
+	timing->s3Wait = 20000000;
+	timing->noAck = 5000000;
+	timing->rest = 20000000;
+	timing->restMax = 0;
+}
+
+static bool nameMatch(const char *name, const char *p, size_t len) {
+	size_t i;
+	for ( i = 0; i < len; i++ ) {
+		if ( !name[i] || tolower((unsigned char)name[i]) != tolower((unsigned char)p[i]) ) {
+			return false;
+		}
+	}
+	return name[len] == '\0';
+}
+
+bool railParseFields(
+	const char *spec, const struct RailField *fields, size_t numFields, void *base)
+{
+	const char *p = spec;
+	char *end;
+	size_t i, len;
+	unsigned long long value;
+	for ( ;; ) {
+		for ( len = 0; p[len] && p[len] != '='; len++ );
+		if ( p[len] != '=' ) {
+			return false;
+		}
+		for ( i = 0; i < numFields; i++ ) {
+			if ( nameMatch(fields[i].name, p, len) ) {
+				break;
+			}
+		}
+		if ( i == numFields ) {
+			return false;
+		}
+		value = strtoull(p + len + 1, &end, fields[i].type == RAIL_FIELD_MS ? 10 : 0);
+		if ( end == p + len + 1 || (*end != ',' && *end != '\0') ) {
+			return false;
+		}
+		switch ( fields[i].type ) {
+		case RAIL_FIELD_U32:
+			if ( value > 0xFFFFFFFFULL ) {
+				return false;
+			}
+			*(uint32 *)((char *)base + fields[i].offset) = (uint32)value;
+			break;
+		case RAIL_FIELD_U64:
+			*(uint64 *)((char *)base + fields[i].offset) = value;
+			break;
+		case RAIL_FIELD_MS:
+			if ( value > ~0ULL / 1000 ) {
+				return false;
+			}
+			*(uint64 *)((char *)base + fields[i].offset) = value * 1000;
+			break;
+		}
+		if ( *end == '\0' ) {
+			return true;
+		}
+		p = end + 1;
+	}
+}
+
+bool railParseTimings(const char *spec, struct RailTimings *timing) {
+	static const struct RailField fields[] = {
+		{"ackPoll", offsetof(struct RailTimings, ackPoll), RAIL_FIELD_MS},
+		{"ackWait", offsetof(struct RailTimings, ackWait), RAIL_FIELD_MS},
+		{"s3Settle", offsetof(struct RailTimings, s3Settle), RAIL_FIELD_MS},
+		{"s3Poll", offsetof(struct RailTimings, s3Poll), RAIL_FIELD_MS},
+		{"s3Wait", offsetof(struct RailTimings, s3Wait), RAIL_FIELD_MS},
+		{"noAck", offsetof(struct RailTimings, noAck), RAIL_FIELD_MS},
+		{"rest", offsetof(struct RailTimings, rest), RAIL_FIELD_MS},
+		{"restMax", offsetof(struct RailTimings, restMax), RAIL_FIELD_MS}
+	};
+	return railParseFields(spec, fields, sizeof(fields) / sizeof(*fields), timing);
+}
+
+const char *railStateName(enum RailState state) {
+	static const char *const names[RAIL_NUM_STATES] = {
+		"idle", "coord", "hello", "info1", "info2", "s3", "s3-final"
+	};
+	return (uint32)state < RAIL_NUM_STATES ? names[state] : "?";
+}
+
+// Progress messages name a signal by its index, not by the FPGALink channels it talks on (see
+// RAIL_READ_CHAN()), which only say which signal it is together with the board.
+static void say(const struct RailCtl *self, const char *fmt, ...) {
+	if ( self->log ) {
+		va_list args;
+		va_start(args, fmt);
+		vfprintf(self->log, fmt, args);
+		va_end(args);
+	}
+}
+
+static void note(
+	struct RailCtl *self, uint32 c, EvType type, uint64 now, uint32 word0, uint32 word1)
+{
+	if ( self->events ) {
+		const struct RailChannel *const ch = self->chan + c;
+		evLogAppend(self->events, now, c, type, (uint8)ch->state, ch->x, ch->y, word0, word1);
+	}
+}
+
+// A channel only ever waits for one word, so it is never in the queue twice.
+static void makeReady(struct RailCtl *self, uint32 c) {
+	self->ready[(self->readyHead + self->numReady++) % self->numChannels] = c;
+}
+
+static void onTimer(struct TwTimer *timer, void *context) {
+	struct RailCtl *const self = (struct RailCtl *)context;
+	makeReady(self, (uint32)((struct RailChannel *)timer - self->chan));
+}
+
+ReturnCode railCtlInit(
+	struct RailCtl *self, struct RailPort *port, uint32 numChannels,
+	struct TrackTable *track, const struct RailTimings *timing, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 c;
+	memset(self, 0, sizeof(*self));
+	self->port = port;
+	self->log = stdout;
+	railKeyInit(&self->key, RAIL_KEY);
+	self->numChannels = numChannels > port->numSignals ? port->numSignals : numChannels;
+	CHECK_STATUS(!self->numChannels, FLP_ARGS, cleanup, "railCtlInit(): no channels");
+	self->chan = (struct RailChannel *)calloc(self->numChannels, sizeof(struct RailChannel));
+	self->ready = (uint32 *)malloc(self->numChannels * sizeof(uint32));
+	self->batch = (uint32 *)malloc(self->numChannels * sizeof(uint32));
+	self->raw = (uint32 *)malloc(self->numChannels * sizeof(uint32));
+	self->words = (uint32 *)malloc(self->numChannels * sizeof(uint32));
+	self->conflictChan = (uint32 *)malloc(self->numChannels * sizeof(uint32));
+	CHECK_STATUS(
+		!self->chan || !self->ready || !self->batch || !self->raw || !self->words ||
+		!self->conflictChan, FLP_NO_MEMORY, cleanup,
+		"railCtlInit(): cannot allocate %u channels", self->numChannels);
+	if ( timing ) {
+		self->timing = *timing;
+	} else {
+		railTimingsInit(&self->timing);
+	}
+	twInit(&self->wheel, clkNow(port->clock), RAIL_TICK_US);
+	self->track = track;
+	retVal = routeInit(&self->routes, &track->grid, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	track->routes = &self->routes;
+	retVal = tcInit(&self->conflicts, &self->routes, self->numChannels, RAIL_ROUTE_LEN, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	track->conflicts = &self->conflicts;
+	for ( c = 0; c < self->numChannels; c++ ) {
+		twTimerInit(&self->chan[c].timer);
+		self->chan[c].state = RAIL_COORD;
+		self->chan[c].enteredAt = self->wheel.origin;
+		self->chan[c].rest = self->timing.rest;
+		self->chan[c].route = ROUTE_NONE;
+		self->chan[c].conflict = ROUTE_NONE;
+		makeReady(self, c);
+	}
+	return FLP_SUCCESS;
+cleanup:
+	railCtlDestroy(self);
+	return retVal;
+}
+
+void railCtlDestroy(struct RailCtl *self) {
+	if ( self->track && self->track->conflicts == &self->conflicts ) {
+		self->track->conflicts = NULL;
+	}
+	if ( self->track && self->track->routes == &self->routes ) {
+		self->track->routes = NULL;
+	}
+	tcDestroy(&self->conflicts);
+	routeDestroy(&self->routes);
+	free(self->conflictChan);
+	free(self->words);
+	free(self->raw);
+	free(self->batch);
+	free(self->ready);
+	free(self->chan);
+	self->conflictChan = NULL;
+	self->words = NULL;
+	self->raw = NULL;
+	self->batch = NULL;
+	self->ready = NULL;
+	self->chan = NULL;
+}
+
+void railCtlRequeue(struct RailCtl *self) {
+	uint32 c;
+	self->readyHead = 0;
+	self->numReady = 0;
+	for ( c = 0; c < self->numChannels; c++ ) {
+		if ( !twPending(&self->chan[c].timer) ) {
+			makeReady(self, c);
+		}
+	}
+}
+
+static ReturnCode sendWords(
+	struct RailCtl *self, uint32 c, const uint32 *words, uint32 count, const char **error)
+{
+	uint32 enc[2], i;
+	for ( i = 0; i < count; i++ ) {
+		enc[i] = railKeyEncrypt(&self->key, words[i]);
+	}
+	return railPortWrite(self->port, c, enc, count, error);
+}
+
+// Four bytes of rail info for the signal at (x, y), starting at direction first.
+static uint32 railInfo(const struct RailCtl *self, const struct RailChannel *ch, uint32 first) {
+	const struct TrackGrid *const grid = &self->track->grid;
+	const uint32 base = tgIndex(grid, ch->x, ch->y, first);
+	return
+		((uint32)tgCell(grid, base) << 24) | ((uint32)tgCell(grid, base + 1) << 16) |
+		((uint32)tgCell(grid, base + 2) << 8) | tgCell(grid, base + 3);
+}
+
+// Report each signal whose route changed status in the last change to the conflict set, which
+// channel c brought about. One resting is started over now, so its next process sends it the
+// rail info as it stands.
+static void routesChanged(struct RailCtl *self, uint32 c, uint64 now) {
+	static const char *const status[] = { "clear", "blocked", "in conflict" };
+	uint32 i;
+	for ( i = 0; i < self->conflicts.numChanged; i++ ) {
+		const uint32 s = self->conflicts.changed[i];
+		const uint32 c2 = self->conflictChan[s];
+		struct RailChannel *const ch = self->chan + c2;
+		const TcStatus st = tcStatus(&self->conflicts, s);
+		say(self, "signal %u: route now %s, after signal %u\n", c2, status[st], c);
+		note(self, c2, EV_CONFLICT, now, st, c);
+		if ( c2 != c && ch->state == RAIL_IDLE && twPending(&ch->timer) ) {
+			ch->rest = self->timing.rest;
+			twSchedule(&self->wheel, &ch->timer, now);
+		}
+	}
+}
+
+// Look up the route of the signal on channel c: of the directions out of its coordinates, the
+// one whose route runs furthest. That is a handful of reads from the route index. Then enter it
+// in the conflict set, from its coordinates if it has none.
+static ReturnCode findRoute(struct RailCtl *self, uint32 c, uint64 now, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailChannel *const ch = self->chan + c;
+	const uint32 base = tgIndex(&self->track->grid, ch->x, ch->y, 0);
+	uint32 dir, reach, start;
+	ch->route = ROUTE_NONE;
+	ch->reach = 0;
+	for ( dir = 0; dir < TG_DIRS; dir++ ) {
+		reach = routeReach(&self->routes, base + dir);
+		if ( reach > ch->reach ) {
+			ch->route = base + dir;
+			ch->reach = reach;
+		}
+	}
+	if ( ch->route == ROUTE_NONE ) {
+		say(self, "signal %u: no usable route\n", c);
+	} else if ( ch->reach == ROUTE_NONE ) {
+		say(
+			self, "signal %u: route in direction %u runs round a loop\n", c,
+			ch->route % TG_DIRS);
+	} else {
+		say(
+			self, "signal %u: route in direction %u runs %u segments%s\n", c,
+			ch->route % TG_DIRS, ch->reach, ch->reach < RAIL_ROUTE_LEN ? ", too short" : "");
+	}
+	note(
+		self, c, EV_ROUTE, now, ch->route == ROUTE_NONE ? ROUTE_NONE : ch->route % TG_DIRS,
+		ch->reach);
+	start = ch->route == ROUTE_NONE ? base : ch->route;
+	if ( ch->conflict == ROUTE_NONE ) {
+		retVal = tcAdd(&self->conflicts, start, RAIL_ROUTE_LEN, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		ch->conflict = self->conflicts.numSignals - 1;
+		self->conflictChan[ch->conflict] = c;
+	} else {
+		retVal = tcMove(&self->conflicts, ch->conflict, start, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
+	routesChanged(self, c, now);
+cleanup:
+	return retVal;
+}
+
+// Move channel c to a new state, charging the time since it entered the old one to the old one.
+static void enter(struct RailCtl *self, uint32 c, enum RailState state, uint64 now) {
+	struct RailChannel *const ch = self->chan + c;
+	if ( self->stats ) {
+		railStatsAdd(self->stats, c, ch->state, now - ch->enteredAt);
+	}
+	ch->state = state;
+	ch->enteredAt = now;
+	if ( self->view ) {
+		rvTouchSignal(self->view, c);
+	}
+}
+
+// End the process on channel c and rest it. One that updated the track resets the channel to
+// the shortest rest; any other lengthens it, up to restMax. With restMax set, any extra back-off
+// comes out of the rest, so no channel waits longer than restMax (or the back-off, if longer).
+static void finish(struct RailCtl *self, uint32 c, uint64 now, uint64 extra, bool active) {
+	struct RailChannel *const ch = self->chan + c;
+	uint64 wait;
+	if ( active ) {
+		ch->rest = self->timing.rest;
+	} else if ( ch->rest < self->timing.restMax ) {
+		ch->rest = 2 * ch->rest < self->timing.restMax ? 2 * ch->rest : self->timing.restMax;
+	}
+	self->processes++;
+	ch->processes++;
+	say(self, "signal %u: no of processes completed %u\n", c, self->processes);
+	note(self, c, EV_DONE, now, ch->processes, self->processes);
+	enter(self, c, RAIL_IDLE, now);
+	wait = extra + ch->rest;
+	if ( self->timing.restMax > self->timing.rest && wait > self->timing.restMax ) {
+		wait = extra > self->timing.restMax ? extra : self->timing.restMax;
+	}
+	twSchedule(&self->wheel, &ch->timer, now + wait);
+}
+
+// Poll again after interval, or give up on this process if that would pass the deadline.
+static void retry(struct RailCtl *self, uint32 c, uint64 now, uint64 interval) {
+	struct RailChannel *const ch = self->chan + c;
+	if ( now + interval >= ch->deadline ) {
+		note(self, c, EV_GAVE_UP, now, 0, 0);
+		finish(self, c, now, 0, false);
+	} else {
+		twSchedule(&self->wheel, &ch->timer, now + interval);
+	}
+}
+
+// Advance channel c's state machine with the word it just sent, as received and decrypted.
+static ReturnCode dispatch(
+	struct RailCtl *self, uint32 c, uint32 raw, uint32 word, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailChannel *const ch = self->chan + c;
+	const uint32 coord = (uint32)ch->x * 16 + ch->y;
+	const uint64 now = clkNow(self->port->clock);
+	uint32 reply[2];
+	switch ( ch->state ) {
+	case RAIL_COORD:
+		ch->x = (uint8)((word & 0xFF) >> 4);
+		ch->y = (uint8)(word & 0x0F);
+		say(self, "signal %u: x is %d, y is %d\n", c, ch->x, ch->y);
+		note(self, c, EV_COORD, now, word, 0);
+		// trackOpen() covers every 4-bit coordinate, but a table built some other way may not
+		if ( !tgContains(&self->track->grid, ch->x, ch->y, 0) ) {
+			say(self, "signal %u: co-ordinates outside the track table\n", c);
+			note(self, c, EV_OFF_TRACK, now, word, 0);
+			finish(self, c, now, self->timing.noAck, false);
+			break;
+		}
+		retVal = findRoute(self, c, now, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		reply[0] = word & 0xFF;
+		retVal = sendWords(self, c, reply, 1, error);
+		enter(self, c, RAIL_HELLO, now);
+		makeReady(self, c);
+		break;
+
+	case RAIL_HELLO:
+		if ( word != RAIL_ACK1 ) {
+			say(self, "Didn't receive ACK on signal %u, decrypted_data = %u\n", c, word);
+			note(self, c, EV_NO_ACK, now, word, 0);
+			finish(self, c, now, self->timing.noAck, false);
+			break;
+		}
+		say(self, "connection established on signal %u\n", c);
+		note(self, c, EV_CONNECTED, now, word, 0);
+		reply[0] = RAIL_ACK2;
+		reply[1] = railInfo(self, ch, 0);
+		retVal = sendWords(self, c, reply, 2, error);
+		enter(self, c, RAIL_INFO1, now);
+		ch->deadline = now + self->timing.ackWait;
+		makeReady(self, c);
+		break;
+
+	case RAIL_INFO1:
+		if ( word != RAIL_ACK1 ) {
+			retry(self, c, now, self->timing.ackPoll);
+			break;
+		}
+		reply[0] = railInfo(self, ch, 4);
+		retVal = sendWords(self, c, reply, 1, error);
+		enter(self, c, RAIL_INFO2, now);
+		ch->deadline = now + self->timing.ackWait;
+		makeReady(self, c);
+		break;
+
+	case RAIL_INFO2:
+		if ( word != RAIL_ACK1 ) {
+			retry(self, c, now, self->timing.ackPoll);
+			break;
+		}
+		reply[0] = RAIL_ACK2;
+		retVal = sendWords(self, c, reply, 1, error);
+		say(self, "signal %u: S2 state successfully completed\n", c);
+		note(self, c, EV_S2_DONE, now, word, 0);
+		enter(self, c, RAIL_S3, now);
+		ch->deadline = now + self->timing.s3Settle + self->timing.s3Wait;
+		twSchedule(&self->wheel, &ch->timer, now + self->timing.s3Settle);
+		break;
+
+	case RAIL_S3:
+		if ( word == coord ) {
+			reply[0] = coord;
+			retVal = sendWords(self, c, reply, 1, error);
+			enter(self, c, RAIL_S3_FINAL, now);
+			makeReady(self, c);
+		} else if ( raw != 0x00000000 ) {
+			// The signal reports a track cell: its direction is in bits 3..5
+			const uint32 i = (word >> 3) % 8;
+			say(self, "signal %u: received data at S3 is %u\n", c, word);
+			note(self, c, EV_UPDATE, now, word, i);
+			retVal = trackSet(self->track, ch->x, ch->y, i, (uint8)word, error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+			if ( self->view ) {
+				rvTouchCell(self->view, tgIndex(&self->track->grid, ch->x, ch->y, i));
+			}
+			routesChanged(self, c, now);
+			finish(self, c, now, 0, true);
+		} else {
+			retry(self, c, now, self->timing.s3Poll);
+		}
+		break;
+
+	case RAIL_S3_FINAL:
+		finish(self, c, now, 0, false);
+		break;
+
+	case RAIL_IDLE:
+		break;
+	}
+cleanup:
+	return retVal;
+}
+
+ReturnCode railCtlRun(struct RailCtl *self, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct Clock *const clock = self->port->clock;
+	uint32 i, n;
+	uint64 now, wake;
+
+	sigRegisterHandler();
+	for ( ;; ) {
+		if ( sigIsRaised() ) {
+			say(self, "\nCaught SIGINT, quitting after %u processes\n", self->processes);
+			break;
+		}
+		now = clkNow(clock);
+		if ( self->stopAt && now >= self->stopAt ) {
+			break;
+		}
+		twAdvance(&self->wheel, now, onTimer, self);
+		if ( self->stats ) {
+			retVal = railStatsTick(self->stats, now, error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+		}
+		if ( self->snap ) {
+			retVal = railSnapTick(self->snap, self, now, error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+		}
+		if ( self->numReady == 0 ) {
+			wake = twNextWake(&self->wheel);
+			if ( wake > now + RAIL_MAX_SLEEP_US ) {
+				wake = now + RAIL_MAX_SLEEP_US;
+			}
+			if ( self->stopAt && wake > self->stopAt ) {
+				wake = self->stopAt;
+			}
+			if ( wake > now ) {
+				clkWait(clock, wake - now);
+			}
+			continue;
+		}
+
+		// Channels made ready by this pass's dispatches wait for the next pass
+		for ( n = 0; self->numReady; n++ ) {
+			const uint32 c = self->ready[self->readyHead];
+			self->readyHead = (self->readyHead + 1) % self->numChannels;
+			self->numReady--;
+			if ( self->chan[c].state == RAIL_IDLE ) {
+				enter(self, c, RAIL_COORD, now);
+			}
+			self->batch[n] = c;
+		}
+		retVal = railPortPoll(self->port, self->batch, n, self->raw, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		railCryptBatch(&self->key, self->raw, self->words, n);
+		for ( i = 0; i < n; i++ ) {
+			retVal = dispatch(self, self->batch[i], self->raw[i], self->words[i], error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+		}
+		retVal = railPortFlush(self->port, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		if ( self->view ) {
+			rvPublish(self->view, self, now);
+		}
+	}
+	if ( self->stats ) {
+		retVal = railStatsDump(self->stats, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
+	if ( self->snap ) {
+		retVal = railSnapWrite(self, self->snap->path, error);
+	}
+cleanup:
+	return retVal;
+}
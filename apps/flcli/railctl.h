@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILCTL_H
+#define RAILCTL_H
+
+#include <stdio.h>
+#include <makestuff.h>
+#include "flcli.h"
+#include "tracktab.h"
+#include "timerwheel.h"
+#include "railcrypt.h"
+#include "railio.h"
+#include "trackroute.h"
+#include "trackconflict.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define RAIL_ACK1 0xCCCCCCCCU
+	#define RAIL_ACK2 0x33333333U
+
+	#define RAIL_TICK_US 1000         // timer wheel resolution
+	#define RAIL_ROUTE_LEN 8          // segments a signal's route must run to be usable
+
+	// Protocol timings. Each waiting state has a retry interval and a deadline measured from
+	// when it was entered; all are in microseconds.
+	struct RailTimings {
+		uint64 ackPoll;     // between polls for each ACK1 of the S2 handshake
+		uint64 ackWait;     // give up on an ACK1 this long after starting to poll for it
+		uint64 s3Settle;    // after the final ACK2, before the first S3 poll
+		uint64 s3Poll;      // between S3 polls
+		uint64 s3Wait;      // give up on S3 this long after the first poll
+		uint64 noAck;       // extra back-off when a signal does not answer its coordinates
+		uint64 rest;        // between one process on a channel and the next
+		uint64 restMax;     // if above rest, a channel's rest doubles up to this after each process
+		                    // that brings no track update, and drops back to rest after one that
+		                    // does; so quiet signals are polled less, and none less than this.
+		                    // A noAck back-off counts towards it.
+	};
+
+	// The timings of the original sequential loop.
+	void railTimingsInit(struct RailTimings *timing);
+
+	// Override timings from a "name=ms[,name=ms]*" list; names are those of the struct fields,
+	// case-insensitive. Returns false on a malformed list or an unknown name.
+	bool railParseTimings(const char *spec, struct RailTimings *timing);
+
+	// One field of a "name=value[,name=value]*" list, for railParseFields().
+	typedef enum {
+		RAIL_FIELD_U32,     // uint32, in decimal, hex or octal
+		RAIL_FIELD_U64,     // uint64, in decimal, hex or octal
+		RAIL_FIELD_MS       // uint64 microseconds, given in decimal milliseconds
+	} RailFieldType;
+
+	struct RailField {
+		const char *name;   // matched case-insensitively
+		size_t offset;      // within the struct being filled in
+		RailFieldType type;
+	};
+
+	// Set the fields of the struct at base that spec names. Returns false on a malformed list, an
+	// unknown name or a value too big for its field, having set any fields before it.
+	bool railParseFields(
+		const char *spec, const struct RailField *fields, size_t numFields, void *base
+	);
+
+	// Where each signal is in its handshake. A channel only ever waits for one word at a time.
+	enum RailState {
+		RAIL_IDLE,      // resting until its wake time, then starts over at RAIL_COORD
+		RAIL_COORD,     // waiting for the signal's coordinates
+		RAIL_HELLO,     // coordinates echoed; expecting ACK1
+		RAIL_INFO1,     // ACK2 and first half of the rail info sent; polling for ACK1
+		RAIL_INFO2,     // second half sent; polling for ACK1
+		RAIL_S3,        // ACK2 sent; polling for a track update or the coordinates again
+		RAIL_S3_FINAL   // coordinates echoed; waiting for the closing word
+	};
+	#define RAIL_NUM_STATES 7
+
+	const char *railStateName(enum RailState state);
+
+	struct RailStats;
+	struct RailSnap;
+	struct RailView;
+	struct EvLog;
+
+	struct RailChannel {
+		struct TwTimer timer;  // must be first: the wheel hands it back on expiry
+		enum RailState state;
+		uint8 x, y;
+		uint64 deadline;       // time on the port clock by which the current state must be left
+		uint64 enteredAt;      // time on the port clock the current state was entered
+		uint32 processes;      // handshakes finished, successful or not
+		uint64 rest;           // before the next process; see RailTimings.restMax
+		uint32 route;          // grid node the signal's route leaves from; ROUTE_NONE for none
+		uint32 reach;          // usable segments along it; ROUTE_NONE round a loop
+		uint32 conflict;       // its signal in the conflict set; ROUTE_NONE until it has one
+	};
+
+	struct RailCtl {
+		struct RailPort *port;
+		struct RailKey key;
+		uint32 numChannels;
+		uint32 processes;
+		struct RailTimings timing;
+		struct TimerWheel wheel;
+		uint32 readyHead, numReady;
+		uint32 *ready;               // channels due a read, in the order they became due
+		uint32 *batch;               // channels polled this pass
+		uint32 *raw, *words;         // what each sent, as received and decrypted
+		struct TrackTable *track;
+		struct RouteIndex routes;    // over the track table, which keeps it up to date
+		struct TrackConflicts conflicts;  // RAIL_ROUTE_LEN of each route, likewise
+		uint32 *conflictChan;        // channel of each signal in the conflict set
+		struct RailChannel *chan;
+		uint64 stopAt;               // port clock time at which railCtlRun() returns; 0 for never
+		FILE *log;                   // progress messages; stdout by default, NULL for none
+		struct EvLog *events;        // binary record of the same; NULL for none
+		struct RailStats *stats;     // time spent in each state; NULL for none
+		struct RailSnap *snap;       // periodic snapshots for a warm restart; NULL for none
+		struct RailView *view;       // published for readers on other threads; NULL for none
+	};
+
+	// Prepare to drive signals 0..numChannels-1 of a port against an open track table; all
+	// start at RAIL_COORD. A NULL timing gives the defaults. The controller indexes the table's
+	// routes and the conflicts between them, and attaches both to it until railCtlDestroy(). When
+	// a signal sends its coordinates, its route is looked up and entered in the conflict set;
+	// a channel whose route becomes clear, blocked or conflicting as a result, or as a result of a
+	// track update, has it logged and, if resting, is started over now to fetch the new rail info.
+	ReturnCode railCtlInit(
+		struct RailCtl *self, struct RailPort *port, uint32 numChannels,
+		struct TrackTable *track, const struct RailTimings *timing, const char **error
+	);
+	void railCtlDestroy(struct RailCtl *self);
+
+	// Rebuild the ready queue after the channels have been set up from outside (see railsnap.h):
+	// every channel without a pending timer is due now.
+	void railCtlRequeue(struct RailCtl *self);
+
+	// Service every channel concurrently until SIGINT or stopAt. A channel that is waiting sits
+	// in the timer wheel; when its timer fires it joins the ready queue. Each pass polls every
+	// ready channel in one railPortPoll(), decrypts the words together, feeds them to the
+	// per-channel state machines and flushes the replies they queue; when none are ready it
+	// sleeps until the wheel's next wake. With stats attached, every state change is timed, and
+	// the stats are dumped periodically and once more on the way out; likewise the snapshot.
+	// Any view is published at the end of each pass.
+	ReturnCode railCtlRun(struct RailCtl *self, const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railemu.h"
+#include "railctl.h"
+#include "clock.h"
+
+void railEmuConfigInit(struct RailEmuConfig *cfg) {
+	cfg->reply = 20;
+	cfg->jitter = 0;
+	cfg->ack = 0;
+	cfg->update = 25000000;
+	cfg->coordPercent = 10;
+	cfg->quietPercent = 0;
+	cfg->seed = 0x2545F491;
+}
+
+bool railEmuParseConfig(const char *spec, struct RailEmuConfig *cfg) {
+	static const struct RailField fields[] = {
+		{"reply", offsetof(struct RailEmuConfig, reply), RAIL_FIELD_U64},
+		{"jitter", offsetof(struct RailEmuConfig, jitter), RAIL_FIELD_U64},
+		{"ack", offsetof(struct RailEmuConfig, ack), RAIL_FIELD_U64},
+		{"update", offsetof(struct RailEmuConfig, update), RAIL_FIELD_U64},
+		{"coordPercent", offsetof(struct RailEmuConfig, coordPercent), RAIL_FIELD_U32},
+		{"quietPercent", offsetof(struct RailEmuConfig, quietPercent), RAIL_FIELD_U32},
+		{"seed", offsetof(struct RailEmuConfig, seed), RAIL_FIELD_U32}
+	};
+	return railParseFields(spec, fields, sizeof(fields) / sizeof(*fields), cfg);
+}
+
+static uint32 nextRandom(struct RailEmu *self) {
+	self->rng ^= self->rng << 13;
+	self->rng ^= self->rng >> 17;
+	self->rng ^= self->rng << 5;
+	return self->rng;
+}
+
+// True if every byte of an info word describes direction first, first + 1, ... in bits 3..5.
+static bool validInfo(uint32 info, uint32 first) {
+	uint32 i;
+	for ( i = 0; i < 4; i++ ) {
+		if ( ((info >> (24 - 8 * i)) >> 3 & 7) != first + i ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The plaintext word signal s answers a read with at time now, or false if it has nothing to
+// say. Also advances the signal past whatever it sends.
+static bool answer(struct RailEmu *self, struct RailEmuSignal *s, uint64 now, uint32 *word) {
+	const uint32 coord = (uint32)s->x * 16 + s->y;
+	switch ( s->state ) {
+	case EMU_COORD:
+		s->state = EMU_ECHO;
+		*word = coord;
+		return true;
+	case EMU_HELLO:
+		s->state = EMU_ACK2;
+		*word = RAIL_ACK1;
+		return true;
+	case EMU_INFO1:
+	case EMU_INFO2:
+		if ( now < s->readyAt ) {
+			return false;
+		}
+		s->state = s->state == EMU_INFO1 ? EMU_INFO2_DATA : EMU_FINAL_ACK2;
+		*word = RAIL_ACK1;
+		return true;
+	case EMU_S3:
+		if ( now < s->readyAt ) {
+			return false;
+		}
+		if ( s->coordNext ) {
+			s->state = EMU_S3_ECHO;
+			*word = coord;
+		} else {
+			// A known cell: ok flag, direction and next direction
+			const uint32 r = nextRandom(self);
+			s->state = EMU_COORD;
+			self->updates++;
+			*word = 0x80 | (r & 0x40) | (r >> 8 & 7) << 3 | (r >> 16 & 7);
+			if ( *word == coord ) {
+				// For x of 8 or more a cell byte can equal the coordinates, which the controller
+				// takes for the S3 echo; report a different next direction instead
+				*word ^= 1;
+			}
+		}
+		return true;
+	case EMU_S3_FINAL:
+		s->state = EMU_COORD;
+		*word = RAIL_ACK2;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Signal s receives a plaintext word from the controller at time now.
+static void receive(struct RailEmu *self, struct RailEmuSignal *s, uint32 word, uint64 now) {
+	const uint32 coord = (uint32)s->x * 16 + s->y;
+	bool ok = false;
+	switch ( s->state ) {
+	case EMU_ECHO:
+		if ( (ok = (word == coord)) ) {
+			s->state = EMU_HELLO;
+		}
+		break;
+	case EMU_ACK2:
+		if ( (ok = (word == RAIL_ACK2)) ) {
+			s->state = EMU_INFO1_DATA;
+		}
+		break;
+	case EMU_INFO1_DATA:
+		if ( (ok = validInfo(word, 0)) ) {
+			s->state = EMU_INFO1;
+			s->readyAt = now + self->cfg.ack;
+		}
+		break;
+	case EMU_INFO2_DATA:
+		if ( (ok = validInfo(word, 4)) ) {
+			s->state = EMU_INFO2;
+			s->readyAt = now + self->cfg.ack;
+		}
+		break;
+	case EMU_FINAL_ACK2:
+		if ( (ok = (word == RAIL_ACK2)) ) {
+			s->state = EMU_S3;
+			s->readyAt = now + self->cfg.update;
+			s->coordNext = nextRandom(self) % 100 < self->cfg.coordPercent || s->quiet;
+		}
+		break;
+	case EMU_S3_ECHO:
+		if ( (ok = (word == coord)) ) {
+			s->state = EMU_S3_FINAL;
+		}
+		break;
+	default:
+		break;
+	}
+	if ( !ok ) {
+		self->errors++;
+		s->state = EMU_COORD;
+	}
+}
+
+static ReturnCode emuWrite(
+	struct RailPort *port, uint32 signal, const uint32 *words, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailEmu *const self = (struct RailEmu *)port;
+	const uint64 now = clkNow(port->clock);
+	uint32 i;
+	CHECK_STATUS(
+		signal >= port->numSignals, FLP_CHAN_RANGE, cleanup,
+		"railPortWrite(): no signal %u", signal);
+	for ( i = 0; i < count; i++ ) {
+		receive(self, self->sig + signal, railKeyDecrypt(&self->key, words[i]), now);
+	}
+	self->writes += count;
+cleanup:
+	return retVal;
+}
+
+static ReturnCode emuSubmit(struct RailPort *port, uint32 signal, uint32 count, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailEmu *const self = (struct RailEmu *)port;
+	struct RailEmuRead *read;
+	uint64 start = clkNow(port->clock);
+	uint32 word;
+	CHECK_STATUS(
+		signal >= port->numSignals, FLP_CHAN_RANGE, cleanup,
+		"railPortSubmit(): no signal %u", signal);
+	CHECK_STATUS(
+		count != 1, FLP_ARGS, cleanup,
+		"railPortSubmit(): the emulator reads one word at a time");
+	CHECK_STATUS(
+		self->numPending == RAIL_EMU_DEPTH, FLP_ARGS, cleanup,
+		"railPortSubmit(): more than %d reads in flight", RAIL_EMU_DEPTH);
+	if ( start < self->lastDone ) {
+		start = self->lastDone;
+	}
+	start += self->cfg.reply;
+	if ( self->cfg.jitter ) {
+		start += nextRandom(self) % (self->cfg.jitter + 1);
+	}
+	if ( answer(self, self->sig + signal, start, &word) ) {
+		word = railKeyEncrypt(&self->key, word);
+	} else {
+		word = 0x00000000;
+		self->idleReads++;
+	}
+	read = self->pending + (self->head + self->numPending++) % RAIL_EMU_DEPTH;
+	read->word = word;
+	read->doneAt = self->lastDone = start;
+	self->reads++;
+cleanup:
+	return retVal;
+}
+
+static ReturnCode emuAwait(struct RailPort *port, uint32 *words, uint32 count, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailEmu *const self = (struct RailEmu *)port;
+	const struct RailEmuRead *read;
+	uint64 now;
+	CHECK_STATUS(
+		count != 1, FLP_ARGS, cleanup,
+		"railPortAwait(): the emulator reads one word at a time");
+	CHECK_STATUS(
+		!self->numPending, FLP_PROTOCOL, cleanup,
+		"railPortAwait(): no read in flight");
+	read = self->pending + self->head;
+	now = clkNow(port->clock);
+	if ( now < read->doneAt ) {
+		clkWait(port->clock, read->doneAt - now);
+	}
+	*words = read->word;
+	self->head = (self->head + 1) % RAIL_EMU_DEPTH;
+	self->numPending--;
+cleanup:
+	return retVal;
+}
+
+static ReturnCode emuFlush(struct RailPort *port, const char **error) {
+	(void)port;
+	(void)error;
+	return FLP_SUCCESS;
+}
+
+static const struct RailPortOps emuOps = {emuWrite, emuSubmit, emuAwait, emuFlush};
+
+ReturnCode railEmuInit(
+	struct RailEmu *self, struct Clock *clock, uint32 numSignals, uint32 xDim, uint32 yDim,
+	const struct RailEmuConfig *cfg, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 i;
+	memset(self, 0, sizeof(*self));
+	if ( cfg ) {
+		self->cfg = *cfg;
+	} else {
+		railEmuConfigInit(&self->cfg);
+	}
+	xDim = xDim > 16 ? 16 : xDim;
+	yDim = yDim > 16 ? 16 : yDim;
+	CHECK_STATUS(
+		!numSignals || !xDim || !yDim, FLP_ARGS, cleanup,
+		"railEmuInit(): need at least one signal and one track cell");
+	self->sig = (struct RailEmuSignal *)calloc(numSignals, sizeof(struct RailEmuSignal));
+	CHECK_STATUS(
+		!self->sig, FLP_NO_MEMORY, cleanup,
+		"railEmuInit(): cannot allocate %u signals", numSignals);
+	for ( i = 0; i < numSignals; i++ ) {
+		self->sig[i].state = EMU_COORD;
+		self->sig[i].x = (uint8)(i % xDim);
+		self->sig[i].y = (uint8)(i / xDim % yDim);
+		self->sig[i].quiet = (uint64)i * 100 < (uint64)self->cfg.quietPercent * numSignals;
+	}
+	self->port.ops = &emuOps;
+	self->port.clock = clock ? clock : clkReal();
+	self->port.numSignals = numSignals;
+	self->port.depth = RAIL_EMU_DEPTH;
+	railKeyInit(&self->key, RAIL_KEY);
+	self->rng = self->cfg.seed ? self->cfg.seed : 1;
+cleanup:
+	return retVal;
+}
+
+void railEmuDestroy(struct RailEmu *self) {
+	free(self->sig);
+	self->sig = NULL;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILEMU_H
+#define RAILEMU_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "railio.h"
+#include "railcrypt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define RAIL_EMU_DEPTH 256  // reads the emulator will hold in flight
+
+	// How the emulated signals behave. Delays are in microseconds.
+	struct RailEmuConfig {
+		uint64 reply;         // latency of every read
+		uint64 jitter;        // up to this much extra read latency, uniformly distributed
+		uint64 ack;           // after each half of the rail info arrives, before the signal ACKs it
+		uint64 update;        // after the final ACK2, before the signal reports in S3
+		uint32 coordPercent;  // S3 phases that end with the coordinates instead of a track update
+		uint32 quietPercent;  // signals, from the first, with no traffic: every S3 phase so ends
+		uint32 seed;
+	};
+
+	// Defaults: 20us reads, immediate ACKs, an S3 report 1s after the controller's default
+	// settle time, and one S3 phase in ten ending with the coordinates.
+	void railEmuConfigInit(struct RailEmuConfig *cfg);
+
+	// Override fields from a "name=value[,name=value]*" list, names as in the struct,
+	// case-insensitive. Returns false on a malformed list or an unknown name.
+	bool railEmuParseConfig(const char *spec, struct RailEmuConfig *cfg);
+
+	// Where each emulated signal is in the handshake, seen from the signal's side
+	enum RailEmuState {
+		EMU_COORD,       // next read: its coordinates
+		EMU_ECHO,        // expecting the coordinates back
+		EMU_HELLO,       // next read: ACK1
+		EMU_ACK2,        // expecting ACK2
+		EMU_INFO1_DATA,  // expecting rail info for directions 0..3
+		EMU_INFO1,       // next read: ACK1 once the ack delay has passed, else nothing
+		EMU_INFO2_DATA,  // expecting rail info for directions 4..7
+		EMU_INFO2,       // next read: ACK1 once the ack delay has passed, else nothing
+		EMU_FINAL_ACK2,  // expecting the final ACK2
+		EMU_S3,          // next read: nothing until the update delay has passed, then a report
+		EMU_S3_ECHO,     // reported its coordinates; expecting them back
+		EMU_S3_FINAL     // next read: the closing word
+	};
+
+	struct RailEmuSignal {
+		uint8 state;
+		uint8 x, y;
+		bool coordNext;  // this S3 phase ends with the coordinates
+		bool quiet;      // ...as does every one; see RailEmuConfig.quietPercent
+		uint64 readyAt;  // clock time at which the pending ACK or report becomes available
+	};
+
+	struct RailEmuRead {
+		uint32 word;
+		uint64 doneAt;
+	};
+
+	// Emulates any number of signals behind a RailPort. Reads are answered one after another,
+	// each reply latency after the later of its submission and the previous answer; awaiting a
+	// read sleeps on the clock until then.
+	struct RailEmu {
+		struct RailPort port;  // must be first
+		struct RailEmuConfig cfg;
+		struct RailKey key;
+		struct RailEmuSignal *sig;
+		uint32 rng;
+		uint32 head, numPending;
+		struct RailEmuRead pending[RAIL_EMU_DEPTH];
+		uint64 lastDone;
+		uint64 reads;          // words read by the controller
+		uint64 idleReads;      // ...of which the signal had nothing to say
+		uint64 writes;         // words written by the controller
+		uint64 updates;        // track updates reported
+		uint64 errors;         // unexpected words written; the signal starts over
+	};
+
+	// Emulate numSignals signals whose coordinates are spread over the first xDim x yDim cells
+	// of the track (each at most 16, the coordinate byte's limit). The signals, and the
+	// controller driving them, run on the given clock; NULL for the real one.
+	ReturnCode railEmuInit(
+		struct RailEmu *self, struct Clock *clock, uint32 numSignals, uint32 xDim, uint32 yDim,
+		const struct RailEmuConfig *cfg, const char **error
+	);
+	void railEmuDestroy(struct RailEmu *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railevlog.h"
+#include "clock.h"
+
+static const char *const typeNames[EV_NUM_TYPES] = {
+	NULL, "coord", "off-track", "no-ack", "connected", "s2-done", "update", "gave-up", "done", "route",
+	"conflict"
+};
+
+const char *evTypeName(uint32 type) {
+	return type < EV_NUM_TYPES ? typeNames[type] : NULL;
+}
+
+EvType evTypeParse(const char *name) {
+	uint32 i;
+	for ( i = 1; i < EV_NUM_TYPES; i++ ) {
+		if ( !strcmp(name, typeNames[i]) ) {
+			return (EvType)i;
+		}
+	}
+	return (EvType)0;
+}
+
+#ifdef WIN32
+
+ReturnCode evLogCreate(
+	struct EvLog *self, const char *path, uint32 capacity, uint64 now, const char **error)
+{
+	ReturnCode retVal;
+	(void)path; (void)capacity; (void)now;
+	memset(self, 0, sizeof(*self));
+	FAIL(FLP_ARGS, cleanup);
+cleanup:
+	errRender(error, "evLogCreate(): event logs are not supported on this platform");
+	return retVal;
+}
+
+ReturnCode evLogOpen(struct EvLog *self, const char *path, const char **error) {
+	return evLogCreate(self, path, 0, 0, error);
+}
+
+void evLogClose(struct EvLog *self) {
+	(void)self;
+}
+
+#else
+
+void evLogClose(struct EvLog *self) {
+	if ( self->hdr ) {
+		munmap((void *)self->hdr, self->mapSize);
+		self->hdr = NULL;
+		self->rec = NULL;
+	}
+}
+
+ReturnCode evLogCreate(
+	struct EvLog *self, const char *path, uint32 capacity, uint64 now, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 cap = 64;
+	int fd;
+	void *map;
+	memset(self, 0, sizeof(*self));
+	while ( cap < capacity && cap < 0x80000000U ) {
+		cap <<= 1;
+	}
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	CHECK_STATUS(fd < 0, FLP_CANNOT_SAVE, cleanup, "evLogCreate(): cannot create %s", path);
+	self->mapSize = sizeof(struct EvLogHeader) + (size_t)cap * sizeof(struct EvRecord);
+	CHECK_STATUS(
+		ftruncate(fd, (off_t)self->mapSize), FLP_CANNOT_SAVE, cleanup,
+		"evLogCreate(): cannot size %s", path);
+	map = mmap(NULL, self->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	CHECK_STATUS(map == MAP_FAILED, FLP_CANNOT_SAVE, cleanup, "evLogCreate(): cannot map %s", path);
+	self->hdr = (struct EvLogHeader *)map;
+	self->rec = (struct EvRecord *)(self->hdr + 1);
+	self->hdr->version = EVLOG_VERSION;
+	self->hdr->capacity = cap;
+	self->hdr->startMicros = now;
+	self->hdr->startEpoch = clkEpochMicros();
+	self->hdr->head = 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(self->hdr->magic, EVLOG_MAGIC, sizeof(self->hdr->magic));
+cleanup:
+	if ( fd >= 0 ) {
+		close(fd);
+	}
+	return retVal;
+}
+
+ReturnCode evLogOpen(struct EvLog *self, const char *path, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct stat st;
+	int fd;
+	void *map;
+	memset(self, 0, sizeof(*self));
+	fd = open(path, O_RDONLY);
+	CHECK_STATUS(fd < 0, FLP_CANNOT_LOAD, cleanup, "evLogOpen(): cannot open %s", path);
+	CHECK_STATUS(
+		fstat(fd, &st) || (size_t)st.st_size < sizeof(struct EvLogHeader), FLP_CANNOT_LOAD, cleanup,
+		"evLogOpen(): %s is not an event log", path);
+	self->mapSize = (size_t)st.st_size;
+	map = mmap(NULL, self->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	CHECK_STATUS(map == MAP_FAILED, FLP_CANNOT_LOAD, cleanup, "evLogOpen(): cannot map %s", path);
+	self->hdr = (struct EvLogHeader *)map;
+	self->rec = (struct EvRecord *)(self->hdr + 1);
+	CHECK_STATUS(
+		memcmp(self->hdr->magic, EVLOG_MAGIC, sizeof(self->hdr->magic)) ||
+		self->hdr->version != EVLOG_VERSION ||
+		!self->hdr->capacity || (self->hdr->capacity & (self->hdr->capacity - 1)) ||
+		sizeof(struct EvLogHeader) + (size_t)self->hdr->capacity * sizeof(struct EvRecord) != self->mapSize,
+		FLP_CANNOT_LOAD, cleanup, "evLogOpen(): %s is not a version %d event log",
+		path, EVLOG_VERSION);
+cleanup:
+	if ( fd >= 0 ) {
+		close(fd);
+	}
+	if ( retVal ) {
+		evLogClose(self);
+	}
+	return retVal;
+}
+
+#endif
+
+void evLogAppend(
+	struct EvLog *self, uint64 micros, uint32 signal, EvType type, uint8 state, uint8 x,
+	uint8 y, uint32 word0, uint32 word1)
+{
+	struct EvLogHeader *const hdr = self->hdr;
+	const uint64 head = hdr->head;
+	struct EvRecord *const rec = self->rec + (head & (hdr->capacity - 1));
+	__atomic_store_n(&rec->seq, ~(uint64)0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->micros = micros - hdr->startMicros;
+	rec->signal = signal;
+	rec->type = (uint8)type;
+	rec->state = state;
+	rec->x = x;
+	rec->y = y;
+	rec->word[0] = word0;
+	rec->word[1] = word1;
+	__atomic_store_n(&rec->seq, head, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint64 evLogEnd(const struct EvLog *self) {
+	return __atomic_load_n(&self->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+uint64 evLogFirst(const struct EvLog *self) {
+	const uint64 head = evLogEnd(self);
+	return head > self->hdr->capacity ? head - self->hdr->capacity : 0;
+}
+
+bool evLogGet(const struct EvLog *self, uint64 seq, struct EvRecord *rec) {
+	const struct EvRecord *const slot = self->rec + (seq & (self->hdr->capacity - 1));
+	if ( __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq ) {
+		return false;
+	}
+	*rec = *slot;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
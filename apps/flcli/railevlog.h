@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILEVLOG_H
+#define RAILEVLOG_H
+
+#include <makestuff.h>
+#include "flcli.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// A binary log of what the rail controller does, one fixed-size record per event, in a file
+	// mapped into memory as a ring: once it is full, each new record overwrites the oldest. The
+	// controller is the only writer; any number of readers may map the file while it runs, or
+	// afterwards. All fields are in host byte order.
+	//
+	// The header's head counts records ever written; record n lives in slot n % capacity and
+	// carries n as its seq. The writer marks a slot invalid before overwriting it and stamps the
+	// new seq once it is complete, so a reader that finds the same seq before and after copying
+	// a record out knows the copy is whole.
+	#define EVLOG_MAGIC "FLEVLOG\0"
+	#define EVLOG_VERSION 1
+	#define EVLOG_DEFAULT_RECORDS 1048576
+
+	typedef enum {
+		EV_COORD = 1,  // the signal sent its coordinates: x, y; word[0] as decrypted
+		EV_OFF_TRACK,  // ...which are outside the track table
+		EV_NO_ACK,     // expected ACK1 after echoing the coordinates; got word[0]
+		EV_CONNECTED,  // ACK1 received; the rail info follows
+		EV_S2_DONE,    // both halves of the rail info acknowledged
+		EV_UPDATE,     // track update: word[0] as decrypted, stored in direction word[1]
+		EV_GAVE_UP,    // the state's deadline passed without the expected word
+		EV_DONE,       // process finished; word[0] is the signal's count, word[1] the total
+		EV_ROUTE,      // route looked up at the coordinates: word[0] the direction it leaves in
+		               // (0xFFFFFFFF for none), word[1] its usable segments (0xFFFFFFFF round a loop)
+		EV_CONFLICT    // route status changed: word[0] the TcStatus, word[1] the channel causing it
+	} EvType;
+	#define EV_NUM_TYPES 11
+
+	struct EvLogHeader {
+		char magic[8];
+		uint32 version;
+		uint32 capacity;     // records the ring holds; a power of two
+		uint64 startMicros;  // controller clock when the log was created
+		uint64 startEpoch;   // wall clock at the same instant, in microseconds since 1970
+		uint64 head;         // records written so far
+		uint8 reserved[24];
+	};
+
+	struct EvRecord {
+		uint64 seq;          // this record's sequence number; all ones while being written
+		uint64 micros;       // controller clock, relative to startMicros
+		uint32 signal;
+		uint8 type;          // EvType
+		uint8 state;         // enum RailState the signal was in
+		uint8 x, y;          // the signal's coordinates, as last sent
+		uint32 word[2];
+	};
+
+	struct EvLog {
+		struct EvLogHeader *hdr;
+		struct EvRecord *rec;
+		size_t mapSize;
+	};
+
+	// Writer side: create (or truncate) the file, holding at least capacity records (rounded up
+	// to a power of two). Record times are given on the writer's clock; now is its current time.
+	ReturnCode evLogCreate(
+		struct EvLog *self, const char *path, uint32 capacity, uint64 now, const char **error
+	);
+	void evLogAppend(
+		struct EvLog *self, uint64 micros, uint32 signal, EvType type, uint8 state, uint8 x,
+		uint8 y, uint32 word0, uint32 word1
+	);
+
+	// Reader side, read-only.
+	ReturnCode evLogOpen(struct EvLog *self, const char *path, const char **error);
+
+	// Unmap either side.
+	void evLogClose(struct EvLog *self);
+
+	// Sequence numbers of the oldest record still in the ring, and one past the newest.
+	uint64 evLogFirst(const struct EvLog *self);
+	uint64 evLogEnd(const struct EvLog *self);
+
+	// Copy out record seq. Returns false if it has been, or may have been, overwritten.
+	bool evLogGet(const struct EvLog *self, uint64 seq, struct EvRecord *rec);
+
+	// "coord", "no-ack" etc, or NULL for an unknown type; and back, or 0 for an unknown name.
+	const char *evTypeName(uint32 type);
+	EvType evTypeParse(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <makestuff.h>
+#include <libfpgalink.h>
+#include <liberror.h>
+#include "railio.h"
+
+ReturnCode railWriteWordsAsync(
+	struct FLContext *handle, uint8 chan, const uint32 *words, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint8 buf[4 * RAIL_MAX_WORDS];
+	FLStatus fStatus;
+	uint32 i;
+	CHECK_STATUS(
+		count > RAIL_MAX_WORDS, FLP_ARGS, cleanup,
+		"railWriteWordsAsync(): cannot write more than %d words at once", RAIL_MAX_WORDS);
+	for ( i = 0; i < count; i++ ) {
+		railPackWord(buf + 4 * i, words[i]);
+	}
+	fStatus = flWriteChannelAsync(handle, chan, 4 * count, buf, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "railWriteWordsAsync()");
+cleanup:
+	return retVal;
+}
+
+ReturnCode railReadWordsSubmit(
+	struct FLContext *handle, uint8 chan, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FLStatus fStatus;
+	CHECK_STATUS(
+		count > RAIL_MAX_WORDS, FLP_ARGS, cleanup,
+		"railReadWordsSubmit(): cannot read more than %d words at once", RAIL_MAX_WORDS);
+	fStatus = flReadChannelAsyncSubmit(handle, chan, 4 * count, NULL, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "railReadWordsSubmit()");
+cleanup:
+	return retVal;
+}
+
+ReturnCode railReadWordsAwait(
+	struct FLContext *handle, uint32 *words, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FLStatus fStatus;
+	const uint8 *recvData;
+	uint32 actualLength, i;
+	fStatus = flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "railReadWordsAwait()");
+	CHECK_STATUS(
+		actualLength != 4 * count, FLP_PROTOCOL, cleanup,
+		"railReadWordsAwait(): expected %u bytes, got %u", 4 * count, actualLength);
+	for ( i = 0; i < count; i++ ) {
+		words[i] = railUnpackWord(recvData + 4 * i);
+	}
+cleanup:
+	return retVal;
+}
+
+static ReturnCode railFlPortWrite(
+	struct RailPort *self, uint32 signal, const uint32 *words, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	CHECK_STATUS(
+		signal >= self->numSignals, FLP_CHAN_RANGE, cleanup,
+		"railPortWrite(): no signal %u", signal);
+	retVal = railWriteWordsAsync(
+		((struct RailFlPort *)self)->handle, RAIL_WRITE_CHAN(signal), words, count, error);
+cleanup:
+	return retVal;
+}
+
+static ReturnCode railFlPortSubmit(
+	struct RailPort *self, uint32 signal, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	CHECK_STATUS(
+		signal >= self->numSignals, FLP_CHAN_RANGE, cleanup,
+		"railPortSubmit(): no signal %u", signal);
+	retVal = railReadWordsSubmit(
+		((struct RailFlPort *)self)->handle, RAIL_READ_CHAN(signal), count, error);
+cleanup:
+	return retVal;
+}
+
+static ReturnCode railFlPortAwait(
+	struct RailPort *self, uint32 *words, uint32 count, const char **error)
+{
+	return railReadWordsAwait(((struct RailFlPort *)self)->handle, words, count, error);
+}
+
+static ReturnCode railFlPortFlush(struct RailPort *self, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct FLContext *const handle = ((struct RailFlPort *)self)->handle;
+	FLStatus fStatus = flFlushAsyncWrites(handle, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "railPortFlush()");
+	fStatus = flAwaitAsyncWrites(handle, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "railPortFlush()");
+cleanup:
+	return retVal;
+}
+
+static const struct RailPortOps railFlPortOps = {
+	railFlPortWrite, railFlPortSubmit, railFlPortAwait, railFlPortFlush
+};
+
+void railFlPortInit(struct RailFlPort *self, struct FLContext *handle) {
+	self->port.ops = &railFlPortOps;
+	self->port.clock = clkReal();
+	self->port.numSignals = RAIL_CHANNELS;
+	self->port.depth = RAIL_DEPTH;
+	self->handle = handle;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILIO_H
+#define RAILIO_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "clock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	struct FLContext;
+
+	// Rail messages are 32-bit words sent most-significant byte first. The host reads signal c
+	// on channel 2c and writes to it on channel 2c+1.
+	#define RAIL_MAX_WORDS 256
+	#define RAIL_READ_CHAN(c) ((uint8)(2U * (c)))
+	#define RAIL_WRITE_CHAN(c) ((uint8)(2U * (c) + 1U))
+
+	#define RAIL_CHANNELS 64  // signals one FPGALink device serves
+	#define RAIL_DEPTH 64     // word reads in flight at once on an FPGALink device: a full scan
+
+	static inline void railPackWord(uint8 *p, uint32 word) {
+		p[0] = (uint8)(word >> 24);
+		p[1] = (uint8)(word >> 16);
+		p[2] = (uint8)(word >> 8);
+		p[3] = (uint8)word;
+	}
+
+	static inline uint32 railUnpackWord(const uint8 *p) {
+		return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+	}
+
+	// Queue a write of count words on a channel without waiting for it, or submit a read of
+	// count words and collect it later, each in a single FPGALink transfer. Reads complete in the
+	// order they were submitted.
+	ReturnCode railWriteWordsAsync(
+		struct FLContext *handle, uint8 chan, const uint32 *words, uint32 count, const char **error
+	);
+	ReturnCode railReadWordsSubmit(
+		struct FLContext *handle, uint8 chan, uint32 count, const char **error
+	);
+	ReturnCode railReadWordsAwait(
+		struct FLContext *handle, uint32 *words, uint32 count, const char **error
+	);
+
+	// Where the rail controller sends and receives words: an FPGALink device, or the emulator
+	// in railemu.h. Signals are numbered 0..numSignals-1. Writes are queued and only guaranteed
+	// to have reached the signal after flush(); reads of count words are submitted and awaited
+	// in order, at most depth at a time. The port's clock is the one its signals live by, so
+	// its users wait on it rather than on the real clock.
+	struct RailPort;
+
+	struct RailPortOps {
+		ReturnCode (*write)(
+			struct RailPort *self, uint32 signal, const uint32 *words, uint32 count,
+			const char **error
+		);
+		ReturnCode (*submit)(struct RailPort *self, uint32 signal, uint32 count, const char **error);
+		ReturnCode (*await)(struct RailPort *self, uint32 *words, uint32 count, const char **error);
+		ReturnCode (*flush)(struct RailPort *self, const char **error);
+	};
+
+	struct RailPort {
+		const struct RailPortOps *ops;
+		struct Clock *clock;
+		uint32 numSignals;
+		uint32 depth;
+	};
+
+	static inline ReturnCode railPortWrite(
+		struct RailPort *self, uint32 signal, const uint32 *words, uint32 count,
+		const char **error)
+	{
+		return self->ops->write(self, signal, words, count, error);
+	}
+
+	static inline ReturnCode railPortSubmit(
+		struct RailPort *self, uint32 signal, uint32 count, const char **error)
+	{
+		return self->ops->submit(self, signal, count, error);
+	}
+
+	static inline ReturnCode railPortAwait(
+		struct RailPort *self, uint32 *words, uint32 count, const char **error)
+	{
+		return self->ops->await(self, words, count, error);
+	}
+
+	static inline ReturnCode railPortFlush(struct RailPort *self, const char **error) {
+		return self->ops->flush(self, error);
+	}
+
+	// Read one word from each of count signals, words[i] from signals[i]. All the reads are
+	// submitted before the first is awaited, up to the port's depth, so scanning as many signals
+	// as the port has in flight costs one pipelined round trip. On failure, reads already in
+	// flight are drained so the port is left idle.
+	ReturnCode railPortPoll(
+		struct RailPort *self, const uint32 *signals, uint32 count, uint32 *words,
+		const char **error
+	);
+
+	// The port for a real device: signal c reads channel 2c and writes channel 2c+1.
+	struct RailFlPort {
+		struct RailPort port;  // must be first
+		struct FLContext *handle;
+	};
+
+	void railFlPortInit(struct RailFlPort *self, struct FLContext *handle);
+
+	// Several ports behind one global signal namespace: the first board's signals come first,
+	// then the second's, and so on. Reads to different boards are in flight together, so the
+	// boards work in parallel; results still come back in submission order. All boards must
+	// run on the same clock.
+	#define RAIL_MAX_BOARDS 8
+
+	struct RailMultiRead {
+		uint32 board;
+		uint32 word;
+		bool reaped;  // collected early, to make room on its board
+	};
+
+	struct RailMultiPort {
+		struct RailPort port;  // must be first
+		uint32 numBoards;
+		struct RailPort *board[RAIL_MAX_BOARDS];
+		uint32 base[RAIL_MAX_BOARDS];      // global number of each board's signal 0
+		uint32 inFlight[RAIL_MAX_BOARDS];  // reads outstanding on each board
+		struct RailMultiRead *reads;       // every read in flight, oldest first
+		uint32 head, numReads;
+	};
+
+	ReturnCode railMultiPortInit(
+		struct RailMultiPort *self, struct RailPort *const *boards, uint32 numBoards,
+		const char **error
+	);
+	void railMultiPortDestroy(struct RailMultiPort *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railio.h"
+
+ReturnCode railPortPoll(
+	struct RailPort *self, const uint32 *signals, uint32 count, uint32 *words, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 submitted = 0, reaped = 0, discard;
+	while ( reaped < count ) {
+		while ( submitted < count && submitted - reaped < self->depth ) {
+			retVal = railPortSubmit(self, signals[submitted], 1, error);
+			CHECK_STATUS(retVal, retVal, cleanup);
+			submitted++;
+		}
+		retVal = railPortAwait(self, words + reaped, 1, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		reaped++;
+	}
+cleanup:
+	while ( reaped < submitted ) {
+		if ( railPortAwait(self, &discard, 1, NULL) ) {
+			break;
+		}
+		reaped++;
+	}
+	return retVal;
+}
+
+// The board holding global signal *signal, which is rewritten to that board's own numbering.
+static uint32 findBoard(const struct RailMultiPort *self, uint32 *signal) {
+	uint32 b = self->numBoards - 1;
+	while ( *signal < self->base[b] ) {
+		b--;
+	}
+	*signal -= self->base[b];
+	return b;
+}
+
+static ReturnCode multiWrite(
+	struct RailPort *port, uint32 signal, const uint32 *words, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailMultiPort *const self = (struct RailMultiPort *)port;
+	uint32 b;
+	CHECK_STATUS(
+		signal >= port->numSignals, FLP_CHAN_RANGE, cleanup,
+		"railPortWrite(): no signal %u", signal);
+	b = findBoard(self, &signal);
+	retVal = railPortWrite(self->board[b], signal, words, count, error);
+cleanup:
+	return retVal;
+}
+
+static ReturnCode multiSubmit(
+	struct RailPort *port, uint32 signal, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailMultiPort *const self = (struct RailMultiPort *)port;
+	struct RailMultiRead *read;
+	uint32 b, i;
+	CHECK_STATUS(
+		signal >= port->numSignals, FLP_CHAN_RANGE, cleanup,
+		"railPortSubmit(): no signal %u", signal);
+	CHECK_STATUS(
+		count != 1, FLP_ARGS, cleanup,
+		"railPortSubmit(): a multi-board port reads one word at a time");
+	CHECK_STATUS(
+		self->numReads == port->depth, FLP_ARGS, cleanup,
+		"railPortSubmit(): more than %u reads in flight", port->depth);
+	b = findBoard(self, &signal);
+	if ( self->inFlight[b] == self->board[b]->depth ) {
+		// The board is full: collect its oldest read now, and hand it out in its turn
+		for ( i = 0; ; i++ ) {
+			read = self->reads + (self->head + i) % port->depth;
+			if ( read->board == b && !read->reaped ) {
+				break;
+			}
+		}
+		retVal = railPortAwait(self->board[b], &read->word, 1, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		read->reaped = true;
+		self->inFlight[b]--;
+	}
+	retVal = railPortSubmit(self->board[b], signal, 1, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	self->inFlight[b]++;
+	read = self->reads + (self->head + self->numReads++) % port->depth;
+	read->board = b;
+	read->reaped = false;
+cleanup:
+	return retVal;
+}
+
+static ReturnCode multiAwait(struct RailPort *port, uint32 *words, uint32 count, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailMultiPort *const self = (struct RailMultiPort *)port;
+	struct RailMultiRead *read;
+	CHECK_STATUS(
+		count != 1, FLP_ARGS, cleanup,
+		"railPortAwait(): a multi-board port reads one word at a time");
+	CHECK_STATUS(!self->numReads, FLP_PROTOCOL, cleanup, "railPortAwait(): no read in flight");
+	read = self->reads + self->head;
+	if ( !read->reaped ) {
+		// Nothing older is outstanding on this board, so its next completion is this read
+		retVal = railPortAwait(self->board[read->board], &read->word, 1, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		self->inFlight[read->board]--;
+	}
+	*words = read->word;
+	self->head = (self->head + 1) % port->depth;
+	self->numReads--;
+cleanup:
+	return retVal;
+}
+
+static ReturnCode multiFlush(struct RailPort *port, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct RailMultiPort *const self = (struct RailMultiPort *)port;
+	uint32 b;
+	for ( b = 0; b < self->numBoards; b++ ) {
+		retVal = railPortFlush(self->board[b], error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
+cleanup:
+	return retVal;
+}
+
+static const struct RailPortOps multiOps = {multiWrite, multiSubmit, multiAwait, multiFlush};
+
+ReturnCode railMultiPortInit(
+	struct RailMultiPort *self, struct RailPort *const *boards, uint32 numBoards,
+	const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 b;
+	memset(self, 0, sizeof(*self));
+	CHECK_STATUS(
+		!numBoards || numBoards > RAIL_MAX_BOARDS, FLP_ARGS, cleanup,
+		"railMultiPortInit(): need 1 to %d boards", RAIL_MAX_BOARDS);
+	self->port.ops = &multiOps;
+	self->port.clock = boards[0]->clock;
+	self->numBoards = numBoards;
+	for ( b = 0; b < numBoards; b++ ) {
+		CHECK_STATUS(
+			boards[b]->clock != self->port.clock, FLP_ARGS, cleanup,
+			"railMultiPortInit(): board %u runs on a different clock", b);
+		self->board[b] = boards[b];
+		self->base[b] = self->port.numSignals;
+		self->port.numSignals += boards[b]->numSignals;
+		self->port.depth += boards[b]->depth;
+	}
+	self->reads = (struct RailMultiRead *)malloc(self->port.depth * sizeof(struct RailMultiRead));
+	CHECK_STATUS(!self->reads, FLP_NO_MEMORY, cleanup, "railMultiPortInit(): out of memory");
+cleanup:
+	return retVal;
+}
+
+void railMultiPortDestroy(struct RailMultiPort *self) {
+	free(self->reads);
+	self->reads = NULL;
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/un.h>
+	#include <sys/time.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railquery.h"
+#include "railview.h"
+#include "railctl.h"
+#include "trackgrid.h"
+
+#define RQ_POLL_MS 100     // how soon the server notices it should stop
+#define RQ_READ_MS 1000    // how long a client has to send its query
+
+static void version(FILE *out, uint64 version, uint64 at, uint32 processes) {
+	fprintf(out, "version %llu at %llu processes %u\n",
+		(unsigned long long)version, (unsigned long long)at, processes);
+}
+
+static void signalRow(FILE *out, uint32 c, const struct RailViewSignal *s) {
+	fprintf(out, "%u,%s,%u,%u,%u,%llu\n",
+		c, railStateName((enum RailState)s->state), s->x, s->y, s->processes,
+		(unsigned long long)s->since);
+}
+
+bool rqAnswer(struct RailQuery *self, const char *query, FILE *out) {
+	const struct RailView *const view = self->view;
+	uint64 v, at;
+	uint32 processes, c, i;
+	char *end;
+	if ( !strcmp(query, "signals") ) {
+		v = rvReadSignals(view, self->signals, &at, &processes);
+		version(out, v, at, processes);
+		for ( c = 0; c < view->numSignals; c++ ) {
+			signalRow(out, c, self->signals + c);
+		}
+		return true;
+	}
+	if ( !strncmp(query, "signal ", 7) ) {
+		c = (uint32)strtoul(query + 7, &end, 10);
+		if ( end == query + 7 || *end || c >= view->numSignals ) {
+			fprintf(out, "error: no such signal\n");
+			return false;
+		}
+		v = rvReadSignal(view, c, self->signals, &at, &processes);
+		version(out, v, at, processes);
+		signalRow(out, c, self->signals);
+		return true;
+	}
+	if ( !strcmp(query, "track") ) {
+		v = rvReadTrack(view, self->cells, &at, &processes);
+		version(out, v, at, processes);
+		for ( i = 0; i < view->numCells; i++ ) {
+			if ( self->cells[i] & 0x80 ) {
+				fprintf(out, "%u,%u,%u,0x%02X\n",
+					i / TG_DIRS / view->yDim, i / TG_DIRS % view->yDim, i % TG_DIRS,
+					self->cells[i]);
+			}
+		}
+		return true;
+	}
+	fprintf(out, "error: unknown query (try signals, signal <n> or track)\n");
+	return false;
+}
+
+#ifdef WIN32
+
+ReturnCode rqStart(
+	struct RailQuery *self, const struct RailView *view, const char *path, const char **error)
+{
+	ReturnCode retVal;
+	(void)view; (void)path;
+	memset(self, 0, sizeof(*self));
+	FAIL(FLP_ARGS, cleanup);
+cleanup:
+	errRender(error, "rqStart(): query sockets are not supported on this platform");
+	return retVal;
+}
+
+void rqStop(struct RailQuery *self) {
+	(void)self;
+}
+
+#else
+
+// Read one query from a client, answer it and hang up. A client that is too slow or sends
+// too much gets nothing.
+static void serve(struct RailQuery *self, int client) {
+	char line[RQ_MAX_LINE + 2];
+	size_t len = 0;
+	ssize_t n;
+	char *answer = NULL;
+	size_t answerLen = 0, sent = 0;
+	FILE *out;
+	const struct timeval timeout = {RQ_READ_MS / 1000, (RQ_READ_MS % 1000) * 1000};
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	while ( len < sizeof(line) - 1 && !memchr(line, '\n', len) ) {
+		n = recv(client, line + len, sizeof(line) - 1 - len, 0);
+		if ( n <= 0 ) {
+			break;
+		}
+		len += (size_t)n;
+	}
+	line[len] = '\0';
+	if ( !len || (len == sizeof(line) - 1 && !memchr(line, '\n', len)) ) {
+		return;
+	}
+	line[strcspn(line, "\r\n")] = '\0';
+	out = open_memstream(&answer, &answerLen);
+	if ( !out ) {
+		return;
+	}
+	rqAnswer(self, line, out);
+	fclose(out);
+	while ( sent < answerLen ) {
+		n = send(client, answer + sent, answerLen - sent, MSG_NOSIGNAL);
+		if ( n <= 0 ) {
+			break;
+		}
+		sent += (size_t)n;
+	}
+	free(answer);
+	self->served++;
+}
+
+static void *serverThread(void *arg) {
+	struct RailQuery *const self = (struct RailQuery *)arg;
+	struct pollfd pfd;
+	int client;
+	pfd.fd = self->fd;
+	pfd.events = POLLIN;
+	while ( !__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE) ) {
+		if ( poll(&pfd, 1, RQ_POLL_MS) <= 0 ) {
+			continue;
+		}
+		client = accept(self->fd, NULL, NULL);
+		if ( client >= 0 ) {
+			serve(self, client);
+			close(client);
+		}
+	}
+	return NULL;
+}
+
+ReturnCode rqStart(
+	struct RailQuery *self, const struct RailView *view, const char *path, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct sockaddr_un addr;
+	struct stat st;
+	bool bound = false;
+	memset(self, 0, sizeof(*self));
+	self->view = view;
+	self->fd = -1;
+	CHECK_STATUS(
+		strlen(path) >= sizeof(addr.sun_path), FLP_ARGS, cleanup,
+		"rqStart(): socket path %s is too long", path);
+	self->path = (char *)malloc(strlen(path) + 1);
+	self->signals = (struct RailViewSignal *)malloc(view->numSignals * sizeof(struct RailViewSignal));
+	self->cells = (uint8 *)malloc(view->numCells);
+	CHECK_STATUS(
+		!self->path || !self->signals || !self->cells, FLP_NO_MEMORY, cleanup,
+		"rqStart(): out of memory");
+	strcpy(self->path, path);
+
+	// A stale socket from an earlier run is replaced, but nothing else is
+	CHECK_STATUS(
+		!lstat(path, &st) && !S_ISSOCK(st.st_mode), FLP_ARGS, cleanup,
+		"rqStart(): %s exists and is not a socket", path);
+	self->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	CHECK_STATUS(self->fd < 0, FLP_ARGS, cleanup, "rqStart(): cannot create a socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	bound = !bind(self->fd, (struct sockaddr *)&addr, sizeof(addr));
+	CHECK_STATUS(
+		!bound || listen(self->fd, 16), FLP_ARGS, cleanup,
+		"rqStart(): cannot listen on %s", path);
+	CHECK_STATUS(
+		pthread_create(&self->server, NULL, serverThread, self), FLP_NO_MEMORY, cleanup,
+		"rqStart(): cannot start the server thread");
+	return FLP_SUCCESS;
+cleanup:
+	if ( self->fd >= 0 ) {
+		close(self->fd);
+	}
+	if ( bound ) {
+		unlink(path);
+	}
+	free(self->cells);
+	free(self->signals);
+	free(self->path);
+	memset(self, 0, sizeof(*self));
+	self->fd = -1;
+	return retVal;
+}
+
+void rqStop(struct RailQuery *self) {
+	if ( !self->path ) {
+		return;
+	}
+	__atomic_store_n(&self->stop, true, __ATOMIC_RELEASE);
+	pthread_join(self->server, NULL);
+	close(self->fd);
+	unlink(self->path);
+	free(self->cells);
+	free(self->signals);
+	free(self->path);
+	self->cells = NULL;
+	self->signals = NULL;
+	self->path = NULL;
+	self->fd = -1;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILQUERY_H
+#define RAILQUERY_H
+
+#ifndef WIN32
+	#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <makestuff.h>
+#include "flcli.h"
+#include "railview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Answers queries about a RailView on a local (AF_UNIX) stream socket, from a thread of its
+	// own, so the controller never waits for a client. Each connection sends one line and gets
+	// the answer back, after which the server closes it. Every answer starts with a line giving
+	// the view's version, the controller clock it was published at and the total processes:
+	//
+	//   signals          every signal: signal,state,x,y,processes,since
+	//   signal <n>       just signal n, likewise
+	//   track            every known cell: x,y,dir,cell (the protocol byte, in hex)
+	//
+	// A bad query gets a single line starting "error:".
+	#define RQ_MAX_LINE 64
+
+	struct RailQuery {
+		const struct RailView *view;
+		char *path;
+		int fd;
+		struct RailViewSignal *signals;  // server thread's copies
+		uint8 *cells;
+		uint32 served;                   // connections answered
+		bool stop;
+		#ifndef WIN32
+			pthread_t server;
+		#endif
+	};
+
+	// Bind the socket at path, replacing any stale one, and start answering queries. Anything
+	// else already at path is left alone and fails the start.
+	ReturnCode rqStart(
+		struct RailQuery *self, const struct RailView *view, const char *path, const char **error
+	);
+
+	// Stop answering and remove the socket.
+	void rqStop(struct RailQuery *self);
+
+	// Format the answer to a query into out, as the server would send it. Returns false for a
+	// bad query, with the error line in out.
+	bool rqAnswer(struct RailQuery *self, const char *query, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
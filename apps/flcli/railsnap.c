@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railsnap.h"
+#include "railctl.h"
+#include "tracktab.h"
+#include "timerwheel.h"
+#include "clock.h"
+
+ReturnCode railSnapInit(
+	struct RailSnap *self, const char *path, uint64 interval, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	self->path = (char *)malloc(strlen(path) + 1);
+	CHECK_STATUS(!self->path, FLP_NO_MEMORY, cleanup, "railSnapInit(): out of memory");
+	strcpy(self->path, path);
+	self->interval = interval;
+	self->nextSave = 0;
+cleanup:
+	return retVal;
+}
+
+void railSnapDestroy(struct RailSnap *self) {
+	free(self->path);
+	self->path = NULL;
+}
+
+// Time from now until then, or zero if it has passed.
+static uint64 until(uint64 then, uint64 now) {
+	return then > now ? then - now : 0;
+}
+
+ReturnCode railSnapWrite(struct RailCtl *ctl, const char *path, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	char *const tmpPath = (char *)malloc(strlen(path) + 5);
+	const struct TimerWheel *const wheel = &ctl->wheel;
+	const uint64 now = clkNow(ctl->port->clock);
+	struct RailSnapHeader hdr;
+	struct RailSnapChannel rec;
+	FILE *file = NULL;
+	uint32 c;
+	CHECK_STATUS(!tmpPath, FLP_NO_MEMORY, cleanup, "railSnapWrite(): out of memory");
+
+	// A snapshot must not claim progress the track table could lose
+	retVal = trackSync(ctl->track, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+	file = fopen(tmpPath, "wb");
+	CHECK_STATUS(!file, FLP_CANNOT_SAVE, cleanup, "railSnapWrite(): cannot create %s", tmpPath);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RAILSNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = RAILSNAP_VERSION;
+	hdr.numChannels = ctl->numChannels;
+	hdr.savedEpoch = clkEpochMicros();
+	hdr.processes = ctl->processes;
+	fwrite(&hdr, sizeof(hdr), 1, file);
+	memset(&rec, 0, sizeof(rec));
+	for ( c = 0; c < ctl->numChannels; c++ ) {
+		const struct RailChannel *const ch = ctl->chan + c;
+		rec.state = (uint8)ch->state;
+		rec.x = ch->x;
+		rec.y = ch->y;
+		rec.processes = ch->processes;
+		rec.wakeIn = twPending(&ch->timer) ?
+			until(wheel->origin + ch->timer.expires * wheel->tickMicros, now) : TW_NEVER;
+		rec.deadlineIn = until(ch->deadline, now);
+		rec.rest = ch->rest;
+		fwrite(&rec, sizeof(rec), 1, file);
+	}
+
+	// No fsync: the snapshot is there for when the controller dies, not the machine; after a
+	// power cut, an older snapshot only means more channels starting over.
+	CHECK_STATUS(
+		fflush(file) || ferror(file), FLP_CANNOT_SAVE, cleanup,
+		"railSnapWrite(): cannot write %s", tmpPath);
+	fclose(file);
+	file = NULL;
+	#ifdef WIN32
+		remove(path);
+	#endif
+	CHECK_STATUS(
+		rename(tmpPath, path), FLP_CANNOT_SAVE, cleanup,
+		"railSnapWrite(): cannot replace %s", path);
+cleanup:
+	if ( file ) {
+		fclose(file);
+		remove(tmpPath);
+	}
+	free(tmpPath);
+	return retVal;
+}
+
+ReturnCode railSnapTick(struct RailSnap *self, struct RailCtl *ctl, uint64 now, const char **error) {
+	if ( !self->interval ) {
+		return FLP_SUCCESS;
+	}
+	if ( !self->nextSave ) {
+		self->nextSave = now + self->interval;
+		return FLP_SUCCESS;
+	}
+	if ( now < self->nextSave ) {
+		return FLP_SUCCESS;
+	}
+	self->nextSave = now + self->interval;
+	return railSnapWrite(ctl, self->path, error);
+}
+
+ReturnCode railSnapLoad(
+	struct RailCtl *ctl, const char *path, bool *found, uint32 *revalidated,
+	const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FILE *const file = fopen(path, "rb");
+	struct RailSnapHeader hdr;
+	struct RailSnapChannel rec;
+	uint64 now, epoch, down;
+	uint32 c, numSaved, numBack = 0;
+	*found = file != NULL;
+	if ( !file ) {
+		return FLP_SUCCESS;
+	}
+	CHECK_STATUS(
+		fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+		memcmp(hdr.magic, RAILSNAP_MAGIC, sizeof(hdr.magic)) ||
+		hdr.version != RAILSNAP_VERSION,
+		FLP_CANNOT_LOAD, cleanup, "railSnapLoad(): %s is not a version %d rail snapshot",
+		path, RAILSNAP_VERSION);
+
+	// Charge the time the controller was down against every timer and deadline
+	now = clkNow(ctl->port->clock);
+	epoch = clkEpochMicros();
+	down = epoch > hdr.savedEpoch ? epoch - hdr.savedEpoch : 0;
+	numSaved = hdr.numChannels < ctl->numChannels ? hdr.numChannels : ctl->numChannels;
+	for ( c = 0; c < numSaved; c++ ) {
+		struct RailChannel *const ch = ctl->chan + c;
+		CHECK_STATUS(
+			fread(&rec, sizeof(rec), 1, file) != 1 || rec.state >= RAIL_NUM_STATES,
+			FLP_CANNOT_LOAD, cleanup, "railSnapLoad(): %s is truncated or corrupt", path);
+		ch->x = rec.x;
+		ch->y = rec.y;
+		ch->processes = rec.processes;
+		if ( rec.rest > ch->rest && ctl->timing.restMax > ch->rest ) {
+			ch->rest = rec.rest < ctl->timing.restMax ? rec.rest : ctl->timing.restMax;
+		}
+		switch ( (enum RailState)rec.state ) {
+		case RAIL_IDLE:
+		case RAIL_S3:
+			ch->state = (enum RailState)rec.state;
+			ch->deadline = now + until(rec.deadlineIn, down);
+			if ( rec.wakeIn != TW_NEVER ) {
+				twSchedule(&ctl->wheel, &ch->timer, now + until(rec.wakeIn, down));
+			}
+			break;
+		case RAIL_COORD:
+			break;
+		default:
+			numBack++;
+			break;
+		}
+	}
+	ctl->processes = hdr.processes;
+	railCtlRequeue(ctl);
+	if ( revalidated ) {
+		*revalidated = numBack;
+	}
+cleanup:
+	fclose(file);
+	return retVal;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILSNAP_H
+#define RAILSNAP_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "railctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// A snapshot of where every channel is in its handshake, so that a restarted controller can
+	// carry on instead of putting every signal back through the coordinate exchange. The track
+	// table needs nothing extra: it has its own journal, which is synced before each snapshot is
+	// written. Times are stored relative to the moment of saving, with the wall clock of that
+	// moment, so the snapshot survives a change of controller clock. All fields are in host byte
+	// order.
+	#define RAILSNAP_MAGIC "FLRSNAP\0"
+	#define RAILSNAP_VERSION 2
+	#define RAILSNAP_DEFAULT_SECS 1
+
+	struct RailSnapHeader {
+		char magic[8];
+		uint32 version;
+		uint32 numChannels;
+		uint64 savedEpoch;   // wall clock when saved, in microseconds since 1970
+		uint32 processes;    // the controller's total
+		uint32 reserved;
+	};
+
+	struct RailSnapChannel {
+		uint8 state;         // enum RailState
+		uint8 x, y;
+		uint8 reserved;
+		uint32 processes;
+		uint64 wakeIn;       // until the channel's timer was due; TW_NEVER if none was pending
+		uint64 deadlineIn;   // until its deadline; 0 if already passed
+		uint64 rest;         // its current rest; see RailTimings.restMax
+	};
+
+	struct RailSnap {
+		char *path;
+		uint64 interval;     // between periodic saves; 0 for only the final one
+		uint64 nextSave;
+	};
+
+	ReturnCode railSnapInit(
+		struct RailSnap *self, const char *path, uint64 interval, const char **error
+	);
+	void railSnapDestroy(struct RailSnap *self);
+
+	// Sync the track table, then write the controller's channels to a temporary file and rename
+	// it over path.
+	ReturnCode railSnapWrite(struct RailCtl *ctl, const char *path, const char **error);
+
+	// Save if the interval has passed since the last save.
+	ReturnCode railSnapTick(struct RailSnap *self, struct RailCtl *ctl, uint64 now, const char **error);
+
+	// Warm restart: put a freshly-initialised controller's channels back where the snapshot at
+	// path left them, less the time since it was saved. Each channel's rest is kept, within the
+	// controller's current rest and restMax. Channels resting or waiting out S3 keep
+	// their timers; those caught between a write and the answer to it (hello, info1, info2 and
+	// s3-final) cannot be trusted to match their signal and start over at coord, as do any the
+	// snapshot does not cover. Sets *found to false and leaves the controller alone if there is
+	// no snapshot; otherwise *revalidated (if not NULL) gets the number sent back to coord.
+	ReturnCode railSnapLoad(
+		struct RailCtl *ctl, const char *path, bool *found, uint32 *revalidated,
+		const char **error
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
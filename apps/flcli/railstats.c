@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railstats.h"
+
+#define WORST 3  // signals listed per state in the summary
+
+ReturnCode railStatsInit(
+	struct RailStats *self, uint32 numChannels, const char *path, FILE *out, uint64 interval,
+	const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 i;
+	memset(self, 0, sizeof(*self));
+	self->numChannels = numChannels;
+	self->out = out;
+	self->interval = interval;
+	self->chan = (struct Hist *)malloc((size_t)numChannels * RAIL_NUM_STATES * sizeof(struct Hist));
+	CHECK_STATUS(
+		!self->chan, FLP_NO_MEMORY, cleanup,
+		"railStatsInit(): cannot allocate histograms for %u signals", numChannels);
+	if ( path ) {
+		self->path = (char *)malloc(strlen(path) + 1);
+		CHECK_STATUS(!self->path, FLP_NO_MEMORY, cleanup, "railStatsInit(): out of memory");
+		strcpy(self->path, path);
+	}
+	for ( i = 0; i < numChannels * RAIL_NUM_STATES; i++ ) {
+		histInit(self->chan + i);
+	}
+	for ( i = 0; i < RAIL_NUM_STATES; i++ ) {
+		histInit(self->state + i);
+	}
+	return FLP_SUCCESS;
+cleanup:
+	railStatsDestroy(self);
+	return retVal;
+}
+
+void railStatsDestroy(struct RailStats *self) {
+	free(self->path);
+	free(self->chan);
+	self->path = NULL;
+	self->chan = NULL;
+}
+
+void railStatsAdd(struct RailStats *self, uint32 c, enum RailState state, uint64 micros) {
+	const uint32 value = micros > 0xFFFFFFFFU ? 0xFFFFFFFFU : (uint32)micros;
+	histAdd(self->chan + c * RAIL_NUM_STATES + state, value);
+	histAdd(self->state + state, value);
+}
+
+void railStatsSummary(const struct RailStats *self, FILE *out) {
+	uint32 s, c, i;
+	fprintf(out, "Rail handshake time by state:\n");
+	for ( s = 0; s < RAIL_NUM_STATES; s++ ) {
+		uint32 worst[WORST], worstP99[WORST], numWorst = 0;
+		fprintf(out, "  ");
+		histSummary(self->state + s, out, railStateName((enum RailState)s));
+		if ( !self->state[s].count ) {
+			continue;
+		}
+		// Keep the WORST highest p99s, in descending order
+		for ( c = 0; c < self->numChannels; c++ ) {
+			const struct Hist *const h = self->chan + c * RAIL_NUM_STATES + s;
+			uint32 p99;
+			if ( !h->count ) {
+				continue;
+			}
+			p99 = histPercentile(h, 99.0);
+			for ( i = numWorst; i > 0 && worstP99[i - 1] < p99; i-- ) {
+				if ( i < WORST ) {
+					worst[i] = worst[i - 1];
+					worstP99[i] = worstP99[i - 1];
+				}
+			}
+			if ( i < WORST ) {
+				worst[i] = c;
+				worstP99[i] = p99;
+				if ( numWorst < WORST ) {
+					numWorst++;
+				}
+			}
+		}
+		fprintf(out, "    slowest p99:");
+		for ( i = 0; i < numWorst; i++ ) {
+			fprintf(out, " signal %u %uus%s", worst[i], worstP99[i], i + 1 < numWorst ? "," : "");
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void writeRow(FILE *file, const char *signal, enum RailState state, const struct Hist *h) {
+	fprintf(
+		file, "%s,%s,%llu,%u,%llu,%u,%u,%u,%u\n",
+		signal, railStateName(state), (unsigned long long)h->count, h->min,
+		(unsigned long long)(h->sum / h->count), histPercentile(h, 50.0),
+		histPercentile(h, 90.0), histPercentile(h, 99.0), h->max);
+}
+
+ReturnCode railStatsWrite(const struct RailStats *self, const char *path, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	char *const tmpPath = (char *)malloc(strlen(path) + 5);
+	FILE *file = NULL;
+	char signal[16];
+	uint32 s, c;
+	CHECK_STATUS(!tmpPath, FLP_NO_MEMORY, cleanup, "railStatsWrite(): out of memory");
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+	file = fopen(tmpPath, "w");
+	CHECK_STATUS(!file, FLP_CANNOT_SAVE, cleanup, "railStatsWrite(): cannot create %s", tmpPath);
+	fprintf(file, "signal,state,count,min,mean,p50,p90,p99,max\n");
+	for ( s = 0; s < RAIL_NUM_STATES; s++ ) {
+		if ( self->state[s].count ) {
+			writeRow(file, "all", (enum RailState)s, self->state + s);
+		}
+	}
+	for ( c = 0; c < self->numChannels; c++ ) {
+		for ( s = 0; s < RAIL_NUM_STATES; s++ ) {
+			const struct Hist *const h = self->chan + c * RAIL_NUM_STATES + s;
+			if ( h->count ) {
+				sprintf(signal, "%u", c);
+				writeRow(file, signal, (enum RailState)s, h);
+			}
+		}
+	}
+	CHECK_STATUS(
+		fflush(file) || ferror(file), FLP_CANNOT_SAVE, cleanup,
+		"railStatsWrite(): cannot write %s", tmpPath);
+	fclose(file);
+	file = NULL;
+	#ifdef WIN32
+		remove(path);
+	#endif
+	CHECK_STATUS(
+		rename(tmpPath, path), FLP_CANNOT_SAVE, cleanup,
+		"railStatsWrite(): cannot replace %s", path);
+cleanup:
+	if ( file ) {
+		fclose(file);
+		remove(tmpPath);
+	}
+	free(tmpPath);
+	return retVal;
+}
+
+ReturnCode railStatsDump(struct RailStats *self, const char **error) {
+	if ( self->out ) {
+		railStatsSummary(self, self->out);
+		fflush(self->out);
+	}
+	return self->path ? railStatsWrite(self, self->path, error) : FLP_SUCCESS;
+}
+
+ReturnCode railStatsTick(struct RailStats *self, uint64 now, const char **error) {
+	if ( !self->interval ) {
+		return FLP_SUCCESS;
+	}
+	if ( !self->nextDump ) {
+		self->nextDump = now + self->interval;
+		return FLP_SUCCESS;
+	}
+	if ( now < self->nextDump ) {
+		return FLP_SUCCESS;
+	}
+	self->nextDump = now + self->interval;
+	return railStatsDump(self, error);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILSTATS_H
+#define RAILSTATS_H
+
+#include <stdio.h>
+#include <makestuff.h>
+#include "flcli.h"
+#include "hist.h"
+#include "railctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// How long each signal spends in each handshake state, one histogram per signal and state
+	// plus one per state over all signals. Times are on the controller's clock, in microseconds.
+	struct RailStats {
+		uint32 numChannels;
+		struct Hist *chan;                 // numChannels * RAIL_NUM_STATES, signal-major
+		struct Hist state[RAIL_NUM_STATES];
+		char *path;                        // rewritten at every dump; NULL for none
+		FILE *out;                         // where summaries go; NULL for none
+		uint64 interval;                   // between periodic dumps; 0 for only the final one
+		uint64 nextDump;
+	};
+
+	ReturnCode railStatsInit(
+		struct RailStats *self, uint32 numChannels, const char *path, FILE *out,
+		uint64 interval, const char **error
+	);
+	void railStatsDestroy(struct RailStats *self);
+
+	// Signal c has just left state after spending micros in it.
+	void railStatsAdd(struct RailStats *self, uint32 c, enum RailState state, uint64 micros);
+
+	// Per-state summaries over all signals, each followed by the signals with the worst p99.
+	void railStatsSummary(const struct RailStats *self, FILE *out);
+
+	// CSV of every non-empty histogram: signal (or "all"), state, count, min, mean, p50, p90, p99
+	// and max. Written to a temporary file and renamed over path.
+	ReturnCode railStatsWrite(const struct RailStats *self, const char *path, const char **error);
+
+	// Print the summary and rewrite the file, as configured.
+	ReturnCode railStatsDump(struct RailStats *self, const char **error);
+
+	// Dump if the interval has passed since the last one.
+	ReturnCode railStatsTick(struct RailStats *self, uint64 now, const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "railview.h"
+#include "railctl.h"
+#include "tracktab.h"
+#include "trackgrid.h"
+
+static void copySignal(struct RailViewSignal *out, const struct RailChannel *ch) {
+	out->state = (uint8)ch->state;
+	out->x = ch->x;
+	out->y = ch->y;
+	out->reserved = 0;
+	out->processes = ch->processes;
+	out->since = ch->enteredAt;
+}
+
+ReturnCode rvInit(struct RailView *self, const struct RailCtl *ctl, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	const struct TrackGrid *const grid = &ctl->track->grid;
+	uint32 i;
+	memset(self, 0, sizeof(*self));
+	self->numSignals = ctl->numChannels;
+	self->xDim = grid->xDim;
+	self->yDim = grid->yDim;
+	self->numCells = grid->numCells;
+	self->signal = (struct RailViewSignal *)malloc(self->numSignals * sizeof(struct RailViewSignal));
+	self->cell = (uint8 *)malloc(self->numCells);
+	self->dirtySignal = (uint32 *)malloc(self->numSignals * sizeof(uint32));
+	self->dirtyCell = (uint32 *)malloc(self->numSignals * sizeof(uint32));
+	self->signalDirty = (uint8 *)calloc(self->numSignals, 1);
+	CHECK_STATUS(
+		!self->signal || !self->cell || !self->dirtySignal || !self->dirtyCell ||
+		!self->signalDirty, FLP_NO_MEMORY, cleanup, "rvInit(): out of memory");
+	for ( i = 0; i < self->numSignals; i++ ) {
+		copySignal(self->signal + i, ctl->chan + i);
+	}
+	for ( i = 0; i < self->numCells; i++ ) {
+		self->cell[i] = tgCell(grid, i);
+	}
+	self->processes = ctl->processes;
+	return FLP_SUCCESS;
+cleanup:
+	rvDestroy(self);
+	return retVal;
+}
+
+void rvDestroy(struct RailView *self) {
+	free(self->signalDirty);
+	free(self->dirtyCell);
+	free(self->dirtySignal);
+	free(self->cell);
+	free(self->signal);
+	self->signalDirty = NULL;
+	self->dirtyCell = NULL;
+	self->dirtySignal = NULL;
+	self->cell = NULL;
+	self->signal = NULL;
+}
+
+void rvTouchSignal(struct RailView *self, uint32 c) {
+	if ( !self->signalDirty[c] ) {
+		self->signalDirty[c] = 1;
+		self->dirtySignal[self->numDirtySignals++] = c;
+	}
+}
+
+// A pass updates at most one cell per signal, so this only overflows if publishes are skipped.
+void rvTouchCell(struct RailView *self, uint32 index) {
+	if ( self->numDirtyCells < self->numSignals ) {
+		self->dirtyCell[self->numDirtyCells++] = index;
+	} else {
+		self->allCells = true;
+	}
+}
+
+void rvPublish(struct RailView *self, const struct RailCtl *ctl, uint64 now) {
+	const struct TrackGrid *const grid = &ctl->track->grid;
+	const uint64 seq = self->seq;
+	uint32 i;
+	if ( !self->numDirtySignals && !self->numDirtyCells && !self->allCells ) {
+		return;
+	}
+	__atomic_store_n(&self->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for ( i = 0; i < self->numDirtySignals; i++ ) {
+		const uint32 c = self->dirtySignal[i];
+		copySignal(self->signal + c, ctl->chan + c);
+		self->signalDirty[c] = 0;
+	}
+	if ( self->allCells ) {
+		for ( i = 0; i < self->numCells; i++ ) {
+			self->cell[i] = tgCell(grid, i);
+		}
+	} else {
+		for ( i = 0; i < self->numDirtyCells; i++ ) {
+			self->cell[self->dirtyCell[i]] = tgCell(grid, self->dirtyCell[i]);
+		}
+	}
+	self->at = now;
+	self->processes = ctl->processes;
+	__atomic_store_n(&self->seq, seq + 2, __ATOMIC_RELEASE);
+	self->numDirtySignals = 0;
+	self->numDirtyCells = 0;
+	self->allCells = false;
+}
+
+// Copy length bytes from src, which the controller publishes into, until the copy is whole.
+// The controller holds the seqlock only while copying in a pass's changes, so this spins at
+// most that long each time round.
+static uint64 readStable(
+	const struct RailView *self, const void *src, void *dst, size_t length, uint64 *at,
+	uint32 *processes)
+{
+	uint64 seq, t;
+	uint32 p;
+	for ( ;; ) {
+		seq = __atomic_load_n(&self->seq, __ATOMIC_ACQUIRE);
+		if ( seq & 1 ) {
+			continue;
+		}
+		memcpy(dst, src, length);
+		t = self->at;
+		p = self->processes;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ( __atomic_load_n(&self->seq, __ATOMIC_RELAXED) == seq ) {
+			break;
+		}
+	}
+	if ( at ) {
+		*at = t;
+	}
+	if ( processes ) {
+		*processes = p;
+	}
+	return seq / 2;
+}
+
+uint64 rvReadSignals(
+	const struct RailView *self, struct RailViewSignal *signals, uint64 *at, uint32 *processes)
+{
+	return readStable(
+		self, self->signal, signals, self->numSignals * sizeof(struct RailViewSignal), at,
+		processes);
+}
+
+uint64 rvReadSignal(
+	const struct RailView *self, uint32 c, struct RailViewSignal *signal, uint64 *at,
+	uint32 *processes)
+{
+	return readStable(self, self->signal + c, signal, sizeof(*signal), at, processes);
+}
+
+uint64 rvReadTrack(
+	const struct RailView *self, uint8 *cells, uint64 *at, uint32 *processes)
+{
+	return readStable(self, self->cell, cells, self->numCells, at, processes);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RAILVIEW_H
+#define RAILVIEW_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "railctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// A copy of the controller's signal and track state that other threads can read while it
+	// runs. The controller owns it and is its only writer: as it goes it notes which signals and
+	// cells have changed, and at the end of each pass copies just those in under a seqlock. A
+	// reader copies out what it wants and checks the sequence number did not move meanwhile,
+	// retrying if it did, so it never sees a pass half-applied and never makes the controller
+	// wait. Passes that change nothing leave the sequence number alone.
+	struct RailViewSignal {
+		uint8 state;         // enum RailState
+		uint8 x, y;          // coordinates, as last sent
+		uint8 reserved;
+		uint32 processes;
+		uint64 since;        // controller clock when it entered state
+	};
+
+	struct RailView {
+		// Published; use the rvRead*() functions
+		uint64 seq;          // odd while the controller is publishing
+		uint64 at;           // controller clock as of the last publish
+		uint32 processes;    // the controller's total
+		uint32 numSignals;
+		uint32 xDim, yDim;
+		uint32 numCells;
+		struct RailViewSignal *signal;
+		uint8 *cell;         // protocol cell byte of every track cell, in tgIndex() order
+
+		// Controller only: what to copy in at the next publish
+		uint32 numDirtySignals, numDirtyCells;
+		uint32 *dirtySignal, *dirtyCell;
+		uint8 *signalDirty;
+		bool allCells;       // more cells changed than dirtyCell holds
+	};
+
+	// Size the view for the controller's channels and track table and publish them whole.
+	ReturnCode rvInit(struct RailView *self, const struct RailCtl *ctl, const char **error);
+	void rvDestroy(struct RailView *self);
+
+	// Controller side: note that a signal or a track cell has changed.
+	void rvTouchSignal(struct RailView *self, uint32 c);
+	void rvTouchCell(struct RailView *self, uint32 index);
+
+	// Controller side: copy in everything touched since the last publish.
+	void rvPublish(struct RailView *self, const struct RailCtl *ctl, uint64 now);
+
+	// Reader side. Each fills in a consistent copy and returns the number of publishes it
+	// reflects; at and processes are optional.
+	uint64 rvReadSignals(
+		const struct RailView *self, struct RailViewSignal *signals, uint64 *at, uint32 *processes
+	);
+	uint64 rvReadSignal(
+		const struct RailView *self, uint32 c, struct RailViewSignal *signal, uint64 *at,
+		uint32 *processes
+	);
+	uint64 rvReadTrack(
+		const struct RailView *self, uint8 *cells, uint64 *at, uint32 *processes
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
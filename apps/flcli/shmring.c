@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "shmring.h"
+
+#define RECORD_ALIGN 8
+#define ALIGN_UP(x) (((x) + RECORD_ALIGN - 1) & ~(uint64)(RECORD_ALIGN - 1))
+
+static char *shmName(const char *name) {
+	const size_t length = strlen(name);
+	char *const result = (char *)malloc(length + 2);
+	if ( result ) {
+		if ( name[0] == '/' ) {
+			memcpy(result, name, length + 1);
+		} else {
+			result[0] = '/';
+			memcpy(result + 1, name, length + 1);
+		}
+	}
+	return result;
+}
+
+#ifdef WIN32
+
+ReturnCode shmRingCreate(
+	struct ShmRing *self, const char *name, size_t capacity, const char **error)
+{
+	ReturnCode retVal;
+	(void)self; (void)name; (void)capacity;
+	FAIL(FLP_ARGS, cleanup);
+cleanup:
+	errRender(error, "shmRingCreate(): shared-memory rings are not supported on this platform");
+	return retVal;
+}
+
+ReturnCode shmRingAttach(struct ShmRing *self, const char *name, const char **error) {
+	return shmRingCreate(self, name, 0, error);
+}
+
+void shmRingDestroy(struct ShmRing *self) {
+	(void)self;
+}
+
+void shmRingDetach(struct ShmRing *self) {
+	(void)self;
+}
+
+#else
+
+static void unmap(struct ShmRing *self) {
+	if ( self->hdr ) {
+		munmap((void *)self->hdr, self->mapSize);
+		self->hdr = NULL;
+		self->data = NULL;
+	}
+	free(self->name);
+	self->name = NULL;
+}
+
+ReturnCode shmRingCreate(
+	struct ShmRing *self, const char *name, size_t capacity, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	size_t cap = 4096;
+	int fd = -1;
+	void *map;
+	memset(self, 0, sizeof(*self));
+	CHECK_STATUS(
+		capacity > ((size_t)SHM_MAX_MB << 20), FLP_ARGS, cleanup,
+		"shmRingCreate(): a ring may be at most %d MB", SHM_MAX_MB);
+	while ( cap < capacity ) {
+		cap <<= 1;
+	}
+	self->name = shmName(name);
+	CHECK_STATUS(!self->name, FLP_NO_MEMORY, cleanup, "shmRingCreate(): out of memory");
+	fd = shm_open(self->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	CHECK_STATUS(fd < 0, FLP_CANNOT_SAVE, cleanup, "shmRingCreate(): cannot create %s", self->name);
+	self->mapSize = sizeof(struct ShmRingHeader) + cap;
+	CHECK_STATUS(
+		ftruncate(fd, (off_t)self->mapSize), FLP_CANNOT_SAVE, cleanup,
+		"shmRingCreate(): cannot size %s", self->name);
+	map = mmap(NULL, self->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	CHECK_STATUS(map == MAP_FAILED, FLP_CANNOT_SAVE, cleanup, "shmRingCreate(): cannot map %s", self->name);
+	self->hdr = (struct ShmRingHeader *)map;
+	self->data = (uint8 *)map + sizeof(struct ShmRingHeader);
+	self->hdr->version = SHM_VERSION;
+	self->hdr->capacity = cap;
+	self->hdr->reserve = 0;
+	self->hdr->head = 0;
+	self->hdr->records = 0;
+	__atomic_store_n(&self->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+cleanup:
+	if ( fd >= 0 ) {
+		close(fd);
+	}
+	if ( retVal ) {
+		if ( fd >= 0 ) {
+			shm_unlink(self->name);
+		}
+		unmap(self);
+	}
+	return retVal;
+}
+
+void shmRingDestroy(struct ShmRing *self) {
+	if ( self->name ) {
+		shm_unlink(self->name);
+	}
+	unmap(self);
+}
+
+ReturnCode shmRingAttach(struct ShmRing *self, const char *name, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct stat st;
+	int fd = -1;
+	void *map;
+	memset(self, 0, sizeof(*self));
+	self->name = shmName(name);
+	CHECK_STATUS(!self->name, FLP_NO_MEMORY, cleanup, "shmRingAttach(): out of memory");
+	fd = shm_open(self->name, O_RDONLY, 0);
+	CHECK_STATUS(fd < 0, FLP_CANNOT_LOAD, cleanup, "shmRingAttach(): cannot open %s", self->name);
+	CHECK_STATUS(
+		fstat(fd, &st) || (size_t)st.st_size < sizeof(struct ShmRingHeader), FLP_CANNOT_LOAD, cleanup,
+		"shmRingAttach(): %s is not a capture ring", self->name);
+	self->mapSize = (size_t)st.st_size;
+	map = mmap(NULL, self->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+	CHECK_STATUS(map == MAP_FAILED, FLP_CANNOT_LOAD, cleanup, "shmRingAttach(): cannot map %s", self->name);
+	self->hdr = (struct ShmRingHeader *)map;
+	self->data = (uint8 *)map + sizeof(struct ShmRingHeader);
+	CHECK_STATUS(
+		__atomic_load_n(&self->hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+		self->hdr->version != SHM_VERSION ||
+		sizeof(struct ShmRingHeader) + self->hdr->capacity != self->mapSize,
+		FLP_CANNOT_LOAD, cleanup, "shmRingAttach(): %s is not a version %d capture ring",
+		self->name, SHM_VERSION);
+	self->pos = __atomic_load_n(&self->hdr->head, __ATOMIC_ACQUIRE);
+cleanup:
+	if ( fd >= 0 ) {
+		close(fd);
+	}
+	if ( retVal ) {
+		unmap(self);
+	}
+	return retVal;
+}
+
+void shmRingDetach(struct ShmRing *self) {
+	unmap(self);
+}
+
+#endif
+
+ReturnCode shmRingPublish(
+	struct ShmRing *self, uint8 channel, const uint8 *data, uint32 length, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct ShmRingHeader *const hdr = self->hdr;
+	const uint64 cap = hdr->capacity;
+	const uint64 need = ALIGN_UP(sizeof(struct ShmRecord) + (uint64)length);
+	uint64 head = hdr->head;
+	uint64 offset = head & (cap - 1);
+	struct ShmRecord *rec;
+	CHECK_STATUS(
+		need > cap / 2, FLP_ARGS, cleanup,
+		"shmRingPublish(): %u-byte chunk is too big for a %llu-byte ring",
+		length, (unsigned long long)cap);
+
+	// Records never wrap; if this one won't fit before the end, pad to the start
+	if ( offset + need > cap ) {
+		const uint64 pad = cap - offset;
+		__atomic_store_n(&hdr->reserve, head + pad, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		((struct ShmRecord *)(self->data + offset))->length = SHM_PAD_RECORD;
+		head += pad;
+		offset = 0;
+		__atomic_store_n(&hdr->head, head, __ATOMIC_RELEASE);
+	}
+
+	// Claim the space, fill it in, then publish it
+	__atomic_store_n(&hdr->reserve, head + need, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec = (struct ShmRecord *)(self->data + offset);
+	rec->length = length;
+	rec->channel = channel;
+	rec->seq = hdr->records;
+	memcpy(rec + 1, data, length);
+	hdr->records++;
+	__atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+cleanup:
+	return retVal;
+}
+
+ShmStatus shmRingPeek(
+	struct ShmRing *self, const uint8 **data, uint32 *length, uint8 *channel, uint64 *seq)
+{
+	const uint64 cap = self->hdr->capacity;
+	for ( ;; ) {
+		const uint64 head = __atomic_load_n(&self->hdr->head, __ATOMIC_ACQUIRE);
+		const struct ShmRecord *rec;
+		uint32 recLength;
+		if ( self->pos == head ) {
+			return SHM_EMPTY;
+		}
+		if ( head - self->pos > cap ) {
+			self->pos = head;
+			return SHM_LOST;
+		}
+		rec = (const struct ShmRecord *)(self->data + (self->pos & (cap - 1)));
+		recLength = rec->length;
+		if ( recLength == SHM_PAD_RECORD ) {
+			self->length = cap - (self->pos & (cap - 1));
+			if ( shmRingCommit(self) == SHM_LOST ) {
+				return SHM_LOST;
+			}
+			continue;
+		}
+		if ( ALIGN_UP(sizeof(struct ShmRecord) + (uint64)recLength) > cap / 2 ) {
+			// A torn header: the producer lapped us while we were reading it
+			self->pos = head;
+			return SHM_LOST;
+		}
+		*data = (const uint8 *)(rec + 1);
+		*length = recLength;
+		*channel = (uint8)rec->channel;
+		*seq = rec->seq;
+		self->length = ALIGN_UP(sizeof(struct ShmRecord) + (uint64)recLength);
+		return SHM_OK;
+	}
+}
+
+ShmStatus shmRingCommit(struct ShmRing *self) {
+	uint64 reserve;
+	const uint64 start = self->pos;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	reserve = __atomic_load_n(&self->hdr->reserve, __ATOMIC_RELAXED);
+	self->pos += self->length;
+	self->length = 0;
+	if ( reserve - start > self->hdr->capacity ) {
+		self->pos = __atomic_load_n(&self->hdr->head, __ATOMIC_ACQUIRE);
+		return SHM_LOST;
+	}
+	return SHM_OK;
+}
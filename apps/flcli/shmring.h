@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <makestuff.h>
+#include "flcli.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// A named POSIX shared-memory ring carrying captured chunks from one producer (flcli) to any
+	// number of local consumers. The producer never waits: a consumer that falls more than the
+	// ring's capacity behind loses data, and finds out when it commits or peeks next.
+	//
+	// Positions are 64-bit byte counts that only ever increase. Before overwriting, the producer
+	// advances "reserve"; once the record is complete it advances "head". A consumer reads a record
+	// in place, then checks "reserve" to confirm the bytes it looked at were not recycled meanwhile.
+	#define SHM_MAGIC 0x52534C46  // "FLSR"
+	#define SHM_VERSION 1
+	#define SHM_PAD_RECORD 0xFFFFFFFF
+	#define SHM_MAX_MB 1024       // largest ring; records may be up to half a ring
+
+	struct ShmRingHeader {
+		uint32 magic;
+		uint32 version;
+		uint64 capacity;  // data bytes following the header; a power of two
+		uint64 reserve;   // end of the region the producer may be writing
+		uint64 head;      // end of the last complete record
+		uint64 records;   // records published so far
+		uint8 reserved[24];
+	};
+
+	struct ShmRecord {
+		uint32 length;    // payload bytes, or SHM_PAD_RECORD to skip to the start of the ring
+		uint32 channel;
+		uint64 seq;
+	};
+
+	struct ShmRing {
+		struct ShmRingHeader *hdr;
+		uint8 *data;
+		size_t mapSize;
+		char *name;
+		uint64 pos;       // consumer only: position of the next record to read
+		uint64 length;    // consumer only: bytes occupied by the record being read
+	};
+
+	typedef enum {
+		SHM_OK,
+		SHM_EMPTY,
+		SHM_LOST
+	} ShmStatus;
+
+	// Producer side. The name gets a leading '/' if it does not already have one; capacity is
+	// rounded up to a power of two. The object is unlinked again by shmRingDestroy().
+	ReturnCode shmRingCreate(
+		struct ShmRing *self, const char *name, size_t capacity, const char **error
+	);
+	ReturnCode shmRingPublish(
+		struct ShmRing *self, uint8 channel, const uint8 *data, uint32 length, const char **error
+	);
+	void shmRingDestroy(struct ShmRing *self);
+
+	// Consumer side. Attaching starts at the current head, i.e. only new data is seen.
+	ReturnCode shmRingAttach(struct ShmRing *self, const char *name, const char **error);
+
+	// Point *data at the next record's payload, in the shared mapping. SHM_LOST means the consumer
+	// was lapped; it has been moved up to the producer's head and should call again.
+	ShmStatus shmRingPeek(
+		struct ShmRing *self, const uint8 **data, uint32 *length, uint8 *channel, uint64 *seq
+	);
+
+	// Finish with the record returned by shmRingPeek(). Returns SHM_LOST if the producer may have
+	// overwritten it while it was being read, in which case the data should be discarded.
+	ShmStatus shmRingCommit(struct ShmRing *self);
+
+	void shmRingDetach(struct ShmRing *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
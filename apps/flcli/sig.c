@@ -1,4 +1,5 @@
 #include <makestuff.h>
+#include "flcli.h"
 #ifdef WIN32
 	#include <windows.h>
 #else
@@ -7,11 +8,20 @@
 #endif
 
 static bool m_sigint = false;
+static bool m_trigger = false;
 
 bool sigIsRaised(void) {
 	return m_sigint;
 }
 
+bool sigTakeTrigger(void) {
+	const bool trigger = m_trigger;
+	if ( trigger ) {
+		m_trigger = false;
+	}
+	return trigger;
+}
+
 #ifdef WIN32
 	static BOOL sigHandler(DWORD signum) {
 		if ( signum == CTRL_C_EVENT ) {
@@ -41,3 +51,20 @@ void sigRegisterHandler(void) {
 		}
 	#endif
 }
+
+#ifndef WIN32
+	static void trigHandler(int signum) {
+		(void)signum;
+		m_trigger = true;
+	}
+#endif
+
+void sigRegisterTrigger(void) {
+	#ifndef WIN32
+		struct sigaction newAction;
+		newAction.sa_handler = trigHandler;
+		sigemptyset(&newAction.sa_mask);
+		newAction.sa_flags = 0;
+		sigaction(SIGUSR1, &newAction, NULL);
+	#endif
+}
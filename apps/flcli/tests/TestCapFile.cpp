@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+#include <liberror.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "capfile.h"
+
+namespace {
+
+	const char *const CAP_PATH = "capfile-test.flcap";
+
+	// Chunk i is 10 + i bytes of i, completed i ms into the capture
+	const uint32 NUM_CHUNKS = 10;
+
+	uint32 chunkLength(uint32 i) {
+		return 10 + i;
+	}
+
+	uint64 chunkStart(uint32 i) {
+		uint64 start = 0;
+		for ( uint32 j = 0; j < i; j++ ) {
+			start += chunkLength(j);
+		}
+		return start;
+	}
+
+	// Write the chunks with an index every four, so the last index holds only two
+	void writeCapture() {
+		struct CapWriter writer;
+		const char *error = NULL;
+		std::vector<uint8> data;
+		CHECK_EQUAL(FLP_SUCCESS, capCreate(&writer, CAP_PATH, 4, &error));
+		for ( uint32 i = 0; i < NUM_CHUNKS; i++ ) {
+			data.assign(chunkLength(i), (uint8)i);
+			CHECK_EQUAL(
+				FLP_SUCCESS,
+				capAppend(&writer, (uint8)(i % 2), writer.hdr.startMicros + 1000 * i, &data[0], chunkLength(i), &error));
+		}
+		CHECK_EQUAL(FLP_SUCCESS, capClose(&writer, &error));
+	}
+
+	// The chunk at offset must be chunk i
+	void checkChunk(const struct CapReader *reader, uint64 offset, uint32 i) {
+		const uint8 *data = NULL;
+		const struct CapRecord *const rec = capNext(reader, &offset, &data);
+		CHECK(rec != NULL);
+		if ( rec ) {
+			CHECK_EQUAL(chunkLength(i), rec->length);
+			CHECK_EQUAL(1000ULL * i, rec->micros);
+			CHECK_EQUAL(i % 2, rec->channel);
+			CHECK_EQUAL(i, (uint32)data[0]);
+			CHECK_EQUAL(i, (uint32)data[rec->length - 1]);
+		}
+	}
+}
+
+TEST(CapFile_roundTrip) {
+	struct CapReader reader;
+	const char *error = NULL;
+	const struct CapRecord *rec;
+	const uint8 *data;
+	uint64 offset, start, i;
+	writeCapture();
+	CHECK_EQUAL(FLP_SUCCESS, capMap(&reader, CAP_PATH, &error));
+	CHECK_EQUAL((uint64)NUM_CHUNKS, reader.numIndex);
+	CHECK_EQUAL((uint64)NUM_CHUNKS, reader.hdr->numChunks);
+
+	// Every chunk in order, with the index records skipped
+	offset = sizeof(struct CapFileHeader);
+	for ( i = 0; (rec = capNext(&reader, &offset, &data)); i++ ) {
+		CHECK_EQUAL(chunkLength((uint32)i), rec->length);
+	}
+	CHECK_EQUAL((uint64)NUM_CHUNKS, i);
+
+	// By time: the first chunk at or after the target
+	for ( i = 0; i < NUM_CHUNKS; i++ ) {
+		offset = capSeekTime(&reader, 1000 * i, &start);
+		checkChunk(&reader, offset, (uint32)i);
+		CHECK_EQUAL(chunkStart((uint32)i), start);
+		if ( i ) {
+			offset = capSeekTime(&reader, 1000 * i - 500, &start);
+			checkChunk(&reader, offset, (uint32)i);
+		}
+	}
+	CHECK_EQUAL((uint64)reader.mapSize, capSeekTime(&reader, 1000 * NUM_CHUNKS, &start));
+
+	// By stream offset: the chunk holding the byte
+	for ( i = 0; i < NUM_CHUNKS; i++ ) {
+		offset = capSeekOffset(&reader, chunkStart((uint32)i), &start);
+		checkChunk(&reader, offset, (uint32)i);
+		CHECK_EQUAL(chunkStart((uint32)i), start);
+		offset = capSeekOffset(&reader, chunkStart((uint32)i + 1) - 1, &start);
+		checkChunk(&reader, offset, (uint32)i);
+	}
+	CHECK_EQUAL((uint64)reader.mapSize, capSeekOffset(&reader, chunkStart(NUM_CHUNKS), &start));
+	capUnmap(&reader);
+	std::remove(CAP_PATH);
+}
+
+TEST(CapFile_badIndexCountRejected) {
+	// An index record claiming more entries than it holds must not be copied out
+	struct CapReader reader;
+	struct CapFileHeader hdr;
+	struct CapIndexHeader idx;
+	const char *error = NULL;
+	FILE *file;
+	writeCapture();
+	file = std::fopen(CAP_PATH, "r+b");
+	CHECK(file != NULL);
+	CHECK_EQUAL(1U, (uint32)std::fread(&hdr, sizeof(hdr), 1, file));
+	std::fseek(file, (long)(hdr.lastIndex + sizeof(struct CapRecord)), SEEK_SET);
+	CHECK_EQUAL(1U, (uint32)std::fread(&idx, sizeof(idx), 1, file));
+	CHECK_EQUAL(2U, idx.count);
+	idx.count = 1000000;
+	std::fseek(file, (long)(hdr.lastIndex + sizeof(struct CapRecord)), SEEK_SET);
+	std::fwrite(&idx, sizeof(idx), 1, file);
+	std::fclose(file);
+	CHECK_EQUAL(FLP_CANNOT_LOAD, capMap(&reader, CAP_PATH, &error));
+	CHECK(error != NULL);
+	errFree(error);
+	std::remove(CAP_PATH);
+}
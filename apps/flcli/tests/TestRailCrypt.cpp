@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <UnitTest++.h>
+#include "railcrypt.h"
+
+namespace {
+
+	// Deterministic stream of test words (xorshift32), so failures are reproducible
+	struct Random {
+		uint32 state;
+		explicit Random(uint32 seed) : state(seed) { }
+		uint32 next() {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+	};
+
+	void checkKey(uint32 key, Random &rnd, int words) {
+		struct RailKey rk;
+		railKeyInit(&rk, key);
+		CHECK_EQUAL(key, rk.key);
+		CHECK_EQUAL(railEncryptRef(0, key), rk.encMask);
+		CHECK_EQUAL(railDecryptRef(0, key), rk.decMask);
+		for ( int i = 0; i < words; i++ ) {
+			const uint32 w = rnd.next();
+			CHECK_EQUAL(railEncryptRef(w, key), railKeyEncrypt(&rk, w));
+			CHECK_EQUAL(railDecryptRef(w, key), railKeyDecrypt(&rk, w));
+			CHECK_EQUAL(w, railKeyDecrypt(&rk, railKeyEncrypt(&rk, w)));
+		}
+	}
+}
+
+TEST(RailCrypt_deployedKey) {
+	Random rnd(0x12345678);
+	checkKey(RAIL_KEY, rnd, 10000);
+}
+
+TEST(RailCrypt_edgeKeys) {
+	Random rnd(0x9E3779B9);
+	checkKey(0x00000000, rnd, 100);
+	checkKey(0xFFFFFFFF, rnd, 100);
+	checkKey(0x80000000, rnd, 100);
+	checkKey(0x00000001, rnd, 100);
+	checkKey(0x0F0F0F0F, rnd, 100);
+}
+
+TEST(RailCrypt_randomKeys) {
+	Random rnd(0xC0FFEE01);
+	for ( int i = 0; i < 2000; i++ ) {
+		checkKey(rnd.next(), rnd, 50);
+	}
+}
+
+TEST(RailCrypt_everyPopcount) {
+	// One key per popcount, so every encrypt and decrypt loop length is covered
+	Random rnd(0x0BADF00D);
+	uint32 key = 0;
+	checkKey(key, rnd, 20);
+	for ( int i = 0; i < 32; i++ ) {
+		key |= 1U << ((i * 7) % 32);
+		checkKey(key, rnd, 20);
+	}
+}
+
+TEST(RailCrypt_masksMatch) {
+	// The cipher is its own inverse for every key
+	Random rnd(0xFACEFEED);
+	for ( int i = 0; i < 10000; i++ ) {
+		struct RailKey rk;
+		railKeyInit(&rk, rnd.next());
+		CHECK_EQUAL(rk.encMask, rk.decMask);
+	}
+}
+
+TEST(RailCrypt_batchKernels) {
+	// Every kernel this CPU supports must match the scalar cipher, including the ragged tails
+	static const char *const kernels[] = {"avx512", "avx2", "sse2", "scalar"};
+	const char *const initial = railCryptKernel();
+	Random rnd(0x5EED1234);
+	uint32 in[67], masks[67], out[67];
+	struct RailKey rk;
+	railKeyInit(&rk, RAIL_KEY);
+	for ( int i = 0; i < 67; i++ ) {
+		in[i] = rnd.next();
+		masks[i] = rnd.next();
+	}
+	for ( int k = 0; k < 4; k++ ) {
+		if ( !railCryptUseKernel(kernels[k]) ) {
+			continue;
+		}
+		CHECK_EQUAL(kernels[k], railCryptKernel());
+		for ( int n = 0; n <= 67; n++ ) {
+			railCryptBatch(&rk, in, out, n);
+			for ( int i = 0; i < n; i++ ) {
+				CHECK_EQUAL(railKeyEncrypt(&rk, in[i]), out[i]);
+			}
+			railCryptBatchLanes(masks, in, out, n);
+			for ( int i = 0; i < n; i++ ) {
+				CHECK_EQUAL(in[i] ^ masks[i], out[i]);
+			}
+		}
+	}
+	CHECK(railCryptUseKernel("scalar"));
+	CHECK(!railCryptUseKernel("mmx"));
+	CHECK(railCryptUseKernel(initial));
+}
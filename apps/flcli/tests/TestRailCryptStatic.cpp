@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <UnitTest++.h>
+#include "railcrypt.hpp"
+
+namespace {
+
+	// The word-at-a-time reference from railcrypt.c, transcribed into C++11 constexpr form so the
+	// compiler can check the key schedule against it. bitXor() is a plain XOR.
+	namespace ref {
+		constexpr uint32 findki(uint32 a, int n) {
+			return n ? findki(a / 2U, n - 1) : a % 2U;
+		}
+
+		constexpr uint32 findtiFrom(uint32 key, int i) {
+			return i < 32 ? findki(key, i) ^ findtiFrom(key, i + 4) : 0;
+		}
+
+		constexpr uint32 findti(uint32 key, int n) {
+			return findki(key, n % 4) ^ findtiFrom(key, n + 4);
+		}
+
+		constexpr uint32 findt(uint32 key) {
+			return findti(key, 0) | findti(key, 1) << 1 | findti(key, 2) << 2 | findti(key, 3) << 3;
+		}
+
+		constexpr uint32 concatFrom(uint32 b, uint32 a, int i) {
+			return i ? concatFrom(b << 4 | a, a, i - 1) : b;
+		}
+
+		constexpr uint32 concat(uint32 a) {
+			return concatFrom(a, a, 8);
+		}
+
+		constexpr uint32 count1(uint32 a) {
+			return a ? (a & 1U) + count1(a >> 1) : 0;
+		}
+
+		constexpr uint32 encLoop(uint32 cipher, uint32 t, uint32 i) {
+			return i ? encLoop(cipher ^ concat(t), (t + 1) % 16U, i - 1) : cipher;
+		}
+
+		constexpr uint32 decLoop(uint32 cipher, uint32 t, uint32 i) {
+			return i ? decLoop(cipher ^ concat(t), (t + 15) % 16U, i - 1) : cipher;
+		}
+
+		constexpr uint32 encrypt(uint32 inp, uint32 key) {
+			return encLoop(inp, findt(key), count1(key));
+		}
+
+		constexpr uint32 decrypt(uint32 inp, uint32 key) {
+			return decLoop(inp, (findt(key) + 15) % 16U, 32 - count1(key));
+		}
+	}
+
+	constexpr bool matches(uint32 key, uint32 word) {
+		return
+			rail::encMask(key) == ref::encrypt(0, key) &&
+			rail::decMask(key) == ref::decrypt(0, key) &&
+			(word ^ rail::encMask(key)) == ref::encrypt(word, key) &&
+			(word ^ rail::decMask(key)) == ref::decrypt(word, key);
+	}
+
+	static_assert(matches(RAIL_KEY, 0x12345678), "deployed key");
+	static_assert(matches(0x00000000, 0xCCCCCCCC), "no key bits");
+	static_assert(matches(0xFFFFFFFF, 0x33333333), "all key bits");
+	static_assert(matches(0x80000000, 0xDEADBEEF), "top key bit");
+	static_assert(matches(0x00000001, 0xCAFEF00D), "bottom key bit");
+	static_assert(matches(0x0F0F0F0F, 0x00000000), "nibble pattern");
+	static_assert(matches(0x12345678, 0xFFFFFFFF), "mixed key");
+	static_assert(rail::DeployedKey::decrypt(rail::DeployedKey::encrypt(0xCCCCCCCC)) == 0xCCCCCCCC, "round trip");
+	static_assert(rail::keyOf(RAIL_KEY).encMask == rail::DeployedKey::encMask, "keyOf");
+
+	// Usable in contexts that need a constant expression
+	const uint32 deployedMasks[2] = {rail::DeployedKey::encMask, rail::DeployedKey::decMask};
+}
+
+TEST(RailCryptStatic_matchesRuntime) {
+	// The same schedule evaluated at run time must agree with railKeyInit() and the C reference
+	uint32 key = 0x2545F491;
+	for ( int i = 0; i < 5000; i++ ) {
+		struct RailKey rk;
+		const RailKey ck = rail::keyOf(key);
+		railKeyInit(&rk, key);
+		CHECK_EQUAL(rk.encMask, ck.encMask);
+		CHECK_EQUAL(rk.decMask, ck.decMask);
+		CHECK_EQUAL(railEncryptRef(0, key), rail::encMask(key));
+		CHECK_EQUAL(railDecryptRef(0, key), rail::decMask(key));
+		key ^= key << 13;
+		key ^= key >> 17;
+		key ^= key << 5;
+	}
+}
+
+TEST(RailCryptStatic_deployedKey) {
+	struct RailKey rk;
+	railKeyInit(&rk, RAIL_KEY);
+	CHECK_EQUAL(rk.encMask, deployedMasks[0]);
+	CHECK_EQUAL(rk.decMask, deployedMasks[1]);
+	CHECK_EQUAL(railKeyEncrypt(&rk, 0xCCCCCCCC), rail::DeployedKey::encrypt(0xCCCCCCCC));
+
+	// CHECK_EQUAL() takes its arguments by reference, which needs the out-of-line definitions
+	CHECK_EQUAL(RAIL_KEY, rail::DeployedKey::key);
+	CHECK_EQUAL(rk.encMask, rail::DeployedKey::encMask);
+	CHECK_EQUAL(rk.decMask, rail::DeployedKey::decMask);
+}
@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "railctl.h"
+#include "railemu.h"
+#include "railstats.h"
+#include "railevlog.h"
+#include "railsnap.h"
+#include "clock.h"
+
+namespace {
+
+	const char *const TRACK_PATH = "railemu-test.csv";
+	const char *const JOURNAL_PATH = "railemu-test.csv.wal";
+	const char *const SNAP_PATH = "railemu-test.snap";
+
+	const char *const FAST_TIMINGS = "ackPoll=1,ackWait=100,s3Settle=5,s3Poll=2,s3Wait=100,noAck=5,rest=10";
+
+	// Run the controller against emulated signals for runMicros of virtual time, optionally
+	// timing its states, logging its events and laying track before it starts.
+	struct EmuRun {
+		struct VirtualClock clock;
+		struct TrackTable track;
+		struct RailEmu emu;
+		struct RailCtl ctl;
+
+		EmuRun(
+			uint32 numSignals, const char *emuSpec, const char *railSpec, uint64 runMicros,
+			struct RailStats *stats = NULL, struct EvLog *events = NULL,
+			void (*layTrack)(struct TrackTable *) = NULL)
+		{
+			struct RailEmuConfig cfg;
+			struct RailTimings timing;
+			const char *error = NULL;
+			std::remove(TRACK_PATH);
+			std::remove(JOURNAL_PATH);
+			clkVirtualInit(&clock, 0);
+			railEmuConfigInit(&cfg);
+			CHECK(!emuSpec || railEmuParseConfig(emuSpec, &cfg));
+			railTimingsInit(&timing);
+			CHECK(!railSpec || railParseTimings(railSpec, &timing));
+			CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, TRACK_PATH, NULL, NULL, &error));
+			if ( layTrack ) {
+				layTrack(&track);
+			}
+			CHECK_EQUAL(
+				FLP_SUCCESS,
+				railEmuInit(&emu, &clock.clock, numSignals, track.grid.xDim, track.grid.yDim, &cfg, &error));
+			CHECK_EQUAL(FLP_SUCCESS, railCtlInit(&ctl, &emu.port, numSignals, &track, &timing, &error));
+			ctl.log = NULL;
+			ctl.stats = stats;
+			ctl.events = events;
+			ctl.stopAt = runMicros;
+			CHECK_EQUAL(FLP_SUCCESS, railCtlRun(&ctl, &error));
+		}
+
+		~EmuRun() {
+			const char *error = NULL;
+			railCtlDestroy(&ctl);
+			railEmuDestroy(&emu);
+			trackClose(&track, FLP_SUCCESS, &error);
+			std::remove(TRACK_PATH);
+			std::remove(JOURNAL_PATH);
+		}
+
+		// Kill the controller and start another on the same signals, optionally resuming from a
+		// snapshot, then run it until stopAt.
+		void restart(const char *snapPath, uint64 stopAt) {
+			const struct RailTimings timing = ctl.timing;
+			const char *error = NULL;
+			railCtlDestroy(&ctl);
+			CHECK_EQUAL(FLP_SUCCESS, railCtlInit(&ctl, &emu.port, emu.port.numSignals, &track, &timing, &error));
+			ctl.log = NULL;
+			if ( snapPath ) {
+				bool found = false;
+				CHECK_EQUAL(FLP_SUCCESS, railSnapLoad(&ctl, snapPath, &found, NULL, &error));
+				CHECK(found);
+			}
+			ctl.stopAt = stopAt;
+			CHECK_EQUAL(FLP_SUCCESS, railCtlRun(&ctl, &error));
+		}
+	};
+}
+
+TEST(RailEmu_parseSpecs) {
+	// Both lists go through railParseFields(): names in any case, timings in decimal ms, emulator
+	// settings in any base, and 32-bit fields range-checked
+	struct RailTimings timing;
+	struct RailEmuConfig cfg;
+	railTimingsInit(&timing);
+	railEmuConfigInit(&cfg);
+	CHECK(railParseTimings("ACKPOLL=3,restMax=010", &timing));
+	CHECK_EQUAL(3000ULL, timing.ackPoll);
+	CHECK_EQUAL(10000ULL, timing.restMax);
+	CHECK(railEmuParseConfig("seed=0x10,update=0x100000000", &cfg));
+	CHECK_EQUAL(16U, cfg.seed);
+	CHECK_EQUAL(0x100000000ULL, cfg.update);
+	CHECK(!railEmuParseConfig("seed=0x100000000", &cfg));
+	CHECK(!railEmuParseConfig("bogus=1", &cfg));
+	CHECK(!railParseTimings("rest", &timing));
+	CHECK(!railParseTimings("rest=", &timing));
+	CHECK(!railParseTimings("rest=5,", &timing));
+	CHECK(!railParseTimings("rest=5x", &timing));
+	CHECK(!railParseTimings("rest=99999999999999999", &timing));
+}
+
+namespace {
+	void setCell(struct TrackTable *track, uint32 x, uint32 y, uint32 dir, uint32 next) {
+		const char *error = NULL;
+		CHECK_EQUAL(FLP_SUCCESS, trackSet(track, x, y, dir, (uint8)(0xC0 | dir << 3 | next), &error));
+	}
+
+	// Straight track heading +x from (0, 0) to (5, 0), where it runs out, and a two-cell loop
+	// between (0, 2) and (1, 2)
+	void layRoutes(struct TrackTable *track) {
+		for ( uint32 x = 0; x < 5; x++ ) {
+			setCell(track, x, 0, 2, 2);
+		}
+		setCell(track, 0, 2, 2, 6);
+		setCell(track, 1, 2, 6, 2);
+	}
+}
+
+TEST(RailEmu_routesLookedUp) {
+	// When a signal sends its coordinates, the controller finds the direction out of them whose
+	// route runs furthest. The signals never report a cell, so the track stays as laid.
+	EmuRun run(40, "update=5000,quietPercent=100", FAST_TIMINGS, 100000, NULL, NULL, layRoutes);
+	const struct TrackGrid *const grid = &run.track.grid;
+	CHECK_EQUAL(0U, (uint32)run.emu.errors);
+	CHECK_EQUAL(0ULL, run.emu.updates);
+	for ( uint32 x = 0; x < 5; x++ ) {
+		CHECK(run.ctl.chan[x].processes > 0);
+		CHECK_EQUAL(tgIndex(grid, x, 0, 2), run.ctl.chan[x].route);
+		CHECK_EQUAL(5 - x, run.ctl.chan[x].reach);
+	}
+	CHECK_EQUAL(ROUTE_NONE, run.ctl.chan[5].route);
+	CHECK_EQUAL(0U, run.ctl.chan[5].reach);
+	CHECK_EQUAL(tgIndex(grid, 0, 2, 2), run.ctl.chan[32].route);
+	CHECK_EQUAL(ROUTE_NONE, run.ctl.chan[32].reach);
+	CHECK_EQUAL(tgIndex(grid, 1, 2, 6), run.ctl.chan[33].route);
+	CHECK_EQUAL(ROUTE_NONE, run.ctl.chan[33].reach);
+}
+
+TEST(RailEmu_routeConflicts) {
+	// The two signals on the loop both want its cells, so the second to send its coordinates puts
+	// both in conflict; everyone on the short straight is blocked
+	const char *const path = "railemu-test.evlog";
+	struct EvLog events;
+	struct EvRecord rec;
+	const char *error = NULL;
+	uint32 numConflicts = 0;
+	CHECK_EQUAL(FLP_SUCCESS, evLogCreate(&events, path, 1 << 16, 0, &error));
+	{
+		EmuRun run(40, "update=5000,quietPercent=100", FAST_TIMINGS, 100000, NULL, &events, layRoutes);
+		const struct TrackConflicts *const tc = &run.ctl.conflicts;
+		CHECK_EQUAL(&run.ctl.conflicts, run.track.conflicts);
+		CHECK_EQUAL(40U, tc->numSignals);
+		for ( uint32 x = 0; x < 6; x++ ) {
+			CHECK_EQUAL(TC_BLOCKED, tcStatus(tc, run.ctl.chan[x].conflict));
+		}
+		CHECK_EQUAL(TC_CONFLICT, tcStatus(tc, run.ctl.chan[32].conflict));
+		CHECK_EQUAL(TC_CONFLICT, tcStatus(tc, run.ctl.chan[33].conflict));
+		for ( uint64 seq = 0; seq < evLogEnd(&events); seq++ ) {
+			CHECK(evLogGet(&events, seq, &rec));
+			if ( rec.type == EV_CONFLICT ) {
+				CHECK(rec.signal == 32 || rec.signal == 33);
+				numConflicts++;
+			}
+		}
+
+		// Clear when the first joins, then both in conflict when the second does, and no more
+		CHECK_EQUAL(3U, numConflicts);
+	}
+	evLogClose(&events);
+	std::remove(path);
+}
+
+TEST(RailEmu_routeConflictsTrackUpdates) {
+	// Signals on the loop report cells at their coordinates, which open and close it. Each
+	// report that changes a route is logged straight after it, and the controller ends up
+	// where a rescan would.
+	const char *const path = "railemu-test.evlog";
+	struct EvLog events;
+	struct EvRecord rec;
+	const char *error = NULL;
+	uint32 cause = ROUTE_NONE, byUpdate = 0;
+	CHECK_EQUAL(FLP_SUCCESS, evLogCreate(&events, path, 1 << 20, 0, &error));
+	{
+		EmuRun run(40, "update=5000,coordPercent=0", FAST_TIMINGS, 2000000, NULL, &events, layRoutes);
+		struct TrackConflicts *const tc = &run.ctl.conflicts;
+		std::vector<TcStatus> before(tc->numSignals);
+		CHECK_EQUAL(0U, (uint32)run.emu.errors);
+		CHECK_EQUAL(0ULL, evLogFirst(&events));
+		for ( uint64 seq = 0; seq < evLogEnd(&events); seq++ ) {
+			CHECK(evLogGet(&events, seq, &rec));
+			if ( rec.type == EV_UPDATE ) {
+				cause = rec.signal;
+			} else if ( rec.type == EV_CONFLICT ) {
+				if ( rec.word[1] == cause ) {
+					byUpdate++;
+				}
+			} else {
+				cause = ROUTE_NONE;
+			}
+		}
+		CHECK(byUpdate > 0);
+		CHECK_EQUAL(40U, tc->numSignals);
+		for ( uint32 s = 0; s < tc->numSignals; s++ ) {
+			before[s] = tcStatus(tc, s);
+		}
+		tcRescan(tc);
+		CHECK_EQUAL(0U, tc->numChanged);
+		for ( uint32 s = 0; s < tc->numSignals; s++ ) {
+			CHECK_EQUAL(before[s], tcStatus(tc, s));
+		}
+	}
+	evLogClose(&events);
+	std::remove(path);
+}
+
+TEST(RailEmu_handshakesComplete) {
+	// Every process either updates the track or closes with the coordinates; the controller
+	// never writes a word the signals did not expect
+	EmuRun run(256, "update=10000,coordPercent=25", FAST_TIMINGS, 300000);
+	CHECK_EQUAL(0U, (uint32)run.emu.errors);
+	CHECK(run.ctl.processes >= 256);
+	CHECK(run.emu.updates > 0);
+	for ( uint32 c = 0; c < 256; c++ ) {
+		CHECK(run.ctl.chan[c].processes > 0);
+	}
+}
+
+TEST(RailEmu_trackUpdated) {
+	// Reports land in the table at the reporting signal's coordinates
+	EmuRun run(64, "update=5000,coordPercent=0", FAST_TIMINGS, 200000);
+	uint32 known = 0;
+	for ( uint32 i = 0; i < run.track.grid.numCells; i++ ) {
+		if ( tgCell(&run.track.grid, i) & 0x80 ) {
+			known++;
+		}
+	}
+	CHECK(run.emu.updates > 0);
+	CHECK(known > 0);
+	CHECK_EQUAL(0U, (uint32)run.emu.errors);
+}
+
+TEST(RailEmu_slowAcksArePolled) {
+	// ACKs that take several polls to appear still get through
+	EmuRun run(16, "ack=4000,update=5000,jitter=50", FAST_TIMINGS, 300000);
+	CHECK_EQUAL(0U, (uint32)run.emu.errors);
+	CHECK(run.emu.idleReads > 0);
+	CHECK(run.emu.updates > 0);
+}
+
+TEST(RailEmu_virtualClockIsDeterministic) {
+	// Same configuration, same seed: the same course of events, however fast the host is
+	EmuRun a(128, "jitter=300,ack=2000,update=8000,coordPercent=20", FAST_TIMINGS, 500000);
+	EmuRun b(128, "jitter=300,ack=2000,update=8000,coordPercent=20", FAST_TIMINGS, 500000);
+	CHECK_EQUAL(a.ctl.processes, b.ctl.processes);
+	CHECK_EQUAL((uint32)a.emu.reads, (uint32)b.emu.reads);
+	CHECK_EQUAL((uint32)a.emu.writes, (uint32)b.emu.writes);
+	CHECK_EQUAL((uint32)a.emu.updates, (uint32)b.emu.updates);
+	for ( uint32 c = 0; c < 128; c++ ) {
+		CHECK_EQUAL(a.ctl.chan[c].processes, b.ctl.chan[c].processes);
+	}
+}
+
+TEST(RailEmu_hourAtDefaultTimings) {
+	// The deployed timings take about 45s per process (24s settle, a 1s S3 poll, 20s rest), so
+	// an hour of one device's 64 signals is about 80 processes each
+	EmuRun run(RAIL_CHANNELS, NULL, NULL, 3600000000ULL);
+	CHECK_EQUAL(0U, (uint32)run.emu.errors);
+	for ( uint32 c = 0; c < RAIL_CHANNELS; c++ ) {
+		CHECK(run.ctl.chan[c].processes >= 75);
+		CHECK(run.ctl.chan[c].processes <= 81);
+	}
+}
+
+TEST(RailEmu_stateTimes) {
+	// At the deployed timings each process spends about 24s settling plus one 1s poll in S3 and
+	// rests 20s; everything else is a read round trip
+	struct RailStats stats;
+	const char *error = NULL;
+	CHECK_EQUAL(FLP_SUCCESS, railStatsInit(&stats, 8, NULL, NULL, 0, &error));
+	{
+		EmuRun run(8, NULL, NULL, 600000000ULL, &stats);
+		const struct Hist *const s3 = stats.state + RAIL_S3;
+		const struct Hist *const idle = stats.state + RAIL_IDLE;
+		CHECK(s3->count >= 8 * 10);
+		CHECK(s3->min >= 25000000 && s3->max < 25100000);
+		CHECK(idle->min >= 20000000 && idle->max < 20100000);
+		CHECK(stats.state[RAIL_HELLO].max < 1000);
+		CHECK_EQUAL(s3->count, stats.chan[3 * RAIL_NUM_STATES + RAIL_S3].count * 8);
+	}
+	railStatsDestroy(&stats);
+}
+
+TEST(RailEmu_eventLog) {
+	// Every process ends in exactly one "done" record, and every track update is logged with
+	// the coordinates of the signal that sent it
+	const char *const path = "railemu-test.evlog";
+	struct EvLog events;
+	struct EvRecord rec;
+	const char *error = NULL;
+	uint64 counts[EV_NUM_TYPES] = {0,};
+	CHECK_EQUAL(FLP_SUCCESS, evLogCreate(&events, path, 1 << 16, 0, &error));
+	{
+		EmuRun run(32, "update=10000,coordPercent=25", FAST_TIMINGS, 300000, NULL, &events);
+		CHECK_EQUAL(0ULL, evLogFirst(&events));
+		for ( uint64 seq = 0; seq < evLogEnd(&events); seq++ ) {
+			CHECK(evLogGet(&events, seq, &rec));
+			CHECK(rec.type > 0 && rec.type < EV_NUM_TYPES);
+			CHECK(rec.signal < 32);
+			CHECK(rec.micros <= 300000);
+			if ( rec.type == EV_UPDATE ) {
+				CHECK_EQUAL(RAIL_S3, (int)rec.state);
+				CHECK_EQUAL(rec.x, run.ctl.chan[rec.signal].x);
+				CHECK_EQUAL(rec.y, run.ctl.chan[rec.signal].y);
+			}
+			counts[rec.type]++;
+		}
+		CHECK_EQUAL((uint64)run.ctl.processes, counts[EV_DONE]);
+		CHECK_EQUAL(run.emu.updates, counts[EV_UPDATE]);
+		CHECK(counts[EV_CONNECTED] > 0);
+	}
+	evLogClose(&events);
+	std::remove(path);
+}
+
+TEST(RailEmu_pollScansEverySignal) {
+	// A scan wider than the port's depth still reads every signal once, in order
+	struct VirtualClock clock;
+	struct RailEmu emu;
+	struct RailKey key;
+	const char *error = NULL;
+	const uint32 n = 1000;
+	uint32 signals[1000], words[1000];
+	clkVirtualInit(&clock, 0);
+	railKeyInit(&key, RAIL_KEY);
+	CHECK_EQUAL(FLP_SUCCESS, railEmuInit(&emu, &clock.clock, n, 16, 16, NULL, &error));
+	for ( uint32 i = 0; i < n; i++ ) {
+		signals[i] = n - 1 - i;
+	}
+	CHECK_EQUAL(FLP_SUCCESS, railPortPoll(&emu.port, signals, n, words, &error));
+	for ( uint32 i = 0; i < n; i++ ) {
+		const uint32 s = signals[i];
+		CHECK_EQUAL((s % 16) * 16 + s / 16 % 16, railKeyDecrypt(&key, words[i]));
+	}
+	CHECK_EQUAL(n, (uint32)emu.reads);
+	CHECK_EQUAL(0U, emu.numPending);
+
+	// One pipelined pass: every reply latency back to back, none waiting on another round trip
+	CHECK_EQUAL((uint64)n * 20, clock.now);
+	railEmuDestroy(&emu);
+}
+
+TEST(RailEmu_boardsPollInParallel) {
+	// Three boards behind one port: each signal is read from its own board, and the boards'
+	// reply latencies overlap, even when one board has more reads queued than it can hold
+	struct VirtualClock clock;
+	struct RailEmu emu[3];
+	struct RailPort *boards[3];
+	struct RailMultiPort multi;
+	struct RailKey key;
+	const char *error = NULL;
+	const uint32 n = 300, perBoard = 2 * n;
+	uint32 signals[300], words[300];
+	clkVirtualInit(&clock, 0);
+	railKeyInit(&key, RAIL_KEY);
+	for ( uint32 b = 0; b < 3; b++ ) {
+		CHECK_EQUAL(FLP_SUCCESS, railEmuInit(emu + b, &clock.clock, perBoard, 16, 16, NULL, &error));
+		boards[b] = &emu[b].port;
+	}
+	CHECK_EQUAL(FLP_SUCCESS, railMultiPortInit(&multi, boards, 3, &error));
+	CHECK_EQUAL(3 * perBoard, multi.port.numSignals);
+
+	// Spread evenly: one pass costs a third of what a single board would take
+	for ( uint32 i = 0; i < n; i++ ) {
+		signals[i] = (i % 3) * perBoard + i / 3;
+	}
+	CHECK_EQUAL(FLP_SUCCESS, railPortPoll(&multi.port, signals, n, words, &error));
+	for ( uint32 i = 0; i < n; i++ ) {
+		const uint32 s = i / 3;
+		CHECK_EQUAL((s % 16) * 16 + s / 16 % 16, railKeyDecrypt(&key, words[i]));
+	}
+	CHECK_EQUAL((uint64)n / 3 * 20, clock.now);
+
+	// All on the middle board, more than its depth: still every signal, in order
+	for ( uint32 i = 0; i < n; i++ ) {
+		signals[i] = perBoard + perBoard - 1 - i;
+	}
+	CHECK_EQUAL(FLP_SUCCESS, railPortPoll(&multi.port, signals, n, words, &error));
+	for ( uint32 i = 0; i < n; i++ ) {
+		const uint32 s = perBoard - 1 - i;
+		CHECK_EQUAL((s % 16) * 16 + s / 16 % 16, railKeyDecrypt(&key, words[i]));
+	}
+	CHECK_EQUAL((uint32)n / 3, (uint32)emu[0].reads);
+	CHECK_EQUAL((uint32)n / 3 + n, (uint32)emu[1].reads);
+	CHECK_EQUAL(0U, multi.numReads);
+
+	railMultiPortDestroy(&multi);
+	for ( uint32 b = 0; b < 3; b++ ) {
+		railEmuDestroy(emu + b);
+	}
+}
+
+TEST(RailEmu_controllerDrivesBoards) {
+	// The controller runs handshakes on every board's signals through the one port
+	struct VirtualClock clock;
+	struct TrackTable track;
+	struct RailEmu emu[2];
+	struct RailPort *boards[2];
+	struct RailMultiPort multi;
+	struct RailCtl ctl;
+	struct RailEmuConfig cfg;
+	struct RailTimings timing;
+	const char *error = NULL;
+	std::remove(TRACK_PATH);
+	std::remove(JOURNAL_PATH);
+	clkVirtualInit(&clock, 0);
+	railEmuConfigInit(&cfg);
+	CHECK(railEmuParseConfig("update=10000,coordPercent=25", &cfg));
+	railTimingsInit(&timing);
+	CHECK(railParseTimings(FAST_TIMINGS, &timing));
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, TRACK_PATH, NULL, NULL, &error));
+	for ( uint32 b = 0; b < 2; b++ ) {
+		cfg.seed += b;
+		CHECK_EQUAL(
+			FLP_SUCCESS,
+			railEmuInit(emu + b, &clock.clock, 100, track.grid.xDim, track.grid.yDim, &cfg, &error));
+		boards[b] = &emu[b].port;
+	}
+	CHECK_EQUAL(FLP_SUCCESS, railMultiPortInit(&multi, boards, 2, &error));
+	CHECK_EQUAL(FLP_SUCCESS, railCtlInit(&ctl, &multi.port, multi.port.numSignals, &track, &timing, &error));
+	ctl.log = NULL;
+	ctl.stopAt = 300000;
+	CHECK_EQUAL(FLP_SUCCESS, railCtlRun(&ctl, &error));
+	for ( uint32 b = 0; b < 2; b++ ) {
+		CHECK_EQUAL(0U, (uint32)emu[b].errors);
+		CHECK(emu[b].updates > 0);
+	}
+	for ( uint32 c = 0; c < 200; c++ ) {
+		CHECK(ctl.chan[c].processes > 0);
+	}
+	railCtlDestroy(&ctl);
+	railMultiPortDestroy(&multi);
+	for ( uint32 b = 0; b < 2; b++ ) {
+		railEmuDestroy(emu + b);
+	}
+	trackClose(&track, FLP_SUCCESS, &error);
+	std::remove(TRACK_PATH);
+	std::remove(JOURNAL_PATH);
+}
+
+TEST(RailEmu_adaptiveRest) {
+	// Half the signals never have anything to report. With restMax, their rest doubles to the
+	// bound and they are polled far less, while the busy half keep the shortest rest and, with
+	// less to wait for in each pass, report more often than before; no quiet signal goes longer
+	// than the bound between processes.
+	const char *const emuSpec = "update=5000,coordPercent=0,quietPercent=50";
+	EmuRun fixed(64, emuSpec, FAST_TIMINGS, 3000000);
+	EmuRun adaptive(64, emuSpec, (std::string(FAST_TIMINGS) + ",restMax=160").c_str(), 3000000);
+	CHECK_EQUAL(0U, (uint32)adaptive.emu.errors);
+	CHECK(adaptive.emu.reads * 10 < fixed.emu.reads * 7);
+	CHECK(adaptive.emu.updates >= fixed.emu.updates);
+	for ( uint32 c = 0; c < 64; c++ ) {
+		const struct RailChannel *const ch = adaptive.ctl.chan + c;
+		if ( c < 32 ) {
+			CHECK_EQUAL(160000ULL, ch->rest);
+			CHECK(ch->processes >= 3000000 / (160000 + 10000));
+		} else {
+			CHECK_EQUAL(10000ULL, ch->rest);
+			CHECK(ch->processes >= fixed.ctl.chan[c].processes);
+		}
+	}
+}
+
+TEST(RailEmu_warmRestart) {
+	// Sixty seconds in at the deployed timings, every signal is settling in S3. Resumed from a
+	// snapshot, the controller polls each when its settle time is up and collects its report;
+	// started cold, it takes each signal's S3 silence for coordinates, the signal errs and starts
+	// over, and nothing reports until a whole handshake and settle time have gone by.
+	const char *error = NULL;
+	{
+		EmuRun run(RAIL_CHANNELS, "coordPercent=0", NULL, 60000000ULL);
+		const uint64 updates = run.emu.updates;
+		CHECK_EQUAL(FLP_SUCCESS, railSnapWrite(&run.ctl, SNAP_PATH, &error));
+		run.restart(SNAP_PATH, 80000000ULL);
+		CHECK_EQUAL(0U, (uint32)run.emu.errors);
+		CHECK_EQUAL(updates + RAIL_CHANNELS, run.emu.updates);
+		for ( uint32 c = 0; c < RAIL_CHANNELS; c++ ) {
+			CHECK_EQUAL(2U, run.ctl.chan[c].processes);
+		}
+	}
+	{
+		EmuRun run(RAIL_CHANNELS, "coordPercent=0", NULL, 60000000ULL);
+		const uint64 updates = run.emu.updates;
+		run.restart(NULL, 80000000ULL);
+		CHECK_EQUAL((uint32)RAIL_CHANNELS, (uint32)run.emu.errors);
+		CHECK_EQUAL(updates, run.emu.updates);
+	}
+	std::remove(SNAP_PATH);
+}
+
+TEST(RailEmu_warmRestartRevalidates) {
+	// Resting and settling channels keep their timers, coord channels are due at once, and those
+	// caught mid-exchange start over at coord. A missing snapshot leaves the controller alone.
+	// Each channel's rest is kept, up to the new controller's restMax.
+	const char *error = NULL;
+	bool found = true;
+	uint32 c, revalidated = 0, uncertain = 0, timed = 0;
+	enum RailState expected[64];
+	struct RailTimings timing;
+	EmuRun run(64, NULL, FAST_TIMINGS, 1000);
+	const uint64 now = clkNow(run.ctl.port->clock);
+	railTimingsInit(&timing);
+	timing.restMax = 4 * timing.rest;
+	for ( c = 0; c < 64; c++ ) {
+		struct RailChannel *const ch = run.ctl.chan + c;
+		ch->state = (enum RailState)(c % RAIL_NUM_STATES);
+		ch->x = (uint8)(c % 16);
+		ch->y = (uint8)(c / 16);
+		ch->processes = c;
+		ch->rest = timing.rest << (c % 4);
+		expected[c] = ch->state;
+		if ( ch->state == RAIL_IDLE || ch->state == RAIL_S3 ) {
+			twSchedule(&run.ctl.wheel, &ch->timer, now + 1000000 + 10000 * c);
+			timed++;
+		} else {
+			twCancel(&run.ctl.wheel, &ch->timer);
+			if ( ch->state != RAIL_COORD ) {
+				expected[c] = RAIL_COORD;
+				uncertain++;
+			}
+		}
+	}
+	CHECK_EQUAL(FLP_SUCCESS, railSnapWrite(&run.ctl, SNAP_PATH, &error));
+	railCtlDestroy(&run.ctl);
+	CHECK_EQUAL(FLP_SUCCESS, railCtlInit(&run.ctl, &run.emu.port, 64, &run.track, &timing, &error));
+	CHECK_EQUAL(FLP_SUCCESS, railSnapLoad(&run.ctl, "railemu-missing.snap", &found, NULL, &error));
+	CHECK(!found);
+	CHECK_EQUAL(64U, run.ctl.numReady);
+	CHECK_EQUAL(FLP_SUCCESS, railSnapLoad(&run.ctl, SNAP_PATH, &found, &revalidated, &error));
+	CHECK(found);
+	CHECK_EQUAL(uncertain, revalidated);
+	CHECK_EQUAL(64U - timed, run.ctl.numReady);
+	for ( c = 0; c < 64; c++ ) {
+		const struct RailChannel *const ch = run.ctl.chan + c;
+		CHECK_EQUAL(expected[c], ch->state);
+		CHECK_EQUAL(c % 16, (uint32)ch->x);
+		CHECK_EQUAL(c, ch->processes);
+		CHECK_EQUAL(timing.rest << (c % 4 < 3 ? c % 4 : 2), ch->rest);
+		CHECK_EQUAL(expected[c] != RAIL_COORD, twPending(&ch->timer));
+		if ( twPending(&ch->timer) ) {
+			// Less however long the restart took on the wall clock
+			const uint64 wake = run.ctl.wheel.origin + ch->timer.expires * run.ctl.wheel.tickMicros;
+			CHECK(wake <= now + 1000000 + 10000 * c + RAIL_TICK_US);
+			CHECK(wake + 50000 >= now + 1000000 + 10000 * c);
+		}
+	}
+	std::remove(SNAP_PATH);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <UnitTest++.h>
+#include <makestuff.h>
+#include <liberror.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "railevlog.h"
+
+namespace {
+	const char *const LOG_PATH = "evlog-test.evlog";
+}
+
+TEST(EvLog_ringKeepsNewest) {
+	// A 64-record ring after 100 appends holds records 36..99, readable from a second mapping
+	struct EvLog writer, reader;
+	struct EvRecord rec;
+	const char *error = NULL;
+	CHECK_EQUAL(FLP_SUCCESS, evLogCreate(&writer, LOG_PATH, 50, 1000, &error));
+	CHECK_EQUAL(64U, writer.hdr->capacity);
+	for ( uint32 i = 0; i < 100; i++ ) {
+		evLogAppend(&writer, 1000 + 10 * i, i % 7, EV_COORD, 1, (uint8)(i % 16), 3, i, ~i);
+	}
+	CHECK_EQUAL(FLP_SUCCESS, evLogOpen(&reader, LOG_PATH, &error));
+	CHECK_EQUAL(36ULL, evLogFirst(&reader));
+	CHECK_EQUAL(100ULL, evLogEnd(&reader));
+	CHECK(!evLogGet(&reader, 35, &rec));
+	CHECK(!evLogGet(&reader, 100, &rec));
+	for ( uint64 seq = 36; seq < 100; seq++ ) {
+		const uint32 i = (uint32)seq;
+		CHECK(evLogGet(&reader, seq, &rec));
+		CHECK_EQUAL(seq, rec.seq);
+		CHECK_EQUAL(10ULL * i, rec.micros);
+		CHECK_EQUAL(i % 7, rec.signal);
+		CHECK_EQUAL(i % 16, (uint32)rec.x);
+		CHECK_EQUAL(i, rec.word[0]);
+		CHECK_EQUAL(~i, rec.word[1]);
+	}
+
+	// The reader follows the writer through the shared mapping
+	evLogAppend(&writer, 5000, 1, EV_DONE, 0, 0, 0, 1, 2);
+	CHECK_EQUAL(101ULL, evLogEnd(&reader));
+	CHECK(evLogGet(&reader, 100, &rec));
+	CHECK_EQUAL((uint8)EV_DONE, rec.type);
+	CHECK(!evLogGet(&reader, 36, &rec));
+	evLogClose(&reader);
+	evLogClose(&writer);
+	std::remove(LOG_PATH);
+}
+
+TEST(EvLog_rejectsOtherFiles) {
+	struct EvLog reader;
+	const char *error = NULL;
+	FILE *f = std::fopen(LOG_PATH, "wb");
+	std::fputs("not an event log, but long enough to hold a header.......................", f);
+	std::fclose(f);
+	CHECK_EQUAL(FLP_CANNOT_LOAD, evLogOpen(&reader, LOG_PATH, &error));
+	CHECK(error != NULL);
+	errFree(error);
+	std::remove(LOG_PATH);
+}
+
+TEST(EvLog_rejectsBadCapacities) {
+	// Slots are found by masking with capacity - 1, so it must be a nonzero power of two, even
+	// when the file is the right size for it
+	struct EvLog writer, reader;
+	struct EvLogHeader hdr;
+	struct EvRecord rec;
+	const char *error = NULL;
+	const uint32 capacities[] = {0, 3, 48};
+	CHECK_EQUAL(FLP_SUCCESS, evLogCreate(&writer, LOG_PATH, 4, 1000, &error));
+	hdr = *writer.hdr;
+	evLogClose(&writer);
+	std::memset(&rec, 0, sizeof(rec));
+	for ( uint32 i = 0; i < sizeof(capacities) / sizeof(*capacities); i++ ) {
+		FILE *f = std::fopen(LOG_PATH, "wb");
+		hdr.capacity = capacities[i];
+		std::fwrite(&hdr, sizeof(hdr), 1, f);
+		for ( uint32 j = 0; j < capacities[i]; j++ ) {
+			std::fwrite(&rec, sizeof(rec), 1, f);
+		}
+		std::fclose(f);
+		CHECK_EQUAL(FLP_CANNOT_LOAD, evLogOpen(&reader, LOG_PATH, &error));
+		CHECK(error != NULL);
+		errFree(error);
+		error = NULL;
+	}
+	std::remove(LOG_PATH);
+}
+
+TEST(EvLog_typeNames) {
+	for ( uint32 t = 1; t < EV_NUM_TYPES; t++ ) {
+		CHECK_EQUAL(t, (uint32)evTypeParse(evTypeName(t)));
+	}
+	CHECK_EQUAL(0, (int)evTypeParse("bogus"));
+	CHECK(evTypeName(0) == NULL);
+	CHECK(evTypeName(EV_NUM_TYPES) == NULL);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <UnitTest++.h>
+#include <makestuff.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "railstats.h"
+
+namespace {
+	const char *const STATS_PATH = "railstats-test.csv";
+}
+
+TEST(RailStats_slowestSignals) {
+	// Signal 2 is slowest in COORD, then 0; signal 1 never reached it
+	struct RailStats stats;
+	const char *error = NULL;
+	char buf[2048] = {0,};
+	FILE *out = std::tmpfile();
+	CHECK_EQUAL(FLP_SUCCESS, railStatsInit(&stats, 3, NULL, NULL, 0, &error));
+	railStatsAdd(&stats, 0, RAIL_COORD, 500);
+	railStatsAdd(&stats, 2, RAIL_COORD, 9000);
+	railStatsAdd(&stats, 1, RAIL_IDLE, 20000000);
+	CHECK_EQUAL(2U, (uint32)stats.state[RAIL_COORD].count);
+	CHECK_EQUAL(9000U, stats.state[RAIL_COORD].max);
+	railStatsSummary(&stats, out);
+	std::rewind(out);
+	CHECK(std::fread(buf, 1, sizeof(buf) - 1, out) > 0);
+	CHECK(std::strstr(buf, "slowest p99: signal 2 9000us, signal 0 500us\n"));
+	CHECK(std::strstr(buf, "hello: no samples"));
+	std::fclose(out);
+	railStatsDestroy(&stats);
+}
+
+TEST(RailStats_csv) {
+	struct RailStats stats;
+	const char *error = NULL;
+	char line[256];
+	FILE *in;
+	CHECK_EQUAL(FLP_SUCCESS, railStatsInit(&stats, 2, STATS_PATH, NULL, 0, &error));
+	railStatsAdd(&stats, 1, RAIL_S3, 25000000);
+	railStatsAdd(&stats, 1, RAIL_S3, 25000000);
+	CHECK_EQUAL(FLP_SUCCESS, railStatsDump(&stats, &error));
+	in = std::fopen(STATS_PATH, "r");
+	CHECK(in != NULL);
+	if ( in ) {
+		CHECK(std::fgets(line, sizeof(line), in));
+		CHECK_EQUAL("signal,state,count,min,mean,p50,p90,p99,max\n", line);
+		CHECK(std::fgets(line, sizeof(line), in));
+		CHECK_EQUAL("all,s3,2,25000000,25000000,25000000,25000000,25000000,25000000\n", line);
+		CHECK(std::fgets(line, sizeof(line), in));
+		CHECK_EQUAL("1,s3,2,25000000,25000000,25000000,25000000,25000000,25000000\n", line);
+		CHECK(!std::fgets(line, sizeof(line), in));
+		std::fclose(in);
+	}
+	std::remove(STATS_PATH);
+	railStatsDestroy(&stats);
+}
+
+TEST(RailStats_periodicDump) {
+	struct RailStats stats;
+	const char *error = NULL;
+	FILE *out = std::tmpfile();
+	CHECK_EQUAL(FLP_SUCCESS, railStatsInit(&stats, 1, NULL, out, 1000, &error));
+	CHECK_EQUAL(FLP_SUCCESS, railStatsTick(&stats, 5000, &error));
+	CHECK_EQUAL(0L, std::ftell(out));
+	CHECK_EQUAL(FLP_SUCCESS, railStatsTick(&stats, 5999, &error));
+	CHECK_EQUAL(0L, std::ftell(out));
+	CHECK_EQUAL(FLP_SUCCESS, railStatsTick(&stats, 6000, &error));
+	CHECK(std::ftell(out) > 0);
+	std::fclose(out);
+	railStatsDestroy(&stats);
+}
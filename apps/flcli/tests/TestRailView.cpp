@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <UnitTest++.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "railctl.h"
+#include "railemu.h"
+#include "railview.h"
+#include "railquery.h"
+#include "clock.h"
+
+namespace {
+
+	const char *const TRACK_PATH = "railview-test.csv";
+	const char *const JOURNAL_PATH = "railview-test.csv.wal";
+	const char *const SOCKET_PATH = "railview-test.sock";
+
+	const char *const FAST_TIMINGS = "ackPoll=1,ackWait=100,s3Settle=5,s3Poll=2,s3Wait=100,noAck=5,rest=10";
+
+	// A controller on emulated signals with a view attached, not yet run.
+	struct ViewRun {
+		struct VirtualClock clock;
+		struct TrackTable track;
+		struct RailEmu emu;
+		struct RailCtl ctl;
+		struct RailView view;
+
+		explicit ViewRun(uint32 numSignals) {
+			struct RailEmuConfig cfg;
+			struct RailTimings timing;
+			const char *error = NULL;
+			std::remove(TRACK_PATH);
+			std::remove(JOURNAL_PATH);
+			clkVirtualInit(&clock, 0);
+			railEmuConfigInit(&cfg);
+			CHECK(railEmuParseConfig("update=5000,coordPercent=20", &cfg));
+			railTimingsInit(&timing);
+			CHECK(railParseTimings(FAST_TIMINGS, &timing));
+			CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, TRACK_PATH, NULL, NULL, &error));
+			CHECK_EQUAL(
+				FLP_SUCCESS,
+				railEmuInit(&emu, &clock.clock, numSignals, track.grid.xDim, track.grid.yDim, &cfg, &error));
+			CHECK_EQUAL(FLP_SUCCESS, railCtlInit(&ctl, &emu.port, numSignals, &track, &timing, &error));
+			CHECK_EQUAL(FLP_SUCCESS, rvInit(&view, &ctl, &error));
+			ctl.log = NULL;
+			ctl.view = &view;
+		}
+
+		~ViewRun() {
+			const char *error = NULL;
+			rvDestroy(&view);
+			railCtlDestroy(&ctl);
+			railEmuDestroy(&emu);
+			trackClose(&track, FLP_SUCCESS, &error);
+			std::remove(TRACK_PATH);
+			std::remove(JOURNAL_PATH);
+		}
+
+		void run(uint64 until) {
+			const char *error = NULL;
+			ctl.stopAt = until;
+			CHECK_EQUAL(FLP_SUCCESS, railCtlRun(&ctl, &error));
+		}
+	};
+
+	// Send a query to the server at SOCKET_PATH and return its whole answer.
+	std::string ask(const char *query) {
+		struct sockaddr_un addr;
+		std::string answer;
+		char buf[256];
+		ssize_t n;
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		CHECK(fd >= 0);
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		std::strcpy(addr.sun_path, SOCKET_PATH);
+		CHECK_EQUAL(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+		CHECK_EQUAL((ssize_t)std::strlen(query), write(fd, query, std::strlen(query)));
+		while ( (n = read(fd, buf, sizeof(buf))) > 0 ) {
+			answer.append(buf, (size_t)n);
+		}
+		close(fd);
+		return answer;
+	}
+}
+
+TEST(RailView_matchesController) {
+	// After a run, the published copy is the controller's state, cell for cell
+	ViewRun r(64);
+	std::vector<struct RailViewSignal> signals(64);
+	std::vector<uint8> cells(r.track.grid.numCells);
+	uint64 at;
+	uint32 processes, known = 0;
+	r.run(200000);
+	CHECK(rvReadSignals(&r.view, &signals[0], &at, &processes) > 0);
+	CHECK_EQUAL(r.ctl.processes, processes);
+	CHECK(at > 0 && at <= 200000);
+	for ( uint32 c = 0; c < 64; c++ ) {
+		CHECK_EQUAL((uint32)r.ctl.chan[c].state, (uint32)signals[c].state);
+		CHECK_EQUAL(r.ctl.chan[c].x, signals[c].x);
+		CHECK_EQUAL(r.ctl.chan[c].processes, signals[c].processes);
+		CHECK_EQUAL(r.ctl.chan[c].enteredAt, signals[c].since);
+	}
+	for ( uint32 c = 0; c < 64; c += 7 ) {
+		struct RailViewSignal one;
+		uint64 oneAt;
+		uint32 oneProcesses;
+		rvReadSignal(&r.view, c, &one, &oneAt, &oneProcesses);
+		CHECK_EQUAL(at, oneAt);
+		CHECK_EQUAL(processes, oneProcesses);
+		CHECK_EQUAL(signals[c].processes, one.processes);
+		CHECK_EQUAL(signals[c].since, one.since);
+	}
+	rvReadTrack(&r.view, &cells[0], NULL, NULL);
+	for ( uint32 i = 0; i < r.track.grid.numCells; i++ ) {
+		CHECK_EQUAL(tgCell(&r.track.grid, i), cells[i]);
+		known += cells[i] >> 7;
+	}
+	CHECK(known > 0);
+}
+
+TEST(RailView_readersNeverSeeHalfAPass) {
+	// Every consistent copy has the per-signal counts adding up to the total, which a copy
+	// straddling a publish would not; meanwhile the controller runs at full speed
+	ViewRun r(256);
+	std::atomic<bool> done(false);
+	uint32 reads = 0, bad = 0;
+	std::thread reader([&]() {
+		std::vector<struct RailViewSignal> signals(256);
+		uint32 processes, sum;
+		while ( !done.load() ) {
+			rvReadSignals(&r.view, &signals[0], NULL, &processes);
+			sum = 0;
+			for ( uint32 c = 0; c < 256; c++ ) {
+				sum += signals[c].processes;
+			}
+			bad += sum != processes;
+			reads++;
+		}
+	});
+	r.run(2000000);
+	done.store(true);
+	reader.join();
+	CHECK(reads > 0);
+	CHECK_EQUAL(0U, bad);
+	CHECK(r.view.seq > 1000);
+}
+
+TEST(RailView_querySocket) {
+	ViewRun r(16);
+	struct RailQuery query;
+	const char *error = NULL;
+	std::string answer;
+	r.run(100000);
+	CHECK_EQUAL(FLP_SUCCESS, rqStart(&query, &r.view, SOCKET_PATH, &error));
+
+	answer = ask("signal 3\n");
+	CHECK_EQUAL(0U, answer.find("version "));
+	CHECK(answer.find("\n3,") != std::string::npos);
+	answer = ask("signals\n");
+	CHECK_EQUAL(17, (int)std::count(answer.begin(), answer.end(), '\n'));
+	answer = ask("track");
+	CHECK_EQUAL(0U, answer.find("version "));
+	answer = ask("signal 16\n");
+	CHECK_EQUAL(0U, answer.find("error:"));
+	answer = ask("reboot\n");
+	CHECK_EQUAL(0U, answer.find("error:"));
+
+	rqStop(&query);
+	CHECK_EQUAL(5U, query.served);
+	CHECK(access(SOCKET_PATH, F_OK) != 0);
+}
+
+TEST(RailView_querySocketLeavesOtherFiles) {
+	// A stale socket is replaced; a file that is not a socket is never deleted
+	ViewRun r(16);
+	struct RailQuery query;
+	const char *error = NULL;
+	FILE *file;
+	CHECK_EQUAL(FLP_SUCCESS, rqStart(&query, &r.view, SOCKET_PATH, &error));
+	query.path[0] = '\0';   // so rqStop() leaves the socket behind, as a crash would
+	rqStop(&query);
+	CHECK_EQUAL(0, access(SOCKET_PATH, F_OK));
+	CHECK_EQUAL(FLP_SUCCESS, rqStart(&query, &r.view, SOCKET_PATH, &error));
+	rqStop(&query);
+
+	file = std::fopen(SOCKET_PATH, "w");
+	std::fputs("precious\n", file);
+	std::fclose(file);
+	CHECK_EQUAL(FLP_ARGS, rqStart(&query, &r.view, SOCKET_PATH, &error));
+	CHECK(error != NULL);
+	errFree(error);
+	CHECK_EQUAL(0, access(SOCKET_PATH, F_OK));
+	std::remove(SOCKET_PATH);
+}
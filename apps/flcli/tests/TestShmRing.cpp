@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+#include <liberror.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "shmring.h"
+
+namespace {
+
+	const char *const RING_NAME = "flcli-shmring-test";
+
+	// The smallest ring is 4096 bytes; each of these records takes 1520 of them
+	const uint32 BIG_RECORD = 1500;
+
+	// Record n is length bytes of n, on channel n % 2
+	void publish(struct ShmRing *ring, uint32 n, uint32 length) {
+		const char *error = NULL;
+		std::vector<uint8> data(length, (uint8)n);
+		CHECK_EQUAL(FLP_SUCCESS, shmRingPublish(ring, (uint8)(n % 2), &data[0], length, &error));
+	}
+
+	// The next record must be record n
+	void consume(struct ShmRing *ring, uint32 n, uint32 length) {
+		const uint8 *data = NULL;
+		uint32 got = 0;
+		uint8 channel = 0xFF;
+		uint64 seq = 0;
+		CHECK_EQUAL(SHM_OK, shmRingPeek(ring, &data, &got, &channel, &seq));
+		CHECK_EQUAL(length, got);
+		CHECK_EQUAL(n % 2, (uint32)channel);
+		CHECK_EQUAL((uint64)n, seq);
+		if ( data && got == length ) {
+			CHECK_EQUAL(n & 0xFF, (uint32)data[0]);
+			CHECK_EQUAL(n & 0xFF, (uint32)data[length - 1]);
+		}
+		CHECK_EQUAL(SHM_OK, shmRingCommit(ring));
+	}
+
+	ShmStatus peek(struct ShmRing *ring) {
+		const uint8 *data;
+		uint32 length;
+		uint8 channel;
+		uint64 seq;
+		return shmRingPeek(ring, &data, &length, &channel, &seq);
+	}
+
+	struct Rings {
+		struct ShmRing producer;
+		struct ShmRing consumer;
+		Rings() {
+			const char *error = NULL;
+			CHECK_EQUAL(FLP_SUCCESS, shmRingCreate(&producer, RING_NAME, 4096, &error));
+			CHECK_EQUAL(FLP_SUCCESS, shmRingAttach(&consumer, RING_NAME, &error));
+		}
+		~Rings() {
+			shmRingDetach(&consumer);
+			shmRingDestroy(&producer);
+		}
+	};
+}
+
+TEST_FIXTURE(Rings, ShmRing_publishPeekCommit) {
+	uint32 n;
+	CHECK_EQUAL(SHM_EMPTY, peek(&consumer));
+	for ( n = 0; n < 3; n++ ) {
+		publish(&producer, n, 10 + n);
+	}
+	for ( n = 0; n < 3; n++ ) {
+		consume(&consumer, n, 10 + n);
+	}
+	CHECK_EQUAL(SHM_EMPTY, peek(&consumer));
+}
+
+TEST_FIXTURE(Rings, ShmRing_wrapsWithPadding) {
+	// Two big records fit before the end; the third pads out to the start
+	uint32 n;
+	for ( n = 0; n < 20; n++ ) {
+		publish(&producer, n, BIG_RECORD);
+		consume(&consumer, n, BIG_RECORD);
+	}
+	CHECK_EQUAL(SHM_EMPTY, peek(&consumer));
+}
+
+TEST_FIXTURE(Rings, ShmRing_lappedBeforePeek) {
+	// A consumer more than a ring behind is moved up to the head
+	uint32 n;
+	for ( n = 0; n < 10; n++ ) {
+		publish(&producer, n, BIG_RECORD);
+	}
+	CHECK_EQUAL(SHM_LOST, peek(&consumer));
+	CHECK_EQUAL(SHM_EMPTY, peek(&consumer));
+	publish(&producer, n, BIG_RECORD);
+	consume(&consumer, n, BIG_RECORD);
+}
+
+TEST_FIXTURE(Rings, ShmRing_lappedWhileReading) {
+	// The producer reuses the record's space between the peek and the commit
+	const uint8 *data;
+	uint32 length;
+	uint8 channel;
+	uint64 seq;
+	uint32 n;
+	publish(&producer, 0, BIG_RECORD);
+	CHECK_EQUAL(SHM_OK, shmRingPeek(&consumer, &data, &length, &channel, &seq));
+	for ( n = 1; n < 4; n++ ) {
+		publish(&producer, n, BIG_RECORD);
+	}
+	CHECK_EQUAL(SHM_LOST, shmRingCommit(&consumer));
+	CHECK_EQUAL(SHM_EMPTY, peek(&consumer));
+}
+
+TEST(ShmRing_sizesRejected) {
+	struct ShmRing ring;
+	const char *error = NULL;
+	std::vector<uint8> data(4096, 0);
+	CHECK_EQUAL(
+		FLP_ARGS, shmRingCreate(&ring, RING_NAME, ((size_t)SHM_MAX_MB << 20) + 1, &error));
+	CHECK(error != NULL);
+	errFree(error);
+	error = NULL;
+
+	// Records may take up at most half the ring
+	CHECK_EQUAL(FLP_SUCCESS, shmRingCreate(&ring, RING_NAME, 4096, &error));
+	CHECK_EQUAL(FLP_SUCCESS, shmRingPublish(&ring, 0, &data[0], 2048 - 16, &error));
+	CHECK_EQUAL(FLP_ARGS, shmRingPublish(&ring, 0, &data[0], 2048 - 15, &error));
+	CHECK(error != NULL);
+	errFree(error);
+	shmRingDestroy(&ring);
+}
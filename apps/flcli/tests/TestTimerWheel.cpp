@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "timerwheel.h"
+
+namespace {
+	// Each timer the wheel fires, and the time passed to the twAdvance() that fired it.
+	struct Fired {
+		uint64 now;
+		std::vector<struct TwTimer *> timer;
+		std::vector<uint64> at;
+	};
+
+	void onFire(struct TwTimer *timer, void *context) {
+		struct Fired *const fired = (struct Fired *)context;
+		fired->timer.push_back(timer);
+		fired->at.push_back(fired->now);
+	}
+
+	uint32 advance(struct TimerWheel *wheel, uint64 now, struct Fired *fired) {
+		fired->now = now;
+		return twAdvance(wheel, now, onFire, fired);
+	}
+}
+
+TEST(TimerWheel_cascadeAcrossSlotBoundary) {
+	// Timers filed in the outer wheels come down a level at each turn of the one below, and
+	// still fire on their own tick: either side of the first wheel's turn, one in the second
+	// wheel off a slot boundary, and one in the third
+	const uint64 ticks[] = { 63, 64, 65, 100, 4096 + 5 };
+	const uint32 numTimers = sizeof(ticks) / sizeof(*ticks);
+	struct TimerWheel wheel;
+	struct TwTimer timer[numTimers];
+	struct Fired fired;
+	twInit(&wheel, 0, 1);
+	for ( uint32 i = 0; i < numTimers; i++ ) {
+		twTimerInit(&timer[i]);
+		twSchedule(&wheel, &timer[i], ticks[i]);
+	}
+	CHECK_EQUAL(numTimers, wheel.count);
+	for ( uint64 now = 0; now <= 5000; now++ ) {
+		advance(&wheel, now, &fired);
+	}
+	CHECK_EQUAL(numTimers, (uint32)fired.timer.size());
+	for ( uint32 i = 0; i < fired.timer.size(); i++ ) {
+		CHECK_EQUAL(timer + i, fired.timer[i]);
+		CHECK_EQUAL(ticks[i], fired.at[i]);
+		CHECK(!twPending(&timer[i]));
+	}
+	CHECK_EQUAL(0U, wheel.count);
+}
+
+TEST(TimerWheel_beyondTopLevelParked) {
+	// A timer further out than the wheels reach waits in the outermost one, is re-filed when
+	// that comes round, and fires neither early nor late
+	const uint64 range = 1ULL << (TW_BITS * TW_LEVELS);
+	const uint64 due = 2 * range + 1000;
+	struct TimerWheel wheel;
+	struct TwTimer far, near;
+	struct Fired fired;
+	twInit(&wheel, 0, 1);
+	twTimerInit(&far);
+	twTimerInit(&near);
+	twSchedule(&wheel, &far, due);
+	twSchedule(&wheel, &near, 10);
+	CHECK_EQUAL(1U, advance(&wheel, 10, &fired));
+	CHECK_EQUAL(0U, advance(&wheel, range, &fired));
+	CHECK_EQUAL(0U, advance(&wheel, due - 1, &fired));
+	CHECK(twPending(&far));
+	CHECK(twNextWake(&wheel) <= due);
+	CHECK_EQUAL(1U, advance(&wheel, due, &fired));
+	CHECK_EQUAL(&far, fired.timer.back());
+	CHECK_EQUAL(TW_NEVER, twNextWake(&wheel));
+}
+
+namespace {
+	// Come round again ten ticks later, up to tick 1060
+	void again(struct TwTimer *timer, void *context) {
+		struct TimerWheel *const wheel = (struct TimerWheel *)context;
+		if ( timer->expires < 1060 ) {
+			twSchedule(wheel, timer, wheel->origin + (timer->expires + 10) * wheel->tickMicros);
+		}
+	}
+}
+
+TEST(TimerWheel_cancelAndReschedule) {
+	// A cancelled timer never fires; a rescheduled one fires only at its new time, even if that
+	// moves it to another wheel; and the callback may reschedule the timer it is handed
+	struct TimerWheel wheel;
+	struct TwTimer a, b, c;
+	struct Fired fired;
+	twInit(&wheel, 0, 1);
+	twTimerInit(&a);
+	twTimerInit(&b);
+	twTimerInit(&c);
+	twCancel(&wheel, &a);
+	CHECK_EQUAL(0U, wheel.count);
+	twSchedule(&wheel, &a, 10);
+	twSchedule(&wheel, &b, 20);
+	twSchedule(&wheel, &c, 30);
+	twCancel(&wheel, &a);
+	CHECK(!twPending(&a));
+	twSchedule(&wheel, &b, 5);
+	twSchedule(&wheel, &c, 1000);
+	CHECK_EQUAL(2U, wheel.count);
+	CHECK_EQUAL(1U, advance(&wheel, 30, &fired));
+	CHECK_EQUAL(&b, fired.timer[0]);
+	CHECK_EQUAL(30ULL, fired.at[0]);
+	CHECK_EQUAL(0U, advance(&wheel, 999, &fired));
+	CHECK_EQUAL(1U, advance(&wheel, 1000, &fired));
+	CHECK_EQUAL(&c, fired.timer[1]);
+	CHECK_EQUAL(0U, wheel.count);
+
+	twSchedule(&wheel, &a, 1050);
+	CHECK_EQUAL(0U, twAdvance(&wheel, 1049, again, &wheel));
+	CHECK_EQUAL(1U, twAdvance(&wheel, 1050, again, &wheel));
+	CHECK(twPending(&a));
+	CHECK_EQUAL(1060ULL, a.expires);
+	CHECK_EQUAL(1U, twAdvance(&wheel, 1060, again, &wheel));
+	CHECK(!twPending(&a));
+	CHECK_EQUAL(0U, wheel.count);
+}
+
+TEST(TimerWheel_nextWakeAfterAdvance) {
+	// Ticks of 1ms from 5ms: the next wake is the soonest expiry within the first wheel, else
+	// the tick at which it next turns; following it reaches every timer on time
+	struct TimerWheel wheel;
+	struct TwTimer a, b, c;
+	struct Fired fired;
+	twInit(&wheel, 5000, 1000);
+	twTimerInit(&a);
+	twTimerInit(&b);
+	twTimerInit(&c);
+	CHECK_EQUAL(TW_NEVER, twNextWake(&wheel));
+	twSchedule(&wheel, &a, 5000 + 9500);    // rounds up to tick 10
+	twSchedule(&wheel, &b, 5000 + 30000);
+	twSchedule(&wheel, &c, 5000 + 200000);  // in the second wheel
+
+	// Tick zero starts a turn of the first wheel, so that is the first wake
+	CHECK_EQUAL(5000ULL, twNextWake(&wheel));
+	CHECK_EQUAL(0U, advance(&wheel, 5000, &fired));
+	CHECK_EQUAL(5000ULL + 10000, twNextWake(&wheel));
+	CHECK_EQUAL(0U, advance(&wheel, 5000 + 9999, &fired));
+	CHECK_EQUAL(1U, advance(&wheel, twNextWake(&wheel), &fired));
+	CHECK_EQUAL(&a, fired.timer.back());
+	CHECK_EQUAL(5000ULL + 30000, twNextWake(&wheel));
+	CHECK_EQUAL(1U, advance(&wheel, twNextWake(&wheel), &fired));
+	CHECK_EQUAL(&b, fired.timer.back());
+
+	// Only c is left, beyond the first wheel: wake at each of its turns until c comes down
+	for ( uint32 i = 0; twPending(&c) && i < 10; i++ ) {
+		const uint64 wake = twNextWake(&wheel);
+		CHECK(wake <= 5000 + 200000);
+		CHECK(wake > fired.now);
+		advance(&wheel, wake, &fired);
+	}
+	CHECK(!twPending(&c));
+	CHECK_EQUAL(&c, fired.timer.back());
+	CHECK_EQUAL(5000ULL + 200000, fired.at.back());
+	CHECK_EQUAL(TW_NEVER, twNextWake(&wheel));
+}
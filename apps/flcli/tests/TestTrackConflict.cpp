@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+#include <liberror.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "trackgrid.h"
+#include "trackroute.h"
+#include "trackconflict.h"
+
+namespace {
+	const uint8 EAST = 0xC0 | 2 << 3 | 2;  // usable, heading +x, carrying on +x
+
+	void setCell(struct TrackGrid *grid, struct RouteIndex *routes, struct TrackConflicts *tc, uint32 i, uint8 cell) {
+		tgSetCell(grid, i, cell);
+		routeUpdate(routes, i);
+		tcUpdate(tc, i);
+	}
+}
+
+TEST(TrackConflict_blockAndConflict) {
+	// Two signals on one line heading +x, asking for routes that overlap
+	struct TrackGrid grid;
+	struct RouteIndex routes;
+	struct TrackConflicts tc;
+	const char *error = NULL;
+	CHECK_EQUAL(FLP_SUCCESS, tgInit(&grid, 8, 2, &error));
+	for ( uint32 x = 0; x < 8; x++ ) {
+		tgSet(&grid, x, 0, 2, EAST);
+	}
+	CHECK_EQUAL(FLP_SUCCESS, routeInit(&routes, &grid, &error));
+	CHECK_EQUAL(FLP_SUCCESS, tcInit(&tc, &routes, 4, 8, &error));
+	CHECK_EQUAL(FLP_SUCCESS, tcAdd(&tc, tgIndex(&grid, 0, 0, 2), 2, &error));
+	CHECK_EQUAL(TC_CLEAR, tcStatus(&tc, 0));
+	CHECK_EQUAL(FLP_SUCCESS, tcAdd(&tc, tgIndex(&grid, 1, 0, 2), 3, &error));
+	CHECK_EQUAL(TC_CONFLICT, tcStatus(&tc, 0));
+	CHECK_EQUAL(TC_CONFLICT, tcStatus(&tc, 1));
+
+	// The track off the end of the grid: the second route is now too short
+	CHECK_EQUAL(FLP_SUCCESS, tcAdd(&tc, tgIndex(&grid, 6, 0, 2), 3, &error));
+	CHECK_EQUAL(TC_BLOCKED, tcStatus(&tc, 2));
+
+	// A segment goes not ok under the second signal: it is blocked, which ends the conflict
+	setCell(&grid, &routes, &tc, tgIndex(&grid, 2, 0, 2), 0x80 | 2 << 3 | 2);
+	CHECK_EQUAL(TC_CLEAR, tcStatus(&tc, 0));
+	CHECK_EQUAL(TC_BLOCKED, tcStatus(&tc, 1));
+	CHECK_EQUAL(2U, tc.numChanged);
+
+	// A cell nobody's route reads changes nothing
+	setCell(&grid, &routes, &tc, tgIndex(&grid, 5, 1, 0), EAST);
+	CHECK_EQUAL(0U, tc.numWork);
+	CHECK_EQUAL(0U, tc.numChanged);
+
+	// ...and back
+	setCell(&grid, &routes, &tc, tgIndex(&grid, 2, 0, 2), EAST);
+	CHECK_EQUAL(TC_CONFLICT, tcStatus(&tc, 0));
+	CHECK_EQUAL(TC_CONFLICT, tcStatus(&tc, 1));
+
+	// The second signal moves off the line, and the first is clear again
+	CHECK_EQUAL(FLP_SUCCESS, tcMove(&tc, 1, tgIndex(&grid, 0, 1, 0), &error));
+	CHECK_EQUAL(TC_CLEAR, tcStatus(&tc, 0));
+	CHECK_EQUAL(TC_BLOCKED, tcStatus(&tc, 1));
+	CHECK_EQUAL(FLP_ARGS, tcMove(&tc, 3, 0, &error));
+	CHECK(error != NULL);
+	errFree(error);
+	tcDestroy(&tc);
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+}
+
+TEST(TrackConflict_incrementalMatchesRescan) {
+	struct TrackGrid grid;
+	struct RouteIndex routes;
+	struct TrackConflicts tc;
+	const char *error = NULL;
+	uint32 state = 99;
+	const uint32 numSignals = 40;
+	std::vector<int> before(numSignals);
+	CHECK_EQUAL(FLP_SUCCESS, tgInit(&grid, 6, 6, &error));
+	for ( uint32 i = 0; i < grid.numCells; i++ ) {
+		state = state * 1103515245U + 12345U;
+		const uint32 r = state >> 8;
+		tgSetCell(&grid, i, (uint8)(0x80 | (r % 10 ? 0x40 : 0) | (i % TG_DIRS) << 3 | (r >> 4) % TG_DIRS));
+	}
+	CHECK_EQUAL(FLP_SUCCESS, routeInit(&routes, &grid, &error));
+	CHECK_EQUAL(FLP_SUCCESS, tcInit(&tc, &routes, numSignals, 6, &error));
+	for ( uint32 s = 0; s < numSignals; s++ ) {
+		state = state * 1103515245U + 12345U;
+		CHECK_EQUAL(FLP_SUCCESS, tcAdd(&tc, (state >> 8) % grid.numCells, 1 + (state >> 20) % 6, &error));
+	}
+	for ( uint32 step = 0; step < 300; step++ ) {
+		state = state * 1103515245U + 12345U;
+		const uint32 i = (state >> 8) % grid.numCells;
+		setCell(&grid, &routes, &tc, i, (uint8)(tgCell(&grid, i) ^ ((state >> 28) ? 0x40 : 0x01)));
+		if ( step % 3 == 0 ) {
+			// A signal turns up somewhere else
+			CHECK_EQUAL(FLP_SUCCESS, tcMove(&tc, (state >> 4) % numSignals, i, &error));
+		}
+		for ( uint32 s = 0; s < numSignals; s++ ) {
+			before[s] = tcStatus(&tc, s);
+		}
+		tcRescan(&tc);
+		CHECK_EQUAL(0U, tc.numChanged);
+		for ( uint32 s = 0; s < numSignals; s++ ) {
+			CHECK_EQUAL(before[s], (int)tcStatus(&tc, s));
+		}
+	}
+	tcDestroy(&tc);
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+}
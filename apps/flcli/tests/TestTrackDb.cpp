@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+#include <liberror.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "trackgrid.h"
+#include "trackdb.h"
+
+namespace {
+
+	const char *const DB_PATH = "trackdb-test.tdb";
+
+	// A 5x3 grid with a known cell at every third index
+	void fillGrid(struct TrackGrid *grid) {
+		const char *error = NULL;
+		CHECK_EQUAL(FLP_SUCCESS, tgInit(grid, 5, 3, &error));
+		for ( uint32 i = 0; i < grid->numCells; i += 3 ) {
+			tgSetCell(grid, i, (uint8)(0x80 | (i & 1) << 6 | (i % TG_DIRS) << 3 | (i % 7)));
+		}
+	}
+
+	void writeDb(const struct TrackGrid *grid) {
+		FILE *const file = std::fopen(DB_PATH, "wb");
+		CHECK(file != NULL);
+		CHECK(tdbWrite(file, grid));
+		std::fclose(file);
+	}
+
+	std::vector<uint8> readFile(const char *path) {
+		std::vector<uint8> data;
+		FILE *const file = std::fopen(path, "rb");
+		int ch;
+		while ( file && (ch = std::fgetc(file)) != EOF ) {
+			data.push_back((uint8)ch);
+		}
+		if ( file ) {
+			std::fclose(file);
+		}
+		return data;
+	}
+
+	void writeFile(const char *path, const std::vector<uint8> &data) {
+		FILE *const file = std::fopen(path, "wb");
+		CHECK(file != NULL);
+		CHECK_EQUAL(data.size(), std::fwrite(&data[0], 1, data.size(), file));
+		std::fclose(file);
+	}
+
+	// tdbOpen() on DB_PATH must fail with FLP_CANNOT_LOAD and an error containing what
+	void expectRejected(const char *what) {
+		struct TrackDb db;
+		struct TrackGrid grid;
+		const char *error = NULL;
+		CHECK_EQUAL(FLP_CANNOT_LOAD, tdbOpen(&db, DB_PATH, &grid, &error));
+		CHECK(error != NULL);
+		if ( error ) {
+			CHECK(std::strstr(error, what) != NULL);
+			errFree(error);
+		}
+		CHECK(db.map == NULL);
+	}
+}
+
+TEST(TrackDb_roundTrip) {
+	// A written database opens as the same grid, mapped in place
+	struct TrackGrid grid, loaded;
+	struct TrackDb db;
+	const char *error = NULL;
+	fillGrid(&grid);
+	writeDb(&grid);
+	CHECK_EQUAL(FLP_SUCCESS, tdbOpen(&db, DB_PATH, &loaded, &error));
+	CHECK_EQUAL((uint32)TDB_VERSION, db.version);
+	CHECK_EQUAL(5U, loaded.xDim);
+	CHECK_EQUAL(3U, loaded.yDim);
+	CHECK(!loaded.owned);
+	for ( uint32 i = 0; i < grid.numCells; i++ ) {
+		CHECK_EQUAL(tgCell(&grid, i), tgCell(&loaded, i));
+	}
+	tgDestroy(&loaded);
+	tdbClose(&db);
+	tgDestroy(&grid);
+	std::remove(DB_PATH);
+}
+
+TEST(TrackDb_versionOne) {
+	// A version 1 file's cell bytes are copied into a new grid
+	struct TdbHeaderV1 hdr;
+	struct TrackGrid loaded;
+	struct TrackDb db;
+	const char *error = NULL;
+	std::vector<uint8> file(sizeof(hdr) + 8 * 8 * TG_DIRS);
+	uint8 *const cells = &file[sizeof(hdr)];
+	for ( uint32 i = 0; i < 8 * 8 * TG_DIRS; i++ ) {
+		cells[i] = (uint8)((i % 5 ? 0x80 : 0x00) | (i % TG_DIRS) << 3 | (i % 3));
+	}
+	std::memset(&hdr, 0, sizeof(hdr));
+	std::memcpy(hdr.magic, TDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = 1;
+	hdr.cellOffset = sizeof(hdr);
+	hdr.xDim = 8;
+	hdr.yDim = 8;
+	hdr.dirs = TG_DIRS;
+	hdr.cellCount = 8 * 8 * TG_DIRS;
+	hdr.checksum = tdbChecksum(0, cells, hdr.cellCount);
+	std::memcpy(&file[0], &hdr, sizeof(hdr));
+	writeFile(DB_PATH, file);
+	CHECK_EQUAL(FLP_SUCCESS, tdbOpen(&db, DB_PATH, &loaded, &error));
+	CHECK_EQUAL(1U, db.version);
+	CHECK(loaded.owned);
+	for ( uint32 i = 0; i < 8 * 8 * TG_DIRS; i++ ) {
+		// An unknown cell keeps only its direction
+		CHECK_EQUAL((uint32)(cells[i] & 0x80 ? cells[i] : cells[i] & 0x38), (uint32)tgCell(&loaded, i));
+	}
+	tgDestroy(&loaded);
+	tdbClose(&db);
+
+	// ...and a flipped cell byte is caught
+	file[sizeof(hdr) + 17] ^= 0x40;
+	writeFile(DB_PATH, file);
+	expectRejected("checksum mismatch");
+	std::remove(DB_PATH);
+}
+
+TEST(TrackDb_corruptByteRejected) {
+	struct TrackGrid grid;
+	std::vector<uint8> file;
+	fillGrid(&grid);
+	writeDb(&grid);
+	tgDestroy(&grid);
+	file = readFile(DB_PATH);
+	file[TG_ALIGN + 3] ^= 0x10;
+	writeFile(DB_PATH, file);
+	expectRejected("checksum mismatch");
+	std::remove(DB_PATH);
+}
+
+TEST(TrackDb_badHeadersRejected) {
+	// An empty grid passes every size check and the checksum over no bytes, so the dimensions
+	// themselves must be checked
+	struct TrackGrid grid;
+	struct TdbHeader hdr;
+	std::vector<uint8> file;
+	fillGrid(&grid);
+	writeDb(&grid);
+	tgDestroy(&grid);
+	file = readFile(DB_PATH);
+	std::memcpy(&hdr, &file[0], sizeof(hdr));
+	hdr.yDim = 0;
+	hdr.numCells = 0;
+	hdr.okOffset = hdr.knownOffset + tgOkOffset(0);
+	hdr.nextOffset = hdr.knownOffset + tgNextOffset(0);
+	hdr.dataBytes = tgBlockBytes(0);
+	hdr.checksum = tdbChecksum(0, &file[TG_ALIGN], (size_t)hdr.dataBytes);
+	std::memcpy(&file[0], &hdr, sizeof(hdr));
+	writeFile(DB_PATH, file);
+	expectRejected("not a valid version 2");
+
+	file[0] = 'X';
+	writeFile(DB_PATH, file);
+	expectRejected("not a track database");
+	std::remove(DB_PATH);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "trackgrid.h"
+#include "trackroute.h"
+#include "tracktab.h"
+
+namespace {
+
+	uint32 rnd(uint32 *state) {
+		*state = *state * 1103515245U + 12345U;
+		return *state >> 8;
+	}
+
+	// A random cell: mostly usable segments, some dead ends and some unknown
+	uint8 randomCell(uint32 *state, uint32 dir) {
+		const uint32 r = rnd(state) % 10;
+		if ( r == 0 ) {
+			return (uint8)(dir << 3);
+		}
+		return (uint8)(0x80 | (r == 1 ? 0 : 0x40) | dir << 3 | rnd(state) % TG_DIRS);
+	}
+
+	// Check every pair against a plain walk of the grid from each node.
+	void checkAgainstWalk(const struct RouteIndex *routes) {
+		const uint32 n = routes->numNodes;
+		std::vector<uint32> hops(n);
+		struct RouteIndex fresh;
+		const char *error = NULL;
+		CHECK_EQUAL(FLP_SUCCESS, routeInit(&fresh, routes->grid, &error));
+		for ( uint32 from = 0; from < n; from++ ) {
+			uint32 node = from, h = 0;
+			for ( uint32 i = 0; i < n; i++ ) {
+				hops[i] = ROUTE_NONE;
+			}
+			while ( node != ROUTE_NONE && hops[node] == ROUTE_NONE ) {
+				hops[node] = h++;
+				node = fresh.succ[node];
+			}
+			for ( uint32 to = 0; to < n; to++ ) {
+				CHECK_EQUAL(fresh.succ[to], routes->succ[to]);
+				CHECK_EQUAL(hops[to], routeHops(routes, from, to));
+			}
+		}
+		routeDestroy(&fresh);
+	}
+}
+
+TEST(TrackRoute_straightLine) {
+	// Three cells heading +x along y = 1, then a dead end
+	struct TrackGrid grid;
+	struct RouteIndex routes;
+	const char *error = NULL;
+	CHECK_EQUAL(FLP_SUCCESS, tgInit(&grid, 5, 3, &error));
+	for ( uint32 x = 0; x < 3; x++ ) {
+		CHECK(tgSet(&grid, x, 1, 2, 0x80 | 0x40 | 2 << 3 | 2));
+	}
+	CHECK_EQUAL(FLP_SUCCESS, routeInit(&routes, &grid, &error));
+	const uint32 a = tgIndex(&grid, 0, 1, 2), d = tgIndex(&grid, 3, 1, 2);
+	CHECK_EQUAL(3U, routeHops(&routes, a, d));
+	CHECK_EQUAL(0U, routeHops(&routes, d, d));
+	CHECK_EQUAL(ROUTE_NONE, routeHops(&routes, d, a));
+	CHECK_EQUAL(ROUTE_NONE, routeHops(&routes, a, tgIndex(&grid, 4, 1, 2)));
+
+	// Cutting the middle segment ends the route there; restoring it, past the end of the grid
+	// too, joins it up again
+	tgSet(&grid, 1, 1, 2, 0x80 | 2 << 3 | 2);
+	routeUpdate(&routes, tgIndex(&grid, 1, 1, 2));
+	CHECK_EQUAL(ROUTE_NONE, routeHops(&routes, a, d));
+	CHECK_EQUAL(1U, routeHops(&routes, a, tgIndex(&grid, 1, 1, 2)));
+	tgSet(&grid, 1, 1, 2, 0x80 | 0x40 | 2 << 3 | 2);
+	tgSet(&grid, 3, 1, 2, 0x80 | 0x40 | 2 << 3 | 2);
+	tgSet(&grid, 4, 1, 2, 0x80 | 0x40 | 2 << 3 | 2);
+	routeUpdate(&routes, tgIndex(&grid, 1, 1, 2));
+	routeUpdate(&routes, tgIndex(&grid, 3, 1, 2));
+	routeUpdate(&routes, tgIndex(&grid, 4, 1, 2));
+	CHECK_EQUAL(4U, routeHops(&routes, a, tgIndex(&grid, 4, 1, 2)));
+	CHECK_EQUAL(ROUTE_NONE, routeNext(&routes, tgIndex(&grid, 4, 1, 2)));
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+}
+
+TEST(TrackRoute_loop) {
+	// Round a 2x2 square: +y, +x, -y, -x
+	struct TrackGrid grid;
+	struct RouteIndex routes;
+	const char *error = NULL;
+	CHECK_EQUAL(FLP_SUCCESS, tgInit(&grid, 3, 3, &error));
+	CHECK(tgSet(&grid, 0, 0, 0, 0xC0 | 0 << 3 | 2));
+	CHECK(tgSet(&grid, 0, 1, 2, 0xC0 | 2 << 3 | 4));
+	CHECK(tgSet(&grid, 1, 1, 4, 0xC0 | 4 << 3 | 6));
+	CHECK(tgSet(&grid, 1, 0, 6, 0xC0 | 6 << 3 | 0));
+	// ...with a spur from (2,0) leading in at (1,0)
+	CHECK(tgSet(&grid, 2, 0, 6, 0xC0 | 6 << 3 | 6));
+	CHECK_EQUAL(FLP_SUCCESS, routeInit(&routes, &grid, &error));
+	const uint32 spur = tgIndex(&grid, 2, 0, 6);
+	const uint32 corner = tgIndex(&grid, 0, 0, 0), last = tgIndex(&grid, 1, 1, 4);
+	CHECK_EQUAL(2U, routeHops(&routes, spur, corner));
+	CHECK_EQUAL(4U, routeHops(&routes, spur, last));
+	CHECK_EQUAL(2U, routeHops(&routes, corner, last));
+	CHECK_EQUAL(2U, routeHops(&routes, last, corner));
+	CHECK_EQUAL(ROUTE_NONE, routeHops(&routes, corner, spur));
+	checkAgainstWalk(&routes);
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+}
+
+TEST(TrackRoute_incrementalMatchesRebuild) {
+	// Random tracks changed one cell at a time: the index always agrees with a fresh walk
+	struct TrackGrid grid;
+	struct RouteIndex routes;
+	const char *error = NULL;
+	uint32 state = 12345;
+	CHECK_EQUAL(FLP_SUCCESS, tgInit(&grid, 4, 4, &error));
+	for ( uint32 i = 0; i < grid.numCells; i++ ) {
+		tgSetCell(&grid, i, randomCell(&state, i % TG_DIRS));
+	}
+	CHECK_EQUAL(FLP_SUCCESS, routeInit(&routes, &grid, &error));
+	checkAgainstWalk(&routes);
+	for ( uint32 step = 0; step < 200; step++ ) {
+		const uint32 i = rnd(&state) % grid.numCells;
+		tgSetCell(&grid, i, randomCell(&state, i % TG_DIRS));
+		routeUpdate(&routes, i);
+		if ( step % 10 == 9 ) {
+			checkAgainstWalk(&routes);
+		}
+	}
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+}
+
+TEST(TrackRoute_followsTrackSet) {
+	// An index attached to a track table sees the controller's updates as they are made
+	struct TrackTable track;
+	struct RouteIndex routes;
+	const char *error = NULL;
+	std::remove("trackroute-test.csv");
+	std::remove("trackroute-test.csv.wal");
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, "trackroute-test.csv", NULL, NULL, &error));
+	CHECK_EQUAL(FLP_SUCCESS, routeInit(&routes, &track.grid, &error));
+	track.routes = &routes;
+	const uint32 a = tgIndex(&track.grid, 2, 2, 2), b = tgIndex(&track.grid, 4, 2, 0);
+	CHECK_EQUAL(ROUTE_NONE, routeHops(&routes, a, b));
+	CHECK_EQUAL(FLP_SUCCESS, trackSet(&track, 2, 2, 2, 0xC0 | 2 << 3 | 2, &error));
+	CHECK_EQUAL(FLP_SUCCESS, trackSet(&track, 3, 2, 2, 0xC0 | 2 << 3 | 0, &error));
+	CHECK_EQUAL(2U, routeHops(&routes, a, b));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	routeDestroy(&routes);
+	std::remove("trackroute-test.csv");
+	std::remove("trackroute-test.csv.wal");
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <vector>
+#include <UnitTest++.h>
+#include <makestuff.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "track.h"
+#include "trackdb.h"
+#include "trackgrid.h"
+#include "tracktab.h"
+
+namespace {
+
+	const char *const TRACK_PATH = "tracktab-test.csv";
+	const char *const JOURNAL_PATH = "tracktab-test.csv.wal";
+	const char *const CRASH_PATH = "tracktab-crash.csv";
+	const char *const CRASH_JOURNAL_PATH = "tracktab-crash.csv.wal";
+
+	void removeAll() {
+		std::remove(TRACK_PATH);
+		std::remove(JOURNAL_PATH);
+		std::remove(CRASH_PATH);
+		std::remove(CRASH_JOURNAL_PATH);
+	}
+
+	// A known, usable cell at direction dir that leads on in direction next
+	uint8 cellByte(uint32 dir, uint32 next) {
+		return (uint8)(0x80 | 0x40 | dir << 3 | next);
+	}
+
+	std::vector<uint8> readFile(const char *path) {
+		std::vector<uint8> data;
+		FILE *const file = std::fopen(path, "rb");
+		int ch;
+		if ( file ) {
+			while ( (ch = std::fgetc(file)) != EOF ) {
+				data.push_back((uint8)ch);
+			}
+			std::fclose(file);
+		}
+		return data;
+	}
+
+	void writeFile(const char *path, const std::vector<uint8> &data, size_t length) {
+		FILE *const file = std::fopen(path, "wb");
+		CHECK(file != NULL);
+		if ( length ) {
+			CHECK_EQUAL(length, std::fwrite(&data[0], 1, length, file));
+		}
+		std::fclose(file);
+	}
+
+	// What a crash right now would leave behind: copy the snapshot and the first journalBytes of
+	// the journal of the open table, as they are on disk, to CRASH_PATH.
+	void crashCopy(size_t journalBytes) {
+		const std::vector<uint8> snapshot = readFile(TRACK_PATH);
+		const std::vector<uint8> journal = readFile(JOURNAL_PATH);
+		CHECK(journalBytes <= journal.size());
+		writeFile(CRASH_PATH, snapshot, snapshot.size());
+		writeFile(CRASH_JOURNAL_PATH, journal, journalBytes);
+	}
+
+	// Three updates to the first three cells of (1, 2), synced but not yet compacted away.
+	void writeThree(struct TrackTable *track) {
+		const char *error = NULL;
+		removeAll();
+		CHECK_EQUAL(FLP_SUCCESS, trackOpen(track, TRACK_PATH, NULL, NULL, &error));
+		for ( uint32 dir = 0; dir < 3; dir++ ) {
+			CHECK_EQUAL(FLP_SUCCESS, trackSet(track, 1, 2, dir, cellByte(dir, 4), &error));
+		}
+		CHECK_EQUAL(FLP_SUCCESS, trackSync(track, &error));
+		CHECK_EQUAL(3 * sizeof(struct TrackRecord), readFile(JOURNAL_PATH).size());
+	}
+}
+
+TEST(TrackTab_syncWaitsForTheJournal) {
+	// trackSync() returns only once every queued update is in the journal
+	struct TrackTable track;
+	const char *error = NULL;
+	bool found = true;
+	uint32 replayed = 1;
+	removeAll();
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, TRACK_PATH, &found, &replayed, &error));
+	CHECK(!found);
+	CHECK_EQUAL(0U, replayed);
+	for ( uint32 i = 0; i < 200; i++ ) {
+		CHECK_EQUAL(FLP_SUCCESS, trackSet(&track, i % 8, i / 8 % 8, i % 8, cellByte(i % 8, 1), &error));
+	}
+	CHECK_EQUAL(FLP_SUCCESS, trackSync(&track, &error));
+	CHECK_EQUAL(200ULL, track.queued);
+	CHECK_EQUAL(track.queued, track.durable);
+	CHECK_EQUAL(200 * sizeof(struct TrackRecord), readFile(JOURNAL_PATH).size());
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	removeAll();
+}
+
+TEST(TrackTab_journalReplayed) {
+	// A table reopened after a crash has every synced update, and folds them into its snapshot
+	struct TrackTable track, after;
+	const char *error = NULL;
+	bool found = false;
+	uint32 replayed = 0;
+	writeThree(&track);
+	crashCopy(3 * sizeof(struct TrackRecord));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&after, CRASH_PATH, &found, &replayed, &error));
+	CHECK(found);
+	CHECK_EQUAL(3U, replayed);
+	for ( uint32 dir = 0; dir < 3; dir++ ) {
+		CHECK_EQUAL(cellByte(dir, 4), tgCell(&after.grid, tgIndex(&after.grid, 1, 2, dir)));
+	}
+	CHECK_EQUAL(0U, (uint32)readFile(CRASH_JOURNAL_PATH).size());
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&after, FLP_SUCCESS, &error));
+	removeAll();
+}
+
+TEST(TrackTab_tornTailIgnored) {
+	// A record cut short by the crash is dropped; those before it survive
+	struct TrackTable track, after;
+	const char *error = NULL;
+	bool found = false;
+	uint32 replayed = 0;
+	writeThree(&track);
+	crashCopy(3 * sizeof(struct TrackRecord) - 3);
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&after, CRASH_PATH, &found, &replayed, &error));
+	CHECK(found);
+	CHECK_EQUAL(2U, replayed);
+	CHECK_EQUAL(cellByte(0, 4), tgCell(&after.grid, tgIndex(&after.grid, 1, 2, 0)));
+	CHECK_EQUAL(cellByte(1, 4), tgCell(&after.grid, tgIndex(&after.grid, 1, 2, 1)));
+	CHECK_EQUAL(2U << 3, (uint32)tgCell(&after.grid, tgIndex(&after.grid, 1, 2, 2)));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&after, FLP_SUCCESS, &error));
+	removeAll();
+}
+
+TEST(TrackTab_corruptRecordEndsReplay) {
+	// Replay stops at the first record whose check byte is wrong, even if good ones follow
+	struct TrackTable track, after;
+	const char *error = NULL;
+	bool found = false;
+	uint32 replayed = 0;
+	std::vector<uint8> journal;
+	writeThree(&track);
+	crashCopy(3 * sizeof(struct TrackRecord));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	journal = readFile(CRASH_JOURNAL_PATH);
+	journal[sizeof(struct TrackRecord) + 4] ^= 0x01;  // the second record's value
+	writeFile(CRASH_JOURNAL_PATH, journal, journal.size());
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&after, CRASH_PATH, &found, &replayed, &error));
+	CHECK(found);
+	CHECK_EQUAL(1U, replayed);
+	CHECK_EQUAL(cellByte(0, 4), tgCell(&after.grid, tgIndex(&after.grid, 1, 2, 0)));
+	CHECK_EQUAL(1U << 3, (uint32)tgCell(&after.grid, tgIndex(&after.grid, 1, 2, 1)));
+	CHECK_EQUAL(2U << 3, (uint32)tgCell(&after.grid, tgIndex(&after.grid, 1, 2, 2)));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&after, FLP_SUCCESS, &error));
+	removeAll();
+}
+
+TEST(TrackTab_journalCompacted) {
+	// Once the journal reaches TT_COMPACT_RECORDS the snapshot is rewritten and the journal
+	// emptied: the new snapshot plus what has been journalled since is the whole table
+	struct TrackTable track;
+	struct TrackGrid snapshot;
+	const char *error = NULL;
+	bool found = false;
+	size_t journalBytes;
+	removeAll();
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, TRACK_PATH, NULL, NULL, &error));
+	CHECK_EQUAL(0U, (uint32)readFile(TRACK_PATH).size());
+	for ( uint32 i = 0; i < TT_COMPACT_RECORDS + 100; i++ ) {
+		const uint32 x = i % 8, y = i / 8 % 8, dir = i / 64 % 8;
+		CHECK_EQUAL(FLP_SUCCESS, trackSet(&track, x, y, dir, cellByte(dir, i % 8), &error));
+	}
+	CHECK_EQUAL(FLP_SUCCESS, trackSync(&track, &error));
+	journalBytes = readFile(JOURNAL_PATH).size();
+	CHECK(journalBytes < TT_COMPACT_RECORDS * sizeof(struct TrackRecord));
+	CHECK_EQUAL(0U, (uint32)(journalBytes % sizeof(struct TrackRecord)));
+	CHECK_EQUAL(track.journalRecords * sizeof(struct TrackRecord), journalBytes);
+	CHECK_EQUAL(FLP_SUCCESS, trackLoad(TRACK_PATH, &snapshot, &found, &error));
+	CHECK(found);
+	{
+		// Replay the journal over the snapshot by hand
+		const std::vector<uint8> journal = readFile(JOURNAL_PATH);
+		for ( size_t off = 0; off < journal.size(); off += sizeof(struct TrackRecord) ) {
+			const struct TrackRecord *const rec = (const struct TrackRecord *)&journal[off];
+			tgSetCell(&snapshot, rec->index, rec->value);
+		}
+	}
+	for ( uint32 i = 0; i < track.grid.numCells; i++ ) {
+		CHECK_EQUAL(tgCell(&track.grid, i), tgCell(&snapshot, i));
+	}
+	tgDestroy(&snapshot);
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	removeAll();
+}
+
+TEST(TrackTab_coversProtocolCoordinates) {
+	// Signals report 4-bit coordinates, so a new table and a small database both grow to 16x16,
+	// the database keeping its cells
+	const char *const dbPath = "tracktab-small" TDB_SUFFIX;
+	struct TrackTable track;
+	struct TrackGrid small;
+	const char *error = NULL;
+	FILE *file;
+	removeAll();
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, TRACK_PATH, NULL, NULL, &error));
+	CHECK_EQUAL(16U, track.grid.xDim);
+	CHECK_EQUAL(16U, track.grid.yDim);
+	CHECK_EQUAL(FLP_SUCCESS, trackSet(&track, 15, 15, 7, cellByte(7, 3), &error));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+
+	CHECK_EQUAL(FLP_SUCCESS, tgInit(&small, 4, 20, &error));
+	tgSet(&small, 3, 19, 2, cellByte(2, 5));
+	file = std::fopen(dbPath, "wb");
+	CHECK(tdbWrite(file, &small));
+	std::fclose(file);
+	tgDestroy(&small);
+	CHECK_EQUAL(FLP_SUCCESS, trackOpen(&track, dbPath, NULL, NULL, &error));
+	CHECK_EQUAL(16U, track.grid.xDim);
+	CHECK_EQUAL(20U, track.grid.yDim);
+	CHECK_EQUAL((uint32)cellByte(2, 5), (uint32)tgCell(&track.grid, tgIndex(&track.grid, 3, 19, 2)));
+	CHECK_EQUAL(FLP_SUCCESS, trackSet(&track, 15, 0, 0, cellByte(0, 1), &error));
+	CHECK_EQUAL(FLP_SUCCESS, trackClose(&track, FLP_SUCCESS, &error));
+	std::remove(dbPath);
+	std::remove("tracktab-small" TDB_SUFFIX ".wal");
+	removeAll();
+}
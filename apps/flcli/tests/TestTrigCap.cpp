@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <UnitTest++.h>
+#include <makestuff.h>
+
+// makestuff.h only defines the 64-bit types for C, as C++98 has no long long
+typedef unsigned long long uint64;
+
+#include "trigcap.h"
+
+namespace {
+	const char *const CAP_PATH = "trigcap-test.cap";
+
+	std::string eventPath(uint32 n) {
+		char name[64];
+		std::snprintf(name, sizeof(name), "%s.%u", CAP_PATH, n);
+		return name;
+	}
+
+	std::string readEvent(uint32 n) {
+		std::string data;
+		char buf[256];
+		size_t length;
+		FILE *const file = std::fopen(eventPath(n).c_str(), "rb");
+		CHECK(file != NULL);
+		if ( file ) {
+			while ( (length = std::fread(buf, 1, sizeof(buf), file)) > 0 ) {
+				data.append(buf, length);
+			}
+			std::fclose(file);
+		}
+		return data;
+	}
+
+	void removeEvents() {
+		for ( uint32 n = 0; n < 4; n++ ) {
+			std::remove(eventPath(n).c_str());
+		}
+	}
+
+	// A capture of pre bytes before the trigger and post from it, on pattern.
+	struct Cap {
+		struct TrigCapture cap;
+
+		Cap(size_t pre, uint64 post, const char *pattern) {
+			const char *error = NULL;
+			removeEvents();
+			CHECK_EQUAL(
+				FLP_SUCCESS,
+				trigInit(&cap, pre, post, (const uint8 *)pattern, std::strlen(pattern), CAP_PATH, &error));
+		}
+
+		~Cap() {
+			trigDestroy(&cap);
+			removeEvents();
+		}
+
+		void feed(const char *data, bool external = false) {
+			const char *error = NULL;
+			CHECK_EQUAL(
+				FLP_SUCCESS,
+				trigFeed(&cap, (const uint8 *)data, std::strlen(data), external, &error));
+		}
+	};
+}
+
+TEST(TrigCap_patternSpansChunks) {
+	// "ABC" starts two bytes before the end of the first chunk, at stream offset 10
+	Cap c(4, 4, "ABC");
+	c.feed("0123456789AB");
+	CHECK_EQUAL(0U, c.cap.numEvents);
+	c.feed("C456789xyz");
+	CHECK_EQUAL(1U, c.cap.numEvents);
+	CHECK_EQUAL(TRIG_ARMED, c.cap.state);
+	CHECK_EQUAL("6789ABC4", readEvent(0));
+}
+
+TEST(TrigCap_patternAtOffsetZero) {
+	// At the very start of the stream there is no pre-trigger window to speak of; at the start
+	// of a later chunk, the window comes from the one before
+	Cap c(4, 4, "ABC");
+	c.feed("ABCdefgh");
+	CHECK_EQUAL(1U, c.cap.numEvents);
+	CHECK_EQUAL("ABCd", readEvent(0));
+	c.feed("0123456");
+	c.feed("ABCxyz");
+	CHECK_EQUAL(2U, c.cap.numEvents);
+	CHECK_EQUAL("3456ABCx", readEvent(1));
+}
+
+TEST(TrigCap_chunksShorterThanPattern) {
+	// "ABCD" arrives a byte or two at a time, so only the carried bytes can find it
+	Cap c(4, 4, "ABCD");
+	c.feed("xA");
+	c.feed("B");
+	c.feed("C");
+	CHECK_EQUAL(0U, c.cap.numEvents);
+	c.feed("Dyyyy");
+	CHECK_EQUAL(1U, c.cap.numEvents);
+	CHECK_EQUAL("xABCD", readEvent(0));
+}
+
+TEST(TrigCap_windowsSaved) {
+	// The file holds exactly the pre bytes before the trigger and the post bytes from it, though
+	// the stream comes in 7-byte chunks and the post-trigger window runs over several of them;
+	// then the capture re-arms for the next match
+	char stream[101];
+	for ( uint32 i = 0; i < 100; i++ ) {
+		stream[i] = (char)('a' + i % 26);
+	}
+	stream[100] = '\0';
+	std::memcpy(stream + 30, "!!", 2);
+	std::memcpy(stream + 80, "!!", 2);
+	Cap c(8, 20, "!!");
+	for ( uint32 i = 0; i < 100; i += 7 ) {
+		char chunk[8] = {0,};
+		std::strncpy(chunk, stream + i, 7);
+		c.feed(chunk);
+	}
+	CHECK_EQUAL(2U, c.cap.numEvents);
+	CHECK_EQUAL(std::string(stream + 22, 28), readEvent(0));
+	CHECK_EQUAL(std::string(stream + 72, 28), readEvent(1));
+}
+
+TEST(TrigCap_externalTriggerHeldDuringCapture) {
+	// An external trigger during a capture fires as soon as that capture is done, at the first
+	// byte after it, even if it finishes part-way through a later chunk
+	Cap c(2, 10, "");
+	c.feed("abcdef", true);
+	CHECK_EQUAL(TRIG_CAPTURING, c.cap.state);
+	c.feed("gh", true);
+	CHECK_EQUAL(1U, c.cap.numEvents);
+	c.feed("ijklmn");
+	CHECK_EQUAL(2U, c.cap.numEvents);
+	c.feed("opqrstuv");
+	CHECK_EQUAL(TRIG_ARMED, c.cap.state);
+	CHECK_EQUAL("abcdefghij", readEvent(0));
+	CHECK_EQUAL("ijklmnopqrst", readEvent(1));
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <makestuff.h>
+#include "timerwheel.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_RANGE ((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+static void listInit(struct TwTimer *head) {
+	head->next = head->prev = head;
+}
+
+static void listAppend(struct TwTimer *head, struct TwTimer *timer) {
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void listUnlink(struct TwTimer *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+}
+
+void twInit(struct TimerWheel *self, uint64 nowMicros, uint32 tickMicros) {
+	uint32 level, s;
+	self->origin = nowMicros;
+	self->tickMicros = tickMicros ? tickMicros : 1;
+	self->tick = 0;
+	self->count = 0;
+	for ( level = 0; level < TW_LEVELS; level++ ) {
+		for ( s = 0; s < TW_SLOTS; s++ ) {
+			listInit(&self->slot[level][s]);
+		}
+	}
+}
+
+void twTimerInit(struct TwTimer *timer) {
+	timer->next = timer->prev = NULL;
+	timer->expires = 0;
+}
+
+bool twPending(const struct TwTimer *timer) {
+	return timer->next != NULL;
+}
+
+// File a timer in the wheel whose span covers its distance from the current tick.
+static void file(struct TimerWheel *self, struct TwTimer *timer) {
+	uint64 expires = timer->expires;
+	uint64 delta;
+	uint32 level;
+	if ( expires < self->tick ) {
+		expires = self->tick;
+	}
+	delta = expires - self->tick;
+	if ( delta > TW_RANGE ) {
+		expires = self->tick + TW_RANGE;
+		delta = TW_RANGE;
+	}
+	for ( level = 0; level < TW_LEVELS - 1; level++ ) {
+		if ( delta < (1ULL << (TW_BITS * (level + 1))) ) {
+			break;
+		}
+	}
+	listAppend(&self->slot[level][(expires >> (TW_BITS * level)) & TW_MASK], timer);
+}
+
+void twSchedule(struct TimerWheel *self, struct TwTimer *timer, uint64 atMicros) {
+	if ( twPending(timer) ) {
+		listUnlink(timer);
+	} else {
+		self->count++;
+	}
+	timer->expires = atMicros <= self->origin ? 0 :
+		(atMicros - self->origin + self->tickMicros - 1) / self->tickMicros;
+	file(self, timer);
+}
+
+void twCancel(struct TimerWheel *self, struct TwTimer *timer) {
+	if ( twPending(timer) ) {
+		listUnlink(timer);
+		self->count--;
+	}
+}
+
+// Re-file everything in one slot of an outer wheel; returns the slot index, so that zero means
+// this wheel has also turned and the next one out needs cascading too.
+static uint32 cascade(struct TimerWheel *self, uint32 level) {
+	const uint32 index = (uint32)(self->tick >> (TW_BITS * level)) & TW_MASK;
+	struct TwTimer *const head = &self->slot[level][index];
+	struct TwTimer list;
+	listInit(&list);
+	if ( head->next != head ) {
+		list.next = head->next;
+		list.prev = head->prev;
+		list.next->prev = &list;
+		list.prev->next = &list;
+		listInit(head);
+	}
+	while ( list.next != &list ) {
+		struct TwTimer *const timer = list.next;
+		listUnlink(timer);
+		file(self, timer);
+	}
+	return index;
+}
+
+uint32 twAdvance(struct TimerWheel *self, uint64 nowMicros, TwFire fire, void *context) {
+	uint64 target;
+	uint32 fired = 0, level;
+	if ( nowMicros < self->origin ) {
+		return 0;
+	}
+	target = (nowMicros - self->origin) / self->tickMicros;
+	while ( self->tick <= target ) {
+		const uint32 index = (uint32)self->tick & TW_MASK;
+		struct TwTimer *const head = &self->slot[0][index];
+		if ( index == 0 ) {
+			for ( level = 1; level < TW_LEVELS && cascade(self, level) == 0; level++ );
+		}
+		self->tick++;
+		while ( head->next != head ) {
+			struct TwTimer *const timer = head->next;
+			listUnlink(timer);
+			self->count--;
+			fired++;
+			fire(timer, context);
+		}
+		if ( self->count == 0 ) {
+			// Nothing left to cascade, so skip straight to the target
+			self->tick = target + 1;
+		}
+	}
+	return fired;
+}
+
+uint64 twNextWake(const struct TimerWheel *self) {
+	uint64 t = self->tick;
+	if ( self->count == 0 ) {
+		return TW_NEVER;
+	}
+	// A tick that starts a turn of the first wheel cascades the outer ones, so stop there too
+	while ( (t & TW_MASK) != 0 && self->slot[0][t & TW_MASK].next == &self->slot[0][t & TW_MASK] ) {
+		t++;
+	}
+	return self->origin + t * self->tickMicros;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <makestuff.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Hierarchical timer wheel: TW_LEVELS wheels of TW_SLOTS slots each, the first counting
+	// ticks and each further one counting whole turns of the one below it. Scheduling and
+	// cancelling are O(1); timers due further out than TW_SLOTS^TW_LEVELS ticks are parked in the
+	// last slot of the outermost wheel and re-filed when it comes round.
+	#define TW_BITS 6
+	#define TW_SLOTS (1U << TW_BITS)
+	#define TW_LEVELS 4
+	#define TW_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+	// Embed one of these in whatever needs waking; it is on at most one slot's list at a time.
+	struct TwTimer {
+		struct TwTimer *next, *prev;
+		uint64 expires;   // tick number
+	};
+
+	struct TimerWheel {
+		uint64 origin;    // clkMicros() at tick zero
+		uint32 tickMicros;
+		uint64 tick;      // next tick to process
+		uint32 count;     // timers pending
+		struct TwTimer slot[TW_LEVELS][TW_SLOTS];  // list heads
+	};
+
+	typedef void (*TwFire)(struct TwTimer *timer, void *context);
+
+	void twInit(struct TimerWheel *self, uint64 nowMicros, uint32 tickMicros);
+	void twTimerInit(struct TwTimer *timer);
+
+	// Arrange for timer to fire at the first twAdvance() at or after atMicros; rounds up to the
+	// next tick, so it never fires early. A timer already pending is moved.
+	void twSchedule(struct TimerWheel *self, struct TwTimer *timer, uint64 atMicros);
+	void twCancel(struct TimerWheel *self, struct TwTimer *timer);
+	bool twPending(const struct TwTimer *timer);
+
+	// Fire every timer due by nowMicros, in expiry order within each tick. The callback may
+	// reschedule the timer it is given. Returns the number fired.
+	uint32 twAdvance(struct TimerWheel *self, uint64 nowMicros, TwFire fire, void *context);
+
+	// The time at which twAdvance() next has work to do: the exact expiry of the soonest timer if
+	// it is within one turn of the first wheel, otherwise the next cascade. TW_NEVER if empty.
+	uint64 twNextWake(const struct TimerWheel *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "track.h"
+
+#define TRACK_CSV_MAX_COORD 0xFFFF  // rows beyond this do not size the grid
+
+ReturnCode trackLoad(
+	const char *path, struct TrackGrid *grid, bool *found, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FILE *file = fopen(path, "r");
+	uint32 xDim = TRACK_X, yDim = TRACK_Y;
+	int x, y, dir, ok, next;
+	*found = file != NULL;
+
+	// First pass sizes the grid, second fills it in
+	if ( file ) {
+		while ( fscanf(file, "%d,%d,%d,%d,%d", &x, &y, &dir, &ok, &next) == 5 ) {
+			if ( x >= 0 && x <= TRACK_CSV_MAX_COORD && (uint32)x >= xDim ) {
+				xDim = (uint32)x + 1;
+			}
+			if ( y >= 0 && y <= TRACK_CSV_MAX_COORD && (uint32)y >= yDim ) {
+				yDim = (uint32)y + 1;
+			}
+		}
+		rewind(file);
+	}
+	retVal = tgInit(grid, xDim, yDim, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	if ( file ) {
+		while ( fscanf(file, "%d,%d,%d,%d,%d", &x, &y, &dir, &ok, &next) == 5 ) {
+			if ( x >= 0 && y >= 0 && dir >= 0 && next >= 0 && next < 8 ) {
+				tgSet(
+					grid, (uint32)x, (uint32)y, (uint32)dir,
+					(uint8)(0x80 + 0x40 * (ok & 1) + 8 * dir + next));
+			}
+		}
+	}
+cleanup:
+	if ( file ) {
+		fclose(file);
+	}
+	return retVal;
+}
+
+bool trackWrite(FILE *file, const struct TrackGrid *grid) {
+	uint32 i;
+	for ( i = 0; i < grid->numCells; i++ ) {
+		const uint8 cell = tgCell(grid, i);
+		if ( cell & 0x80 ) {
+			const uint32 xy = i / TG_DIRS;
+			if ( fprintf(
+				file, "%u,%u,%u,%d,%d\n",
+				xy / grid->yDim, xy % grid->yDim, i % TG_DIRS, (cell >> 6) & 1, cell % 8) < 0 )
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <stdio.h>
+#include <makestuff.h>
+#include "flcli.h"
+#include "trackgrid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Protocol coordinates are four bits each, so every track table covers at least
+	// 0..TRACK_MAX_COORD in x and y; a CSV with bigger coordinates only grows it.
+	#define TRACK_MAX_COORD 15
+	#define TRACK_X (TRACK_MAX_COORD + 1)
+	#define TRACK_Y (TRACK_MAX_COORD + 1)
+	#define TRACK_FILE "/home/gani/eval/20140524/makestuff/hdlmake/apps/makestuff/swled/cksum/vhdl/track_data.csv"
+
+	// Load a track CSV ("x,y,dir,ok,next" per line) into a new grid, big enough for both the
+	// default dimensions and every row. If the file cannot be opened, *found is set false and
+	// the grid is empty.
+	ReturnCode trackLoad(
+		const char *path, struct TrackGrid *grid, bool *found, const char **error
+	);
+
+	// Write every known cell as a CSV row. Returns false on a write error.
+	bool trackWrite(FILE *file, const struct TrackGrid *grid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "trackconflict.h"
+
+static void touch(struct TrackConflicts *self, uint32 s) {
+	if ( self->stamp[s] != self->epoch ) {
+		self->stamp[s] = self->epoch;
+		self->work[self->numWork++] = s;
+	}
+}
+
+// Every signal whose route reads cell needs another look.
+static void touchCell(struct TrackConflicts *self, uint32 cell) {
+	uint32 l;
+	for ( l = self->head[cell]; l != ROUTE_NONE; l = self->link[l].next ) {
+		touch(self, l / self->maxLen);
+	}
+}
+
+static void touchRoute(struct TrackConflicts *self, uint32 s) {
+	const struct TcLink *const link = self->link + s * self->maxLen;
+	uint32 i;
+	for ( i = 0; i < self->sig[s].numCells; i++ ) {
+		touchCell(self, link[i].cell);
+	}
+}
+
+static void unlinkRoute(struct TrackConflicts *self, uint32 s) {
+	struct TcLink *const link = self->link + s * self->maxLen;
+	const bool whole = self->sig[s].whole;
+	uint32 i;
+	for ( i = 0; i < self->sig[s].numCells; i++ ) {
+		struct TcLink *const l = link + i;
+		if ( l->prev == ROUTE_NONE ) {
+			self->head[l->cell] = l->next;
+		} else {
+			self->link[l->prev].next = l->next;
+		}
+		if ( l->next != ROUTE_NONE ) {
+			self->link[l->next].prev = l->prev;
+		}
+		if ( whole ) {
+			self->claims[l->cell]--;
+		}
+	}
+	self->sig[s].numCells = 0;
+}
+
+static bool onRoute(const struct TrackConflicts *self, uint32 s, uint32 cell) {
+	const struct TcLink *const link = self->link + s * self->maxLen;
+	uint32 i;
+	for ( i = 0; i < self->sig[s].numCells; i++ ) {
+		if ( link[i].cell == cell ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Walk signal s's route and add it to the list of each cell it reads; a whole route also
+// claims its cells.
+static void linkRoute(struct TrackConflicts *self, uint32 s) {
+	struct TcSignal *const sig = self->sig + s;
+	const uint32 base = s * self->maxLen;
+	uint32 cell = sig->start, l;
+	sig->whole = false;
+	for ( ;; ) {
+		if ( sig->numCells == sig->len || onRoute(self, s, cell) ) {
+			// Long enough, or round a loop that is shorter than asked for
+			sig->whole = true;
+			break;
+		}
+		l = base + sig->numCells++;
+		self->link[l].cell = cell;
+		self->link[l].prev = ROUTE_NONE;
+		self->link[l].next = self->head[cell];
+		if ( self->head[cell] != ROUTE_NONE ) {
+			self->link[self->head[cell]].prev = l;
+		}
+		self->head[cell] = l;
+		cell = routeNext(self->routes, cell);
+		if ( cell == ROUTE_NONE ) {
+			return;
+		}
+	}
+	for ( l = base; l < base + sig->numCells; l++ ) {
+		self->claims[self->link[l].cell]++;
+	}
+}
+
+static void evaluate(struct TrackConflicts *self, uint32 s) {
+	struct TcSignal *const sig = self->sig + s;
+	const struct TcLink *const link = self->link + s * self->maxLen;
+	TcStatus status = TC_CLEAR;
+	uint32 i;
+	if ( !sig->whole ) {
+		status = TC_BLOCKED;
+	} else {
+		for ( i = 0; i < sig->numCells; i++ ) {
+			if ( self->claims[link[i].cell] > 1 ) {
+				status = TC_CONFLICT;
+				break;
+			}
+		}
+	}
+	if ( status != sig->status ) {
+		sig->status = status;
+		self->changed[self->numChanged++] = s;
+	}
+}
+
+static void nextEpoch(struct TrackConflicts *self) {
+	if ( ++self->epoch == 0 ) {
+		memset(self->stamp, 0, self->maxSignals * sizeof(uint32));
+		self->epoch = 1;
+	}
+	self->numWork = 0;
+	self->numChanged = 0;
+}
+
+ReturnCode tcInit(
+	struct TrackConflicts *self, const struct RouteIndex *routes, uint32 maxSignals,
+	uint32 maxLen, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	memset(self, 0, sizeof(*self));
+	CHECK_STATUS(
+		!maxLen || maxLen > TC_MAX_ROUTE || !maxSignals, FLP_ARGS, cleanup,
+		"tcInit(): routes must be 1 to %d segments long", TC_MAX_ROUTE);
+	self->routes = routes;
+	self->maxLen = maxLen;
+	self->maxSignals = maxSignals;
+	self->sig = (struct TcSignal *)calloc(maxSignals, sizeof(struct TcSignal));
+	self->link = (struct TcLink *)malloc((size_t)maxSignals * maxLen * sizeof(struct TcLink));
+	self->head = (uint32 *)malloc(routes->numNodes * sizeof(uint32));
+	self->claims = (uint32 *)calloc(routes->numNodes, sizeof(uint32));
+	self->changed = (uint32 *)malloc(maxSignals * sizeof(uint32));
+	self->stamp = (uint32 *)calloc(maxSignals, sizeof(uint32));
+	self->work = (uint32 *)malloc(maxSignals * sizeof(uint32));
+	CHECK_STATUS(
+		!self->sig || !self->link || !self->head || !self->claims || !self->changed ||
+		!self->stamp || !self->work, FLP_NO_MEMORY, cleanup,
+		"tcInit(): cannot track %u signals", maxSignals);
+	memset(self->head, 0xFF, routes->numNodes * sizeof(uint32));
+	self->epoch = 1;
+	return FLP_SUCCESS;
+cleanup:
+	tcDestroy(self);
+	return retVal;
+}
+
+void tcDestroy(struct TrackConflicts *self) {
+	free(self->work);
+	free(self->stamp);
+	free(self->changed);
+	free(self->claims);
+	free(self->head);
+	free(self->link);
+	free(self->sig);
+	memset(self, 0, sizeof(*self));
+}
+
+ReturnCode tcAdd(struct TrackConflicts *self, uint32 start, uint32 len, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct TcSignal *sig;
+	uint32 s, i;
+	CHECK_STATUS(
+		self->numSignals == self->maxSignals, FLP_ARGS, cleanup,
+		"tcAdd(): already tracking %u signals", self->maxSignals);
+	CHECK_STATUS(
+		start >= self->routes->numNodes || !len || len > self->maxLen, FLP_ARGS, cleanup,
+		"tcAdd(): no route of %u segments from cell %u", len, start);
+	s = self->numSignals++;
+	sig = self->sig + s;
+	sig->start = start;
+	sig->len = len;
+	sig->numCells = 0;
+	sig->status = TC_BLOCKED;
+	nextEpoch(self);
+	linkRoute(self, s);
+	touch(self, s);
+	touchRoute(self, s);
+	for ( i = 0; i < self->numWork; i++ ) {
+		evaluate(self, self->work[i]);
+	}
+cleanup:
+	return retVal;
+}
+
+ReturnCode tcMove(
+	struct TrackConflicts *self, uint32 signal, uint32 start, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 i;
+	CHECK_STATUS(
+		signal >= self->numSignals || start >= self->routes->numNodes, FLP_ARGS, cleanup,
+		"tcMove(): no signal %u or no cell %u", signal, start);
+	nextEpoch(self);
+	touch(self, signal);
+	touchRoute(self, signal);
+	unlinkRoute(self, signal);
+	self->sig[signal].start = start;
+	linkRoute(self, signal);
+	touchRoute(self, signal);
+	for ( i = 0; i < self->numWork; i++ ) {
+		evaluate(self, self->work[i]);
+	}
+cleanup:
+	return retVal;
+}
+
+void tcUpdate(struct TrackConflicts *self, uint32 index) {
+	uint32 i, n;
+	nextEpoch(self);
+	touchCell(self, index);
+
+	// Only the signals that read the cell can have new routes; anyone sharing a cell with one
+	// of their old or new routes may have gained or lost a conflict
+	n = self->numWork;
+	for ( i = 0; i < n; i++ ) {
+		const uint32 s = self->work[i];
+		touchRoute(self, s);
+		unlinkRoute(self, s);
+		linkRoute(self, s);
+		touchRoute(self, s);
+	}
+	for ( i = 0; i < self->numWork; i++ ) {
+		evaluate(self, self->work[i]);
+	}
+}
+
+void tcRescan(struct TrackConflicts *self) {
+	uint32 s;
+	nextEpoch(self);
+	for ( s = 0; s < self->numSignals; s++ ) {
+		unlinkRoute(self, s);
+		linkRoute(self, s);
+	}
+	for ( s = 0; s < self->numSignals; s++ ) {
+		evaluate(self, s);
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACKCONFLICT_H
+#define TRACKCONFLICT_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "trackroute.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Which signals can clear their routes. Each signal asks for a route of len segments from
+	// its start cell, along the route index's next links. It is blocked if the route runs out
+	// first (a cell that is unknown, not ok, or leads off the grid), in conflict if another
+	// signal's whole route uses one of the same cells, and clear otherwise.
+	//
+	// Every cell keeps a list of the signals whose routes read it, so when one cell changes only
+	// those signals are walked again, and only the signals sharing cells with their old or new
+	// routes have their conflicts rechecked.
+	#define TC_MAX_ROUTE 64
+
+	typedef enum {
+		TC_CLEAR,
+		TC_BLOCKED,
+		TC_CONFLICT
+	} TcStatus;
+
+	// Signal s's i-th route cell is link[s * maxLen + i], threaded into that cell's list.
+	struct TcLink {
+		uint32 cell;
+		uint32 prev, next;  // link indices, or ROUTE_NONE
+	};
+
+	struct TcSignal {
+		uint32 start;
+		uint32 len;         // segments asked for
+		uint32 numCells;    // cells the route reads: len if whole, else up to the one that fails
+		bool whole;
+		TcStatus status;
+	};
+
+	struct TrackConflicts {
+		const struct RouteIndex *routes;
+		uint32 maxLen;
+		uint32 numSignals, maxSignals;
+		struct TcSignal *sig;
+		struct TcLink *link;
+		uint32 *head;       // each cell's first link, or ROUTE_NONE
+		uint32 *claims;     // whole routes using each cell
+
+		// Signals whose status changed in the last tcAdd(), tcMove(), tcUpdate() or tcRescan()
+		uint32 *changed, numChanged;
+
+		// Scratch
+		uint32 *stamp, epoch;
+		uint32 *work, numWork;
+	};
+
+	// Room for maxSignals signals with routes of up to maxLen (at most TC_MAX_ROUTE) segments
+	// over the given index, which must be updated before each call to tcUpdate().
+	ReturnCode tcInit(
+		struct TrackConflicts *self, const struct RouteIndex *routes, uint32 maxSignals,
+		uint32 maxLen, const char **error
+	);
+	void tcDestroy(struct TrackConflicts *self);
+
+	// Add a signal, numbered from 0 in the order added.
+	ReturnCode tcAdd(struct TrackConflicts *self, uint32 start, uint32 len, const char **error);
+
+	// Start a signal's route from another cell, re-evaluating only it and those it shared cells
+	// with before or after.
+	ReturnCode tcMove(
+		struct TrackConflicts *self, uint32 signal, uint32 start, const char **error
+	);
+
+	// The cell at grid index has changed: re-evaluate the signals that depend on it.
+	void tcUpdate(struct TrackConflicts *self, uint32 index);
+
+	// Re-evaluate every signal from scratch.
+	void tcRescan(struct TrackConflicts *self);
+
+	static inline TcStatus tcStatus(const struct TrackConflicts *self, uint32 signal) {
+		return self->sig[signal].status;
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef WIN32
+	#include <Windows.h>
+#else
+	#define _POSIX_C_SOURCE 200809L
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "trackdb.h"
+
+bool tdbIsDbPath(const char *path) {
+	const size_t len = strlen(path), suffixLen = strlen(TDB_SUFFIX);
+	return len >= suffixLen && !strcmp(path + len - suffixLen, TDB_SUFFIX);
+}
+
+// CRC-32 (IEEE 802.3), a nibble at a time
+uint32 tdbChecksum(uint32 crc, const uint8 *data, size_t length) {
+	static const uint32 table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+		0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+		0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+	};
+	crc = ~crc;
+	while ( length-- ) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+static void unmap(struct TrackDb *self) {
+	if ( self->map ) {
+		#ifdef WIN32
+			free(self->map);
+		#else
+			munmap(self->map, self->mapSize);
+		#endif
+	}
+	memset(self, 0, sizeof(*self));
+}
+
+// Copy a version 1 file's 8x8 cell bytes into a new grid.
+static ReturnCode openV1(
+	struct TrackDb *self, const char *path, struct TrackGrid *grid, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	const struct TdbHeaderV1 *const hdr = (const struct TdbHeaderV1 *)self->map;
+	const uint8 *cells;
+	uint32 i;
+	CHECK_STATUS(
+		self->mapSize < sizeof(*hdr) || hdr->dirs != TG_DIRS ||
+		hdr->cellCount != (uint32)hdr->xDim * hdr->yDim * TG_DIRS || hdr->cellOffset < sizeof(*hdr) ||
+		hdr->cellOffset > self->mapSize || self->mapSize - hdr->cellOffset < hdr->cellCount,
+		FLP_CANNOT_LOAD, cleanup, "tdbOpen(): %s is not a valid version 1 track database", path);
+	cells = (const uint8 *)self->map + hdr->cellOffset;
+	CHECK_STATUS(
+		tdbChecksum(0, cells, hdr->cellCount) != hdr->checksum,
+		FLP_CANNOT_LOAD, cleanup, "tdbOpen(): %s is corrupt (checksum mismatch)", path);
+	retVal = tgInit(grid, hdr->xDim, hdr->yDim, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	for ( i = 0; i < hdr->cellCount; i++ ) {
+		tgSetCell(grid, i, cells[i]);
+	}
+cleanup:
+	return retVal;
+}
+
+static ReturnCode openV2(
+	struct TrackDb *self, const char *path, struct TrackGrid *grid, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	const struct TdbHeader *const hdr = (const struct TdbHeader *)self->map;
+	const uint32 numCells = hdr->numCells;
+	CHECK_STATUS(
+		self->mapSize < sizeof(*hdr) || hdr->dirs != TG_DIRS ||
+		hdr->xDim == 0 || hdr->yDim == 0 ||
+		(uint64)hdr->xDim * hdr->yDim * TG_DIRS != numCells || numCells > TG_MAX_CELLS ||
+		hdr->knownOffset < sizeof(*hdr) || hdr->knownOffset % TG_ALIGN ||
+		hdr->okOffset != hdr->knownOffset + tgOkOffset(numCells) ||
+		hdr->nextOffset != hdr->knownOffset + tgNextOffset(numCells) ||
+		hdr->dataBytes != tgBlockBytes(numCells) ||
+		hdr->knownOffset > self->mapSize || self->mapSize - hdr->knownOffset < hdr->dataBytes,
+		FLP_CANNOT_LOAD, cleanup, "tdbOpen(): %s is not a valid version 2 track database", path);
+	CHECK_STATUS(
+		tdbChecksum(0, (const uint8 *)self->map + hdr->knownOffset, (size_t)hdr->dataBytes) !=
+		hdr->checksum, FLP_CANNOT_LOAD, cleanup, "tdbOpen(): %s is corrupt (checksum mismatch)", path);
+	CHECK_STATUS(
+		!tgAttach(grid, hdr->xDim, hdr->yDim, (uint8 *)self->map + hdr->knownOffset),
+		FLP_CANNOT_LOAD, cleanup, "tdbOpen(): %s has an unusable %ux%u grid",
+		path, hdr->xDim, hdr->yDim);
+cleanup:
+	return retVal;
+}
+
+ReturnCode tdbOpen(
+	struct TrackDb *self, const char *path, struct TrackGrid *grid, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	const struct TdbHeader *hdr;
+	memset(self, 0, sizeof(*self));
+	#ifdef WIN32
+	{
+		// No mapping here: read the whole file instead
+		FILE *file = fopen(path, "rb");
+		long size;
+		CHECK_STATUS(!file, FLP_CANNOT_LOAD, cleanup, "tdbOpen(): cannot open %s", path);
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		rewind(file);
+		self->map = size > 0 ? malloc((size_t)size) : NULL;
+		if ( !self->map || fread(self->map, 1, (size_t)size, file) != (size_t)size ) {
+			fclose(file);
+			FAIL(FLP_CANNOT_LOAD, badFile);
+		}
+		fclose(file);
+		self->mapSize = (size_t)size;
+	}
+	#else
+	{
+		struct stat st;
+		void *map;
+		const int fd = open(path, O_RDONLY);
+		CHECK_STATUS(fd < 0, FLP_CANNOT_LOAD, cleanup, "tdbOpen(): cannot open %s", path);
+		if ( fstat(fd, &st) || (size_t)st.st_size < sizeof(struct TdbHeader) ) {
+			close(fd);
+			FAIL(FLP_CANNOT_LOAD, badFile);
+		}
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		CHECK_STATUS(map == MAP_FAILED, FLP_CANNOT_LOAD, cleanup, "tdbOpen(): cannot map %s", path);
+		self->map = map;
+		self->mapSize = (size_t)st.st_size;
+	}
+	#endif
+	hdr = (const struct TdbHeader *)self->map;
+	CHECK_STATUS(
+		self->mapSize < sizeof(*hdr) || memcmp(hdr->magic, TDB_MAGIC, sizeof(hdr->magic)),
+		FLP_CANNOT_LOAD, badFile);
+	self->version = hdr->version;
+	if ( hdr->version == 1 ) {
+		retVal = openV1(self, path, grid, error);
+	} else if ( hdr->version == TDB_VERSION ) {
+		retVal = openV2(self, path, grid, error);
+	} else {
+		FAIL(FLP_CANNOT_LOAD, badFile);
+	}
+	CHECK_STATUS(retVal, retVal, cleanup);
+	return FLP_SUCCESS;
+badFile:
+	errRender(error, "tdbOpen(): %s is not a track database this version can read", path);
+cleanup:
+	unmap(self);
+	return retVal;
+}
+
+void tdbClose(struct TrackDb *self) {
+	unmap(self);
+}
+
+bool tdbWrite(FILE *file, const struct TrackGrid *grid) {
+	struct TdbHeader hdr;
+	uint8 pad[TG_ALIGN];
+	memset(&hdr, 0, sizeof(hdr));
+	memset(pad, 0, sizeof(pad));
+	memcpy(hdr.magic, TDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = TDB_VERSION;
+	hdr.dirs = TG_DIRS;
+	hdr.xDim = grid->xDim;
+	hdr.yDim = grid->yDim;
+	hdr.numCells = grid->numCells;
+	hdr.knownOffset = TG_ALIGN;
+	hdr.okOffset = hdr.knownOffset + tgOkOffset(grid->numCells);
+	hdr.nextOffset = hdr.knownOffset + tgNextOffset(grid->numCells);
+	hdr.dataBytes = grid->bytes;
+	hdr.checksum = tdbChecksum(0, grid->block, grid->bytes);
+	return
+		fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+		fwrite(pad, 1, TG_ALIGN - sizeof(hdr), file) == TG_ALIGN - sizeof(hdr) &&
+		fwrite(grid->block, 1, grid->bytes, file) == grid->bytes;
+}
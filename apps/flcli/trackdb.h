@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACKDB_H
+#define TRACKDB_H
+
+#include <stdio.h>
+#include <makestuff.h>
+#include "flcli.h"
+#include "trackgrid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Binary track database. Every version starts with TDB_MAGIC and a uint32 version; all
+	// fields are in host byte order.
+	//
+	// Version 2 (written): a TdbHeader, then the grid's known, ok and next arrays exactly as
+	// trackgrid.h lays them out in memory, at the offsets given in the header. The file is mapped
+	// and used as the grid in place, so opening it costs one mmap() and a checksum pass.
+	//
+	// Version 1 (read only): a TdbHeaderV1, then one protocol cell byte per cell of a fixed 8x8
+	// grid, in [x][y * 8 + dir] order. It is copied into a new grid on open.
+	#define TDB_MAGIC "FLTRKDB\0"
+	#define TDB_VERSION 2
+	#define TDB_SUFFIX ".tdb"
+
+	struct TdbHeader {
+		char magic[8];
+		uint32 version;
+		uint32 dirs;
+		uint32 xDim;
+		uint32 yDim;
+		uint32 numCells;     // xDim * yDim * dirs
+		uint32 checksum;     // CRC-32 of the dataBytes bytes from knownOffset
+		uint64 knownOffset;  // from the start of the file; also where the data starts
+		uint64 okOffset;
+		uint64 nextOffset;
+		uint64 dataBytes;
+	};
+
+	struct TdbHeaderV1 {
+		char magic[8];
+		uint32 version;
+		uint32 cellOffset;
+		uint16 xDim;
+		uint16 yDim;
+		uint16 dirs;
+		uint16 reserved0;
+		uint32 cellCount;
+		uint32 checksum;     // CRC-32 of the cells
+		uint8 reserved[32];
+	};
+
+	struct TrackDb {
+		void *map;
+		size_t mapSize;
+		uint32 version;
+	};
+
+	// True if path names a binary database rather than a CSV.
+	bool tdbIsDbPath(const char *path);
+
+	// Continue a CRC-32 over more data; start with crc = 0.
+	uint32 tdbChecksum(uint32 crc, const uint8 *data, size_t length);
+
+	// Open a database and set up grid on it: a version 2 file is mapped privately and used in
+	// place (changes to the grid never reach the file); a version 1 file is converted into a new
+	// grid. Close the database after destroying the grid.
+	ReturnCode tdbOpen(
+		struct TrackDb *self, const char *path, struct TrackGrid *grid, const char **error
+	);
+	void tdbClose(struct TrackDb *self);
+
+	// Write a grid as a version 2 database. Returns false on a write error.
+	bool tdbWrite(FILE *file, const struct TrackGrid *grid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
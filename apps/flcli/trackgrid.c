@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "trackgrid.h"
+
+static size_t alignUp(size_t bytes) {
+	return (bytes + TG_ALIGN - 1) & ~(size_t)(TG_ALIGN - 1);
+}
+
+static size_t bitsetBytes(uint32 numCells) {
+	return alignUp(((size_t)numCells + 63) / 64 * 8);
+}
+
+size_t tgOkOffset(uint32 numCells) {
+	return bitsetBytes(numCells);
+}
+
+size_t tgNextOffset(uint32 numCells) {
+	return 2 * bitsetBytes(numCells);
+}
+
+size_t tgBlockBytes(uint32 numCells) {
+	return tgNextOffset(numCells) + alignUp(((size_t)numCells + 1) / 2);
+}
+
+static bool dimsValid(uint32 xDim, uint32 yDim) {
+	return
+		xDim && yDim &&
+		(uint64)xDim * yDim * TG_DIRS <= TG_MAX_CELLS;
+}
+
+bool tgAttach(struct TrackGrid *self, uint32 xDim, uint32 yDim, void *block) {
+	if ( !dimsValid(xDim, yDim) ) {
+		return false;
+	}
+	self->xDim = xDim;
+	self->yDim = yDim;
+	self->numCells = xDim * yDim * TG_DIRS;
+	self->block = (uint8 *)block;
+	self->bytes = tgBlockBytes(self->numCells);
+	self->known = (uint64 *)self->block;
+	self->ok = (uint64 *)(self->block + tgOkOffset(self->numCells));
+	self->next = self->block + tgNextOffset(self->numCells);
+	self->owned = false;
+	return true;
+}
+
+ReturnCode tgInit(struct TrackGrid *self, uint32 xDim, uint32 yDim, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	void *block;
+	memset(self, 0, sizeof(*self));
+	CHECK_STATUS(
+		!dimsValid(xDim, yDim), FLP_ARGS, cleanup,
+		"tgInit(): a %ux%u grid is too large", xDim, yDim);
+	block = calloc(1, tgBlockBytes(xDim * yDim * TG_DIRS));
+	CHECK_STATUS(!block, FLP_NO_MEMORY, cleanup, "tgInit(): out of memory");
+	tgAttach(self, xDim, yDim, block);
+	self->owned = true;
+cleanup:
+	return retVal;
+}
+
+void tgCopy(struct TrackGrid *dst, const struct TrackGrid *src) {
+	memcpy(dst->block, src->block, src->bytes);
+}
+
+void tgDestroy(struct TrackGrid *self) {
+	if ( self->owned ) {
+		free(self->block);
+	}
+	memset(self, 0, sizeof(*self));
+}
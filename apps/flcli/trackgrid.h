@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACKGRID_H
+#define TRACKGRID_H
+
+#include <stddef.h>
+#include <makestuff.h>
+#include "flcli.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Track grid: xDim columns of yDim rows of TG_DIRS directions, sized when it is created. The
+	// fields of each cell live in parallel packed arrays indexed by tgIndex(): a "known" bit, an
+	// "ok" bit and a 4-bit "next" direction. The direction itself is the cell's position and is
+	// not stored. All three arrays sit in one block, each starting on a 64-byte boundary, in the
+	// same layout as a version 2 track database (see trackdb.h), so a mapped database can be
+	// used as a grid directly.
+	//
+	// The protocol's cell byte is 0x80 | ok << 6 | dir << 3 | next for a known cell and dir << 3
+	// for an unknown one; tgCell() and tgSetCell() convert to and from it.
+	#define TG_DIRS 8
+	#define TG_ALIGN 64
+	#define TG_MAX_CELLS 0x80000000U
+
+	struct TrackGrid {
+		uint32 xDim;
+		uint32 yDim;
+		uint32 numCells;
+		uint64 *known;
+		uint64 *ok;
+		uint8 *next;     // low nibble is the even cell
+		uint8 *block;    // start of the three arrays
+		size_t bytes;    // size of the block
+		bool owned;      // block was allocated by tgInit()
+	};
+
+	static inline bool tgContains(const struct TrackGrid *self, uint32 x, uint32 y, uint32 dir) {
+		return x < self->xDim && y < self->yDim && dir < TG_DIRS;
+	}
+
+	// Only meaningful if tgContains() is true.
+	static inline uint32 tgIndex(const struct TrackGrid *self, uint32 x, uint32 y, uint32 dir) {
+		return (x * self->yDim + y) * TG_DIRS + dir;
+	}
+
+	static inline uint8 tgCell(const struct TrackGrid *self, uint32 index) {
+		const uint32 dir = index % TG_DIRS;
+		if ( !((self->known[index / 64] >> (index % 64)) & 1) ) {
+			return (uint8)(dir << 3);
+		}
+		return (uint8)(
+			0x80 | ((self->ok[index / 64] >> (index % 64)) & 1) << 6 | dir << 3 |
+			((self->next[index / 2] >> (4 * (index % 2))) & 0x07));
+	}
+
+	// An unknown cell is stored with its ok and next fields clear.
+	static inline void tgSetCell(struct TrackGrid *self, uint32 index, uint8 cell) {
+		const uint64 bit = 1ULL << (index % 64);
+		const uint32 shift = 4 * (index % 2);
+		if ( !(cell & 0x80) ) {
+			cell = 0;
+		}
+		if ( cell & 0x80 ) {
+			self->known[index / 64] |= bit;
+		} else {
+			self->known[index / 64] &= ~bit;
+		}
+		if ( cell & 0x40 ) {
+			self->ok[index / 64] |= bit;
+		} else {
+			self->ok[index / 64] &= ~bit;
+		}
+		self->next[index / 2] =
+			(uint8)((self->next[index / 2] & ~(0x0F << shift)) | (cell & 0x07) << shift);
+	}
+
+	// Bounds-checked access by coordinates; false if (x, y, dir) is outside the grid.
+	static inline bool tgGet(const struct TrackGrid *self, uint32 x, uint32 y, uint32 dir, uint8 *cell) {
+		if ( !tgContains(self, x, y, dir) ) {
+			return false;
+		}
+		*cell = tgCell(self, tgIndex(self, x, y, dir));
+		return true;
+	}
+
+	static inline bool tgSet(struct TrackGrid *self, uint32 x, uint32 y, uint32 dir, uint8 cell) {
+		if ( !tgContains(self, x, y, dir) ) {
+			return false;
+		}
+		tgSetCell(self, tgIndex(self, x, y, dir), cell);
+		return true;
+	}
+
+	// Size of the block for a grid of numCells cells, and where each array starts in it.
+	size_t tgBlockBytes(uint32 numCells);
+	size_t tgOkOffset(uint32 numCells);
+	size_t tgNextOffset(uint32 numCells);
+
+	// Allocate an all-unknown grid.
+	ReturnCode tgInit(struct TrackGrid *self, uint32 xDim, uint32 yDim, const char **error);
+
+	// Use an existing block (e.g. a mapped file) of tgBlockBytes() bytes as a grid's storage.
+	// Returns false if the dimensions are out of range.
+	bool tgAttach(struct TrackGrid *self, uint32 xDim, uint32 yDim, void *block);
+
+	// Copy the contents of one grid into another of the same dimensions.
+	void tgCopy(struct TrackGrid *dst, const struct TrackGrid *src);
+
+	// Free the block if tgInit() allocated it.
+	void tgDestroy(struct TrackGrid *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "trackroute.h"
+
+static const int dx[TG_DIRS] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int dy[TG_DIRS] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+// The node a usable segment at node n leads to, read from the grid.
+static uint32 follow(const struct TrackGrid *grid, uint32 n) {
+	const uint8 cell = tgCell(grid, n);
+	const uint32 dir = n % TG_DIRS, pos = n / TG_DIRS;
+	const uint32 x = (uint32)((int)(pos / grid->yDim) + dx[dir]);
+	const uint32 y = (uint32)((int)(pos % grid->yDim) + dy[dir]);
+	if ( (cell & 0xC0) != 0xC0 || !tgContains(grid, x, y, 0) ) {
+		return ROUTE_NONE;
+	}
+	return tgIndex(grid, x, y, cell & 0x07);
+}
+
+// The node heading dir whose segment leads to n, if any. Only it can: it must sit one step back
+// from n along dir.
+static uint32 feeder(const struct RouteIndex *self, uint32 n, uint32 dir) {
+	const struct TrackGrid *const grid = self->grid;
+	const uint32 pos = n / TG_DIRS;
+	const uint32 x = (uint32)((int)(pos / grid->yDim) - dx[dir]);
+	const uint32 y = (uint32)((int)(pos % grid->yDim) - dy[dir]);
+	uint32 p;
+	if ( !tgContains(grid, x, y, dir) ) {
+		return ROUTE_NONE;
+	}
+	p = tgIndex(grid, x, y, dir);
+	return self->succ[p] == n ? p : ROUTE_NONE;
+}
+
+static void gather(struct RouteIndex *self, uint32 n, uint32 *count) {
+	if ( n != ROUTE_NONE && self->stamp[n] != self->epoch ) {
+		self->stamp[n] = self->epoch;
+		self->list[(*count)++] = n;
+	}
+}
+
+// Number the tree of routes that feed root, which is a terminal or a loop node.
+static void number(struct RouteIndex *self, uint32 root, uint32 group) {
+	uint32 top = 0, order = 0, n, p;
+	self->entry[root] = root;
+	self->depth[root] = 0;
+	self->first[root] = order++;
+	self->group[root] = group;
+	self->iter[root] = 0;
+	self->stack[top++] = root;
+	while ( top ) {
+		n = self->stack[top - 1];
+		if ( self->iter[n] == TG_DIRS ) {
+			self->last[n] = order;
+			top--;
+			continue;
+		}
+		p = feeder(self, n, self->iter[n]++);
+		if ( p == ROUTE_NONE || self->loopPos[p] != ROUTE_NONE ) {
+			continue;
+		}
+		self->entry[p] = root;
+		self->depth[p] = self->depth[n] + 1;
+		self->first[p] = order++;
+		self->group[p] = group;
+		self->iter[p] = 0;
+		self->stack[top++] = p;
+	}
+}
+
+// Renumber every node whose route meets seed's, unless this update has done so already.
+static void renumber(struct RouteIndex *self, uint32 seed) {
+	uint32 count = 0, head = 0, n, d, len, i;
+	if ( seed == ROUTE_NONE || self->stamp[seed] == self->epoch ) {
+		return;
+	}
+	gather(self, seed, &count);
+	while ( head < count ) {
+		n = self->list[head++];
+		gather(self, self->succ[n], &count);
+		for ( d = 0; d < TG_DIRS; d++ ) {
+			gather(self, feeder(self, n, d), &count);
+		}
+	}
+	for ( i = 0; i < count; i++ ) {
+		self->loopPos[self->list[i]] = ROUTE_NONE;
+	}
+
+	// These nodes share one route end. Walking as many hops as there are nodes either runs off
+	// at the terminal or must finish on the loop.
+	n = seed;
+	for ( i = 0; i < count && self->succ[n] != ROUTE_NONE; i++ ) {
+		n = self->succ[n];
+	}
+	if ( self->succ[n] == ROUTE_NONE ) {
+		number(self, n, n);
+		return;
+	}
+	len = 0;
+	d = n;
+	do {
+		self->loopPos[d] = len++;
+		d = self->succ[d];
+	} while ( d != n );
+	do {
+		self->loopLen[d] = len;
+		number(self, d, n);
+		d = self->succ[d];
+	} while ( d != n );
+}
+
+static void nextEpoch(struct RouteIndex *self) {
+	if ( ++self->epoch == 0 ) {
+		memset(self->stamp, 0, self->numNodes * sizeof(uint32));
+		self->epoch = 1;
+	}
+}
+
+ReturnCode routeInit(struct RouteIndex *self, const struct TrackGrid *grid, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	const uint32 n = grid->xDim * grid->yDim * TG_DIRS;
+	uint32 i;
+	memset(self, 0, sizeof(*self));
+	self->grid = grid;
+	self->numNodes = n;
+	self->succ = (uint32 *)malloc(n * sizeof(uint32));
+	self->entry = (uint32 *)malloc(n * sizeof(uint32));
+	self->depth = (uint32 *)malloc(n * sizeof(uint32));
+	self->first = (uint32 *)malloc(n * sizeof(uint32));
+	self->last = (uint32 *)malloc(n * sizeof(uint32));
+	self->loopPos = (uint32 *)malloc(n * sizeof(uint32));
+	self->loopLen = (uint32 *)malloc(n * sizeof(uint32));
+	self->group = (uint32 *)malloc(n * sizeof(uint32));
+	self->stamp = (uint32 *)calloc(n, sizeof(uint32));
+	self->list = (uint32 *)malloc(n * sizeof(uint32));
+	self->stack = (uint32 *)malloc(n * sizeof(uint32));
+	self->iter = (uint8 *)malloc(n);
+	CHECK_STATUS(
+		!self->succ || !self->entry || !self->depth || !self->first || !self->last ||
+		!self->loopPos || !self->loopLen || !self->group || !self->stamp || !self->list ||
+		!self->stack || !self->iter, FLP_NO_MEMORY, cleanup,
+		"routeInit(): cannot index %u nodes", n);
+	for ( i = 0; i < n; i++ ) {
+		self->succ[i] = follow(grid, i);
+	}
+	self->epoch = 1;
+	for ( i = 0; i < n; i++ ) {
+		renumber(self, i);
+	}
+	return FLP_SUCCESS;
+cleanup:
+	routeDestroy(self);
+	return retVal;
+}
+
+void routeDestroy(struct RouteIndex *self) {
+	free(self->iter);
+	free(self->stack);
+	free(self->list);
+	free(self->stamp);
+	free(self->group);
+	free(self->loopLen);
+	free(self->loopPos);
+	free(self->last);
+	free(self->first);
+	free(self->depth);
+	free(self->entry);
+	free(self->succ);
+	memset(self, 0, sizeof(*self));
+}
+
+void routeUpdate(struct RouteIndex *self, uint32 index) {
+	const uint32 next = follow(self->grid, index);
+	const uint32 old = self->succ[index];
+	if ( next == old ) {
+		return;
+	}
+	self->succ[index] = next;
+
+	// The routes through index now end where next's do; those that used to reach old without
+	// passing index keep an end of their own
+	nextEpoch(self);
+	renumber(self, index);
+	renumber(self, old);
+}
+
+uint32 routeHops(const struct RouteIndex *self, uint32 from, uint32 to) {
+	const uint32 e = self->entry[from];
+	if ( self->loopPos[to] == ROUTE_NONE ) {
+		// to must lie on from's way to their common entry
+		if (
+			self->entry[to] != e || self->first[to] > self->first[from] ||
+			self->first[from] >= self->last[to] )
+		{
+			return ROUTE_NONE;
+		}
+		return self->depth[from] - self->depth[to];
+	}
+	if ( self->group[to] != self->group[from] ) {
+		return ROUTE_NONE;
+	}
+	return
+		self->depth[from] +
+		(self->loopPos[to] + self->loopLen[to] - self->loopPos[e]) % self->loopLen[to];
+}
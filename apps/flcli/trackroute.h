@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACKROUTE_H
+#define TRACKROUTE_H
+
+#include <makestuff.h>
+#include "flcli.h"
+#include "trackgrid.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Routes over a track grid. Each grid cell (x, y, dir) is a node: a train at signal (x, y)
+	// heading dir. A known cell with its ok bit set is a usable segment to the neighbouring
+	// signal in direction dir (0 is +y, then clockwise in steps of 45 degrees, so 2 is +x),
+	// where the train carries on heading the cell's next direction. Every node therefore has at
+	// most one successor, and from any node there is exactly one route: it runs either to a
+	// terminal (a node with no usable segment) or round into a loop.
+	//
+	// The index keeps, for every node, the terminal or loop node its route first reaches (its
+	// entry), how many hops away that is, and a preorder interval in the tree of routes that
+	// feed that entry. Together with each loop node's position on its loop, that answers "does
+	// the route from A pass B, and after how many hops" with a few table lookups. When a cell
+	// changes, only the routes through it are renumbered.
+	#define ROUTE_NONE 0xFFFFFFFFU
+
+	struct RouteIndex {
+		const struct TrackGrid *grid;
+		uint32 numNodes;
+		uint32 *succ;       // next node, or ROUTE_NONE
+		uint32 *entry;      // terminal or loop node the route reaches first
+		uint32 *depth;      // hops to entry
+		uint32 *first;      // preorder number in entry's tree...
+		uint32 *last;       // ...and one past that of its last descendant
+		uint32 *loopPos;    // position on its loop, or ROUTE_NONE off a loop
+		uint32 *loopLen;    // length of its loop, for loop nodes
+		uint32 *group;      // same for all nodes whose routes meet
+
+		// Scratch for renumbering
+		uint32 *stamp, epoch;
+		uint32 *list, *stack;
+		uint8 *iter;
+	};
+
+	// Index the routes of a grid as it stands. The grid must outlive the index, and every
+	// change to it must be passed to routeUpdate().
+	ReturnCode routeInit(struct RouteIndex *self, const struct TrackGrid *grid, const char **error);
+	void routeDestroy(struct RouteIndex *self);
+
+	// The cell at grid index has changed.
+	void routeUpdate(struct RouteIndex *self, uint32 index);
+
+	// Hops along the route from one node to another (0 if they are the same), or ROUTE_NONE if
+	// the route from the first never reaches the second.
+	uint32 routeHops(const struct RouteIndex *self, uint32 from, uint32 to);
+
+	static inline uint32 routeNext(const struct RouteIndex *self, uint32 node) {
+		return self->succ[node];
+	}
+
+	// Usable segments on the route from a node before it runs out, or ROUTE_NONE if it goes
+	// round a loop and never does.
+	static inline uint32 routeReach(const struct RouteIndex *self, uint32 node) {
+		const uint32 e = self->entry[node];
+		return self->loopPos[e] == ROUTE_NONE ? routeHops(self, node, e) : ROUTE_NONE;
+	}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WIN32
+	#define _POSIX_C_SOURCE 200809L
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include "tracktab.h"
+#include "trackroute.h"
+#include "trackconflict.h"
+#include "clock.h"
+
+static uint8 recordCheck(const struct TrackRecord *rec) {
+	return (uint8)(
+		rec->index ^ rec->index >> 8 ^ rec->index >> 16 ^ rec->index >> 24 ^
+		rec->value ^ rec->reserved ^ rec->tag ^ 0xA5);
+}
+
+static char *joinPath(const char *path, const char *suffix) {
+	char *const result = (char *)malloc(strlen(path) + strlen(suffix) + 1);
+	if ( result ) {
+		strcpy(result, path);
+		strcat(result, suffix);
+	}
+	return result;
+}
+
+static bool syncFile(FILE *file) {
+	if ( fflush(file) ) {
+		return false;
+	}
+	#ifdef WIN32
+		return true;
+	#else
+		return fsync(fileno(file)) == 0;
+	#endif
+}
+
+// Write a grid to a temporary file and rename it over the snapshot, so a crash leaves either the
+// old snapshot or the new one.
+static ReturnCode writeSnapshot(
+	const struct TrackTable *self, const struct TrackGrid *grid, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	char *const tmpPath = joinPath(self->path, ".tmp");
+	FILE *file = NULL;
+	CHECK_STATUS(!tmpPath, FLP_NO_MEMORY, cleanup, "writeSnapshot(): out of memory");
+	file = fopen(tmpPath, self->isDb ? "wb" : "w");
+	CHECK_STATUS(!file, FLP_CANNOT_SAVE, cleanup, "writeSnapshot(): cannot create %s", tmpPath);
+	CHECK_STATUS(
+		!(self->isDb ? tdbWrite(file, grid) : trackWrite(file, grid)) || !syncFile(file),
+		FLP_CANNOT_SAVE, cleanup,
+		"writeSnapshot(): cannot write %s", tmpPath);
+	fclose(file);
+	file = NULL;
+	#ifdef WIN32
+		remove(self->path);
+	#endif
+	CHECK_STATUS(
+		rename(tmpPath, self->path), FLP_CANNOT_SAVE, cleanup,
+		"writeSnapshot(): cannot replace %s", self->path);
+cleanup:
+	if ( file ) {
+		fclose(file);
+		remove(tmpPath);
+	}
+	free(tmpPath);
+	return retVal;
+}
+
+// Snapshot the image and start an empty journal. Once the rename is done, replaying the old
+// journal over the new snapshot is harmless: the image already ends with those same records.
+static ReturnCode compact(struct TrackTable *self, const char **error) {
+	ReturnCode retVal = writeSnapshot(self, &self->image, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	if ( self->journal ) {
+		fclose(self->journal);
+	}
+	self->journal = fopen(self->journalPath, "wb");
+	CHECK_STATUS(
+		!self->journal || !syncFile(self->journal), FLP_CANNOT_SAVE, cleanup,
+		"compact(): cannot create %s", self->journalPath);
+	self->journalRecords = 0;
+cleanup:
+	return retVal;
+}
+
+// Append a batch to the journal, make it durable and fold it into the image.
+static ReturnCode commit(
+	struct TrackTable *self, const struct TrackRecord *recs, uint32 count, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 i;
+	CHECK_STATUS(
+		fwrite(recs, sizeof(*recs), count, self->journal) != count || !syncFile(self->journal),
+		FLP_CANNOT_SAVE, cleanup, "commit(): cannot append to %s", self->journalPath);
+	for ( i = 0; i < count; i++ ) {
+		tgSetCell(&self->image, recs[i].index, recs[i].value);
+	}
+	self->journalRecords += count;
+	if ( self->journalRecords >= TT_COMPACT_RECORDS ) {
+		retVal = compact(self, error);
+	}
+cleanup:
+	return retVal;
+}
+
+#ifndef WIN32
+static void *committerThread(void *arg) {
+	struct TrackTable *const self = (struct TrackTable *)arg;
+	struct TrackRecord batch[TT_PENDING];
+	pthread_mutex_lock(&self->lock);
+	for ( ;; ) {
+		uint32 count;
+		while ( !self->numPending && !self->done ) {
+			pthread_cond_wait(&self->work, &self->lock);
+		}
+		if ( !self->numPending ) {
+			break;
+		}
+		if ( !self->done ) {
+			// Let the group fill up before paying for the fsync
+			pthread_mutex_unlock(&self->lock);
+			clkSleep(TT_COMMIT_US);
+			pthread_mutex_lock(&self->lock);
+		}
+		count = self->numPending;
+		memcpy(batch, self->pending, count * sizeof(*batch));
+		self->numPending = 0;
+		pthread_cond_broadcast(&self->progress);
+		if ( !self->commitStatus ) {
+			const char *error = NULL;
+			ReturnCode status;
+			pthread_mutex_unlock(&self->lock);
+			status = commit(self, batch, count, &error);
+			pthread_mutex_lock(&self->lock);
+			self->commitStatus = status;
+			self->commitError = error;
+		}
+		self->durable += count;
+		pthread_cond_broadcast(&self->progress);
+	}
+	pthread_mutex_unlock(&self->lock);
+	return NULL;
+}
+#endif
+
+// Hand over the committer's error, if it has one. Called with the lock held.
+static ReturnCode takeCommitError(struct TrackTable *self, const char **error) {
+	const ReturnCode retVal = self->commitStatus;
+	if ( retVal && error ) {
+		*error = self->commitError;
+		self->commitError = NULL;
+	}
+	return retVal;
+}
+
+// Copy a grid smaller than the protocol's coordinate space into a new one that covers it.
+static ReturnCode growGrid(struct TrackGrid *grid, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct TrackGrid bigger;
+	uint32 x, y, dir;
+	if ( grid->xDim >= TRACK_X && grid->yDim >= TRACK_Y ) {
+		return FLP_SUCCESS;
+	}
+	retVal = tgInit(
+		&bigger, grid->xDim > TRACK_X ? grid->xDim : TRACK_X,
+		grid->yDim > TRACK_Y ? grid->yDim : TRACK_Y, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	for ( x = 0; x < grid->xDim; x++ ) {
+		for ( y = 0; y < grid->yDim; y++ ) {
+			for ( dir = 0; dir < TG_DIRS; dir++ ) {
+				tgSet(&bigger, x, y, dir, tgCell(grid, tgIndex(grid, x, y, dir)));
+			}
+		}
+	}
+	tgDestroy(grid);
+	*grid = bigger;
+cleanup:
+	return retVal;
+}
+
+ReturnCode trackOpen(
+	struct TrackTable *self, const char *path, bool *found, uint32 *replayed, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FILE *journal = NULL;
+	struct TrackRecord rec;
+	uint32 numReplayed = 0;
+	bool haveSnapshot = false, haveJournal = false;
+	memset(self, 0, sizeof(*self));
+	self->path = joinPath(path, "");
+	self->journalPath = joinPath(path, ".wal");
+	CHECK_STATUS(
+		!self->path || !self->journalPath, FLP_NO_MEMORY, cleanup, "trackOpen(): out of memory");
+	self->isDb = tdbIsDbPath(path);
+	if ( self->isDb ) {
+		FILE *const file = fopen(path, "rb");
+		haveSnapshot = file != NULL;
+		if ( file ) {
+			fclose(file);
+			retVal = tdbOpen(&self->db, path, &self->grid, error);
+			if ( !retVal ) {
+				retVal = growGrid(&self->grid, error);
+			}
+		} else {
+			retVal = tgInit(&self->grid, TRACK_X, TRACK_Y, error);
+		}
+	} else {
+		retVal = trackLoad(path, &self->grid, &haveSnapshot, error);
+	}
+	CHECK_STATUS(retVal, retVal, cleanup);
+
+	// Replay the journal up to the first torn or corrupt record
+	journal = fopen(self->journalPath, "rb");
+	if ( journal ) {
+		while ( fread(&rec, sizeof(rec), 1, journal) == 1 ) {
+			haveJournal = true;
+			if (
+				rec.tag != TT_RECORD_TAG || rec.check != recordCheck(&rec) ||
+				rec.index >= self->grid.numCells )
+			{
+				break;
+			}
+			tgSetCell(&self->grid, rec.index, rec.value);
+			numReplayed++;
+		}
+		fclose(journal);
+	}
+	retVal = tgInit(&self->image, self->grid.xDim, self->grid.yDim, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	tgCopy(&self->image, &self->grid);
+	if ( haveJournal || !haveSnapshot ) {
+		retVal = compact(self, error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	} else {
+		self->journal = fopen(self->journalPath, "ab");
+		CHECK_STATUS(
+			!self->journal, FLP_CANNOT_SAVE, cleanup,
+			"trackOpen(): cannot open %s", self->journalPath);
+	}
+
+	#ifndef WIN32
+		pthread_mutex_init(&self->lock, NULL);
+		pthread_cond_init(&self->work, NULL);
+		pthread_cond_init(&self->progress, NULL);
+		if ( pthread_create(&self->committer, NULL, committerThread, self) ) {
+			// trackClose() only tears these down along with a running committer
+			pthread_cond_destroy(&self->progress);
+			pthread_cond_destroy(&self->work);
+			pthread_mutex_destroy(&self->lock);
+			fclose(self->journal);
+			self->journal = NULL;
+			errRender(error, "trackOpen(): cannot start the journal thread");
+			FAIL(FLP_NO_MEMORY, cleanup);
+		}
+		self->hasCommitter = true;
+	#endif
+cleanup:
+	if ( found ) {
+		*found = haveSnapshot;
+	}
+	if ( replayed ) {
+		*replayed = numReplayed;
+	}
+	return retVal;
+}
+
+ReturnCode trackSet(
+	struct TrackTable *self, uint32 x, uint32 y, uint32 dir, uint8 value, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	struct TrackRecord rec;
+	CHECK_STATUS(
+		!tgContains(&self->grid, x, y, dir), FLP_ARGS, cleanup,
+		"trackSet(): cell (%u, %u, %u) is outside the %ux%u track table",
+		x, y, dir, self->grid.xDim, self->grid.yDim);
+	rec.index = tgIndex(&self->grid, x, y, dir);
+	rec.value = value;
+	rec.reserved = 0;
+	rec.tag = TT_RECORD_TAG;
+	rec.check = recordCheck(&rec);
+	tgSetCell(&self->grid, rec.index, value);
+	if ( self->routes ) {
+		routeUpdate(self->routes, rec.index);
+		if ( self->conflicts ) {
+			tcUpdate(self->conflicts, rec.index);
+		}
+	}
+	#ifdef WIN32
+		retVal = commit(self, &rec, 1, error);
+	#else
+		pthread_mutex_lock(&self->lock);
+		while ( self->numPending == TT_PENDING && !self->commitStatus ) {
+			pthread_cond_wait(&self->progress, &self->lock);
+		}
+		retVal = takeCommitError(self, error);
+		if ( !retVal ) {
+			self->pending[self->numPending++] = rec;
+			self->queued++;
+			pthread_cond_signal(&self->work);
+		}
+		pthread_mutex_unlock(&self->lock);
+	#endif
+cleanup:
+	return retVal;
+}
+
+ReturnCode trackSync(struct TrackTable *self, const char **error) {
+	#ifdef WIN32
+		(void)self;
+		(void)error;
+		return FLP_SUCCESS;
+	#else
+		ReturnCode retVal;
+		pthread_mutex_lock(&self->lock);
+		while ( self->durable < self->queued && !self->commitStatus ) {
+			pthread_cond_wait(&self->progress, &self->lock);
+		}
+		retVal = takeCommitError(self, error);
+		pthread_mutex_unlock(&self->lock);
+		return retVal;
+	#endif
+}
+
+ReturnCode trackClose(struct TrackTable *self, ReturnCode retVal, const char **error) {
+	ReturnCode status = FLP_SUCCESS;
+	#ifndef WIN32
+		if ( self->hasCommitter ) {
+			pthread_mutex_lock(&self->lock);
+			self->done = true;
+			pthread_cond_signal(&self->work);
+			pthread_mutex_unlock(&self->lock);
+			pthread_join(self->committer, NULL);
+			status = takeCommitError(self, retVal ? NULL : error);
+			pthread_cond_destroy(&self->progress);
+			pthread_cond_destroy(&self->work);
+			pthread_mutex_destroy(&self->lock);
+		}
+	#endif
+	if ( !status && self->journal && self->journalRecords ) {
+		status = compact(self, retVal ? NULL : error);
+	}
+	if ( self->journal ) {
+		fclose(self->journal);
+	}
+	if ( self->commitError ) {
+		errFree(self->commitError);
+	}
+	tgDestroy(&self->image);
+	tgDestroy(&self->grid);
+	tdbClose(&self->db);
+	free(self->journalPath);
+	free(self->path);
+	memset(self, 0, sizeof(*self));
+	return retVal ? retVal : status;
+}
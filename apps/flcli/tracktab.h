@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACKTAB_H
+#define TRACKTAB_H
+
+#ifndef WIN32
+	#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <makestuff.h>
+#include "flcli.h"
+#include "track.h"
+#include "trackdb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	#define TT_COMMIT_US 10000        // group-commit window
+	#define TT_PENDING 1024           // updates queued for the journal
+	#define TT_COMPACT_RECORDS 4096   // journal length that triggers a new snapshot
+
+	// One journal record: the cell at grid index is set to value (a protocol cell byte), with a
+	// tag and check byte to spot a torn or foreign tail.
+	#define TT_RECORD_TAG 0x4A
+
+	struct TrackRecord {
+		uint32 index;
+		uint8 value;
+		uint8 reserved;
+		uint8 tag;
+		uint8 check;
+	};
+
+	// The track table lives in memory. The snapshot is read once at open: a path ending in
+	// TDB_SUFFIX is a binary database (see trackdb.h) that is mapped and used in place, anything
+	// else is a CSV that is parsed into a new grid. A database smaller than TRACK_X by TRACK_Y is
+	// copied into a grid that size instead, so every protocol coordinate has its cells. Every
+	// update is appended to "<path>.wal" by a committer thread, which batches whatever arrives
+	// within TT_COMMIT_US into one write and one fsync. Once the journal reaches
+	// TT_COMPACT_RECORDS the committer rewrites the snapshot (to a temporary file, then renamed
+	// over it) and empties the journal.
+	struct RouteIndex;
+	struct TrackConflicts;
+
+	struct TrackTable {
+		struct TrackGrid grid;   // live table; read and updated by the owner only
+		struct RouteIndex *routes;  // kept in step with grid if the owner sets it; NULL for none
+		struct TrackConflicts *conflicts;  // likewise, over routes
+		struct TrackGrid image;  // table as of the end of the journal; committer only
+		struct TrackDb db;
+		bool isDb;
+		char *path;
+		char *journalPath;
+		FILE *journal;
+		uint32 journalRecords;
+
+		// Updates handed from the owner to the committer
+		struct TrackRecord pending[TT_PENDING];
+		uint32 numPending;
+		uint64 queued;     // updates queued so far
+		uint64 durable;    // of those, how many have been fsync()'d
+		bool done;
+		#ifndef WIN32
+			pthread_mutex_t lock;
+			pthread_cond_t work;
+			pthread_cond_t progress;
+			pthread_t committer;
+			bool hasCommitter;
+		#endif
+
+		// Set by the committer if it fails; the next update or sync returns it
+		ReturnCode commitStatus;
+		const char *commitError;
+	};
+
+	// Load the snapshot at path (a missing file gives an empty table), replay its journal and
+	// start the committer. If the journal was not empty, the two are first folded into a fresh
+	// snapshot. If not NULL, *found says whether there was a snapshot and *replayed gets the
+	// number of journal records recovered.
+	ReturnCode trackOpen(
+		struct TrackTable *self, const char *path, bool *found, uint32 *replayed,
+		const char **error
+	);
+
+	// Set the cell at (x, y, dir) to a protocol cell byte and queue it for the journal. Blocks
+	// only if TT_PENDING updates are already waiting for the committer.
+	ReturnCode trackSet(
+		struct TrackTable *self, uint32 x, uint32 y, uint32 dir, uint8 value, const char **error
+	);
+
+	// Wait until every update so far is on disk.
+	ReturnCode trackSync(struct TrackTable *self, const char **error);
+
+	// Commit what is pending, stop the committer, write a final snapshot and free everything.
+	// Returns retVal unless it is FLP_SUCCESS and closing fails.
+	ReturnCode trackClose(struct TrackTable *self, ReturnCode retVal, const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <libfpgalink.h>
+#include <liberror.h>
+#include "trigcap.h"
+
+ReturnCode trigInit(
+	struct TrigCapture *self, size_t preBytes, uint64 postBytes,
+	const uint8 *pattern, size_t patLen, const char *fileName, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	memset(self, 0, sizeof(*self));
+	CHECK_STATUS(
+		patLen > TRIG_MAX_PATTERN, FLP_ARGS, cleanup,
+		"trigInit(): trigger pattern is longer than %d bytes", TRIG_MAX_PATTERN);
+	self->ringSize = preBytes + TRIG_SLICE + TRIG_MAX_PATTERN;
+	self->ring = (uint8 *)malloc(self->ringSize);
+	CHECK_STATUS(!self->ring, FLP_NO_MEMORY, cleanup, "trigInit(): cannot allocate ring");
+	self->preBytes = preBytes;
+	self->postBytes = postBytes;
+	if ( patLen ) {
+		memcpy(self->pattern, pattern, patLen);
+	}
+	self->patLen = patLen;
+	self->state = TRIG_ARMED;
+	self->fileName = fileName;
+cleanup:
+	return retVal;
+}
+
+void trigDestroy(struct TrigCapture *self) {
+	if ( self->file ) {
+		fclose(self->file);
+		self->file = NULL;
+	}
+	free(self->ring);
+	self->ring = NULL;
+}
+
+// Write stream bytes [from, to) from the ring; they must still be resident.
+static ReturnCode writeRing(struct TrigCapture *self, uint64 from, uint64 to, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	while ( from < to ) {
+		const size_t index = (size_t)(from % self->ringSize);
+		size_t length = self->ringSize - index;
+		if ( length > to - from ) {
+			length = (size_t)(to - from);
+		}
+		CHECK_STATUS(
+			fwrite(self->ring + index, 1, length, self->file) != length, FLP_CANNOT_SAVE, cleanup,
+			"writeRing(): cannot write to capture file");
+		from += length;
+	}
+cleanup:
+	return retVal;
+}
+
+static void appendRing(struct TrigCapture *self, const uint8 *data, size_t length) {
+	while ( length ) {
+		const size_t index = (size_t)(self->total % self->ringSize);
+		size_t chunk = self->ringSize - index;
+		if ( chunk > length ) {
+			chunk = length;
+		}
+		memcpy(self->ring + index, data, chunk);
+		self->total += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+// Return the offset of the first match in data[0..length), or length if there is none. memchr()
+// is vectorised by the C library, so the common case of a rare first byte runs at memory speed.
+static size_t findPattern(const uint8 *pattern, size_t patLen, const uint8 *data, size_t length) {
+	const uint8 *p = data;
+	const uint8 *last;
+	if ( length < patLen ) {
+		return length;
+	}
+	last = data + length - patLen;
+	while ( p <= last ) {
+		p = (const uint8 *)memchr(p, pattern[0], (size_t)(last - p) + 1);
+		if ( !p ) {
+			break;
+		}
+		if ( !memcmp(p + 1, pattern + 1, patLen - 1) ) {
+			return (size_t)(p - data);
+		}
+		p++;
+	}
+	return length;
+}
+
+// Search the seam between the previous chunk and this one; returns how many bytes before the
+// start of data the match begins, or zero for no match.
+static size_t findSeam(struct TrigCapture *self, const uint8 *data, size_t length) {
+	uint8 seam[2 * TRIG_MAX_PATTERN];
+	size_t head = self->patLen - 1, match;
+	if ( !self->carryLen ) {
+		return 0;
+	}
+	if ( head > length ) {
+		head = length;
+	}
+	memcpy(seam, self->carry, self->carryLen);
+	memcpy(seam + self->carryLen, data, head);
+	match = findPattern(self->pattern, self->patLen, seam, self->carryLen + head);
+	return match < self->carryLen ? self->carryLen - match : 0;
+}
+
+static void updateCarry(struct TrigCapture *self, const uint8 *data, size_t length) {
+	const size_t want = self->patLen ? self->patLen - 1 : 0;
+	if ( length >= want ) {
+		memcpy(self->carry, data + length - want, want);
+		self->carryLen = want;
+	} else {
+		const size_t keep = self->carryLen + length > want ? want - length : self->carryLen;
+		memmove(self->carry, self->carry + self->carryLen - keep, keep);
+		memcpy(self->carry + keep, data, length);
+		self->carryLen = keep + length;
+	}
+}
+
+// Fire at stream offset trigPos, which is still in the ring. Everything from the start of the
+// pre-trigger window up to the current end of stream is written out immediately.
+static ReturnCode fire(struct TrigCapture *self, uint64 trigPos, const char **error) {
+	ReturnCode retVal = FLP_SUCCESS;
+	char *name = NULL;
+	uint64 from, to;
+	const size_t nameLen = strlen(self->fileName) + 12;
+	name = (char *)malloc(nameLen);
+	CHECK_STATUS(!name, FLP_NO_MEMORY, cleanup, "fire(): cannot allocate file name");
+	snprintf(name, nameLen, "%s.%u", self->fileName, self->numEvents);
+	self->file = fopen(name, "wb");
+	CHECK_STATUS(!self->file, FLP_CANNOT_SAVE, cleanup, "fire(): cannot open %s", name);
+	from = trigPos > self->preBytes ? trigPos - self->preBytes : 0;
+	to = trigPos + self->postBytes < self->total ? trigPos + self->postBytes : self->total;
+	printf(
+		"\nTrigger %u at stream offset %llu; saving to %s\n",
+		self->numEvents, (unsigned long long)trigPos, name);
+	retVal = writeRing(self, from, to, error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	self->numEvents++;
+	self->postRemaining = trigPos + self->postBytes - to;
+	self->state = TRIG_CAPTURING;
+cleanup:
+	free(name);
+	return retVal;
+}
+
+static void finish(struct TrigCapture *self) {
+	fclose(self->file);
+	self->file = NULL;
+	self->state = TRIG_ARMED;
+	self->carryLen = 0;
+}
+
+ReturnCode trigFeed(
+	struct TrigCapture *self, const uint8 *data, size_t length, bool external,
+	const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	if ( external ) {
+		self->pending = true;
+	}
+	while ( length ) {
+		size_t slice = length > TRIG_SLICE ? TRIG_SLICE : length;
+		if ( self->state == TRIG_CAPTURING ) {
+			// Post-trigger bytes go straight to the file
+			if ( slice > self->postRemaining ) {
+				slice = (size_t)self->postRemaining;
+			}
+			CHECK_STATUS(
+				fwrite(data, 1, slice, self->file) != slice, FLP_CANNOT_SAVE, cleanup,
+				"trigFeed(): cannot write to capture file");
+			self->postRemaining -= slice;
+			if ( !self->postRemaining ) {
+				finish(self);
+			}
+			appendRing(self, data, slice);
+		} else {
+			const uint64 start = self->total;
+			size_t match = slice, seam = 0;
+			if ( self->patLen ) {
+				seam = findSeam(self, data, slice);
+				if ( !seam ) {
+					match = findPattern(self->pattern, self->patLen, data, slice);
+				}
+			}
+			appendRing(self, data, slice);
+			if ( self->pending ) {
+				self->pending = false;
+				retVal = fire(self, start, error);
+			} else if ( seam ) {
+				retVal = fire(self, start - seam, error);
+			} else if ( match < slice ) {
+				retVal = fire(self, start + match, error);
+			} else {
+				updateCarry(self, data, slice);
+			}
+			CHECK_STATUS(retVal, retVal, cleanup);
+			if ( self->state == TRIG_CAPTURING && !self->postRemaining ) {
+				finish(self);
+			}
+		}
+		data += slice;
+		length -= slice;
+	}
+cleanup:
+	return retVal;
+}
+
+ReturnCode trigCaptureLoop(
+	struct FLContext *handle, uint8 chan, struct TrigCapture *self, const char **error)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	FLStatus fStatus;
+	const uint8 *recvData;
+	uint32 actualLength;
+	sigRegisterHandler();
+	sigRegisterTrigger();
+	fStatus = flReadChannelAsyncSubmit(handle, chan, 22528, NULL, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "trigCaptureLoop()");
+	do {
+		fStatus = flReadChannelAsyncSubmit(handle, chan, 22528, NULL, error);
+		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "trigCaptureLoop()");
+		fStatus = flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, error);
+		CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "trigCaptureLoop()");
+		retVal = trigFeed(self, recvData, actualLength, sigTakeTrigger(), error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	} while ( !sigIsRaised() );
+	fStatus = flReadChannelAsyncAwait(handle, &recvData, &actualLength, &actualLength, error);
+	CHECK_STATUS(fStatus, FLP_LIBERR, cleanup, "trigCaptureLoop()");
+	retVal = trigFeed(self, recvData, actualLength, false, error);
+cleanup:
+	return retVal;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRIGCAP_H
+#define TRIGCAP_H
+
+#include <makestuff.h>
+#include <stdio.h>
+#include "flcli.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	struct FLContext;
+
+	#define TRIG_MAX_PATTERN 64
+	#define TRIG_SLICE 65536
+
+	typedef enum {
+		TRIG_ARMED,
+		TRIG_CAPTURING
+	} TrigState;
+
+	// Keeps the last preBytes of a stream in memory. When the trigger pattern appears (or an
+	// external trigger is raised), the pre-trigger window plus the following postBytes are saved
+	// to "<fileName>.<n>", then the capture re-arms.
+	struct TrigCapture {
+		uint8 *ring;
+		size_t ringSize;
+		uint64 total;           // stream bytes seen so far
+		size_t preBytes;
+		uint64 postBytes;
+		uint8 pattern[TRIG_MAX_PATTERN];
+		size_t patLen;
+		uint8 carry[TRIG_MAX_PATTERN];  // last patLen-1 bytes, for matches spanning chunks
+		size_t carryLen;
+		TrigState state;
+		bool pending;           // external trigger raised during a capture, not yet fired
+		uint64 postRemaining;
+		FILE *file;
+		const char *fileName;
+		uint32 numEvents;
+	};
+
+	ReturnCode trigInit(
+		struct TrigCapture *self, size_t preBytes, uint64 postBytes,
+		const uint8 *pattern, size_t patLen, const char *fileName, const char **error
+	);
+
+	// Feed the next chunk of the stream. If external is set, the trigger fires at the start of
+	// this chunk; if a capture is already in progress, it is held until that one finishes and
+	// fires at the first byte after it, taking precedence over any pattern match.
+	ReturnCode trigFeed(
+		struct TrigCapture *self, const uint8 *data, size_t length, bool external,
+		const char **error
+	);
+
+	void trigDestroy(struct TrigCapture *self);
+
+	// Stream chan through the capture until SIGINT. SIGUSR1 raises an external trigger.
+	ReturnCode trigCaptureLoop(
+		struct FLContext *handle, uint8 chan, struct TrigCapture *self, const char **error
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
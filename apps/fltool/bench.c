@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include <argtable2.h>
+#include "fltool.h"
+#include "flcli.h"
+#include "clock.h"
+#include "railcrypt.h"
+#include "trackgrid.h"
+#include "trackroute.h"
+#include "trackconflict.h"
+
+static const char *const cryptKernels[] = {"avx512", "avx2", "sse2", "scalar"};
+
+// Time reps passes over n words with the current kernel, returning words per second. Also checks
+// the last pass against the word-at-a-time reference.
+static double timeCrypt(
+	const uint32 *masks, const uint32 *in, uint32 *out, uint32 n, uint32 reps, bool *ok)
+{
+	struct RailKey key;
+	const uint64 start = clkMicros();
+	uint64 elapsed;
+	uint32 i;
+	railKeyInit(&key, RAIL_KEY);
+	for ( i = 0; i < reps; i++ ) {
+		if ( masks ) {
+			railCryptBatchLanes(masks, in, out, n);
+		} else {
+			railCryptBatch(&key, in, out, n);
+		}
+	}
+	elapsed = clkMicros() - start;
+	*ok = true;
+	for ( i = 0; i < n; i++ ) {
+		if ( out[i] != (in[i] ^ (masks ? masks[i] : key.encMask)) ) {
+			*ok = false;
+		}
+	}
+	return elapsed ? (double)n * reps * 1000000.0 / (double)elapsed : 0.0;
+}
+
+static ReturnCode benchCrypt(const char *progName, const char *only, uint32 n, uint32 reps) {
+	ReturnCode retVal = FLP_SUCCESS;
+	uint32 *in = NULL, *out = NULL, *masks = NULL;
+	uint32 i, seed = 0x2545F491;
+	size_t k;
+	if ( only ) {
+		for ( k = 0; k < sizeof(cryptKernels) / sizeof(*cryptKernels); k++ ) {
+			if ( !strcmp(only, cryptKernels[k]) ) {
+				break;
+			}
+		}
+		if ( k == sizeof(cryptKernels) / sizeof(*cryptKernels) ) {
+			fprintf(stderr, "%s: unknown kernel '%s' (try avx512, avx2, sse2 or scalar)\n", progName, only);
+			FAIL(FLP_ARGS, cleanup);
+		}
+	}
+	in = malloc(n * sizeof(uint32));
+	out = malloc(n * sizeof(uint32));
+	masks = malloc(n * sizeof(uint32));
+	if ( !in || !out || !masks ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(FLP_NO_MEMORY, cleanup);
+	}
+	for ( i = 0; i < n; i++ ) {
+		struct RailKey key;
+		seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+		in[i] = seed;
+		railKeyInit(&key, seed * 0x9E3779B9);
+		masks[i] = key.encMask;
+	}
+	printf("%u words x %u passes\n", n, reps);
+	printf("kernel    one key (words/s)   key per word (words/s)\n");
+	for ( k = 0; k < sizeof(cryptKernels) / sizeof(*cryptKernels); k++ ) {
+		double one, lanes;
+		bool oneOk, lanesOk;
+		if ( only && strcmp(only, cryptKernels[k]) ) {
+			continue;
+		}
+		if ( !railCryptUseKernel(cryptKernels[k]) ) {
+			printf("%-8s  not supported by this CPU\n", cryptKernels[k]);
+			continue;
+		}
+		one = timeCrypt(NULL, in, out, n, reps, &oneOk);
+		lanes = timeCrypt(masks, in, out, n, reps, &lanesOk);
+		printf("%-8s  %17.4g   %22.4g\n", cryptKernels[k], one, lanes);
+		if ( !oneOk || !lanesOk ) {
+			fprintf(stderr, "%s: kernel %s gave wrong results\n", progName, cryptKernels[k]);
+			FAIL(FLP_PROTOCOL, cleanup);
+		}
+	}
+cleanup:
+	free(masks);
+	free(out);
+	free(in);
+	return retVal;
+}
+
+static uint32 xorshift(uint32 *state) {
+	*state ^= *state << 13; *state ^= *state >> 17; *state ^= *state << 5;
+	return *state;
+}
+
+// A side x side network: mostly straight track with the odd 45-degree turn, 3% of it not ok.
+static void makeNetwork(struct TrackGrid *grid, uint32 *seed) {
+	uint32 i;
+	for ( i = 0; i < grid->numCells; i++ ) {
+		const uint32 dir = i % TG_DIRS, r = xorshift(seed) % 100;
+		const uint32 next = r < 5 ? (dir + 1) % TG_DIRS : r < 10 ? (dir + TG_DIRS - 1) % TG_DIRS : dir;
+		tgSetCell(grid, i, (uint8)(0x80 | (xorshift(seed) % 100 < 3 ? 0 : 0x40) | dir << 3 | next));
+	}
+}
+
+static double perUpdate(uint64 micros, uint32 count) {
+	return count ? (double)micros / count : 0.0;
+}
+
+// Flip the ok bit of random cells, re-evaluating the signals incrementally, then the same number
+// of flips with a full rescan after each; then check the two agree.
+static ReturnCode benchConflict(
+	const char *progName, uint32 side, uint32 numSignals, uint32 len, uint32 reps)
+{
+	ReturnCode retVal = FLP_SUCCESS;
+	const char *error = NULL;
+	struct TrackGrid grid = {0,};
+	struct RouteIndex routes = {0,};
+	struct TrackConflicts conflicts = {0,};
+	TcStatus *expect = NULL;
+	uint32 seed = 0x2545F491, i, c, rescans, counts[3] = {0,}, touched = 0;
+	uint64 start, incMicros, fullMicros;
+	retVal = tgInit(&grid, side, side, &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	makeNetwork(&grid, &seed);
+	retVal = routeInit(&routes, &grid, &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	retVal = tcInit(&conflicts, &routes, numSignals, len, &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	for ( i = 0; i < numSignals; i++ ) {
+		retVal = tcAdd(&conflicts, xorshift(&seed) % grid.numCells, len, &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
+	for ( i = 0; i < numSignals; i++ ) {
+		counts[tcStatus(&conflicts, i)]++;
+	}
+	printf(
+		"%ux%u grid (%u cells), %u signals with %u-segment routes: %u clear, %u blocked, %u in conflict\n",
+		side, side, grid.numCells, numSignals, len, counts[TC_CLEAR], counts[TC_BLOCKED],
+		counts[TC_CONFLICT]);
+
+	start = clkMicros();
+	for ( i = 0; i < reps; i++ ) {
+		c = xorshift(&seed) % grid.numCells;
+		tgSetCell(&grid, c, tgCell(&grid, c) ^ 0x40);
+		routeUpdate(&routes, c);
+		tcUpdate(&conflicts, c);
+		touched += conflicts.numWork;
+	}
+	incMicros = clkMicros() - start;
+
+	// Check against a full re-evaluation
+	expect = (TcStatus *)malloc(numSignals * sizeof(TcStatus));
+	CHECK_STATUS(!expect, FLP_NO_MEMORY, cleanup);
+	for ( i = 0; i < numSignals; i++ ) {
+		expect[i] = tcStatus(&conflicts, i);
+	}
+	tcRescan(&conflicts);
+	if ( conflicts.numChanged ) {
+		fprintf(stderr, "%s: incremental update disagrees with a rescan on %u signals\n", progName, conflicts.numChanged);
+		FAIL(FLP_PROTOCOL, cleanup);
+	}
+
+	// A full rescan per change is slow: stop after a second's worth
+	start = clkMicros();
+	for ( rescans = 0; rescans < reps && clkMicros() - start < 1000000; rescans++ ) {
+		c = xorshift(&seed) % grid.numCells;
+		tgSetCell(&grid, c, tgCell(&grid, c) ^ 0x40);
+		routeUpdate(&routes, c);
+		tcRescan(&conflicts);
+	}
+	fullMicros = clkMicros() - start;
+	printf("method       changes   us/change   signals looked at/change\n");
+	printf(
+		"incremental  %7u  %10.3f   %24.1f\n", reps, perUpdate(incMicros, reps),
+		reps ? (double)touched / reps : 0.0);
+	printf(
+		"rescan       %7u  %10.3f   %24u\n", rescans, perUpdate(fullMicros, rescans), numSignals);
+cleanup:
+	free(expect);
+	tcDestroy(&conflicts);
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+	if ( error ) {
+		fprintf(stderr, "%s\n", error);
+		errFree(error);
+	} else if ( retVal == FLP_NO_MEMORY ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+	}
+	return retVal;
+}
+
+int benchCommand(int argc, char *argv[]) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct arg_str *whatOpt = arg_str1(NULL, NULL, "<what>", "                   what to benchmark: crypt or conflict");
+	struct arg_int *wordsOpt = arg_int0("n", "words", "<count>", "          words per pass (default 65536)");
+	struct arg_int *repsOpt = arg_int0("r", "reps", "<count>", "           number of passes, or of cell changes (default 2000)");
+	struct arg_str *kernelOpt = arg_str0("k", "kernel", "<name>", "          only this kernel: avx512, avx2, sse2 or scalar");
+	struct arg_int *gridOpt = arg_int0("g", "grid", "<side>", "            conflict: side of the square track grid (default 256)");
+	struct arg_int *signalsOpt = arg_int0("s", "signals", "<count>", "        conflict: signals on it (default 20000)");
+	struct arg_int *lenOpt = arg_int0("l", "len", "<segments>", "         conflict: route length per signal (default 16)");
+	struct arg_lit *helpOpt = arg_lit0("h", "help", "                   print this help and exit");
+	struct arg_end *endOpt = arg_end(20);
+	void *argTable[] = {whatOpt, wordsOpt, repsOpt, kernelOpt, gridOpt, signalsOpt, lenOpt, helpOpt, endOpt};
+	const char *progName = argv[0];
+	uint32 n = 65536, reps = 2000, side = 256, numSignals = 20000, len = 16;
+	int numErrors;
+
+	if ( arg_nullcheck(argTable) != 0 ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(1, cleanup);
+	}
+	numErrors = arg_parse(argc, argv, argTable);
+	if ( helpOpt->count > 0 ) {
+		printf("Usage: %s", progName);
+		arg_print_syntax(stdout, argTable, "\n");
+		printf("\nMeasure the throughput of flcli's hot paths without a device attached.\n\n");
+		arg_print_glossary(stdout, argTable, "  %-10s %s\n");
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+	if ( numErrors > 0 ) {
+		arg_print_errors(stdout, endOpt, progName);
+		fprintf(stderr, "Try '%s --help' for more information.\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( wordsOpt->count ) {
+		if ( wordsOpt->ival[0] <= 0 ) {
+			fprintf(stderr, "%s: invalid argument to option --words=<count>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		n = (uint32)wordsOpt->ival[0];
+	}
+	if ( repsOpt->count ) {
+		if ( repsOpt->ival[0] <= 0 ) {
+			fprintf(stderr, "%s: invalid argument to option --reps=<count>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		reps = (uint32)repsOpt->ival[0];
+	}
+	if ( gridOpt->count ) {
+		if ( gridOpt->ival[0] <= 0 || gridOpt->ival[0] > 4096 ) {
+			fprintf(stderr, "%s: invalid argument to option --grid=<side>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		side = (uint32)gridOpt->ival[0];
+	}
+	if ( signalsOpt->count ) {
+		if ( signalsOpt->ival[0] <= 0 ) {
+			fprintf(stderr, "%s: invalid argument to option --signals=<count>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		numSignals = (uint32)signalsOpt->ival[0];
+	}
+	if ( lenOpt->count ) {
+		if ( lenOpt->ival[0] <= 0 || lenOpt->ival[0] > TC_MAX_ROUTE ) {
+			fprintf(stderr, "%s: invalid argument to option --len=<segments>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		len = (uint32)lenOpt->ival[0];
+	}
+
+	if ( !strcmp(whatOpt->sval[0], "crypt") ) {
+		retVal = benchCrypt(progName, kernelOpt->count ? kernelOpt->sval[0] : NULL, n, reps);
+	} else if ( !strcmp(whatOpt->sval[0], "conflict") ) {
+		retVal = benchConflict(progName, side, numSignals, len, reps);
+	} else {
+		fprintf(stderr, "%s: unknown benchmark '%s'\n", progName, whatOpt->sval[0]);
+		FAIL(FLP_ARGS, cleanup);
+	}
+cleanup:
+	arg_freetable(argTable, sizeof(argTable) / sizeof(argTable[0]));
+	return retVal;
+}
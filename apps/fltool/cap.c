@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include <argtable2.h>
+#include "fltool.h"
+#include "capfile.h"
+
+// Parse "+seconds" (relative to the start of the capture) or "HH:MM[:SS]" (local time, the first
+// such moment at or after the start of the capture) into microseconds since the start.
+static bool parseTime(const char *spec, const struct CapFileHeader *hdr, uint64 *micros) {
+	char *end;
+	if ( spec[0] == '+' ) {
+		const double secs = strtod(spec + 1, &end);
+		if ( *end || secs < 0.0 ) {
+			return false;
+		}
+		*micros = (uint64)(secs * 1000000.0);
+		return true;
+	} else {
+		const time_t startSecs = (time_t)(hdr->startEpoch / 1000000);
+		struct tm tm = *localtime(&startSecs);
+		unsigned long hh, mm, ss = 0;
+		int64 delta;
+		hh = strtoul(spec, &end, 10);
+		if ( *end != ':' ) {
+			return false;
+		}
+		mm = strtoul(end + 1, &end, 10);
+		if ( *end == ':' ) {
+			ss = strtoul(end + 1, &end, 10);
+		}
+		if ( *end || hh > 23 || mm > 59 || ss > 59 ) {
+			return false;
+		}
+		tm.tm_hour = (int)hh;
+		tm.tm_min = (int)mm;
+		tm.tm_sec = (int)ss;
+		delta = (int64)mktime(&tm) * 1000000 - (int64)hdr->startEpoch;
+		if ( delta < -1000000 ) {
+			delta += (int64)86400 * 1000000;
+		}
+		*micros = delta > 0 ? (uint64)delta : 0;
+		return true;
+	}
+}
+
+static void printTime(FILE *out, const struct CapFileHeader *hdr, uint64 micros) {
+	const uint64 epoch = hdr->startEpoch + micros;
+	const time_t secs = (time_t)(epoch / 1000000);
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+	fprintf(out, "%s.%06u", buf, (uint32)(epoch % 1000000));
+}
+
+static void printInfo(const struct CapReader *reader) {
+	uint64 offset = sizeof(struct CapFileHeader), numChunks = 0, first = 0, last = 0;
+	uint64 bytes[128] = {0,};
+	const struct CapRecord *rec;
+	const uint8 *data;
+	uint32 i;
+	while ( (rec = capNext(reader, &offset, &data)) ) {
+		if ( !numChunks ) {
+			first = rec->micros;
+		}
+		last = rec->micros;
+		bytes[rec->channel & 127] += rec->length;
+		numChunks++;
+	}
+	printf("Capture started ");
+	printTime(stdout, reader->hdr, 0);
+	printf("\n%llu chunks (%llu indexed, one index per %u chunks)\n",
+		(unsigned long long)numChunks, (unsigned long long)reader->numIndex,
+		reader->hdr->indexInterval);
+	if ( numChunks ) {
+		printf("First chunk at ");
+		printTime(stdout, reader->hdr, first);
+		printf("\nLast chunk at  ");
+		printTime(stdout, reader->hdr, last);
+		printf("\n");
+	}
+	for ( i = 0; i < 128; i++ ) {
+		if ( bytes[i] ) {
+			printf("Channel %u: %llu bytes\n", i, (unsigned long long)bytes[i]);
+		}
+	}
+}
+
+int capCommand(int argc, char *argv[]) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct arg_str *fileOpt = arg_str1(NULL, NULL, "<file.flcap>", "             indexed capture written by flcli --dumploop");
+	struct arg_lit *infoOpt = arg_lit0("i", "info", "                   summarise the capture");
+	struct arg_str *fromOpt = arg_str0("f", "from", "<time>", "            start at HH:MM[:SS] local time, or +secs");
+	struct arg_str *toOpt = arg_str0("t", "to", "<time>", "              stop at HH:MM[:SS] local time, or +secs");
+	struct arg_str *atOpt = arg_str0("a", "at", "<offset>", "            start at this payload byte offset");
+	struct arg_str *bytesOpt = arg_str0("n", "bytes", "<count>", "          stop after this many bytes");
+	struct arg_int *chanOpt = arg_int0("c", "chan", "<ch>", "              only extract this channel");
+	struct arg_str *outOpt = arg_str0("o", "out", "<file.bin>", "         write payload here (default stdout)");
+	struct arg_lit *helpOpt = arg_lit0("h", "help", "                   print this help and exit");
+	struct arg_end *endOpt = arg_end(20);
+	void *argTable[] = {
+		fileOpt, infoOpt, fromOpt, toOpt, atOpt, bytesOpt, chanOpt, outOpt, helpOpt, endOpt
+	};
+	const char *progName = argv[0];
+	const char *error = NULL;
+	struct CapReader reader = {0,};
+	const struct CapRecord *rec;
+	const uint8 *data;
+	FILE *out = NULL;
+	uint64 offset, stream = 0, skip = 0, remaining = (uint64)-1, until = (uint64)-1;
+	int numErrors;
+
+	if ( arg_nullcheck(argTable) != 0 ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(1, cleanup);
+	}
+	numErrors = arg_parse(argc, argv, argTable);
+	if ( helpOpt->count > 0 ) {
+		printf("Usage: %s", progName);
+		arg_print_syntax(stdout, argTable, "\n");
+		printf("\nInspect or extract chunks of an indexed capture.\n\n");
+		arg_print_glossary(stdout, argTable, "  %-10s %s\n");
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+	if ( numErrors > 0 ) {
+		arg_print_errors(stdout, endOpt, progName);
+		fprintf(stderr, "Try '%s --help' for more information.\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+
+	retVal = capMap(&reader, fileOpt->sval[0], &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	if ( infoOpt->count ) {
+		printInfo(&reader);
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+
+	if ( atOpt->count ) {
+		const uint64 at = strtoull(atOpt->sval[0], NULL, 0);
+		offset = capSeekOffset(&reader, at, &stream);
+		skip = at - stream;
+	} else if ( fromOpt->count ) {
+		uint64 from;
+		if ( !parseTime(fromOpt->sval[0], reader.hdr, &from) ) {
+			fprintf(stderr, "%s: invalid argument to option --from=<time>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		offset = capSeekTime(&reader, from, &stream);
+	} else {
+		offset = sizeof(struct CapFileHeader);
+	}
+	if ( toOpt->count && !parseTime(toOpt->sval[0], reader.hdr, &until) ) {
+		fprintf(stderr, "%s: invalid argument to option --to=<time>\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( bytesOpt->count ) {
+		remaining = strtoull(bytesOpt->sval[0], NULL, 0);
+	}
+
+	out = outOpt->count ? fopen(outOpt->sval[0], "wb") : stdout;
+	CHECK_STATUS(!out, FLP_CANNOT_SAVE, cleanup);
+	while ( remaining && (rec = capNext(&reader, &offset, &data)) && rec->micros <= until ) {
+		uint64 length = rec->length;
+		if ( chanOpt->count && (int)rec->channel != chanOpt->ival[0] ) {
+			skip = 0;
+			continue;
+		}
+		if ( skip ) {
+			data += skip;
+			length -= skip;
+			skip = 0;
+		}
+		if ( length > remaining ) {
+			length = remaining;
+		}
+		CHECK_STATUS(fwrite(data, 1, (size_t)length, out) != length, FLP_CANNOT_SAVE, cleanup);
+		remaining -= length;
+	}
+cleanup:
+	if ( out && out != stdout ) {
+		fclose(out);
+	}
+	capUnmap(&reader);
+	if ( error ) {
+		fprintf(stderr, "%s\n", error);
+		errFree(error);
+	} else if ( retVal == FLP_CANNOT_SAVE ) {
+		fprintf(stderr, "%s: cannot write output\n", progName);
+	}
+	arg_freetable(argTable, sizeof(argTable) / sizeof(argTable[0]));
+	return retVal;
+}
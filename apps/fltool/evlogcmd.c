@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include <argtable2.h>
+#include "fltool.h"
+#include "railctl.h"
+#include "railevlog.h"
+
+static bool parseSecs(const char *spec, uint64 *micros) {
+	char *end;
+	const double secs = strtod(spec, &end);
+	if ( *end || end == spec || secs < 0.0 ) {
+		return false;
+	}
+	*micros = (uint64)(secs * 1000000.0);
+	return true;
+}
+
+struct Filter {
+	int signal;  // -1 for all
+	EvType type; // 0 for all
+	uint64 from, to;
+};
+
+static bool matches(const struct Filter *filter, const struct EvRecord *rec) {
+	return
+		(filter->signal < 0 || rec->signal == (uint32)filter->signal) &&
+		(!filter->type || rec->type == filter->type) &&
+		rec->micros >= filter->from && rec->micros <= filter->to;
+}
+
+static void printTime(FILE *out, const struct EvLogHeader *hdr, uint64 micros) {
+	const uint64 epoch = hdr->startEpoch + micros;
+	const time_t secs = (time_t)(epoch / 1000000);
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+	fprintf(out, "%s.%06u", buf, (uint32)(epoch % 1000000));
+}
+
+static void printInfo(const struct EvLog *log) {
+	const uint64 first = evLogFirst(log), end = evLogEnd(log);
+	uint64 counts[EV_NUM_TYPES] = {0,};
+	uint64 seq, lost = 0, from = 0, to = 0;
+	struct EvRecord rec;
+	uint32 i;
+	for ( seq = first; seq < end; seq++ ) {
+		if ( !evLogGet(log, seq, &rec) ) {
+			lost++;
+			continue;
+		}
+		if ( seq == first ) {
+			from = rec.micros;
+		}
+		to = rec.micros;
+		counts[rec.type < EV_NUM_TYPES ? rec.type : 0]++;
+	}
+	printf("Log started ");
+	printTime(stdout, log->hdr, 0);
+	printf("\n%llu events written, the last %llu held (capacity %u)\n",
+		(unsigned long long)end, (unsigned long long)(end - first), log->hdr->capacity);
+	if ( end > first ) {
+		printf("Oldest held at ");
+		printTime(stdout, log->hdr, from);
+		printf("\nNewest at      ");
+		printTime(stdout, log->hdr, to);
+		printf("\n");
+	}
+	for ( i = 1; i < EV_NUM_TYPES; i++ ) {
+		if ( counts[i] ) {
+			printf("%-10s %llu\n", evTypeName(i), (unsigned long long)counts[i]);
+		}
+	}
+	if ( lost ) {
+		printf("%llu overwritten while reading\n", (unsigned long long)lost);
+	}
+}
+
+int evlogCommand(int argc, char *argv[]) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct arg_str *fileOpt = arg_str1(NULL, NULL, "<file.evlog>", "             event log written by flcli --railevlog");
+	struct arg_lit *infoOpt = arg_lit0("i", "info", "                   summarise the log");
+	struct arg_int *sigOpt = arg_int0("c", "signal", "<n>", "             only this signal's events");
+	struct arg_str *eventOpt = arg_str0("e", "event", "<name>", "            only this event: coord, off-track, no-ack, connected, s2-done, update, gave-up, done, route, conflict");
+	struct arg_str *fromOpt = arg_str0("f", "from", "<secs>", "             start this far into the log");
+	struct arg_str *toOpt = arg_str0("t", "to", "<secs>", "               stop this far into the log");
+	struct arg_int *tailOpt = arg_int0("n", "tail", "<count>", "           only the last count matching events");
+	struct arg_lit *csvOpt = arg_lit0(NULL, "csv", "                    export as CSV rather than text");
+	struct arg_str *outOpt = arg_str0("o", "out", "<file>", "              write here (default stdout)");
+	struct arg_lit *helpOpt = arg_lit0("h", "help", "                   print this help and exit");
+	struct arg_end *endOpt = arg_end(20);
+	void *argTable[] = {
+		fileOpt, infoOpt, sigOpt, eventOpt, fromOpt, toOpt, tailOpt, csvOpt, outOpt, helpOpt, endOpt
+	};
+	const char *progName = argv[0];
+	const char *error = NULL;
+	struct EvLog log = {NULL,};
+	struct EvRecord rec;
+	FILE *out = NULL;
+	struct Filter filter = {-1, (EvType)0, 0, (uint64)-1};
+	uint64 seq, first, end, skip = 0, count = 0;
+	int numErrors;
+
+	if ( arg_nullcheck(argTable) != 0 ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(1, cleanup);
+	}
+	numErrors = arg_parse(argc, argv, argTable);
+	if ( helpOpt->count > 0 ) {
+		printf("Usage: %s", progName);
+		arg_print_syntax(stdout, argTable, "\n");
+		printf("\nQuery or export a rail event log.\n\n");
+		arg_print_glossary(stdout, argTable, "  %-10s %s\n");
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+	if ( numErrors > 0 ) {
+		arg_print_errors(stdout, endOpt, progName);
+		fprintf(stderr, "Try '%s --help' for more information.\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( eventOpt->count && !(filter.type = evTypeParse(eventOpt->sval[0])) ) {
+		fprintf(stderr, "%s: invalid argument to option --event=<name>\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( fromOpt->count && !parseSecs(fromOpt->sval[0], &filter.from) ) {
+		fprintf(stderr, "%s: invalid argument to option --from=<secs>\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( toOpt->count && !parseSecs(toOpt->sval[0], &filter.to) ) {
+		fprintf(stderr, "%s: invalid argument to option --to=<secs>\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( sigOpt->count ) {
+		filter.signal = sigOpt->ival[0];
+	}
+	if ( tailOpt->count && tailOpt->ival[0] <= 0 ) {
+		fprintf(stderr, "%s: invalid argument to option --tail=<count>\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+
+	retVal = evLogOpen(&log, fileOpt->sval[0], &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	if ( infoOpt->count ) {
+		printInfo(&log);
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+
+	// The log may still be growing: work on the records held when we started
+	first = evLogFirst(&log);
+	end = evLogEnd(&log);
+	if ( tailOpt->count ) {
+		for ( seq = first; seq < end; seq++ ) {
+			if ( evLogGet(&log, seq, &rec) && matches(&filter, &rec) ) {
+				count++;
+			}
+		}
+		if ( count > (uint64)tailOpt->ival[0] ) {
+			skip = count - (uint64)tailOpt->ival[0];
+		}
+	}
+
+	out = outOpt->count ? fopen(outOpt->sval[0], "w") : stdout;
+	CHECK_STATUS(!out, FLP_CANNOT_SAVE, cleanup);
+	if ( csvOpt->count ) {
+		fprintf(out, "seq,micros,signal,event,state,x,y,word0,word1\n");
+	}
+	for ( seq = first; seq < end; seq++ ) {
+		if ( !evLogGet(&log, seq, &rec) || !matches(&filter, &rec) ) {
+			continue;
+		}
+		if ( skip ) {
+			skip--;
+			continue;
+		}
+		if ( csvOpt->count ) {
+			fprintf(
+				out, "%llu,%llu,%u,%s,%s,%u,%u,%u,%u\n",
+				(unsigned long long)seq, (unsigned long long)rec.micros, rec.signal,
+				evTypeName(rec.type) ? evTypeName(rec.type) : "?",
+				railStateName((enum RailState)rec.state), rec.x, rec.y, rec.word[0], rec.word[1]);
+		} else {
+			printTime(out, log.hdr, rec.micros);
+			fprintf(
+				out, "  signal %-4u (%2u,%2u)  %-8s  %-9s  0x%08X %u\n",
+				rec.signal, rec.x, rec.y, railStateName((enum RailState)rec.state),
+				evTypeName(rec.type) ? evTypeName(rec.type) : "?", rec.word[0], rec.word[1]);
+		}
+	}
+	CHECK_STATUS(ferror(out), FLP_CANNOT_SAVE, cleanup);
+cleanup:
+	if ( out && out != stdout ) {
+		fclose(out);
+	}
+	if ( log.hdr ) {
+		evLogClose(&log);
+	}
+	if ( error ) {
+		fprintf(stderr, "%s\n", error);
+		errFree(error);
+	} else if ( retVal == FLP_CANNOT_SAVE ) {
+		fprintf(stderr, "%s: cannot write output\n", progName);
+	}
+	arg_freetable(argTable, sizeof(argTable) / sizeof(argTable[0]));
+	return retVal;
+}
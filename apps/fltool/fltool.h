@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLTOOL_H
+#define FLTOOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Each command gets the arguments following its name, with argv[0] set to "fltool <command>"
+	int benchCommand(int argc, char *argv[]);
+	int capCommand(int argc, char *argv[]);
+	int evlogCommand(int argc, char *argv[]);
+	int railemuCommand(int argc, char *argv[]);
+	int trackCommand(int argc, char *argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
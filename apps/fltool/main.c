@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "fltool.h"
+
+struct Command {
+	const char *name;
+	int (*func)(int argc, char *argv[]);
+	const char *help;
+};
+
+static const struct Command commands[] = {
+	{"bench", benchCommand, "measure the throughput of flcli's hot paths"},
+	{"cap", capCommand, "inspect or extract an indexed capture file"},
+	{"evlog", evlogCommand, "query or export a rail event log"},
+	{"railemu", railemuCommand, "load-test the rail controller against emulated signals"},
+	{"track", trackCommand, "inspect a track table, trace routes, or convert it between CSV and database"},
+	{NULL, NULL, NULL}
+};
+
+int main(int argc, char *argv[]) {
+	const struct Command *cmd;
+	char progName[64];
+	if ( argc >= 2 ) {
+		for ( cmd = commands; cmd->name; cmd++ ) {
+			if ( !strcmp(argv[1], cmd->name) ) {
+				snprintf(progName, sizeof(progName), "fltool %s", cmd->name);
+				argv[1] = progName;
+				return cmd->func(argc - 1, argv + 1);
+			}
+		}
+	}
+	printf("FPGALink offline tools\n\nUsage: fltool <command> [--help | options]\n\nCommands:\n");
+	for ( cmd = commands; cmd->name; cmd++ ) {
+		printf("  %-10s %s\n", cmd->name, cmd->help);
+	}
+	return argc >= 2 && strcmp(argv[1], "--help") ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include <argtable2.h>
+#include "fltool.h"
+#include "flcli.h"
+#include "clock.h"
+#include "tracktab.h"
+#include "railctl.h"
+#include "railemu.h"
+#include "railstats.h"
+#include "railevlog.h"
+#include "railview.h"
+#include "railquery.h"
+
+// Throughput and how evenly the controller spread its attention over the signals. Jain's index
+// is 1.0 when every channel finished the same number of processes, and 1/n when one got them all.
+// wallMicros is the wall time a virtual-clock run took, or 0 for a real-time run.
+static void printReport(
+	const struct RailCtl *ctl, const struct RailEmu *emu, uint64 micros, uint64 wallMicros)
+{
+	const double secs = (double)micros / 1000000.0;
+	uint32 c, least = 0xFFFFFFFF, most = 0;
+	double sum = 0.0, sumSq = 0.0;
+	for ( c = 0; c < ctl->numChannels; c++ ) {
+		const uint32 p = ctl->chan[c].processes;
+		least = p < least ? p : least;
+		most = p > most ? p : most;
+		sum += p;
+		sumSq += (double)p * p;
+	}
+	if ( wallMicros ) {
+		printf(
+			"%u signals for %.2fs of virtual time (%.2fs wall, %.0fx real time)\n",
+			ctl->numChannels, secs, wallMicros / 1000000.0,
+			wallMicros ? (double)micros / wallMicros : 0.0);
+	} else {
+		printf("%u signals for %.2fs\n", ctl->numChannels, secs);
+	}
+	printf("  processes:    %u (%.1f/s)\n", ctl->processes, ctl->processes / secs);
+	printf("  track writes: %llu (%.1f/s)\n", (unsigned long long)emu->updates, emu->updates / secs);
+	printf(
+		"  reads:        %llu (%.1f/s, %.1f%% with nothing to say)\n",
+		(unsigned long long)emu->reads, emu->reads / secs,
+		emu->reads ? 100.0 * emu->idleReads / emu->reads : 0.0);
+	printf("  writes:       %llu (%.1f/s)\n", (unsigned long long)emu->writes, emu->writes / secs);
+	printf("  bad writes:   %llu\n", (unsigned long long)emu->errors);
+	printf(
+		"  per signal:   min %u, mean %.2f, max %u processes; Jain fairness %.4f\n",
+		least, sum / ctl->numChannels, most,
+		sumSq > 0.0 ? sum * sum / (ctl->numChannels * sumSq) : 1.0);
+}
+
+int railemuCommand(int argc, char *argv[]) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct arg_str *trackOpt = arg_str1(NULL, NULL, "<track>", "                  track table the signals update (created if missing)");
+	struct arg_int *signalsOpt = arg_int0("n", "signals", "<count>", "        emulated signals (default 1024)");
+	struct arg_int *durationOpt = arg_int0("d", "duration", "<secs>", "        how long to run (default 10)");
+	struct arg_str *emuOpt = arg_str0("e", "emu", "<name=value[,...]>", " signal behaviour: reply, jitter, ack, update (us), coordPercent, quietPercent, seed");
+	struct arg_str *railCfgOpt = arg_str0("r", "railcfg", "<name=ms[,...]>", "    controller timings, as for flcli --railcfg");
+	struct arg_str *statsOpt = arg_str0("s", "stats", "<file>", "           time every handshake state; summarise, and write CSV here");
+	struct arg_str *evlogOpt = arg_str0("l", "evlog", "<file>", "           record every controller event here, as flcli --railevlog");
+	struct arg_str *queryOpt = arg_str0("q", "query", "<socket>", "         answer state queries here while running, as flcli --railquery");
+	struct arg_lit *virtualOpt = arg_lit0(NULL, "virtual", "                 simulate time instead of waiting for it; --duration is virtual");
+	struct arg_lit *verboseOpt = arg_lit0("v", "verbose", "                print the controller's progress messages");
+	struct arg_lit *helpOpt = arg_lit0("h", "help", "                   print this help and exit");
+	struct arg_end *endOpt = arg_end(20);
+	void *argTable[] = {
+		trackOpt, signalsOpt, durationOpt, emuOpt, railCfgOpt, statsOpt, evlogOpt, queryOpt, virtualOpt, verboseOpt, helpOpt, endOpt
+	};
+	const char *progName = argv[0];
+	const char *error = NULL;
+	struct RailEmuConfig cfg;
+	struct RailTimings timing;
+	struct TrackTable *track = NULL;
+	struct RailEmu *emu = NULL;
+	struct RailCtl ctl = {0,};
+	struct RailStats stats;
+	struct EvLog events = {NULL,};
+	struct RailView view = {0,};
+	struct RailQuery query = {NULL,};
+	struct VirtualClock virtualClock;
+	struct Clock *clock = clkReal();
+	bool trackFound, trackOpened = false, emuReady = false, ctlReady = false, statsReady = false;
+	uint32 numSignals = 1024, duration = 10, replayed;
+	uint64 start, wallStart;
+	int numErrors;
+
+	if ( arg_nullcheck(argTable) != 0 ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(1, cleanup);
+	}
+	numErrors = arg_parse(argc, argv, argTable);
+	if ( helpOpt->count > 0 ) {
+		printf("Usage: %s", progName);
+		arg_print_syntax(stdout, argTable, "\n");
+		printf("\nRun the rail controller against emulated signals and report throughput and fairness.\n\n");
+		arg_print_glossary(stdout, argTable, "  %-10s %s\n");
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+	if ( numErrors > 0 ) {
+		arg_print_errors(stdout, endOpt, progName);
+		fprintf(stderr, "Try '%s --help' for more information.\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	if ( signalsOpt->count ) {
+		if ( signalsOpt->ival[0] <= 0 ) {
+			fprintf(stderr, "%s: invalid argument to option --signals=<count>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		numSignals = (uint32)signalsOpt->ival[0];
+	}
+	if ( durationOpt->count ) {
+		if ( durationOpt->ival[0] <= 0 ) {
+			fprintf(stderr, "%s: invalid argument to option --duration=<secs>\n", progName);
+			FAIL(FLP_ARGS, cleanup);
+		}
+		duration = (uint32)durationOpt->ival[0];
+	}
+	railEmuConfigInit(&cfg);
+	if ( emuOpt->count && !railEmuParseConfig(emuOpt->sval[0], &cfg) ) {
+		fprintf(stderr, "%s: invalid argument to option --emu (names: reply, jitter, ack, update, coordPercent, quietPercent, seed)\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+	railTimingsInit(&timing);
+	if ( railCfgOpt->count && !railParseTimings(railCfgOpt->sval[0], &timing) ) {
+		fprintf(stderr, "%s: invalid argument to option --railcfg (names: ackPoll, ackWait, s3Settle, s3Poll, s3Wait, noAck, rest, restMax)\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+
+	track = (struct TrackTable *)malloc(sizeof(struct TrackTable));
+	emu = (struct RailEmu *)malloc(sizeof(struct RailEmu));
+	if ( !track || !emu ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(FLP_NO_MEMORY, cleanup);
+	}
+	retVal = trackOpen(track, trackOpt->sval[0], &trackFound, &replayed, &error);
+	trackOpened = true;
+	CHECK_STATUS(retVal, retVal, cleanup);
+	if ( !trackFound ) {
+		printf("no track file at %s; starting with an empty table\n", trackOpt->sval[0]);
+	}
+	if ( replayed ) {
+		printf("replayed %u track updates from %s\n", replayed, track->journalPath);
+	}
+	if ( virtualOpt->count ) {
+		clkVirtualInit(&virtualClock, 0);
+		clock = &virtualClock.clock;
+	}
+	retVal = railEmuInit(emu, clock, numSignals, track->grid.xDim, track->grid.yDim, &cfg, &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	emuReady = true;
+	retVal = railCtlInit(&ctl, &emu->port, numSignals, track, &timing, &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	ctlReady = true;
+	if ( !verboseOpt->count ) {
+		ctl.log = NULL;
+	}
+	if ( statsOpt->count ) {
+		retVal = railStatsInit(&stats, numSignals, statsOpt->sval[0], NULL, 0, &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		statsReady = true;
+		ctl.stats = &stats;
+	}
+	if ( evlogOpt->count ) {
+		retVal = evLogCreate(&events, evlogOpt->sval[0], EVLOG_DEFAULT_RECORDS, clkNow(clock), &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		ctl.events = &events;
+	}
+	if ( queryOpt->count ) {
+		retVal = rvInit(&view, &ctl, &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		ctl.view = &view;
+		retVal = rqStart(&query, &view, queryOpt->sval[0], &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	}
+
+	wallStart = clkMicros();
+	start = clkNow(clock);
+	ctl.stopAt = start + (uint64)duration * 1000000;
+	retVal = railCtlRun(&ctl, &error);
+	CHECK_STATUS(retVal, retVal, cleanup);
+	printReport(
+		&ctl, emu, clkNow(clock) - start,
+		virtualOpt->count ? clkMicros() - wallStart : 0);
+	if ( statsReady ) {
+		railStatsSummary(&stats, stdout);
+	}
+cleanup:
+	rqStop(&query);
+	if ( ctl.view ) {
+		rvDestroy(&view);
+	}
+	if ( events.hdr ) {
+		evLogClose(&events);
+	}
+	if ( statsReady ) {
+		railStatsDestroy(&stats);
+	}
+	if ( ctlReady ) {
+		railCtlDestroy(&ctl);
+	}
+	if ( emuReady ) {
+		railEmuDestroy(emu);
+	}
+	if ( trackOpened ) {
+		retVal = trackClose(track, retVal, &error);
+	}
+	free(emu);
+	free(track);
+	if ( error ) {
+		fprintf(stderr, "%s\n", error);
+		errFree(error);
+	}
+	arg_freetable(argTable, sizeof(argTable) / sizeof(argTable[0]));
+	return retVal;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2012-2014 Chris McClelland
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <makestuff.h>
+#include <liberror.h>
+#include <argtable2.h>
+#include "fltool.h"
+#include "track.h"
+#include "trackdb.h"
+#include "trackroute.h"
+
+static void printInfo(const char *path, const struct TrackDb *db, const struct TrackGrid *grid) {
+	uint32 i, known = 0;
+	for ( i = 0; i < grid->numCells; i++ ) {
+		if ( tgCell(grid, i) & 0x80 ) {
+			known++;
+		}
+	}
+	if ( db ) {
+		printf("%s: track database version %u", path, db->version);
+	} else {
+		printf("%s: track CSV", path);
+	}
+	printf(", %ux%ux%u cells, %u known\n", grid->xDim, grid->yDim, TG_DIRS, known);
+}
+
+static bool parseNode(const char *spec, const struct TrackGrid *grid, uint32 *node, const char **end) {
+	unsigned int x, y, dir;
+	int used;
+	if ( sscanf(spec, "%u,%u,%u%n", &x, &y, &dir, &used) != 3 || !tgContains(grid, x, y, dir) ) {
+		return false;
+	}
+	*node = tgIndex(grid, x, y, dir);
+	*end = spec + used;
+	return true;
+}
+
+static void printNode(const struct TrackGrid *grid, uint32 node) {
+	printf("%u,%u,%u", node / TG_DIRS / grid->yDim, node / TG_DIRS % grid->yDim, node % TG_DIRS);
+}
+
+// Answer "x,y,dir:x,y,dir": how many hops from the first node to the second, and the way.
+static bool printRoute(const struct RouteIndex *routes, const char *spec) {
+	const struct TrackGrid *const grid = routes->grid;
+	uint32 from, to, hops, n;
+	const char *end;
+	if ( !parseNode(spec, grid, &from, &end) || *end != ':' || !parseNode(end + 1, grid, &to, &end) || *end ) {
+		return false;
+	}
+	hops = routeHops(routes, from, to);
+	printNode(grid, from);
+	printf(" -> ");
+	printNode(grid, to);
+	if ( hops == ROUTE_NONE ) {
+		printf(": no route\n");
+		return true;
+	}
+	printf(": %u hops:", hops);
+	for ( n = from; ; n = routeNext(routes, n) ) {
+		printf(" ");
+		printNode(grid, n);
+		if ( n == to ) {
+			break;
+		}
+	}
+	printf("\n");
+	return true;
+}
+
+int trackCommand(int argc, char *argv[]) {
+	ReturnCode retVal = FLP_SUCCESS;
+	struct arg_str *fileOpt = arg_str1(NULL, NULL, "<in>", "                     track CSV, or database ending in " TDB_SUFFIX);
+	struct arg_lit *infoOpt = arg_lit0("i", "info", "                   summarise the track table");
+	struct arg_str *outOpt = arg_str0("o", "out", "<out>", "              convert: write a database if <out> ends in " TDB_SUFFIX ", else a CSV");
+	struct arg_str *routeOpt = arg_strn("r", "route", "<x,y,d:x,y,d>", 0, 64, "    is there a route from one cell to the other, and how long (repeatable)");
+	struct arg_lit *helpOpt = arg_lit0("h", "help", "                   print this help and exit");
+	struct arg_end *endOpt = arg_end(20);
+	void *argTable[] = {fileOpt, infoOpt, outOpt, routeOpt, helpOpt, endOpt};
+	const char *progName = argv[0];
+	const char *error = NULL;
+	struct TrackDb db = {0,};
+	struct TrackGrid grid = {0,};
+	struct RouteIndex routes = {0,};
+	int i;
+	bool isDb = false, found;
+	FILE *out;
+	int numErrors;
+
+	if ( arg_nullcheck(argTable) != 0 ) {
+		fprintf(stderr, "%s: insufficient memory\n", progName);
+		FAIL(1, cleanup);
+	}
+	numErrors = arg_parse(argc, argv, argTable);
+	if ( helpOpt->count > 0 ) {
+		printf("Usage: %s", progName);
+		arg_print_syntax(stdout, argTable, "\n");
+		printf("\nInspect a track table, trace routes through it, or convert it between CSV and binary database.\n\n");
+		arg_print_glossary(stdout, argTable, "  %-10s %s\n");
+		FAIL(FLP_SUCCESS, cleanup);
+	}
+	if ( numErrors > 0 ) {
+		arg_print_errors(stdout, endOpt, progName);
+		fprintf(stderr, "Try '%s --help' for more information.\n", progName);
+		FAIL(FLP_ARGS, cleanup);
+	}
+
+	if ( tdbIsDbPath(fileOpt->sval[0]) ) {
+		isDb = true;
+		retVal = tdbOpen(&db, fileOpt->sval[0], &grid, &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+	} else {
+		retVal = trackLoad(fileOpt->sval[0], &grid, &found, &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		if ( !found ) {
+			fprintf(stderr, "%s: cannot open %s\n", progName, fileOpt->sval[0]);
+			FAIL(FLP_CANNOT_LOAD, cleanup);
+		}
+	}
+	if ( infoOpt->count || (!outOpt->count && !routeOpt->count) ) {
+		printInfo(fileOpt->sval[0], isDb ? &db : NULL, &grid);
+	}
+	if ( outOpt->count ) {
+		const bool toDb = tdbIsDbPath(outOpt->sval[0]);
+		bool ok;
+		out = fopen(outOpt->sval[0], toDb ? "wb" : "w");
+		ok = out && (toDb ? tdbWrite(out, &grid) : trackWrite(out, &grid));
+		if ( out && fclose(out) ) {
+			ok = false;
+		}
+		out = NULL;
+		if ( !ok ) {
+			fprintf(stderr, "%s: cannot write %s\n", progName, outOpt->sval[0]);
+			FAIL(FLP_CANNOT_SAVE, cleanup);
+		}
+	}
+	if ( routeOpt->count ) {
+		retVal = routeInit(&routes, &grid, &error);
+		CHECK_STATUS(retVal, retVal, cleanup);
+		for ( i = 0; i < routeOpt->count; i++ ) {
+			if ( !printRoute(&routes, routeOpt->sval[i]) ) {
+				fprintf(stderr, "%s: invalid argument to option --route=<x,y,d:x,y,d>\n", progName);
+				FAIL(FLP_ARGS, cleanup);
+			}
+		}
+	}
+cleanup:
+	routeDestroy(&routes);
+	tgDestroy(&grid);
+	tdbClose(&db);
+	if ( error ) {
+		fprintf(stderr, "%s\n", error);
+		errFree(error);
+	}
+	arg_freetable(argTable, sizeof(argTable) / sizeof(argTable[0]));
+	return retVal;
+}